@@ -14,29 +14,13 @@
 #include <itkBinaryBallStructuringElement.h>
 #include <itkBinaryMorphologicalClosingImageFilter.h>
 // #include <itkGrayscaleFillholeImageFilter.h>
-#include <itkConnectedComponentImageFilter.h>
-#include <itkShapeLabelObject.h>
 #include <itkLabelMap.h>
-#include <itkLabelImageToShapeLabelMapFilter.h>
 #include <itkLabelImageToStatisticsLabelMapFilter.h>
 #include <itkExtractImageFilter.h>
-#include <itkRelabelComponentImageFilter.h>
 #include <itkImageRegionIteratorWithIndex.h>
 #include <itkImageFileWriter.h>
 #include <vector>
 #include <algorithm>
-#include <ctime>
-
-#include <itkDecisionRule.h>
-#include <itkVector.h>
-#include <itkListSample.h>
-#include <itkKdTree.h>
-#include <itkWeightedCentroidKdTreeGenerator.h>
-#include <itkKdTreeBasedKmeansEstimator.h>
-#include <itkMinimumDecisionRule.h>
-#include <itkEuclideanDistanceMetric.h>
-#include <itkDistanceToCentroidMembershipFunction.h>
-#include <itkSampleClassifierFilter.h>
 
 
 #include "PQCT_Datatypes.h"
@@ -48,17 +32,14 @@
 void PQCT_Analyzer::DilateSubcutaneousFatForPVECorrection(){
 
   //! Mask sub. fat region.
-  typedef itk::BinaryThresholdImageFilter<LabelImageType, 
-    LabelImageType> 
-    SelectSubcutaneousFatFilterType;
-  SelectSubcutaneousFatFilterType::Pointer selectsubcutaneousfatFilter = 
-    SelectSubcutaneousFatFilterType::New();
-  selectsubcutaneousfatFilter->SetInput( this->m_TissueLabelImage );
-  selectsubcutaneousfatFilter->SetInsideValue( FOREGROUND );
-  selectsubcutaneousfatFilter->SetOutsideValue( BACKGROUND );
-  selectsubcutaneousfatFilter->SetLowerThreshold( SUB_FAT ); 
-  selectsubcutaneousfatFilter->SetUpperThreshold( SUB_FAT ); 
-  selectsubcutaneousfatFilter->Update();
+  size_t numberOfPixels =
+    PQCT_LabelKernels::GetNumberOfPixels( this->m_TissueLabelImage.GetPointer() );
+  LabelImageType::Pointer subcutaneousFatMask =
+    PQCT_LabelKernels::CreateLabelImage( this->m_TissueLabelImage.GetPointer() );
+  PQCT_LabelKernels::ThresholdToMask<LabelPixelType>( this->m_TissueLabelImage->GetBufferPointer(),
+						      subcutaneousFatMask->GetBufferPointer(),
+						      numberOfPixels,
+						      SUB_FAT, SUB_FAT, FOREGROUND, BACKGROUND );
 
 
   //! Generate structuring element.
@@ -78,21 +59,20 @@ void PQCT_Analyzer::DilateSubcutaneousFatForPVECorrection(){
   BinaryDilationFilterType::Pointer binaryDilationFilter = 
     BinaryDilationFilterType::New();
   binaryDilationFilter->SetKernel( structuringElement );
-  binaryDilationFilter->SetInput( selectsubcutaneousfatFilter->GetOutput() );
+  binaryDilationFilter->SetInput( subcutaneousFatMask );
   binaryDilationFilter->SetForegroundValue( FOREGROUND );
   binaryDilationFilter->Update();
   
 
   //! Update label map while preserving the air voxels.
-  typedef itk::ImageRegionIteratorWithIndex<LabelImageType> LabelImageIteratorType;
-  LabelImageIteratorType itImage(this->m_TissueLabelImage, 
-				 this->m_TissueLabelImage->GetBufferedRegion());
-  for(itImage.GoToBegin();!itImage.IsAtEnd();++itImage) {
-    LabelImageType::IndexType idx = itImage.GetIndex();
-    if( binaryDilationFilter->GetOutput()->GetPixel(idx) == FOREGROUND &&
-	itImage.Get() == IM_FAT )
-      itImage.Set( SUB_FAT );
-  }
+  PQCT_LabelLUT dilationLUT;
+  dilationLUT.Set( IM_FAT, SUB_FAT );
+  PQCT_LabelKernels::MaskedRemapLabels<LabelPixelType>( this->m_TissueLabelImage->GetBufferPointer(),
+							binaryDilationFilter->GetOutput()->GetBufferPointer(),
+							numberOfPixels,
+							FOREGROUND, FOREGROUND,
+							dilationLUT,
+							PQCT_LabelLUT() );
 
 
 }
@@ -101,58 +81,29 @@ void PQCT_Analyzer::DilateSubcutaneousFatForPVECorrection(){
 //! Separate IMFAT from Muscle in CT using clustering.
 void PQCT_Analyzer::SeparateIMFATFromMuscle() {
 
-  //! Create vector of samples.
-  typedef itk::Vector<PQCTPixelType, 1> MeasurementVectorType;
-  typedef itk::Statistics::ListSample< MeasurementVectorType > SampleType;
-
-  SampleType::Pointer samples = SampleType::New();
-  MeasurementVectorType mv;
-
-  typedef itk::ImageRegionIteratorWithIndex<LabelImageType> LabelImageIteratorType;
-  LabelImageIteratorType itImage(this->m_TissueLabelImage, 
-				 this->m_TissueLabelImage->GetLargestPossibleRegion());
-  typedef LabelImageType::IndexType LabelImageIndexType;
-  std::vector<LabelImageIndexType> sampleIndices;
-
-
   //! Samples are pixel intensities corresponding to 
   //! previously detected muscle and imfat pixels.
-  //! For each pixel of muscle and imat
-  //! add pixel index and intensity to corresponding vectors.
-  for(itImage.GoToBegin();!itImage.IsAtEnd();++itImage) {
-
-    if ( itImage.Get() == MUSCLE || itImage.Get() == IM_FAT) {
-      sampleIndices.push_back(itImage.GetIndex());  
-      samples->PushBack(this->m_PQCTImage->GetPixel(itImage.GetIndex()));
-    }
-  }
-  
-  
-  //! Create a kd-tree.
-  typedef itk::Statistics::WeightedCentroidKdTreeGenerator< SampleType >
-    TreeGeneratorType;
-  TreeGeneratorType::Pointer treeGenerator = TreeGeneratorType::New();
-  
-  treeGenerator->SetSample( samples );
-  treeGenerator->SetBucketSize( 16 );
-  treeGenerator->Update();
- 
-  //! Create and run kmeans estimator.
-  typedef TreeGeneratorType::KdTreeType TreeType;
-  typedef itk::Statistics::KdTreeBasedKmeansEstimator<TreeType> EstimatorType;
-  EstimatorType::Pointer estimator = EstimatorType::New();
- 
-  EstimatorType::ParametersType initialMeans(2);
-  initialMeans[0] = -20.0; // Cluster 1, mean[0]
-  initialMeans[1] = 50.0; // Cluster 2, mean[0]
-
-  estimator->SetParameters( initialMeans );
-  estimator->SetKdTree( treeGenerator->GetOutput() );
-  estimator->SetMaximumIteration( 200 );
-  estimator->SetCentroidPositionChangesThreshold(0.0);
-  estimator->StartOptimization();
-
-  EstimatorType::ParametersType estimatedMeans = estimator->GetParameters();
+  PQCT_LabelLUT sampleLabels( 0 );
+  sampleLabels.Set( MUSCLE, 1 );
+  sampleLabels.Set( IM_FAT, 1 );
+
+  //! Cluster numbers to tissue labels.
+  std::vector<LabelPixelType> classLabels;
+  classLabels.push_back( IM_FAT );
+  classLabels.push_back( MUSCLE );
+
+  //! K-means on the sample histogram and
+  //! classification of the samples in place.
+  std::vector<double> estimatedMeans( 2 );
+  estimatedMeans[0] = -20.0; // Cluster 1, mean[0]
+  estimatedMeans[1] = 50.0; // Cluster 2, mean[0]
+  if ( !PQCT_HistogramKMeans::ClassifyLabels<PQCTPixelType>( this->m_PQCTImage->GetBufferPointer(),
+							     this->m_TissueLabelImage->GetBufferPointer(),
+							     PQCT_LabelKernels::GetNumberOfPixels( this->m_TissueLabelImage.GetPointer() ),
+							     sampleLabels,
+							     classLabels,
+							     estimatedMeans ) )
+    throw "K-means clustering failed.";
  
   for ( unsigned int i = 0 ; i < 2 ; i++ )
     {
@@ -160,161 +111,52 @@ void PQCT_Analyzer::SeparateIMFATFromMuscle() {
     std::cout << "    estimated mean : " << estimatedMeans[i] << std::endl;
     }
 
-  //! Create classifier.
-
-  //! Membership function is distance to cluster's centroid.
-  typedef itk::Statistics::DistanceToCentroidMembershipFunction< MeasurementVectorType >
-    MembershipFunctionType;
-  typedef MembershipFunctionType::Pointer                      MembershipFunctionPointer;
-
-  //! Decision rule is minimum distance.
-  typedef itk::Statistics::MinimumDecisionRule DecisionRuleType;
-  DecisionRuleType::Pointer decisionRule = DecisionRuleType::New();
-
-  //! Configure classifier.
-  typedef itk::Statistics::SampleClassifierFilter< SampleType > ClassifierType;
-  ClassifierType::Pointer classifier = ClassifierType::New();
- 
-  classifier->SetDecisionRule(decisionRule);
-  classifier->SetInput( samples );
-  classifier->SetNumberOfClasses( 2 );
- 
-  typedef ClassifierType::ClassLabelVectorObjectType               ClassLabelVectorObjectType;
-  typedef ClassifierType::ClassLabelVectorType                     ClassLabelVectorType;
-  typedef ClassifierType::MembershipFunctionVectorObjectType       MembershipFunctionVectorObjectType;
-  typedef ClassifierType::MembershipFunctionVectorType             MembershipFunctionVectorType;
- 
-  ClassLabelVectorObjectType::Pointer  classLabelsObject = ClassLabelVectorObjectType::New();
-  classifier->SetClassLabels( classLabelsObject );
- 
-  ClassLabelVectorType &  classLabelsVector = classLabelsObject->Get();
-  classLabelsVector.push_back( IM_FAT );
-  classLabelsVector.push_back( MUSCLE );
-
-  MembershipFunctionVectorObjectType::Pointer membershipFunctionsObject =
-    MembershipFunctionVectorObjectType::New();
-  classifier->SetMembershipFunctions( membershipFunctionsObject );
- 
-  MembershipFunctionVectorType &  membershipFunctionsVector = membershipFunctionsObject->Get();
- 
-  MembershipFunctionType::CentroidType origin( samples->GetMeasurementVectorSize() );
-  int index = 0;
-  for ( unsigned int i = 0 ; i < 2 ; i++ )
-    {
-    MembershipFunctionPointer membershipFunction = MembershipFunctionType::New();
-    for ( unsigned int j = 0 ; j < samples->GetMeasurementVectorSize(); j++ )
-      {
-      origin[j] = estimatedMeans[index++];
-      }
-    membershipFunction->SetCentroid( origin );
-    membershipFunctionsVector.push_back( membershipFunction.GetPointer() );
-    }
-
-  //! Classify samples and set pixel values in label map.
-
-  classifier->Update();
- 
-  const ClassifierType::MembershipSampleType* membershipSample = classifier->GetOutput();
-  ClassifierType::MembershipSampleType::ConstIterator iter = membershipSample->Begin();
-  unsigned int count;
-
-  while ( iter != membershipSample->End() )
-    {
-    // std::cout << "measurement vector = " << iter.GetMeasurementVector()
-    //           << "class label = " << iter.GetClassLabel()
-    //           << std::endl;
-    
-    this->m_TissueLabelImage->SetPixel(sampleIndices[count], iter.GetClassLabel());
-    ++count;
-    ++iter;
-    }
-
 }
 
 
 //! Remove patient table and select left thigh.
 LabelImageType::Pointer PQCT_Analyzer::SelectOneLeg(){
 
-  //! Apply foreground/background thresholding.
-  typedef itk::BinaryThresholdImageFilter<PQCTImageType, 
-    LabelImageType> 
-    ForegroundBackgroundThresholdFilterType;
-  ForegroundBackgroundThresholdFilterType::Pointer foregroundBackgroundThresholdFilter = 
-    ForegroundBackgroundThresholdFilterType::New();
-  foregroundBackgroundThresholdFilter->SetInput( this->m_PQCTImage );
-  foregroundBackgroundThresholdFilter->SetInsideValue( FOREGROUND );
-  foregroundBackgroundThresholdFilter->SetOutsideValue( AIR );
-  foregroundBackgroundThresholdFilter->SetLowerThreshold( this->m_CT_LegThreshold );
-  foregroundBackgroundThresholdFilter->SetUpperThreshold( SIGNEDSHORTMAX );  // number of regions we want detected 
-  foregroundBackgroundThresholdFilter->Update();
-
-  //! Connected components.
-  //! Apply connected component labeling.
-  typedef itk::ConnectedComponentImageFilter<LabelImageType, 
-    LabelImageType, 
-    LabelImageType> 
-    ConnectedComponentLabelFilterType;
-  ConnectedComponentLabelFilterType::Pointer labelMaskFilter2 = 
-    ConnectedComponentLabelFilterType::New();
-  labelMaskFilter2->SetInput( foregroundBackgroundThresholdFilter->GetOutput() );
-  labelMaskFilter2->SetMaskImage( foregroundBackgroundThresholdFilter->GetOutput() );
-  labelMaskFilter2->SetFullyConnected( true );
-  labelMaskFilter2->Update();
-
-  //! Use statistical label map objects for each tissue type.
-  typedef unsigned long LabelType;
-  typedef itk::ShapeLabelObject< LabelType, pixelDimensions > LabelObjectType;
-  typedef itk::LabelMap< LabelObjectType > LabelMapType;
-
-  //! Shape attributes.
-  //! Convert label image to shape label map.
-  typedef itk::LabelImageToShapeLabelMapFilter<LabelImageType,LabelMapType> 
-    LabelImageToShapeLabelMapFilterType;
-  LabelImageToShapeLabelMapFilterType::Pointer labelImageToShapeLabelMapFilter = 
-    LabelImageToShapeLabelMapFilterType::New();
-  labelImageToShapeLabelMapFilter->SetInput( labelMaskFilter2->GetOutput() );
-  labelImageToShapeLabelMapFilter->SetBackgroundValue( AIR );
-  labelImageToShapeLabelMapFilter->Update();
+  //! Foreground/background thresholding and connected components,
+  //! ranked by size, with their areas, centroids and bounding boxes.
+  LabelImageType::Pointer foregroundComponents;
+  std::vector<PQCT_ComponentType> components;
+  {
+    PQCT_TraceScope traceScope( this->m_Tracer, TRACE_CCL );
+    foregroundComponents = 
+      PQCT_ConnectedComponents::Label( this->m_PQCTImage.GetPointer(),
+				       (PQCTPixelType) this->m_CT_LegThreshold,
+				       (PQCTPixelType) SIGNEDSHORTMAX,
+				       components );
+  }
+  if ( components.empty() )
+    throw "No leg found above the leg threshold.";
 
   //! Dsiplay computed shape attributes.
-  //! Get label map.
-  LabelMapType::Pointer labelMap = labelImageToShapeLabelMapFilter->GetOutput();
-
-  //! Pass quantification parameter names and values.
-  //! Compute centroids.
-
   std::cout << "Tissue label\tArea (mm^2)\tCentroid coordinates" << std::endl;
 
   std::vector<float> regionCentroids;
-  std::vector <LabelImageType::RegionType> regionBoundingBoxes;
-  for(unsigned int i = 0; i < labelMap->GetNumberOfLabelObjects(); i++)
+  for(unsigned int i = 0; i < components.size(); i++)
     {
-      LabelObjectType * labelObject = labelMap->GetNthLabelObject(i);
-      const LabelType & label = labelObject->GetLabel();
+      const PQCT_ComponentType & component = components[i];
 
-      std::cout << label << "\t" 
-		<< labelObject->GetPhysicalSize() << "\t" 
-		<< labelObject->GetCentroid() << std::endl;
+      std::cout << i + 1 << "\t" 
+		<< component.PhysicalSize << "\t" 
+		<< "[" << component.Centroid[0] << ", " << component.Centroid[1] << "]" << std::endl;
 
       //! Set small regions RL coordinate to 0 to discard from leg selection.
-      //! Store information needed in the next steps.
-      if(labelObject->GetPhysicalSize() < LEGPHYSICALSIZETHRESHOLD) {
+      if(component.PhysicalSize < LEGPHYSICALSIZETHRESHOLD)
 	regionCentroids.push_back( 0 );
-	regionBoundingBoxes.push_back( labelObject->GetBoundingBox() );
-      }
-      else {
-	regionCentroids.push_back( labelObject->GetCentroid()[0] );
-	regionBoundingBoxes.push_back( labelObject->GetBoundingBox() );
-      }
+      else
+	regionCentroids.push_back( component.Centroid[0] );
     }
 
 
   //! Select left-most object as the one with maximum R coordinate.
+  //! Large components rank first, so the leg has a label of its own.
   int leftlegIndex = static_cast<int> ( std::max_element(regionCentroids.begin(), 
 							 regionCentroids.end()) - regionCentroids.begin() );
-  LabelObjectType * labelObject2 = labelMap->GetNthLabelObject(leftlegIndex);
-  this->m_leftlegLabel = labelObject2->GetLabel();
-  PQCTImageType::RegionType leftlegBoundingBox = regionBoundingBoxes[leftlegIndex];
+  PQCTImageType::RegionType leftlegBoundingBox = components[leftlegIndex].BoundingBox;
   PQCTImageType::IndexType newIndex;
   PQCTImageType::SizeType newSize;
   for(int i=0;i<pixelDimensions;i++) {
@@ -323,7 +165,7 @@ LabelImageType::Pointer PQCT_Analyzer::SelectOneLeg(){
     }
   leftlegBoundingBox.SetSize(newSize);
   leftlegBoundingBox.SetIndex(newIndex);
-  std::cout << "Left leg is object with label: " << this->m_leftlegLabel << std::endl;
+  std::cout << "Left leg is object with label: " << leftlegIndex + 1 << std::endl;
   std::cout << "Corresponding bounding box is: " 
 	    << leftlegBoundingBox 
 	    << std::endl;
@@ -342,15 +184,50 @@ LabelImageType::Pointer PQCT_Analyzer::SelectOneLeg(){
 
 
   //! Write image to nifti file.
-  itk::ImageFileWriter< PQCTImageType >::Pointer 
-    inputWriter = itk::ImageFileWriter< PQCTImageType >::New();
-  inputWriter->SetInput( this->m_PQCTImage );
-  inputWriter->SetFileName( this->m_outputPath + "OneLeg.nii" );
-  // inputWriter->SetFileName( this->m_outputPath + this->m_SubjectID + inputImageFileExtension );
-  inputWriter->Update();
-  inputWriter = 0;
-
-  return labelMaskFilter2->GetOutput();
+  this->WriteIntermediateImage( this->m_PQCTImage, oneLegImageFileExtension, OUTPUT_QC );
+
+  //! Leg mask on the uncropped grid.
+  this->m_leftlegLabel = 1;
+  PQCT_LabelKernels::ThresholdToMask<LabelPixelType>( foregroundComponents->GetBufferPointer(),
+						      foregroundComponents->GetBufferPointer(),
+						      PQCT_LabelKernels::GetNumberOfPixels( foregroundComponents.GetPointer() ),
+						      (LabelPixelType) (leftlegIndex + 1),
+						      (LabelPixelType) (leftlegIndex + 1),
+						      (LabelPixelType) this->m_leftlegLabel, 0 );
+  return foregroundComponents;
+}
+
+
+//! Analyze every slice of a CT series at the middle thigh.
+//! Each slice gets its own label image and quantification file,
+//! named after the series and the slice number.
+void PQCT_Analyzer::AnalyzeCTMidThighSeries() {
+
+  std::string seriesID = this->m_SubjectID;
+  std::vector<PQCTImageType::Pointer> slices;
+  slices.swap( this->m_CTSlices );
+
+  for (unsigned int i = 0; i < slices.size(); i++) {
+    std::stringstream sliceID;
+    sliceID << seriesID << "_Slice";
+    sliceID.width(3);
+    sliceID.fill('0');
+    sliceID << i;
+
+    this->ResetAnalysisState();
+    this->m_SubjectID = sliceID.str();
+    this->m_DetectorInformation.SliceOrigin = this->m_CTSlicePositions[i];
+    this->m_PQCTImage = slices[i];
+    slices[i] = 0;
+    std::cout << "Slice " << i + 1 << " of " << slices.size() << std::endl;
+
+    //! Write orginal image to nifti file.
+    this->WriteIntermediateImage( this->m_PQCTImage, inputImageFileExtension, OUTPUT_QC );
+
+    this->AnalyzeCTMidThigh();
+  }
+
+  this->m_SubjectID = seriesID;
 }
 
 
@@ -391,35 +268,9 @@ void PQCT_Analyzer::CopyFinalLabelsinOriginalSpace(LabelImageType::Pointer label
 }
 
 
-//! Analyze at middle thigh site.
-void PQCT_Analyzer::AnalyzeCTMidThigh(){
-
-  //! Open output csv file for writing.
-  std::string prefix = this->m_outputPath + this->m_SubjectID + "_MidThigh";
-  std::string tempFilename = prefix + quantificationFileExtension;
-  this->m_textFile.open(tempFilename.c_str());
-  if (this->m_textFile.fail()) {
-    std::cerr << "unable to open file for writing" << std::endl;
-    return;
-  }
-
-  //! Start clock.
-  std::clock_t begin = std::clock();
-
-  std::cout << "--------Quantification at middle thigh--------" << std::endl;
-
-
-  //! Instantiate the output label image before any cropping.
-  LabelImageType::Pointer outputLabelImage = this->CreateOutputLabelImage();
-
-
-  //! Remove patient table and select left thigh.
-  LabelImageType::Pointer LegOnlyMask = this->SelectOneLeg();
-
-
-  //! 1. Segment tissue types.
-  this->ApplyKMeans();
-
+//! Separate fat types, bone marrow and muscle at the middle thigh from the
+//! K-means labels, within the selected thigh.
+void PQCT_Analyzer::SegmentCTMidThighTissues(){
 
   //! 2. Separate intermuscular from subcutaneous fat.
   //! Label connected fat components.
@@ -457,6 +308,7 @@ void PQCT_Analyzer::AnalyzeCTMidThigh(){
 
 
   //! 6. Mask results with total thigh mask.
+  LabelImageType::Pointer LegOnlyMask = this->m_LegOnlyMask;
   typedef itk::ImageRegionIteratorWithIndex<LabelImageType> LabelImageIteratorType;
   LabelImageIteratorType itImage(LegOnlyMask, 
   				 LegOnlyMask->GetLargestPossibleRegion());
@@ -472,57 +324,48 @@ void PQCT_Analyzer::AnalyzeCTMidThigh(){
       // std::cout << labelmapIdx << std::endl;
     }
   }
+}
 
 
-  //! 7. Compute: bone, muscle, fat areas, and bone, muscle density.
-  // Display results.
-  this->LogHeaderInfo();
-  this->ComputeTissueShapeAttributes();
-  this->ComputeTissueIntensityAttributes();
+//! Analyze at middle thigh site.
+void PQCT_Analyzer::AnalyzeCTMidThigh(){
+
+  //! Output filename prefix.
+  std::string prefix = this->m_outputPath + this->m_SubjectID + "_MidThigh";
 
+  //! Start clock.
+  double begin = this->m_Tracer.GetElapsedTime();
 
-  //! Foreground/background segmentation and computation of region attributes.
-  LabelImageType::Pointer totalLegCrosssectionImage = 
-    // this->ForegroundBackgroundSegmentationByFastMarching();
-    this->ForegroundBackgroundSegmentationAfterKMeans();
+  std::cout << "--------Quantification at middle thigh--------" << std::endl;
 
 
-  //! Compute centroid and density over total leg.
-  this->ComputeTissueShapeAttributes( totalLegCrosssectionImage );
-  this->ComputeTissueIntensityAttributes( totalLegCrosssectionImage );
-  
-  //! Stop the clock.
-  std::clock_t end = std::clock();
-  double elapsed_secs = double(end - begin) / CLOCKS_PER_SEC;
+  //! Instantiate the output label image before any cropping.
+  LabelImageType::Pointer outputLabelImage = this->CreateOutputLabelImage();
 
-  //! Pass Elapsed_Time to stringstream.
-  std::stringstream tempStringstream;
-  tempStringstream.str("");
-  tempStringstream << "Elapsed_Time";
-  this->m_TissueIntensityEntries.headerString.width(STRING_LENGTH);
-  this->m_TissueIntensityEntries.headerString << tempStringstream.str();
 
-  this->m_TissueIntensityEntries.valueString.width(STRING_LENGTH); 
-  this->m_TissueIntensityEntries.valueString << elapsed_secs;
+  //! Remove patient table and select left thigh.
+  this->m_LegOnlyMask = this->SelectOneLeg();
+
+
+  //! 1. Segment tissue types, then 2.-6. separate fat, marrow and muscle
+  //! within the thigh mask, while the total leg is measured from the
+  //! K-means labels.
+  //! 7. Compute: bone, muscle, fat areas, and bone, muscle density.
+  MeasurementType tissueMeasurement, totalLegMeasurement;
+  this->ExecuteTissueStages( &PQCT_Analyzer::SegmentCTMidThighTissues,
+			     tissueMeasurement,
+			     totalLegMeasurement );
+  
+  //! Pass Elapsed_Time, stage times and memory to the quantification entries.
+  this->AddProcessingStatistics( begin );
 
   //! Write measurements to text file.
-  this->WriteToTextFile();
+  this->WriteQuantification( prefix + quantificationFileExtension );
   
   //! Update output label image with the segmentation output.
   this->CopyFinalLabelsinOriginalSpace(outputLabelImage);
 
   //! Save output image to file.
-  itk::ImageFileWriter<LabelImageType>::Pointer labelWriter2 = 
-    itk::ImageFileWriter<LabelImageType>::New();
-  // labelWriter2->SetInput( this->m_TissueLabelImage ); 
-  labelWriter2->SetInput( outputLabelImage ); 
-  labelWriter2->SetFileName( prefix + 
-			     labelImageFileExtension );
-  labelWriter2->Update();
-  labelWriter2 = 0;
-
-
-  //! Close output stream before exiting.
-  this->m_textFile.close();
+  this->WriteLabelImage( outputLabelImage, prefix + labelImageFileExtension );
 
 }
@@ -23,8 +23,6 @@
 #include <itkMedianImageFilter.h>
 #include <itkRecursiveGaussianImageFilter.h>
 #include <itkScalarImageKmeansImageFilter.h>
-#include <itkConnectedComponentImageFilter.h>
-#include <itkRelabelComponentImageFilter.h>
 #include <itkBinaryThresholdImageFilter.h>
 #include <itkGrayscaleFillholeImageFilter.h>
 
@@ -42,6 +40,8 @@
 #include <itkLabelImageToShapeLabelMapFilter.h>
 #include <itkLabelImageToStatisticsLabelMapFilter.h>
 
+#include <itksys/SystemTools.hxx>
+
 #include "PQCT_Datatypes.h"
 #include "PQCT_Analysis.h"
 
@@ -50,12 +50,29 @@
 //! This should implement all common image analysis operations.
 
 
-//! Execute the workflow.
-void PQCT_Analyzer::Execute() {
+//! Execute the workflow. Returns EXIT_FAILURE if the image could not
+//! be read or analyzed, so that batch drivers can report the subject.
+int PQCT_Analyzer::Execute() {
 
-  //! Read file with parameter values.
-  this->ParseSegmentationParameterFile(this->m_parameterFilename,
-				       true);
+  //! Read file with parameter values, unless they were set beforehand.
+  //! Without a parameter file the default values are used.
+  if ( !this->m_ParameterValuesAreSet ) {
+    try {
+      this->ParseSegmentationParameterFile(this->m_parameterFilename,
+					   true);
+    }
+    catch(const char * Message) {
+      std::cerr << "Error:" << Message << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  //! Drop the inputs and results of a previous run of this analyzer.
+  this->ResetAnalysisState();
+  this->m_PQCTImage = 0;
+  this->m_CTSlices.clear();
+  this->m_CTSlicePositions.clear();
+  this->m_Tracer.Reset();
 
   //! Read original image according to anatomical site.
   try {
@@ -65,24 +82,33 @@ void PQCT_Analyzer::Execute() {
     case PQCT_SIXTYSIX_PCT_TIBIA:
       this->ReadPQCTImage();
       break;
-    case CT_MID_THIGH:
-      this->ReadDicomCTImage();
+    case CT_MID_THIGH://! A directory holds a series of slices.
+      if ( itksys::SystemTools::FileIsDirectory( this->m_PQCTImageFilename.c_str() ) )
+	this->ReadDicomCTSeries();
+      else
+	this->ReadDicomCTImage();
       break;
     case PQCT_ANONYMIZE:
       this->ReadPQCTImage();
       break;
+    case PQCT_CATALOG://! Input is a directory, headers are read per file.
+    case PQCT_BULK_ANONYMIZE://! Input is a file list.
+    case DICOM_CATALOG:
+    case METRICS_EXPORT://! Input is a cohort results file.
+      break;
     default:
       std::cerr << "Unknown workflow number." 
 		<< std::endl;
       // exit(1);
-      break;
+      return EXIT_FAILURE;
     }
   }
   catch(const char * Message) {
     std::cerr << "Error:" << Message << std::endl;
-    return;
+    return EXIT_FAILURE;
   }
   
+  int status = EXIT_SUCCESS;
   try {
     //! Switch to algorithm according to anatomical site.
     switch(this->m_WorkflowID) {
@@ -96,23 +122,139 @@ void PQCT_Analyzer::Execute() {
       this->Analyze66PCT();
       break;
     case CT_MID_THIGH:
-      this->AnalyzeCTMidThigh();
+      if ( !this->m_CTSlices.empty() )
+	this->AnalyzeCTMidThighSeries();
+      else
+	this->AnalyzeCTMidThigh();
       break;
     case PQCT_ANONYMIZE://! Proceed to file anonymization.
       this->AnonymizePQCTImage();
+      break;
+    case PQCT_BULK_ANONYMIZE://! Anonymization of a file list.
+      this->BulkAnonymizePQCTImages();
+      break;
+    case PQCT_CATALOG://! Header-only index of a directory tree.
+      this->CatalogPQCTDirectory();
+      break;
+    case DICOM_CATALOG://! Tag-only index of a DICOM directory tree.
+      this->CatalogDicomDirectory();
+      break;
+    case METRICS_EXPORT://! Cohort results to CSV.
+      this->ExportMetricsToCSV();
+      break;
     default:
       std::cerr << "Unknown workflow number." 
 		<< std::endl;
       // exit(1);
-      break;
+      return EXIT_FAILURE;
     }
   }
   catch (itk::ExceptionObject & e)
     {
       std::cerr << "Exception in quantification algorithm " << std::endl;
       std::cerr << e << std::endl;
-      return;
+      status = EXIT_FAILURE;
     }
+  catch(const char * Message) {
+    std::cerr << "Error:" << Message << std::endl;
+    status = EXIT_FAILURE;
+  }
+
+  this->m_MemoryFootprint = this->m_Tracer.GetMemoryFootprint();
+
+  //! Stage timings, also of a failed analysis.
+  try {
+    this->WriteTrace();
+  }
+  catch(const char * Message) {
+    std::cerr << "Error:" << Message << std::endl;
+  }
+
+  return status;
+}
+
+
+//! Clear per-image results so that the analyzer can process another image.
+void PQCT_Analyzer::ResetAnalysisState() {
+  this->m_TissueShapeEntries.headerString.str("");
+  this->m_TissueShapeEntries.headerString.clear();
+  this->m_TissueShapeEntries.valueString.str("");
+  this->m_TissueShapeEntries.valueString.clear();
+  this->m_TissueIntensityEntries.headerString.str("");
+  this->m_TissueIntensityEntries.headerString.clear();
+  this->m_TissueIntensityEntries.valueString.str("");
+  this->m_TissueIntensityEntries.valueString.clear();
+
+  this->m_TissueClassesVector.clear();
+  this->m_TissueClassesVectorNoAir.clear();
+
+  this->m_MetricsRecords.clear();
+  this->m_QuantificationText.clear();
+  this->m_MetricsPassStart = 0;
+
+  this->m_KmeansLabelImage = 0;
+  this->m_TissueLabelImage = 0;
+  this->m_LegOnlyMask = 0;
+  this->m_DerivedImages.Clear();
+}
+
+
+//! Add processing time and memory to the quantification entries:
+//! wall-clock time since startTime, the time and heap allocations of
+//! each traced stage started since, and the peak memory of the run.
+void PQCT_Analyzer::AddProcessingStatistics(double startTime) {
+  double elapsedTime = this->m_Tracer.GetElapsedTime() - startTime;
+  for (unsigned int i = 0; i < this->m_MetricsRecords.size(); i++)
+    this->m_MetricsRecords[i].ElapsedTime = elapsedTime;
+  if (this->m_MetricsAppender != NULL)
+    return;
+
+  // Set floating point precision.
+  this->m_TissueIntensityEntries.valueString.setf(std::ios::fixed, std::ios::floatfield);
+  this->m_TissueIntensityEntries.valueString.precision(FLOAT_PRECISION);
+
+  this->m_TissueIntensityEntries.headerString.width(STRING_LENGTH);
+  this->m_TissueIntensityEntries.headerString << "Elapsed_Time";
+
+  this->m_TissueIntensityEntries.valueString.width(STRING_LENGTH); 
+  this->m_TissueIntensityEntries.valueString << elapsedTime;
+
+  std::vector<double> stageTimes;
+  this->m_Tracer.GetStageTimes( startTime, stageTimes );
+  for (unsigned int i = 0; i < stageTimes.size(); i++) {
+    this->m_TissueIntensityEntries.headerString.width(STRING_LENGTH);
+    this->m_TissueIntensityEntries.headerString << TraceStageString[i] + "_Time";
+
+    this->m_TissueIntensityEntries.valueString.width(STRING_LENGTH); 
+    this->m_TissueIntensityEntries.valueString << stageTimes[i];
+  }
+
+  const double bytesPerMB = 1024.0 * 1024.0;
+  std::vector<PQCT_MemorySizeType> stageAllocations;
+  this->m_Tracer.GetStageAllocations( startTime, stageAllocations );
+  for (unsigned int i = 0; i < stageAllocations.size(); i++) {
+    this->m_TissueIntensityEntries.headerString.width(STRING_LENGTH);
+    this->m_TissueIntensityEntries.headerString << TraceStageString[i] + "_Alloc(MB)";
+
+    this->m_TissueIntensityEntries.valueString.width(STRING_LENGTH); 
+    this->m_TissueIntensityEntries.valueString << stageAllocations[i] / bytesPerMB;
+  }
+
+  PQCT_MemoryFootprintType footprint = this->m_Tracer.GetMemoryFootprint();
+  this->m_TissueIntensityEntries.headerString.width(STRING_LENGTH);
+  this->m_TissueIntensityEntries.headerString << "Peak_Heap(MB)";
+  this->m_TissueIntensityEntries.valueString.width(STRING_LENGTH); 
+  this->m_TissueIntensityEntries.valueString << footprint.PeakHeapBytes / bytesPerMB;
+
+  this->m_TissueIntensityEntries.headerString.width(STRING_LENGTH);
+  this->m_TissueIntensityEntries.headerString << "Peak_Image_Buffers";
+  this->m_TissueIntensityEntries.valueString.width(STRING_LENGTH); 
+  this->m_TissueIntensityEntries.valueString << footprint.PeakImageBuffers;
+
+  this->m_TissueIntensityEntries.headerString.width(STRING_LENGTH);
+  this->m_TissueIntensityEntries.headerString << "Peak_RSS(MB)";
+  this->m_TissueIntensityEntries.valueString.width(STRING_LENGTH); 
+  this->m_TissueIntensityEntries.valueString << footprint.PeakResidentSetSize / bytesPerMB;
 }
 
 
@@ -120,6 +262,7 @@ void PQCT_Analyzer::Execute() {
 FloatImageType::Pointer PQCT_Analyzer::SmoothInputVolume( PQCTImageType::Pointer inputImage,
 							  int denoisingMethod )
 {
+  PQCT_TraceScope traceScope( this->m_Tracer, TRACE_SMOOTH );
   FloatImageType::Pointer outputVolume = NULL;
 
   switch( denoisingMethod ) {
@@ -192,45 +335,93 @@ FloatImageType::Pointer PQCT_Analyzer::SmoothInputVolume( PQCTImageType::Pointer
 }
 
 
-//! Foreground/Background segmentation by fast marching.
-LabelImageType::Pointer PQCT_Analyzer::ForegroundBackgroundSegmentationByFastMarching() {
+//! Smoothed analyzed image, computed once per image and method.
+FloatImageType::Pointer PQCT_Analyzer::GetSmoothedImage( int denoisingMethod )
+{
+  PQCT_DerivedImageCache::DerivedImageKeyType key;
+  switch( denoisingMethod ) {
+  case MEDIAN:
+    key = PQCT_DerivedImageCache::MakeKey( PQCT_DerivedImageCache::SMOOTHED_IMAGE,
+					   denoisingMethod,
+					   this->m_medianFilterKernelLength );
+    break;
+  default:
+    key = PQCT_DerivedImageCache::MakeKey( PQCT_DerivedImageCache::SMOOTHED_IMAGE,
+					   denoisingMethod,
+					   DIFFUSIONFILTERITERATIONS,
+					   DIFFUSIONFILTERTIMESTEP,
+					   DIFFUSIONFILTERCONDUCTANCEPARAMETER );
+  }
 
-  //! 0. Apply denoising.
   FloatImageType::Pointer smoothedImage = 
-    this->SmoothInputVolume( this->m_PQCTImage, 
-			     DIFFUSION );
+    this->m_DerivedImages.Find( this->m_PQCTImage, key );
+  if ( smoothedImage.IsNull() ) {
+    smoothedImage = this->SmoothInputVolume( this->m_PQCTImage, denoisingMethod );
+    this->m_DerivedImages.Insert( this->m_PQCTImage, key, smoothedImage );
+  }
+  return smoothedImage;
+}
+
 
+//! Gradient magnitude of the diffusion-smoothed image.
+FloatImageType::Pointer PQCT_Analyzer::GetGradientMagnitudeImage()
+{
+  PQCT_DerivedImageCache::DerivedImageKeyType key = 
+    PQCT_DerivedImageCache::MakeKey( PQCT_DerivedImageCache::GRADIENT_MAGNITUDE_IMAGE,
+				     DIFFUSION,
+				     this->m_gradientSigma );
+  FloatImageType::Pointer gradientImage = 
+    this->m_DerivedImages.Find( this->m_PQCTImage, key );
+  if ( gradientImage.IsNotNull() )
+    return gradientImage;
 
-  //! Gradient magnitude.
   typedef   itk::GradientMagnitudeRecursiveGaussianImageFilter<FloatImageType, 
     FloatImageType >  GradientFilterType;
-
-  FloatImageType::Pointer gradientImage = 0; 
   GradientFilterType::Pointer  gradientMagnitude = GradientFilterType::New();
   gradientMagnitude->SetSigma( this->m_gradientSigma ); // 0.0625
-  gradientMagnitude->SetInput( smoothedImage );
+  gradientMagnitude->SetInput( this->GetSmoothedImage( DIFFUSION ) ); // originally: this->m_PQCTImage
   gradientMagnitude->Update();
   gradientImage = gradientMagnitude->GetOutput();
 
-  // // Write gradient image to file.
-  // std::string gradientImageFilename = this->m_outputPath +
-  //   this->m_SubjectID + "_" + "gradientmag1.nii";
-  // itk::ImageFileWriter<FloatImageType>::Pointer floatWriter = 
-  //   itk::ImageFileWriter<FloatImageType>::New();
-  // floatWriter->SetInput( gradientImage ); 
-  // floatWriter->SetFileName( gradientImageFilename );
-  // floatWriter->Update();
-  // floatWriter = 0; 
+  this->m_DerivedImages.Insert( this->m_PQCTImage, key, gradientImage );
+  return gradientImage;
+}
+
+
+//! Edge potential (speed) image: sigmoid of the gradient magnitude.
+FloatImageType::Pointer PQCT_Analyzer::GetSpeedImage( float alpha, float beta )
+{
+  PQCT_DerivedImageCache::DerivedImageKeyType key = 
+    PQCT_DerivedImageCache::MakeKey( PQCT_DerivedImageCache::SPEED_IMAGE,
+				     DIFFUSION,
+				     this->m_gradientSigma,
+				     alpha,
+				     beta );
+  FloatImageType::Pointer speedImage = 
+    this->m_DerivedImages.Find( this->m_PQCTImage, key );
+  if ( speedImage.IsNotNull() )
+    return speedImage;
 
-  //! Speed image.
   typedef   itk::SigmoidImageFilter<FloatImageType, FloatImageType >  SigmoidFilterType;
   SigmoidFilterType::Pointer sigmoid = SigmoidFilterType::New();
-  sigmoid->SetAlpha( -4 );   
-  sigmoid->SetBeta( 30 );  
-  sigmoid->SetOutputMinimum( 0.0 );
-  sigmoid->SetOutputMaximum( 1.0 );
-  sigmoid->SetInput( gradientImage ); 
+  sigmoid->SetAlpha( alpha );   
+  sigmoid->SetBeta( beta );  
+  sigmoid->SetOutputMinimum(  0.0  );
+  sigmoid->SetOutputMaximum(  1.0  );
+  sigmoid->SetInput( this->GetGradientMagnitudeImage() ); 
   sigmoid->Update();
+  speedImage = sigmoid->GetOutput();
+
+  this->m_DerivedImages.Insert( this->m_PQCTImage, key, speedImage );
+  return speedImage;
+}
+
+
+//! Foreground/Background segmentation by fast marching.
+LabelImageType::Pointer PQCT_Analyzer::ForegroundBackgroundSegmentationByFastMarching() {
+
+  //! Speed image from the smoothed gradient magnitude.
+  FloatImageType::Pointer speedImage = this->GetSpeedImage( -4, 30 );
 
   //! Fast marching segmentation.
   // Use fast marching to initialize the segmentation process.
@@ -241,32 +432,21 @@ LabelImageType::Pointer PQCT_Analyzer::ForegroundBackgroundSegmentationByFastMar
   }
 
   LabelImageType::Pointer roiVolume = 
-    this->InitializeROIbyFastMarching( sigmoid->GetOutput(),
+    this->InitializeROIbyFastMarching( speedImage,
 				       middleIdx,
 				       500.0F );
   std::cout << "FM-based ROI generation." << std::endl;
 
   // Invert pixel values before feature computation.
-  typedef itk::ImageRegionIteratorWithIndex<LabelImageType> LabelImageIteratorType;
-  LabelImageIteratorType itImage(roiVolume, 
-				 roiVolume->GetBufferedRegion());
-  LabelImageType::IndexType idx;
-
-  for(itImage.GoToBegin();!itImage.IsAtEnd();++itImage) 
-    if ( itImage.Get() == BACKGROUND ) 
-      itImage.Set( TOT_AREA );    
-    else if ( itImage.Get() == FOREGROUND )
-      itImage.Set( BACKGROUND ); 
-
-  std::string fmImageFilename = this->m_outputPath + 
-    this->m_SubjectID + "_"  + 
-    "FB_Mask.nii";
-  itk::ImageFileWriter<LabelImageType>::Pointer maskWriter = 
-    itk::ImageFileWriter<LabelImageType>::New();
-  maskWriter->SetInput( roiVolume ); 
-  maskWriter->SetFileName( fmImageFilename );
-  maskWriter->Update();
-  maskWriter = 0;
+  PQCT_LabelLUT invertLUT;
+  invertLUT.Set( BACKGROUND, TOT_AREA );
+  invertLUT.Set( FOREGROUND, BACKGROUND );
+  PQCT_LabelKernels::RemapLabels( roiVolume->GetBufferPointer(),
+				  roiVolume->GetBufferPointer(),
+				  PQCT_LabelKernels::GetNumberOfPixels( roiVolume.GetPointer() ),
+				  invertLUT );
+
+  this->WriteIntermediateImage( roiVolume, foregroundMaskFileExtension, OUTPUT_DEBUG );
 
   return roiVolume;
 }
@@ -276,33 +456,18 @@ LabelImageType::Pointer PQCT_Analyzer::ForegroundBackgroundSegmentationByFastMar
 LabelImageType::Pointer PQCT_Analyzer::ForegroundBackgroundSegmentationAfterKMeans() {
 
   // Allocate new itk image.
-  LabelImageType::Pointer outputlabelImage = LabelImageType::New();
-  outputlabelImage->CopyInformation( this->m_KmeansLabelImage );
-  outputlabelImage->SetRegions( this->m_KmeansLabelImage->GetLargestPossibleRegion() );
-  outputlabelImage->Allocate();
-  outputlabelImage->FillBuffer( BACKGROUND );
+  LabelImageType::Pointer outputlabelImage =
+    PQCT_LabelKernels::CreateLabelImage( this->m_KmeansLabelImage.GetPointer() );
 
   // Mark non-background pixels.
-  typedef itk::ImageRegionIteratorWithIndex<LabelImageType> LabelImageIteratorType;
-  LabelImageIteratorType itImage(this->m_KmeansLabelImage, 
-				 this->m_KmeansLabelImage->GetBufferedRegion());
-  LabelImageType::IndexType idx;
-
-  for(itImage.GoToBegin();!itImage.IsAtEnd();++itImage) {
-    idx = itImage.GetIndex();
-    if ( itImage.Get() != BACKGROUND ) 
-      outputlabelImage->SetPixel(idx, TOT_AREA );    
-  }
+  PQCT_LabelLUT foregroundLUT( TOT_AREA );
+  foregroundLUT.Set( BACKGROUND, BACKGROUND );
+  PQCT_LabelKernels::RemapLabels( this->m_KmeansLabelImage->GetBufferPointer(),
+				  outputlabelImage->GetBufferPointer(),
+				  PQCT_LabelKernels::GetNumberOfPixels( outputlabelImage.GetPointer() ),
+				  foregroundLUT );
 
-  std::string fmImageFilename = this->m_outputPath + 
-    this->m_SubjectID + "_"  + 
-    "FB_Mask.nii";
-  itk::ImageFileWriter<LabelImageType>::Pointer maskWriter = 
-    itk::ImageFileWriter<LabelImageType>::New();
-  maskWriter->SetInput( outputlabelImage ); 
-  maskWriter->SetFileName( fmImageFilename );
-  maskWriter->Update();
-  maskWriter = 0;
+  this->WriteIntermediateImage( outputlabelImage, foregroundMaskFileExtension, OUTPUT_DEBUG );
 
   return outputlabelImage;
 }
@@ -317,6 +482,7 @@ InitializeROIbyFastMarching(FloatImageType::Pointer speedImage,
 			    LabelImageType::IndexType medianIdx,
 			    float fastmarchingStoppingTime) 
 {
+  PQCT_TraceScope traceScope( this->m_Tracer, TRACE_FAST_MARCHING );
   // Use fast marching to initialize the segmentation process.
 
   // Declare fast marching filter type.
@@ -398,6 +564,7 @@ PQCT_Analyzer::
 ApplyGeodesicActiveContoursToLabelImage(LabelImageType::Pointer roiVolume,
 					FloatImageType::Pointer speedImage,
 					unsigned int label) {
+  PQCT_TraceScope traceScope( this->m_Tracer, TRACE_GAC );
 
   // Calculate distance map from initial ROI.
   // Distance map filter type definition.
@@ -488,54 +655,15 @@ LabelImageType::Pointer PQCT_Analyzer::
 SegmentbyLevelSets( LabelImageType::IndexType medianIdx,
 		    unsigned int label) {
 
-  //! Apply denoising.
-  FloatImageType::Pointer smoothedImage = 
-    this->SmoothInputVolume( this->m_PQCTImage, 
-			     DIFFUSION );
-
-
-  //! Image gradient magnitude.
-  typedef   itk::GradientMagnitudeRecursiveGaussianImageFilter<FloatImageType, 
-    FloatImageType >  GradientFilterType;
-
-  FloatImageType::Pointer gradientImage = 0; 
-  GradientFilterType::Pointer  gradientMagnitude = GradientFilterType::New();
-  gradientMagnitude->SetSigma( this->m_gradientSigma ); // 0.0625
-  gradientMagnitude->SetInput( smoothedImage ); // originally: this->m_PQCTImage
-  gradientMagnitude->Update();
-  gradientImage = gradientMagnitude->GetOutput();
-
-  // // Write gradient image to file.
-  // std::string gradientImageFilename = this->m_outputPath +
-  //   this->m_SubjectID + "_" + "gradientmag.nii";
-  // itk::ImageFileWriter<FloatImageType>::Pointer floatWriter = 
-  //   itk::ImageFileWriter<FloatImageType>::New();
-  // floatWriter->SetInput( gradientImage ); 
-  // floatWriter->SetFileName( gradientImageFilename );
-  // floatWriter->Update();
-  // floatWriter = 0; 
-
-  //! Then apply sigmoid filter to produce edge potential image.
-  // std::cout << "Sigmoid Filter-- Alpha = "
-  // 	    << this->m_sigmoidAlpha
-  // 	    << ", Beta = "
-  // 	    << this->m_sigmoidBeta
-  // 	    << std::endl;
-
-  typedef   itk::SigmoidImageFilter<FloatImageType, FloatImageType >  SigmoidFilterType;
-  SigmoidFilterType::Pointer sigmoid = SigmoidFilterType::New();
-  sigmoid->SetAlpha( this->m_sigmoidAlpha );   
-  sigmoid->SetBeta( this->m_sigmoidBeta  );  
-  sigmoid->SetOutputMinimum(  0.0  );
-  sigmoid->SetOutputMaximum(  1.0  );
-  sigmoid->SetInput( gradientImage ); 
-  sigmoid->Update();
+  //! Edge potential image from the smoothed gradient magnitude.
+  FloatImageType::Pointer speedImage = 
+    this->GetSpeedImage( this->m_sigmoidAlpha, this->m_sigmoidBeta );
 
 
   //! Fast marching.
   // Use fast marching to initialize the segmentation process.
   LabelImageType::Pointer roiVolume = 
-    this->InitializeROIbyFastMarching( sigmoid->GetOutput(),
+    this->InitializeROIbyFastMarching( speedImage,
 				       medianIdx,
 				       this->m_fastmarchingStoppingTime );
   std::cout << "FM-based ROI generation." << std::endl;
@@ -544,7 +672,7 @@ SegmentbyLevelSets( LabelImageType::IndexType medianIdx,
   //! GAC segmentation.
   // this->m_TissueLabelImage = 
   return this->ApplyGeodesicActiveContoursToLabelImage( roiVolume,
-							sigmoid->GetOutput(),
+							speedImage,
 							(unsigned int) label );
 }
 
@@ -553,54 +681,15 @@ SegmentbyLevelSets( LabelImageType::IndexType medianIdx,
 LabelImageType::Pointer PQCT_Analyzer::
 SegmentbyLevelSets( LabelImageType::Pointer roiVolume,
 		    unsigned int label) {
-  //! Apply denoising.
-  FloatImageType::Pointer smoothedImage = 
-    this->SmoothInputVolume( this->m_PQCTImage, 
-			     DIFFUSION );
-
-
-  //! Image gradient magnitude.
-  typedef   itk::GradientMagnitudeRecursiveGaussianImageFilter<FloatImageType, 
-    FloatImageType >  GradientFilterType;
-
-  FloatImageType::Pointer gradientImage = 0; 
-  GradientFilterType::Pointer  gradientMagnitude = GradientFilterType::New();
-  gradientMagnitude->SetSigma( this->m_gradientSigma ); // 0.0625
-  gradientMagnitude->SetInput( smoothedImage ); // originally: this->m_PQCTImage
-  gradientMagnitude->Update();
-  gradientImage = gradientMagnitude->GetOutput();
-
-  // // Write gradient image to file.
-  // std::string gradientImageFilename = this->m_outputPath +
-  //   this->m_SubjectID + "_" + "gradientmag.nii";
-  // itk::ImageFileWriter<FloatImageType>::Pointer floatWriter = 
-  //   itk::ImageFileWriter<FloatImageType>::New();
-  // floatWriter->SetInput( gradientImage ); 
-  // floatWriter->SetFileName( gradientImageFilename );
-  // floatWriter->Update();
-  // floatWriter = 0; 
-
-  //! Then apply sigmoid filter to produce edge potential image.
-  // std::cout << "Sigmoid Filter-- Alpha = "
-  // 	    << this->m_sigmoidAlpha
-  // 	    << ", Beta = "
-  // 	    << this->m_sigmoidBeta
-  // 	    << std::endl;
-
-  typedef   itk::SigmoidImageFilter<FloatImageType, FloatImageType >  SigmoidFilterType;
-  SigmoidFilterType::Pointer sigmoid = SigmoidFilterType::New();
-  sigmoid->SetAlpha( this->m_sigmoidAlpha );   
-  sigmoid->SetBeta( this->m_sigmoidBeta  );  
-  sigmoid->SetOutputMinimum(  0.0  );
-  sigmoid->SetOutputMaximum(  1.0  );
-  sigmoid->SetInput( gradientImage ); 
-  sigmoid->Update();
+  //! Edge potential image from the smoothed gradient magnitude.
+  FloatImageType::Pointer speedImage = 
+    this->GetSpeedImage( this->m_sigmoidAlpha, this->m_sigmoidBeta );
 
 
   //! GAC segmentation.
   // this->m_TissueLabelImage = 
   return  this->ApplyGeodesicActiveContoursToLabelImage( roiVolume,
-							 sigmoid->GetOutput(),
+							 speedImage,
 							 (unsigned int) label );
 }
 
@@ -609,24 +698,31 @@ SegmentbyLevelSets( LabelImageType::Pointer roiVolume,
 LabelImageType::Pointer PQCT_Analyzer::OverlayLabelImages(LabelImageType::Pointer image1,
 							  LabelImageType::Pointer image2)
 {
-  typedef itk::ImageRegionIteratorWithIndex<LabelImageType> LabelImageIteratorType;
-  LabelImageIteratorType itImage(this->m_TissueLabelImage, 
-				 this->m_TissueLabelImage->GetBufferedRegion());
-  LabelImageType::IndexType idx;
-
-  LabelImageType::Pointer outputlabelImage = LabelImageType::New();
-  outputlabelImage->CopyInformation( this->m_TissueLabelImage );
-  outputlabelImage->SetRegions( this->m_TissueLabelImage->GetLargestPossibleRegion() );
-  outputlabelImage->Allocate();
-  outputlabelImage->FillBuffer( BACKGROUND );
-
-  for(itImage.GoToBegin();!itImage.IsAtEnd();++itImage) {
-    idx = itImage.GetIndex();
-    if(image1->GetPixel(idx) > image2->GetPixel(idx))
-      outputlabelImage->SetPixel(idx, image1->GetPixel(idx));
-    else
-      outputlabelImage->SetPixel(idx, image2->GetPixel(idx));
+  std::vector<LabelImageType::Pointer> images;
+  images.push_back( image1 );
+  images.push_back( image2 );
+  return this->OverlayLabelImages( images );
+}
+
+
+//! Overlay images for visualization: the largest label of each pixel.
+LabelImageType::Pointer
+PQCT_Analyzer::OverlayLabelImages(const std::vector<LabelImageType::Pointer> & images)
+{
+  LabelImageType::Pointer outputlabelImage =
+    PQCT_LabelKernels::CreateLabelImage( this->m_TissueLabelImage.GetPointer() );
+  size_t numberOfPixels =
+    PQCT_LabelKernels::GetNumberOfPixels( outputlabelImage.GetPointer() );
+
+  std::vector<const LabelPixelType *> buffers;
+  for (unsigned int i = 0; i < images.size(); i++) {
+    if ( PQCT_LabelKernels::GetNumberOfPixels( images[i].GetPointer() ) != numberOfPixels )
+      throw "Overlaid label images differ in size.";
+    buffers.push_back( images[i]->GetBufferPointer() );
   }
+  PQCT_LabelKernels::MaximumOverlay( buffers,
+				     outputlabelImage->GetBufferPointer(),
+				     numberOfPixels );
   
   return outputlabelImage;
 }
@@ -636,26 +732,21 @@ LabelImageType::Pointer PQCT_Analyzer::OverlayLabelImages(LabelImageType::Pointe
 void PQCT_Analyzer::MapTissueClassesPostKMeans(){
 
   //! Map class labels according to anatomical site.
-  typedef itk::ImageRegionIteratorWithIndex<LabelImageType> LabelImageIteratorType;
-  LabelImageIteratorType itImage(this->m_KmeansLabelImage, 
-				 this->m_KmeansLabelImage->GetBufferedRegion());
-  LabelImageType::IndexType idx;
+  PQCT_LabelLUT classLUT;
 
   switch(this->m_WorkflowID) {
   case PQCT_FOUR_PCT_TIBIA://! 4%
     break;
   case PQCT_THIRTYEIGHT_PCT_TIBIA: case PQCT_SIXTYSIX_PCT_TIBIA: case CT_MID_THIGH: 
     //! 38% and 66% tibia and mid thigh ct.
-    for(itImage.GoToBegin();!itImage.IsAtEnd();++itImage) {
-      idx = itImage.GetIndex();
-      if( itImage.Get() == TRAB_BONE )
-	itImage.Set( CORT_BONE ); 
-    }
+    classLUT.Set( TRAB_BONE, CORT_BONE );
+    PQCT_LabelKernels::RemapLabels( this->m_KmeansLabelImage->GetBufferPointer(),
+				    this->m_KmeansLabelImage->GetBufferPointer(),
+				    PQCT_LabelKernels::GetNumberOfPixels( this->m_KmeansLabelImage.GetPointer() ),
+				    classLUT );
     break;
   default:
-    std::cerr << "Unacceptable workflow number." 
-	      << std::endl;
-    exit(1);
+    throw "Unacceptable workflow number.";
     break;
   }
 }
@@ -663,6 +754,8 @@ void PQCT_Analyzer::MapTissueClassesPostKMeans(){
 
 //! Set HU prior intensities according to workflow.
 void PQCT_Analyzer::SetTissueClassesNoAir() {
+  this->m_TissueClassesVectorNoAir.clear();
+
   //! Pick classes according to anatomical site.
   switch(this->m_WorkflowID) {
   case PQCT_FOUR_PCT_TIBIA://! 4%
@@ -688,9 +781,7 @@ void PQCT_Analyzer::SetTissueClassesNoAir() {
     this->m_TissueClassesVectorNoAir.push_back ( (float) 1200.0 ); // FEMUR 2
     break;
   default:
-    std::cerr << "Unacceptable workflow number." 
-	      << std::endl;
-    exit(1);
+    throw "Unacceptable workflow number.";
     break;
   }
 
@@ -727,9 +818,7 @@ void PQCT_Analyzer::SetTissueClasses() {
     this->m_TissueClassesVector.push_back ( (float) 1200.0 ); // FEMUR 2
     break;
   default:
-    std::cerr << "Unacceptable workflow number." 
-	      << std::endl;
-    exit(1);
+    throw "Unacceptable workflow number.";
     break;
   }
 
@@ -742,71 +831,158 @@ void PQCT_Analyzer::ApplyKMeans() {
 
   //! Apply denoising.
   FloatImageType::Pointer smoothedImage = 
-    this->SmoothInputVolume( this->m_PQCTImage, 
-			     MEDIAN );  // previously: DIFFUSION
+    this->GetSmoothedImage( MEDIAN );  // previously: DIFFUSION
 
+  PQCT_TraceScope traceScope( this->m_Tracer, TRACE_KMEANS );
 
-  //! 1. k-means clustering into 4 groups {bone,fat,muscle,background}.
-  typedef itk::ScalarImageKmeansImageFilter<FloatImageType> 
-    ScalarImageKmeansImageFilterType;
-  ScalarImageKmeansImageFilterType::Pointer scalarImageKmeansImageFilter = 
-    ScalarImageKmeansImageFilterType::New();
-  // scalarImageKmeansImageFilter->SetInput( this->m_PQCTImage );
-  scalarImageKmeansImageFilter->SetInput( smoothedImage );
-  scalarImageKmeansImageFilter->SetDebug( true );
 
+  //! 1. k-means clustering into 4 groups {bone,fat,muscle,background}.
   //! Use prior knowledge to initialize.
   this->SetTissueClasses();
-  std::vector<float>::iterator it;
-  for(it=this->m_TissueClassesVector.begin();it<this->m_TissueClassesVector.end();it++)
-    scalarImageKmeansImageFilter->AddClassWithInitialMean( *it );
-  scalarImageKmeansImageFilter->Update();
-  this->m_KmeansLabelImage = scalarImageKmeansImageFilter->GetOutput();
+  std::vector<double> finalMeans( this->m_TissueClassesVector.begin(),
+				  this->m_TissueClassesVector.end() );
+  LabelImageType::Pointer kmeansLabelImage = 
+    PQCT_LabelKernels::CreateLabelImage( smoothedImage.GetPointer() );
+
+  //! Alternatively, EM-GMM or fuzzy c-means.
+  if (this->m_ClusteringMethod == EMGMM_CLUSTERING || 
+      this->m_ClusteringMethod == FCM_CLUSTERING)
+    this->ApplyHistogramClustering( smoothedImage.GetPointer(), 
+				    kmeansLabelImage.GetPointer(), 
+				    finalMeans );
+
+  //! The median of the calibrated densities has integer values: cluster
+  //! the histogram instead of the pixels.
+  else if ( !PQCT_HistogramKMeans::Classify( smoothedImage->GetBufferPointer(),
+					     kmeansLabelImage->GetBufferPointer(),
+					     PQCT_LabelKernels::GetNumberOfPixels( smoothedImage.GetPointer() ),
+					     finalMeans ) ) {
+    typedef itk::ScalarImageKmeansImageFilter<FloatImageType> 
+      ScalarImageKmeansImageFilterType;
+    ScalarImageKmeansImageFilterType::Pointer scalarImageKmeansImageFilter = 
+      ScalarImageKmeansImageFilterType::New();
+    // scalarImageKmeansImageFilter->SetInput( this->m_PQCTImage );
+    scalarImageKmeansImageFilter->SetInput( smoothedImage );
+    scalarImageKmeansImageFilter->SetDebug( true );
+
+    std::vector<float>::iterator it;
+    for(it=this->m_TissueClassesVector.begin();it<this->m_TissueClassesVector.end();it++)
+      scalarImageKmeansImageFilter->AddClassWithInitialMean( *it );
+    scalarImageKmeansImageFilter->Update();
+    kmeansLabelImage = scalarImageKmeansImageFilter->GetOutput();
+    for(unsigned int i = 0; i < finalMeans.size(); i++)
+      finalMeans[i] = scalarImageKmeansImageFilter->GetFinalMeans()[i];
+  }
+  this->m_KmeansLabelImage = kmeansLabelImage;
 
-  std::cout << "K-means clustering, done" << std::endl;
+  std::cout << "Clustering, done" << std::endl;
   std::cout << "Final means are: " << std::endl;
-  std::cout << scalarImageKmeansImageFilter->GetFinalMeans() << std::endl;
+  std::cout << "[";
+  for(unsigned int i = 0; i < finalMeans.size(); i++)
+    std::cout << ( i > 0 ? ", " : "" ) << finalMeans[i];
+  std::cout << "]" << std::endl;
 
   //! Map cluster numbers to tissue labels according to our convention.
   this->MapTissueClassesPostKMeans();
 
   //! In debug mode, write label image to file.
-  itk::ImageFileWriter<LabelImageType>::Pointer labelWriter = 
-    itk::ImageFileWriter<LabelImageType>::New();
-  labelWriter->SetInput( this->m_KmeansLabelImage ); 
-  labelWriter->SetFileName( this->m_outputPath + "Kmeans_output.nii" );
-  labelWriter->Update();
-  labelWriter = 0;
+  this->WriteIntermediateImage( this->m_KmeansLabelImage, kmeansImageFileExtension, OUTPUT_DEBUG );
 
   //! Use duplicator to create the tissue label image.
   typedef itk::ImageDuplicator< LabelImageType > LabelDuplicatorType;
   LabelDuplicatorType::Pointer labelDuplicator = LabelDuplicatorType::New();
-  labelDuplicator->SetInputImage( scalarImageKmeansImageFilter->GetOutput()  );
+  labelDuplicator->SetInputImage( this->m_KmeansLabelImage );
   labelDuplicator->Update();
   this->m_TissueLabelImage = labelDuplicator->GetOutput();
 }
 
 
+//! EM-GMM with Bayesian classification, or fuzzy c-means, of the
+//! density histogram (emgmmbaycls and fcm of the Matlab feature space
+//! analysis). Densities nearer the air prior than the first tissue
+//! prior are air; the others are clustered from the priors without
+//! air. Labels and means follow the k-means classes: air first.
+void PQCT_Analyzer::ApplyHistogramClustering(const FloatImageType * smoothedImage,
+					     LabelImageType * clusterLabelImage,
+					     std::vector<double> & finalMeans) {
+  size_t numberOfPixels = PQCT_LabelKernels::GetNumberOfPixels( smoothedImage );
+  PQCT_HistogramType histogram;
+  if ( !PQCT_HistogramKMeans::BuildHistogram( smoothedImage->GetBufferPointer(),
+					      numberOfPixels, histogram ) )
+    throw "Histogram clustering needs integer densities.";
+  if (numberOfPixels == 0)
+    return;
+
+  this->SetTissueClassesNoAir();
+  std::vector<double> means( this->m_TissueClassesVectorNoAir.begin(),
+			     this->m_TissueClassesVectorNoAir.end() );
+  if ( means.size() + 1 != finalMeans.size() )
+    throw "Tissue priors do not match.";
+
+  //! Air: values up to the middle of the air and first tissue priors.
+  long airThreshold = (long) std::floor( 0.5 * ( finalMeans[0] + means[0] ) );
+  PQCT_HistogramType tissueHistogram = 
+    PQCT_HistogramClustering::GetUpperHistogram( histogram, airThreshold + 1 );
+
+  std::vector<LabelPixelType> tissueBinClasses;
+  if (this->m_ClusteringMethod == EMGMM_CLUSTERING) {
+    PQCT_GaussianMixtureType mixture;
+    mixture.Means = means;
+    unsigned int iterations = 
+      PQCT_HistogramClustering::EstimateGaussianMixture( tissueHistogram, mixture );
+    PQCT_HistogramClustering::ClassifyBinsBayes( tissueHistogram, mixture, tissueBinClasses );
+    means = mixture.Means;
+
+    std::cout << "EM-GMM clustering, " << iterations << " iterations" << std::endl;
+    std::cout << "Component\tMean\tSD\tPrior" << std::endl;
+    for (unsigned int i = 0; i < mixture.Means.size(); i++)
+      std::cout << i + 1 << "\t" << mixture.Means[i] << "\t" 
+		<< std::sqrt( mixture.Variances[i] ) << "\t" 
+		<< mixture.Priors[i] << std::endl;
+  }
+  else {
+    unsigned int iterations = 
+      PQCT_HistogramClustering::EstimateFuzzyCMeans( tissueHistogram, means );
+    PQCT_HistogramKMeans::ClassifyBins( tissueHistogram, means, tissueBinClasses );
+
+    std::cout << "Fuzzy c-means clustering, " << iterations << " iterations" << std::endl;
+  }
+
+  //! Bin to class table of the whole range, then one labeling pass.
+  std::vector<LabelPixelType> binClasses( histogram.Counts.size(), 0 );
+  double airSum = 0.0, airCount = 0.0;
+  for (size_t b = 0; b < histogram.Counts.size(); b++) {
+    long value = histogram.Minimum + (long) b;
+    if (value <= airThreshold) {
+      airSum += (double) histogram.Counts[b] * value;
+      airCount += (double) histogram.Counts[b];
+    }
+    else
+      binClasses[b] = (LabelPixelType) ( tissueBinClasses[ value - tissueHistogram.Minimum ] + 1 );
+  }
+  PQCT_HistogramClustering::LabelPixels( smoothedImage->GetBufferPointer(),
+					 clusterLabelImage->GetBufferPointer(),
+					 numberOfPixels, histogram, binClasses );
+
+  if (airCount > 0.0)
+    finalMeans[0] = airSum / airCount;
+  for (unsigned int i = 0; i < means.size(); i++)
+    finalMeans[i + 1] = means[i];
+}
+
+
 //! Identify bone marrow and add to label image.
 void PQCT_Analyzer::IdentifyBoneMarrow() {
 
   //! Apply thresholding to create a bone mask.
-  typedef itk::BinaryThresholdImageFilter<LabelImageType, 
-    LabelImageType> 
-    SelectBoneRegionFilterType;
-  SelectBoneRegionFilterType::Pointer boneRegionThresholdFilter = 
-    SelectBoneRegionFilterType::New();
-  boneRegionThresholdFilter->SetInput( this->m_KmeansLabelImage );
-  boneRegionThresholdFilter->SetInsideValue( 1 );
-  boneRegionThresholdFilter->SetOutsideValue( 0 );
-  boneRegionThresholdFilter->SetLowerThreshold( CORT_BONE );
-  boneRegionThresholdFilter->SetUpperThreshold( CORT_BONE );  // number of regions we want detected.
-  boneRegionThresholdFilter->Update();
-
-  typedef itk::ImageRegionIteratorWithIndex<LabelImageType> LabelImageIteratorType;
-  LabelImageIteratorType itImage2(this->m_TissueLabelImage, 
-				  this->m_TissueLabelImage->GetBufferedRegion());
-  LabelImageType::IndexType idx;
+  size_t numberOfPixels =
+    PQCT_LabelKernels::GetNumberOfPixels( this->m_TissueLabelImage.GetPointer() );
+  LabelImageType::Pointer boneMask =
+    PQCT_LabelKernels::CreateLabelImage( this->m_KmeansLabelImage.GetPointer() );
+  PQCT_LabelKernels::ThresholdToMask<LabelPixelType>( this->m_KmeansLabelImage->GetBufferPointer(),
+						      boneMask->GetBufferPointer(),
+						      numberOfPixels,
+						      CORT_BONE, CORT_BONE, 1, 0 );
 
   //! Label any fat inside the tibia and fibula
   //! by hole filling.
@@ -815,7 +991,7 @@ void PQCT_Analyzer::IdentifyBoneMarrow() {
 
   BinaryHoleFillingFilterType::Pointer binaryHoleFillingFilter =
     BinaryHoleFillingFilterType::New();
-  binaryHoleFillingFilter->SetInput( boneRegionThresholdFilter->GetOutput() );
+  binaryHoleFillingFilter->SetInput( boneMask );
   binaryHoleFillingFilter->Update();
    
   // itk::ImageFileWriter<LabelImageType>::Pointer labelWriter = 
@@ -825,12 +1001,18 @@ void PQCT_Analyzer::IdentifyBoneMarrow() {
   // labelWriter->Update();
   // labelWriter = 0;
 
-  for(itImage2.GoToBegin();!itImage2.IsAtEnd();++itImage2) {
-    idx = itImage2.GetIndex();
-    if( boneRegionThresholdFilter->GetOutput()->GetPixel(idx) == 0 &&
-	binaryHoleFillingFilter->GetOutput()->GetPixel(idx) != 0 )
-      itImage2.Set( BONE_INT );
-  }
+  //! Holes: filled, but not bone.
+  PQCT_LabelLUT boneClasses( 0 );
+  boneClasses.SetRange( 1, LABELLUTSIZE - 1, 1 );
+  PQCT_LabelLUT filledClasses( 0 );
+  filledClasses.SetRange( 1, LABELLUTSIZE - 1, 2 );
+  std::vector<PQCT_LabelLUT> classLUTs( 4 );
+  classLUTs[2] = PQCT_LabelLUT( BONE_INT );
+  PQCT_LabelKernels::RemapLabelsByMasks( this->m_TissueLabelImage->GetBufferPointer(),
+					 boneMask->GetBufferPointer(),
+					 binaryHoleFillingFilter->GetOutput()->GetBufferPointer(),
+					 numberOfPixels,
+					 boneClasses, filledClasses, classLUTs );
 
 
 }
@@ -839,67 +1021,46 @@ void PQCT_Analyzer::IdentifyBoneMarrow() {
 //! Identify tibia and fibula (remove fibula).
 void PQCT_Analyzer::IdentifyTibiaAndFibula() {
 
-  //! Apply thresholding to create a bone mask.
-  typedef itk::BinaryThresholdImageFilter<LabelImageType, 
-    LabelImageType> 
-    SelectBoneRegionFilterType;
-  SelectBoneRegionFilterType::Pointer boneRegionThresholdFilter = 
-    SelectBoneRegionFilterType::New();
-  boneRegionThresholdFilter->SetInput( this->m_TissueLabelImage );
-  boneRegionThresholdFilter->SetInsideValue( 1 );
-  boneRegionThresholdFilter->SetOutsideValue( 0 );
-  boneRegionThresholdFilter->SetLowerThreshold( CORT_BONE );
-  boneRegionThresholdFilter->SetUpperThreshold( BONE_INT );  // number of regions we want detected.
-  boneRegionThresholdFilter->Update();
-
-  //! Relabel and compute areas.
+  //! Label the connected components of the bone mask, ranked by size.
   //! The larger bone is tibia and the smaller is fibula.
-  //! Apply connected component labeling on bone.
-  typedef itk::ConnectedComponentImageFilter<LabelImageType, 
-    LabelImageType, 
-    LabelImageType> 
-    ConnectedComponentLabelFilterType;
-  ConnectedComponentLabelFilterType::Pointer labelMaskFilter2 = 
-    ConnectedComponentLabelFilterType::New();
-  labelMaskFilter2->SetInput( boneRegionThresholdFilter->GetOutput() );
-  labelMaskFilter2->SetMaskImage( boneRegionThresholdFilter->GetOutput() );
-  labelMaskFilter2->SetFullyConnected( true );
-  labelMaskFilter2->Update();
-
-  // Rank components wrt to size and relabel.
-  typedef itk::RelabelComponentImageFilter<LabelImageType, 
-    LabelImageType> 
-    RelabelFilterType;
-  RelabelFilterType::Pointer  sortLabelsImageFilter2 = 
-    RelabelFilterType::New();
-  sortLabelsImageFilter2->SetInput( labelMaskFilter2->GetOutput() );
-  sortLabelsImageFilter2->Update();
+  LabelImageType::Pointer boneComponents;
+  std::vector<PQCT_ComponentType> components;
+  {
+    PQCT_TraceScope traceScope( this->m_Tracer, TRACE_CCL );
+    boneComponents = 
+      PQCT_ConnectedComponents::Label( this->m_TissueLabelImage.GetPointer(),
+				       (LabelPixelType) CORT_BONE, (LabelPixelType) BONE_INT,
+				       components );
+  }
 
   // // Write image to check intermediate results.
   // itk::ImageFileWriter<LabelImageType>::Pointer labelWriter = 
   //   itk::ImageFileWriter<LabelImageType>::New();
-  // labelWriter->SetInput( sortLabelsImageFilter2->GetOutput() ); 
+  // labelWriter->SetInput( boneComponents ); 
   //   labelWriter->SetFileName( this->m_outputPath + "ConnectedComponents.nii" );
   // labelWriter->Update();
   // labelWriter = 0;
 
   //! Update tissue labels.
   //! Label tibia and fibula pixels.
-  typedef itk::ImageRegionIteratorWithIndex<LabelImageType> LabelImageIteratorType;
-  LabelImageIteratorType itImage2(this->m_TissueLabelImage, 
-				  this->m_TissueLabelImage->GetBufferedRegion());
-  LabelImageType::IndexType idx;
-  for(itImage2.GoToBegin();!itImage2.IsAtEnd();++itImage2) {
-    idx = itImage2.GetIndex();
-    if( sortLabelsImageFilter2->GetOutput()->GetPixel(idx) > 1 )
-      itImage2.Set( AIR );  // previously: FIBULA.
-  }
+  PQCT_LabelLUT componentClasses( 0 );
+  componentClasses.SetRange( 2, LABELLUTSIZE - 1, 1 );
+  std::vector<PQCT_LabelLUT> classLUTs( 2 );
+  classLUTs[1] = PQCT_LabelLUT( AIR );  // previously: FIBULA.
+  PQCT_LabelKernels::RemapLabelsByMask( this->m_TissueLabelImage->GetBufferPointer(),
+					boneComponents->GetBufferPointer(),
+					PQCT_LabelKernels::GetNumberOfPixels( this->m_TissueLabelImage.GetPointer() ),
+					componentClasses, classLUTs );
  
 }
 
 
 //! Log some header info useful for the study.
 void PQCT_Analyzer::LogHeaderInfo() {
+  //! Subject and site are stored in every metrics record instead.
+  if (this->m_MetricsAppender != NULL)
+    return;
+
   // Set floating point precision.
   std::cout.setf(std::ios::fixed, std::ios::floatfield);
   std::cout.precision(FLOAT_PRECISION);
@@ -964,7 +1125,11 @@ void PQCT_Analyzer::LogHeaderInfo() {
 
 
 //! Compute tissue areas, centroids, etc. 
-void  PQCT_Analyzer::ComputeTissueShapeAttributes(LabelImageType::Pointer labelImage) {
+void  PQCT_Analyzer::
+ComputeTissueShapeAttributes(LabelImageType::Pointer labelImage,
+			     TableEntries & shapeEntries,
+			     std::vector<PQCT_MetricsRecord> & metricsRecords) {
+  PQCT_TraceScope traceScope( this->m_Tracer, TRACE_LABEL_STATISTICS );
 
   // // Rank components wrt to size and relabel.
   // typedef itk::RelabelComponentImageFilter<LabelImageType, 
@@ -986,7 +1151,8 @@ void  PQCT_Analyzer::ComputeTissueShapeAttributes(LabelImageType::Pointer labelI
     LabelImageToShapeLabelMapFilterType;
   LabelImageToShapeLabelMapFilterType::Pointer labelImageToShapeLabelMapFilter = 
     LabelImageToShapeLabelMapFilterType::New();
-  labelImageToShapeLabelMapFilter->SetInput( labelImage );
+  //! Grafted input: label images may be measured by concurrent stages.
+  labelImageToShapeLabelMapFilter->SetInput( PQCT_GraftImage( labelImage.GetPointer() ) );
   labelImageToShapeLabelMapFilter->SetBackgroundValue( AIR );
   labelImageToShapeLabelMapFilter->Update();
 
@@ -1006,8 +1172,8 @@ void  PQCT_Analyzer::ComputeTissueShapeAttributes(LabelImageType::Pointer labelI
   // Set floating point precision.
   std::cout.setf(std::ios::fixed, std::ios::floatfield);
   std::cout.precision(FLOAT_PRECISION);
-  this->m_TissueShapeEntries.valueString.setf(std::ios::fixed, std::ios::floatfield);
-  this->m_TissueShapeEntries.valueString.precision(FLOAT_PRECISION);
+  shapeEntries.valueString.setf(std::ios::fixed, std::ios::floatfield);
+  shapeEntries.valueString.precision(FLOAT_PRECISION);
   
 
   // Display headers in standard output and write to text file.
@@ -1026,33 +1192,47 @@ void  PQCT_Analyzer::ComputeTissueShapeAttributes(LabelImageType::Pointer labelI
 		<< labelObject->GetPhysicalSize() << "\t\t" 
 		<< labelObject->GetCentroid() << std::endl;
 
-      this->m_TissueShapeEntries.headerString.width(STRING_LENGTH);
-      this->m_TissueShapeEntries.valueString.width(STRING_LENGTH);    
+      //! Typed record of this region.
+      PQCT_MetricsRecord record;
+      memset( &record, 0, sizeof(record) );
+      SetMetricsSubjectID( record, this->m_SubjectID );
+      record.Site = this->m_WorkflowID;
+      record.Label = label;
+      record.Area = labelObject->GetPhysicalSize();
+      record.PrincipalMoment1 = labelObject->GetPrincipalMoments()[0];
+      record.PrincipalMoment2 = labelObject->GetPrincipalMoments()[1];
+      record.EquivalentRadius = labelObject->GetEquivalentSphericalRadius();
+      metricsRecords.push_back( record );
+      if (this->m_MetricsAppender != NULL)
+	continue;
+
+      shapeEntries.headerString.width(STRING_LENGTH);
+      shapeEntries.valueString.width(STRING_LENGTH);    
       tempStringstream.str("");
       tempStringstream <<  label << "-" << TissueTypeString[label] << "[Area(mm^2)]";
-      this->m_TissueShapeEntries.headerString << tempStringstream.str();
-      this->m_TissueShapeEntries.valueString << labelObject->GetPhysicalSize();
+      shapeEntries.headerString << tempStringstream.str();
+      shapeEntries.valueString << labelObject->GetPhysicalSize();
 
-      this->m_TissueShapeEntries.headerString.width(STRING_LENGTH);
-      this->m_TissueShapeEntries.valueString.width(STRING_LENGTH);    
+      shapeEntries.headerString.width(STRING_LENGTH);
+      shapeEntries.valueString.width(STRING_LENGTH);    
       tempStringstream.str("");
       tempStringstream <<  label << "-" << TissueTypeString[label] << "[Princ.Mom.1]";
-      this->m_TissueShapeEntries.headerString << tempStringstream.str();
-      this->m_TissueShapeEntries.valueString << labelObject->GetPrincipalMoments()[0];
+      shapeEntries.headerString << tempStringstream.str();
+      shapeEntries.valueString << labelObject->GetPrincipalMoments()[0];
 
-      this->m_TissueShapeEntries.headerString.width(STRING_LENGTH);
-      this->m_TissueShapeEntries.valueString.width(STRING_LENGTH);    
+      shapeEntries.headerString.width(STRING_LENGTH);
+      shapeEntries.valueString.width(STRING_LENGTH);    
       tempStringstream.str("");
       tempStringstream <<  label << "-" << TissueTypeString[label] << "[Princ.Mom.2]";
-      this->m_TissueShapeEntries.headerString << tempStringstream.str();
-      this->m_TissueShapeEntries.valueString << labelObject->GetPrincipalMoments()[1];
+      shapeEntries.headerString << tempStringstream.str();
+      shapeEntries.valueString << labelObject->GetPrincipalMoments()[1];
 
-      this->m_TissueShapeEntries.headerString.width(STRING_LENGTH);
-      this->m_TissueShapeEntries.valueString.width(STRING_LENGTH);    
+      shapeEntries.headerString.width(STRING_LENGTH);
+      shapeEntries.valueString.width(STRING_LENGTH);    
       tempStringstream.str("");
       tempStringstream <<  label << "-" << TissueTypeString[label] << "[Eq.Radius]";
-      this->m_TissueShapeEntries.headerString << tempStringstream.str();
-      this->m_TissueShapeEntries.valueString << labelObject->GetEquivalentSphericalRadius();
+      shapeEntries.headerString << tempStringstream.str();
+      shapeEntries.valueString << labelObject->GetEquivalentSphericalRadius();
     }
 
   // Add end-of-line character.
@@ -1061,6 +1241,15 @@ void  PQCT_Analyzer::ComputeTissueShapeAttributes(LabelImageType::Pointer labelI
 }
 
 
+//! Shape attributes of the analyzer's results.
+void  PQCT_Analyzer::ComputeTissueShapeAttributes(LabelImageType::Pointer labelImage) {
+  this->m_MetricsPassStart = this->m_MetricsRecords.size();
+  this->ComputeTissueShapeAttributes( labelImage,
+				      this->m_TissueShapeEntries,
+				      this->m_MetricsRecords );
+}
+
+
 //! Overloaded version.
 void  PQCT_Analyzer::ComputeTissueShapeAttributes() {
   this->ComputeTissueShapeAttributes(this->m_TissueLabelImage);
@@ -1068,7 +1257,12 @@ void  PQCT_Analyzer::ComputeTissueShapeAttributes() {
 
 
 //! Compute tissue means, std. devs, etc 
-void  PQCT_Analyzer::ComputeTissueIntensityAttributes(LabelImageType::Pointer labelImage) {
+void  PQCT_Analyzer::
+ComputeTissueIntensityAttributes(LabelImageType::Pointer labelImage,
+				 TableEntries & intensityEntries,
+				 std::vector<PQCT_MetricsRecord> & metricsRecords,
+				 unsigned int metricsPassStart) {
+  PQCT_TraceScope traceScope( this->m_Tracer, TRACE_LABEL_STATISTICS );
 
   //! Use statistical label map objects for each tissue type.
   typedef unsigned long LabelType;
@@ -1081,8 +1275,9 @@ void  PQCT_Analyzer::ComputeTissueIntensityAttributes(LabelImageType::Pointer la
     LabelImageToStatisticsLabelMapFilterType;
   LabelImageToStatisticsLabelMapFilterType::Pointer labelImageToStatisticsLabelMapFilter = 
     LabelImageToStatisticsLabelMapFilterType::New();
-  labelImageToStatisticsLabelMapFilter->SetInput( labelImage );
-  labelImageToStatisticsLabelMapFilter->SetFeatureImage( this->m_PQCTImage );
+  //! Grafted inputs: images may be read by concurrent stages.
+  labelImageToStatisticsLabelMapFilter->SetInput( PQCT_GraftImage( labelImage.GetPointer() ) );
+  labelImageToStatisticsLabelMapFilter->SetFeatureImage( PQCT_GraftImage( this->m_PQCTImage.GetPointer() ) );
   labelImageToStatisticsLabelMapFilter->SetBackgroundValue( AIR );
   labelImageToStatisticsLabelMapFilter->Update();
 
@@ -1105,10 +1300,10 @@ void  PQCT_Analyzer::ComputeTissueIntensityAttributes(LabelImageType::Pointer la
   // Set floating point precision.
   std::cout.setf(std::ios::fixed, std::ios::floatfield);
   std::cout.precision(FLOAT_PRECISION);
-  this->m_TissueIntensityEntries.valueString.setf(std::ios::fixed, std::ios::floatfield);
-  this->m_TissueIntensityEntries.valueString.precision(FLOAT_PRECISION);
-  this->m_TissueIntensityEntries.headerString.width(STRING_LENGTH);
-  this->m_TissueIntensityEntries.valueString.width(STRING_LENGTH);    
+  intensityEntries.valueString.setf(std::ios::fixed, std::ios::floatfield);
+  intensityEntries.valueString.precision(FLOAT_PRECISION);
+  intensityEntries.headerString.width(STRING_LENGTH);
+  intensityEntries.valueString.width(STRING_LENGTH);    
 
   // for( it = labelObjectContainer.begin(); it != labelObjectContainer.end(); it++ )
   std::stringstream tempStringstream;
@@ -1123,20 +1318,30 @@ void  PQCT_Analyzer::ComputeTissueIntensityAttributes(LabelImageType::Pointer la
   		<< labelObject->GetMean() << "\t\t" 
 		<< labelObject->GetStandardDeviation() << std::endl;
 
+      //! Complete the record of this region from the shape pass.
+      for (unsigned int j = metricsPassStart; j < metricsRecords.size(); j++)
+	if (metricsRecords[j].Label == label) {
+	  metricsRecords[j].DensityMean = labelObject->GetMean();
+	  metricsRecords[j].DensitySD = labelObject->GetStandardDeviation();
+	  break;
+	}
+      if (this->m_MetricsAppender != NULL)
+	continue;
+
       tempStringstream.str("");
       tempStringstream <<  label << "-" << TissueTypeString[label] << "[Den.M.]";
-      this->m_TissueIntensityEntries.headerString.width(STRING_LENGTH);
-      this->m_TissueIntensityEntries.headerString << tempStringstream.str();
+      intensityEntries.headerString.width(STRING_LENGTH);
+      intensityEntries.headerString << tempStringstream.str();
 
       tempStringstream.str("");
       tempStringstream <<  label << "-" << TissueTypeString[label] << "[Den.SD.]";
-      this->m_TissueIntensityEntries.headerString.width(STRING_LENGTH);
-      this->m_TissueIntensityEntries.headerString << tempStringstream.str();
+      intensityEntries.headerString.width(STRING_LENGTH);
+      intensityEntries.headerString << tempStringstream.str();
 
-      this->m_TissueIntensityEntries.valueString.width(STRING_LENGTH); 
-      this->m_TissueIntensityEntries.valueString << labelObject->GetMean();
-      this->m_TissueIntensityEntries.valueString.width(STRING_LENGTH); 
-      this->m_TissueIntensityEntries.valueString << labelObject->GetStandardDeviation();
+      intensityEntries.valueString.width(STRING_LENGTH); 
+      intensityEntries.valueString << labelObject->GetMean();
+      intensityEntries.valueString.width(STRING_LENGTH); 
+      intensityEntries.valueString << labelObject->GetStandardDeviation();
 
     }
 
@@ -1146,9 +1351,106 @@ void  PQCT_Analyzer::ComputeTissueIntensityAttributes(LabelImageType::Pointer la
 }
 
 
+//! Intensity attributes of the analyzer's results; completes the
+//! records of the preceding shape pass.
+void  PQCT_Analyzer::ComputeTissueIntensityAttributes(LabelImageType::Pointer labelImage) {
+  this->ComputeTissueIntensityAttributes( labelImage,
+					  this->m_TissueIntensityEntries,
+					  this->m_MetricsRecords,
+					  this->m_MetricsPassStart );
+}
+
+
 //! Overloaded version.
 void  PQCT_Analyzer::ComputeTissueIntensityAttributes() {
   this->ComputeTissueIntensityAttributes(this->m_TissueLabelImage);
 }
 
 
+//! Shape and intensity attributes of a label image into stage results.
+void  PQCT_Analyzer::ComputeTissueAttributes(LabelImageType::Pointer labelImage,
+					     AttributeResultsType & results) {
+  this->ComputeTissueShapeAttributes( labelImage,
+				      results.ShapeEntries,
+				      results.MetricsRecords );
+  this->ComputeTissueIntensityAttributes( labelImage,
+					  results.IntensityEntries,
+					  results.MetricsRecords,
+					  0 );
+}
+
+
+//! Append stage results to the quantification of the image.
+void  PQCT_Analyzer::MergeTissueAttributes(const AttributeResultsType & results) {
+  std::string text;
+  text = results.ShapeEntries.headerString.str();
+  this->m_TissueShapeEntries.headerString.write( text.data(), text.size() );
+  text = results.ShapeEntries.valueString.str();
+  this->m_TissueShapeEntries.valueString.write( text.data(), text.size() );
+  text = results.IntensityEntries.headerString.str();
+  this->m_TissueIntensityEntries.headerString.write( text.data(), text.size() );
+  text = results.IntensityEntries.valueString.str();
+  this->m_TissueIntensityEntries.valueString.write( text.data(), text.size() );
+
+  this->m_MetricsPassStart = this->m_MetricsRecords.size();
+  this->m_MetricsRecords.insert( this->m_MetricsRecords.end(),
+				 results.MetricsRecords.begin(),
+				 results.MetricsRecords.end() );
+}
+
+
+//! Measure the segmented tissue label image.
+void PQCT_Analyzer::MeasureTissueLabels(MeasurementType & measurement) {
+  measurement.LabelImage = this->m_TissueLabelImage;
+  this->ComputeTissueAttributes( measurement.LabelImage, measurement.Results );
+}
+
+
+//! Measure a fraction of the bone area around its centroid.
+void PQCT_Analyzer::MeasureAreaFraction(MeasurementType & measurement) {
+  measurement.LabelImage = this->SelectAreaFraction( measurement.Label );
+  this->ComputeTissueAttributes( measurement.LabelImage, measurement.Results );
+}
+
+
+//! Foreground/background segmentation and computation of region attributes.
+void PQCT_Analyzer::MeasureTotalLeg(MeasurementType & measurement) {
+  measurement.LabelImage = 
+    // this->ForegroundBackgroundSegmentationByFastMarching();
+    this->ForegroundBackgroundSegmentationAfterKMeans();
+  this->ComputeTissueAttributes( measurement.LabelImage, measurement.Results );
+}
+
+
+//! Stages shared by the tissue workflows: K-means, then the site
+//! specific segmentation and its measurement, while the total leg is
+//! measured from the K-means labels. Entries are merged in the order
+//! of the sequential workflow.
+void PQCT_Analyzer::ExecuteTissueStages(void (PQCT_Analyzer::*segmentTissues)(),
+					MeasurementType & tissueMeasurement,
+					MeasurementType & totalLegMeasurement) {
+  typedef PQCT_MemberStage<PQCT_Analyzer> StageType;
+  typedef PQCT_MemberDataStage<PQCT_Analyzer, MeasurementType> MeasurementStageType;
+  PQCT_StageGraph stages;
+  stages.AddStage( "KMeans",
+		   new StageType( this, &PQCT_Analyzer::ApplyKMeans ),
+		   "", "KmeansLabels" );
+  stages.AddStage( "TissueSegmentation",
+		   new StageType( this, segmentTissues ),
+		   "KmeansLabels", "TissueLabels" );
+  stages.AddStage( "Tissues",
+		   new MeasurementStageType( this, &PQCT_Analyzer::MeasureTissueLabels,
+					     &tissueMeasurement ),
+		   "TissueLabels", "TissueMeasurement" );
+  stages.AddStage( "TotalLeg",
+		   new MeasurementStageType( this, &PQCT_Analyzer::MeasureTotalLeg,
+					     &totalLegMeasurement ),
+		   "KmeansLabels", "TotalLegMeasurement" );
+  stages.Execute();
+
+  this->LogHeaderInfo();
+  this->MergeTissueAttributes( tissueMeasurement.Results );
+  this->MergeTissueAttributes( totalLegMeasurement.Results );
+}
+
+
@@ -14,6 +14,17 @@ Author:    S. K. Makrogiannis
 #define __PQCT_Analysis_h__
 
 #include "PQCT_Datatypes.h"
+#include "PQCT_FileFormat.h"
+#include "PQCT_Calibration.h"
+#include "PQCT_LabelKernels.h"
+#include "PQCT_ConnectedComponents.h"
+#include "PQCT_HistogramKMeans.h"
+#include "PQCT_HistogramClustering.h"
+#include "PQCT_AsyncWriter.h"
+#include "PQCT_Metrics.h"
+#include "PQCT_DerivedImageCache.h"
+#include "PQCT_StageGraph.h"
+#include "PQCT_Tracer.h"
 
 
 //! Used for storing indices.
@@ -25,9 +36,33 @@ const T arr;
 };
 
 
+//! Quantification of one label image: text entries and typed records.
+//! Workflow stages fill their own results, which are merged in a fixed
+//! order afterwards.
+typedef struct t_AttributeResultsType
+{
+  TableEntries ShapeEntries;
+  TableEntries IntensityEntries;
+  std::vector<PQCT_MetricsRecord> MetricsRecords;
+}
+AttributeResultsType;
+
+//! One measurement of a workflow: the region image and its results.
+typedef struct t_MeasurementType
+{
+  LabelImageType::Pointer LabelImage;
+  int Label;
+  AttributeResultsType Results;
+}
+MeasurementType;
+
+
 //! Class implementing PQCT analysis.
 class PQCT_Analyzer {
 
+  //! Times the protected stages in isolation (PQCT_Benchmarks).
+  friend class PQCT_AnalyzerBenchmark;
+
  public:
 
   PQCT_Analyzer(){
@@ -46,8 +81,19 @@ class PQCT_Analyzer {
     this->SetParameterFilename("./PQCT_Analysis_Params.txt");
     //! Set default output path.
     this->SetOutputPath("./");
+    //! Write outputs synchronously unless an output stage is attached.
+    this->m_OutputWriter = NULL;
+    //! Per-subject text quantification unless a results file is attached.
+    this->m_MetricsAppender = NULL;
+    this->m_MetricsPassStart = 0;
+    this->m_KeepQuantification = false;
+    this->m_MemoryFootprint.PeakHeapBytes = 0;
+    this->m_MemoryFootprint.PeakImageBuffers = 0;
+    this->m_MemoryFootprint.PeakResidentSetSize = 0;
+    this->m_OutputPolicyIsSet = false;
     //! Set algorithm parameters.
     this->SetParameters();
+    this->m_ParameterValuesAreSet = false;
   };
 
   ~PQCT_Analyzer(){};
@@ -72,8 +118,52 @@ class PQCT_Analyzer {
   void SetQuantificationFilename(std::string quantificationFilename){
     this->m_QuantificationFilename = quantificationFilename;
   };
+  //! Hand label images and quantification files to a background writer.
+  //! The writer is not owned; call its Flush() before shutdown.
+  void SetOutputWriter(PQCT_AsyncWriter * outputWriter){
+    this->m_OutputWriter = outputWriter;
+  };
+  //! Append typed metrics to a cohort results file instead of writing a
+  //! fixed-width text file per subject. The appender is not owned.
+  void SetMetricsAppender(PQCT_MetricsAppender * metricsAppender){
+    this->m_MetricsAppender = metricsAppender;
+  };
+  //! Select which images are written. The policy is kept over the
+  //! OutputPolicy entry (or default) of parameters loaded later.
+  void SetOutputPolicy(OutputPolicyType outputPolicy){
+    this->m_OutputPolicyIsSet = true;
+    this->m_ExplicitOutputPolicy = outputPolicy;
+    this->m_parameterValues[OUTPUT_POLICY_PARAMETER] = outputPolicy;
+    this->m_OutputPolicy = outputPolicy;
+  };
+  //! Read a parameter file over the default values. Execute() then uses
+  //! these values instead of parsing the parameter file again.
+  int LoadParameterFile(const std::string & parameterFilename);
+  //! Use previously loaded parameter values (e.g. from a cache).
+  //! Throws on an unacceptable clustering method.
+  void SetParameterValues(const std::vector<float> & parameterValues);
+  const std::vector<float> & GetParameterValues() const {
+    return this->m_parameterValues;
+  };
+  //! Keep the quantification of Execute() in memory instead of writing
+  //! it, so that a session can emit one record for several sites.
+  void SetKeepQuantification(bool keepQuantification){
+    this->m_KeepQuantification = keepQuantification;
+  };
+  const std::string & GetQuantificationText() const {
+    return this->m_QuantificationText;
+  };
+  const std::vector<PQCT_MetricsRecord> & GetMetricsRecords() const {
+    return this->m_MetricsRecords;
+  };
 
-  void Execute();
+  int Execute();
+
+  //! Peak heap, image buffers and resident set of the last Execute().
+  //! Process-wide: exact when the analyzer ran alone.
+  const PQCT_MemoryFootprintType & GetMemoryFootprint() const {
+    return this->m_MemoryFootprint;
+  };
 
  protected:
   void SetParameters();
@@ -81,12 +171,25 @@ class PQCT_Analyzer {
     ParseSegmentationParameterFile( std::string paramsFilename, 
                                     bool debugFlag );
   void CopyParameterValuesToClassVariables();
+  static void CheckParameterValues(const std::vector<float> & parameterValues);
 
   void ReadpQCTImageHeader();
+  void CopyHeaderInformation(const PQCT_HeaderView & headerView);
+  void WriteIntermediateImage(PQCTImageType::Pointer image,
+			      const std::string & suffix,
+			      OutputPolicyType minimumPolicy);
+  void WriteIntermediateImage(LabelImageType::Pointer image,
+			      const std::string & suffix,
+			      OutputPolicyType minimumPolicy);
   void ReadPQCTImage();
   void CalibrateImage();
+  PQCTImageType::Pointer ImportCalibratedPQCTPixels(const char * pixelData);
   void AnonymizePQCTImage();
+  void BulkAnonymizePQCTImages();
+  void CatalogPQCTDirectory();
+  void CatalogDicomDirectory();
   int ReadDicomCTImage();
+  int ReadDicomCTSeries();
   std::string 
     RetrieveDicomTagValue(std::string tagkey, 
 			  itk::GDCMImageIO::Pointer gdcmImageIO);
@@ -94,9 +197,25 @@ class PQCT_Analyzer {
   void Analyze38PCT();
   void Analyze66PCT();
   void AnalyzeCTMidThigh();
+  void ExecuteTissueStages(void (PQCT_Analyzer::*segmentTissues)(),
+			   MeasurementType & tissueMeasurement,
+			   MeasurementType & totalLegMeasurement);
+  void Segment4PCTBone();
+  void Segment38PCTTissues();
+  void Segment66PCTTissues();
+  void SegmentCTMidThighTissues();
+  void MeasureTissueLabels(MeasurementType & measurement);
+  void MeasureAreaFraction(MeasurementType & measurement);
+  void MeasureTotalLeg(MeasurementType & measurement);
+  void AnalyzeCTMidThighSeries();
+  void ResetAnalysisState();
 
   FloatImageType::Pointer SmoothInputVolume( PQCTImageType::Pointer inputVolume,
 					     int denoisingMethod );
+  //! Cached derived images of m_PQCTImage.
+  FloatImageType::Pointer GetSmoothedImage( int denoisingMethod );
+  FloatImageType::Pointer GetGradientMagnitudeImage();
+  FloatImageType::Pointer GetSpeedImage( float alpha, float beta );
   LabelImageType::Pointer 
     ForegroundBackgroundSegmentationByFastMarching();
   LabelImageType::Pointer 
@@ -118,6 +237,7 @@ class PQCT_Analyzer {
     SelectAreaFraction( int label );
   LabelImageType::Pointer OverlayLabelImages(LabelImageType::Pointer image1,
 					     LabelImageType::Pointer image2);
+  LabelImageType::Pointer OverlayLabelImages(const std::vector<LabelImageType::Pointer> & images);
   LabelImageType::Pointer CreateOutputLabelImage();
   void CopyFinalLabelsinOriginalSpace(LabelImageType::Pointer labelImageInOriginalSpace);
 
@@ -133,19 +253,42 @@ class PQCT_Analyzer {
   void DilateSubcutaneousFatForPVECorrection();
   void Separate_Four_PCT_Tissues();
   void LogHeaderInfo();
+  void ComputeTissueShapeAttributes(LabelImageType::Pointer labelImage,
+				    TableEntries & shapeEntries,
+				    std::vector<PQCT_MetricsRecord> & metricsRecords);
   void ComputeTissueShapeAttributes(LabelImageType::Pointer labelImage);
   void ComputeTissueShapeAttributes();
+  void ComputeTissueIntensityAttributes(LabelImageType::Pointer labelImage,
+					TableEntries & intensityEntries,
+					std::vector<PQCT_MetricsRecord> & metricsRecords,
+					unsigned int metricsPassStart);
   void ComputeTissueIntensityAttributes(LabelImageType::Pointer labelImage);
   void ComputeTissueIntensityAttributes();
+  void ComputeTissueAttributes(LabelImageType::Pointer labelImage,
+			       AttributeResultsType & results);
+  void MergeTissueAttributes(const AttributeResultsType & results);
   void IdentifyBoneMarrow();
   void MapTissueClassesPostKMeans();
   void SetTissueClasses();
   void SetTissueClassesNoAir();
   void ApplyKMeans();
-  void WriteToTextFile();
+  void ApplyHistogramClustering(const FloatImageType * smoothedImage,
+				LabelImageType * clusterLabelImage,
+				std::vector<double> & finalMeans);
+  void WriteQuantification(const std::string & filename);
+  void AddProcessingStatistics(double startTime);
+  void WriteTrace();
+  void ExportMetricsToCSV();
+  void WriteLabelImage(LabelImageType::Pointer labelImage,
+		       const std::string & filename);
 
  private:
 
+  //! Convert attenuation units to density.
+  PQCTPixelType CalibratePixelValue(PQCTPixelType originalValue) const {
+    return this->m_CalibrationTable->Calibrate( originalValue );
+  };
+
  // String manipulations to separate the path from filename.
  std::string 
     ExtractDirectory( const std::string& path ) {
@@ -169,49 +312,6 @@ class PQCT_Analyzer {
       this->m_SubjectID = filename;
   }
 
-  // Image header containers.
-
-  typedef struct t_HeaderPrefixType
-  {
-    int HeaderVersion;
-    int HeaderLength;
-  } 
-  HeaderPrefixType;
-
-  typedef struct t_DetectorInformationType
-  {
-    int DetRecTypeLength;
-    double VoxelSize;
-    unsigned short NumberofSlices;
-    double SliceOrigin;
-    int ScanDate;
-  } 
-  DetectorInformationType;
-
-  typedef struct t_PatientInformationType
-  {
-    int PatInfoRecTypeLength;
-    unsigned short PatientGender;
-    unsigned short PatientEthnicGroup;
-    unsigned short PatientMeasurementNumber;
-    int PatientNumber;
-    int PatientBirthDate;
-    std::string PatientName;
-    std::string UserID;
-    std::string PatientID;
-  } 
-  PatientInformationType;
-
-  typedef struct t_ImageInformationType
-  {
-    int PicInfoRecLength;
-    unsigned short int PicX0;
-    unsigned short PicY0;
-    unsigned short MatrixSize[2];
-  } 
-  ImageInformationType;
-
-
   // Other variable-members of the class.
   unsigned short m_WorkflowID, m_SAT_IMFAT_SeparationAlgorithm;
   std::string m_PQCTImageFilename;
@@ -220,20 +320,38 @@ class PQCT_Analyzer {
   std::string m_SubjectID;
   std::vector<float> m_TissueClassesVector, m_TissueClassesVectorNoAir;
   TableEntries m_TissueIntensityEntries, m_TissueShapeEntries;
+  std::vector<PQCT_MetricsRecord> m_MetricsRecords;
+  unsigned int m_MetricsPassStart;
+  PQCT_MetricsAppender * m_MetricsAppender;
+  bool m_KeepQuantification;
+  std::string m_QuantificationText;
 
   // Image and text files.
   PQCTImageType::Pointer m_PQCTImage;
   LabelImageType::Pointer m_KmeansLabelImage;
   LabelImageType::Pointer m_TissueLabelImage;
-  std::ofstream m_textFile;
+  LabelImageType::Pointer m_LegOnlyMask;
+  std::vector<PQCTImageType::Pointer> m_CTSlices;
+  std::vector<double> m_CTSlicePositions;
+  PQCT_DerivedImageCache m_DerivedImages;
+  PQCT_AsyncWriter * m_OutputWriter;
+  PQCT_Tracer m_Tracer;
+  PQCT_MemoryFootprintType m_MemoryFootprint;
 
   // Algorithm parameters.
   std::vector<float> m_parameterValues;
   std::string m_parameterFilename, m_outputPath;
   int m_numberofParameters;
+  bool m_ParameterValuesAreSet;
   std::vector<std::string> m_parameterIDs;
   int m_plaqueSegmentationParamsIndex;
   float m_AUtoDensitySlope, m_AUtoDensityIntercept;
+  unsigned short m_OutputPolicy;
+  bool m_OutputPolicyIsSet;
+  OutputPolicyType m_ExplicitOutputPolicy;
+  unsigned short m_ClusteringMethod;
+  bool m_TraceOutput;
+  const PQCT_CalibrationTable * m_CalibrationTable;
   int m_medianFilterKernelLength;
   double m_gradientSigma;
   double m_fastmarchingStoppingTime;
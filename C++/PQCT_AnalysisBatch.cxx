@@ -0,0 +1,256 @@
+/*===========================================================================
+
+Program:   Bone, muscle and fat quantification from PQCT data.
+Module:    $RCSfile: PQCT_AnalysisBatch.cxx,v $
+Language:  C++
+Date:      $Date: 2012/08/27 10:00:00 $
+Version:   $Revision: 0.1 $
+Author:    S. K. Makrogiannis
+3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+=============================================================================*/
+
+#if defined(_MSC_VER)
+#pragma warning ( disable : 4786 )
+#endif
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+#include "PQCT_Analysis.h"
+#include "PQCT_Threading.h"
+
+
+//! One row of the subject manifest.
+typedef struct t_BatchEntryType
+{
+  std::string ImageFilename;
+  unsigned int WorkflowID;
+  std::string ParameterFilename;
+  int Status;
+  PQCT_MemoryFootprintType Footprint;
+}
+BatchEntryType;
+
+//! State shared by the analyzer pool.
+typedef struct t_BatchType
+{
+  std::vector<BatchEntryType> Entries;
+  std::string OutputPath;
+  PQCT_AsyncWriter * OutputWriter;
+  PQCT_MetricsAppender * MetricsAppender;
+  unsigned int FirstEntry;
+}
+BatchType;
+
+
+//! Read manifest rows: <image> <workflow> <parameter file>.
+//! Blank lines and lines starting with '#' are skipped.
+static void ReadBatchManifest(const std::string & manifestFilename,
+			      std::vector<BatchEntryType> & entries) {
+  std::ifstream manifestFile( manifestFilename.c_str() );
+  if ( !manifestFile )
+    throw "Cannot open batch manifest.";
+
+  std::string line;
+  unsigned int lineNumber = 0;
+  while ( std::getline( manifestFile, line ) ) {
+    lineNumber++;
+    std::istringstream lineStream( line );
+    BatchEntryType entry;
+    if ( !(lineStream >> entry.ImageFilename) || entry.ImageFilename[0] == '#' )
+      continue;
+    if ( !(lineStream >> entry.WorkflowID >> entry.ParameterFilename) ) {
+      std::cerr << "Skipping malformed manifest line " << lineNumber
+		<< std::endl;
+      continue;
+    }
+    entry.Status = EXIT_FAILURE;
+    entry.Footprint.PeakHeapBytes = 0;
+    entry.Footprint.PeakImageBuffers = 0;
+    entry.Footprint.PeakResidentSetSize = 0;
+    entries.push_back( entry );
+  }
+}
+
+
+//! Analyze one subject with its own analyzer; outputs go through the
+//! shared writer and results file.
+static void AnalyzeBatchEntry(unsigned int jobIndex, void * userData) {
+  BatchType * batch = static_cast<BatchType *>( userData );
+  BatchEntryType & entry = batch->Entries[batch->FirstEntry + jobIndex];
+
+  PQCT_Analyzer* ITK_Analyzer = new PQCT_Analyzer();
+  ITK_Analyzer->SetPQCTImageFilename( entry.ImageFilename );
+  ITK_Analyzer->SetParameterFilename( entry.ParameterFilename );
+  ITK_Analyzer->SetOutputPath( batch->OutputPath );
+  ITK_Analyzer->SetWorkflowID( (short)entry.WorkflowID );
+  ITK_Analyzer->SetOutputWriter( batch->OutputWriter );
+  ITK_Analyzer->SetMetricsAppender( batch->MetricsAppender );
+
+  try {
+    entry.Status = ITK_Analyzer->Execute();
+    entry.Footprint = ITK_Analyzer->GetMemoryFootprint();
+  }
+  catch(...) {
+    delete ITK_Analyzer;
+    throw;
+  }
+  delete ITK_Analyzer;
+}
+
+
+//! Number of analyzers whose measured footprint fits in 80% of the
+//! physical memory, at most one per processor. The heap peak is used
+//! when the allocation hooks are linked, the resident set otherwise.
+static unsigned int
+ComputeNumberOfAnalyzers(const PQCT_MemoryFootprintType & footprint,
+			 unsigned int numberOfProcessors) {
+  PQCT_MemorySizeType analyzerBytes = 
+    PQCT_MemoryMonitor::IsHeapAccountingEnabled() ?
+    footprint.PeakHeapBytes : footprint.PeakResidentSetSize;
+  PQCT_MemorySizeType availableBytes = 
+    PQCT_MemoryMonitor::GetPhysicalMemorySize() / 5 * 4;
+  if (analyzerBytes <= 0 || availableBytes <= 0)
+    return numberOfProcessors;
+
+  PQCT_MemorySizeType numberOfAnalyzers = availableBytes / analyzerBytes;
+  if (numberOfAnalyzers < 1)
+    numberOfAnalyzers = 1;
+  if (numberOfAnalyzers > numberOfProcessors)
+    numberOfAnalyzers = numberOfProcessors;
+  return (unsigned int) numberOfAnalyzers;
+}
+
+
+//! Batch routine: runs the subjects of a manifest on a pool of analyzers.
+
+int
+main( int argc, char ** argv )
+{
+  if (argc < 3) {
+    std::cerr << "Usage: "
+              << argv[0]
+              << " <manifest (pqct image, workflow, parameter filename per line)> <output path> [number of concurrent analyzers, 0 = from memory footprint] [cohort results file]"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  BatchType batch;
+  batch.OutputPath = (std::string) argv[2];
+  batch.OutputWriter = NULL;
+  batch.MetricsAppender = NULL;
+  batch.FirstEntry = 0;
+
+  try {
+    ReadBatchManifest( (std::string) argv[1], batch.Entries );
+  }
+  catch(const char * Message) {
+    std::cerr << "Error:" << Message << std::endl;
+    return EXIT_FAILURE;
+  }
+  if ( batch.Entries.empty() ) {
+    std::cerr << "No subjects in manifest." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  unsigned int numberOfProcessors =
+    itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+  unsigned int numberOfAnalyzers = numberOfProcessors;
+  bool sizeFromFootprint = false;
+  if (argc > 3) {
+    numberOfAnalyzers = (unsigned int) atoi(argv[3]);
+    sizeFromFootprint = ( numberOfAnalyzers == 0 );
+  }
+
+  PQCT_AsyncWriter outputWriter( 2 * ( sizeFromFootprint ? 
+				       numberOfProcessors : numberOfAnalyzers ) );
+  batch.OutputWriter = &outputWriter;
+  if (argc > 4) {
+    try {
+      batch.MetricsAppender = new PQCT_MetricsAppender( (std::string) argv[4] );
+    }
+    catch(const char * Message) {
+      std::cerr << "Error:" << Message << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  //! Analyze the first subject alone and fit as many analyzers of its
+  //! footprint as the memory allows. A subject that failed part way has
+  //! not shown its peak, so the batch then runs one analyzer at a time.
+  if (sizeFromFootprint) {
+    std::cout << "Measuring the memory footprint of the first subject." << std::endl;
+    PQCT_ParallelJobs::Run( 1, AnalyzeBatchEntry, &batch, 1 );
+    batch.FirstEntry = 1;
+    if (batch.Entries[0].Status == EXIT_SUCCESS) {
+      const PQCT_MemoryFootprintType & footprint = batch.Entries[0].Footprint;
+      numberOfAnalyzers = ComputeNumberOfAnalyzers( footprint, numberOfProcessors );
+      std::cout << "Peak heap " << footprint.PeakHeapBytes / (1024 * 1024) 
+		<< " MB, peak resident set " 
+		<< footprint.PeakResidentSetSize / (1024 * 1024) << " MB, "
+		<< footprint.PeakImageBuffers << " image buffers." << std::endl;
+    }
+    else {
+      numberOfAnalyzers = 1;
+      std::cout << "First subject failed; no footprint measured." << std::endl;
+    }
+  }
+  if (numberOfAnalyzers < 1)
+    numberOfAnalyzers = 1;
+
+  //! Split the processors between concurrent analyzers so that the
+  //! filters of each analyzer do not oversubscribe the machine.
+  unsigned int threadsPerAnalyzer = numberOfProcessors / numberOfAnalyzers;
+  if (threadsPerAnalyzer < 1)
+    threadsPerAnalyzer = 1;
+  itk::MultiThreader::SetGlobalDefaultNumberOfThreads( threadsPerAnalyzer );
+
+  std::cout << "Analyzing " << batch.Entries.size() - batch.FirstEntry 
+	    << " subjects with "
+	    << numberOfAnalyzers << " analyzers of "
+	    << threadsPerAnalyzer << " threads." << std::endl;
+
+  //! Failures are contained per subject: exceptions escaping an analyzer
+  //! are caught by the pool, other failures are reported by Execute().
+  PQCT_ParallelJobs::Run( batch.Entries.size() - batch.FirstEntry, 
+			  AnalyzeBatchEntry, &batch, numberOfAnalyzers );
+  unsigned int numberOfFailedWrites = outputWriter.Flush();
+  if (batch.MetricsAppender) {
+    batch.MetricsAppender->Flush();
+    delete batch.MetricsAppender;
+  }
+
+  //! Aggregate subject status.
+  std::string statusFilename = batch.OutputPath + "PQCT_Batch_Status.txt";
+  std::ostringstream statusStream;
+  unsigned int numberOfFailedSubjects = 0;
+  for (unsigned int i = 0; i < batch.Entries.size(); i++) {
+    const BatchEntryType & entry = batch.Entries[i];
+    if (entry.Status != EXIT_SUCCESS)
+      numberOfFailedSubjects++;
+    statusStream << entry.ImageFilename << "\t"
+		 << entry.WorkflowID << "\t"
+		 << ( entry.Status == EXIT_SUCCESS ? "OK" : "FAILED" )
+		 << std::endl;
+  }
+  try {
+    PQCT_AsyncWriter::WriteTextFileNow( statusFilename, statusStream.str() );
+  }
+  catch(const char * Message) {
+    std::cerr << "Error:" << Message << std::endl;
+  }
+
+  std::cout << batch.Entries.size() - numberOfFailedSubjects << " of "
+	    << batch.Entries.size() << " subjects analyzed, "
+	    << numberOfFailedSubjects << " failed, "
+	    << numberOfFailedWrites << " output writes failed." << std::endl;
+  std::cout << "Subject status written to " << statusFilename << std::endl;
+
+  return ( numberOfFailedSubjects == 0 && numberOfFailedWrites == 0 ) ?
+    EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,76 @@
+/*===========================================================================
+
+Program:   Bone, muscle and fat quantification from PQCT data.
+Module:    $RCSfile: PQCT_AnalysisDaemon.cxx,v $
+Language:  C++
+Date:      $Date: 2012/08/28 10:00:00 $
+Version:   $Revision: 0.1 $
+Author:    S. K. Makrogiannis
+3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+=============================================================================*/
+
+#include <cstdlib>
+#include <csignal>
+#include <string>
+#include <iostream>
+
+#include "PQCT_AnalysisServer.h"
+
+
+static PQCT_AnalysisServer * analysisServer = NULL;
+
+//! Stop on SIGINT/SIGTERM; running jobs are allowed to finish.
+static void HandleShutdownSignal(int) {
+  if (analysisServer)
+    analysisServer->RequestShutdown();
+}
+
+
+//! Daemon routine: keeps analyzers and parameter sets warm between jobs.
+
+int
+main( int argc, char ** argv )
+{
+  std::string socketFilename = "/tmp/PQCT_Analysis.sock";
+  if (argc > 1)
+    socketFilename = (std::string) argv[1];
+
+  //! One analyzer per processor unless given; filters of each analyzer
+  //! share the remaining processors.
+  unsigned int numberOfProcessors =
+    itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+  unsigned int numberOfAnalyzers = numberOfProcessors;
+  if (argc > 2)
+    numberOfAnalyzers = (unsigned int) atoi(argv[2]);
+  if (numberOfAnalyzers < 1) {
+    std::cerr << "Usage: "
+              << argv[0]
+              << " [socket filename] [number of concurrent analyzers]"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+  unsigned int threadsPerAnalyzer = numberOfProcessors / numberOfAnalyzers;
+  if (threadsPerAnalyzer < 1)
+    threadsPerAnalyzer = 1;
+  itk::MultiThreader::SetGlobalDefaultNumberOfThreads( threadsPerAnalyzer );
+
+  //! Clients that disconnect must not terminate the daemon.
+  signal( SIGPIPE, SIG_IGN );
+
+  int status = EXIT_SUCCESS;
+  analysisServer = new PQCT_AnalysisServer( socketFilename, numberOfAnalyzers );
+  signal( SIGINT, HandleShutdownSignal );
+  signal( SIGTERM, HandleShutdownSignal );
+  try {
+    analysisServer->Run();
+  }
+  catch(const char * Message) {
+    std::cerr << "Error:" << Message << std::endl;
+    status = EXIT_FAILURE;
+  }
+  delete analysisServer;
+  analysisServer = NULL;
+
+  return status;
+}
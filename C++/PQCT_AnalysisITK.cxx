@@ -47,7 +47,7 @@ main( int argc, char ** argv )
   if (argc < 4) {
     std::cerr << "Usage: " 
               << argv[0] 
-              << " <pqct image> <workflow {0,1,2,3,4} (4%, 38%, 66%, MID THIGH CT, Anonymize pQCT)> <parameter filename>"
+              << " <pqct image> <workflow {0,1,2,3,4,5,6,7,8} (4%, 38%, 66%, MID THIGH CT, Anonymize pQCT, Catalog pQCT directory, Anonymize pQCT file list, Catalog DICOM directory, Export metrics to CSV)> <parameter filename>"
               << std::endl; 
     return EXIT_FAILURE;
   }
@@ -62,9 +62,7 @@ main( int argc, char ** argv )
  //! Call intermediate wrapper that passes the arguments and 
   //! invokes image processing pipeline.
 
-  PQCT_AnalysisWrapperITK( pqctImageFilename,
-			   workflowID,
-			   parameterFilename );
-  
-  return EXIT_SUCCESS;
+  return PQCT_AnalysisWrapperITK( pqctImageFilename,
+				  workflowID,
+				  parameterFilename );
 }
@@ -0,0 +1,557 @@
+/*===========================================================================
+
+Program:   Bone, muscle and fat quantification from PQCT data.
+Module:    $RCSfile: PQCT_AnalysisServer.cxx,v $
+Language:  C++
+Date:      $Date: 2012/08/28 10:00:00 $
+Version:   $Revision: 0.1 $
+Author:    S. K. Makrogiannis
+3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+=============================================================================*/
+
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <exception>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <itksys/SystemTools.hxx>
+
+#include "PQCT_Analysis.h"
+#include "PQCT_Threading.h"
+#include "PQCT_AnalysisServer.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+
+//! Start the worker threads; the socket is opened by Run().
+PQCT_AnalysisServer::PQCT_AnalysisServer(const std::string & socketFilename,
+					 unsigned int numberOfAnalyzers) {
+  this->m_SocketFilename = socketFilename;
+  this->m_ListeningSocket = -1;
+  this->m_WakeupPipe[0] = this->m_WakeupPipe[1] = -1;
+  this->m_NumberOfAnalyzers = (numberOfAnalyzers > 0) ? numberOfAnalyzers : 1;
+  this->m_ShutdownRequested = 0;
+  this->m_NextConnectionID = 1;
+  this->m_NextJobID = 1;
+  this->m_NumberOfRunningJobs = 0;
+  this->m_StopWorkers = false;
+  this->m_QueueNotEmpty = itk::ConditionVariable::New();
+
+  this->m_Threader = itk::MultiThreader::New();
+  for (unsigned int i = 0; i < this->m_NumberOfAnalyzers; i++)
+    this->m_WorkerThreadIDs.push_back(
+      this->m_Threader->SpawnThread( WorkerThreadCallback, this ) );
+}
+
+
+//! Cancel queued jobs, let running jobs finish and join the workers.
+PQCT_AnalysisServer::~PQCT_AnalysisServer() {
+  std::vector<AnalysisJobType *> cancelledJobs;
+  this->m_Lock.Lock();
+  this->m_StopWorkers = true;
+  std::set<AnalysisJobType *, JobOrderType>::iterator it;
+  for (it = this->m_Queue.begin(); it != this->m_Queue.end(); ++it) {
+    this->m_Jobs.erase( (*it)->JobID );
+    cancelledJobs.push_back( *it );
+  }
+  this->m_Queue.clear();
+  this->m_QueueNotEmpty->Broadcast();
+  this->m_Lock.Unlock();
+
+  for (unsigned int i = 0; i < cancelledJobs.size(); i++) {
+    std::ostringstream message;
+    message << "CANCELLED " << cancelledJobs[i]->JobID;
+    this->SendMessage( cancelledJobs[i]->ConnectionID, message.str() );
+    delete cancelledJobs[i];
+  }
+
+  for (unsigned int i = 0; i < this->m_WorkerThreadIDs.size(); i++)
+    this->m_Threader->TerminateThread( this->m_WorkerThreadIDs[i] );
+
+  //! Last replies are sent if the clients can take them now.
+  std::map<unsigned long, ConnectionType>::iterator connection;
+  for (connection = this->m_Connections.begin();
+       connection != this->m_Connections.end(); ++connection) {
+    this->FlushConnection( connection->first );
+    close( connection->second.Socket );
+  }
+  for (unsigned int i = 0; i < 2; i++)
+    if (this->m_WakeupPipe[i] >= 0)
+      close( this->m_WakeupPipe[i] );
+  if (this->m_ListeningSocket >= 0) {
+    close( this->m_ListeningSocket );
+    unlink( this->m_SocketFilename.c_str() );
+  }
+}
+
+
+void PQCT_AnalysisServer::RequestShutdown() {
+  PQCT_AtomicStore( &this->m_ShutdownRequested, 1 );
+}
+
+
+//! Bind the socket for the server user only. A stale socket left by a
+//! previous run is replaced; a live server or any other file is not.
+void PQCT_AnalysisServer::OpenListeningSocket() {
+  struct sockaddr_un address;
+  if ( this->m_SocketFilename.size() >= sizeof(address.sun_path) )
+    throw "Socket filename is too long.";
+  memset( &address, 0, sizeof(address) );
+  address.sun_family = AF_UNIX;
+  strcpy( address.sun_path, this->m_SocketFilename.c_str() );
+
+  struct stat fileStatus;
+  if ( lstat( this->m_SocketFilename.c_str(), &fileStatus ) == 0 ) {
+    if ( !S_ISSOCK( fileStatus.st_mode ) )
+      throw "Socket filename exists and is not a socket.";
+    int probeSocket = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if (probeSocket < 0)
+      throw "Cannot create socket.";
+    bool live = ( connect( probeSocket, (struct sockaddr *) &address,
+			   sizeof(address) ) == 0 || errno != ECONNREFUSED );
+    close( probeSocket );
+    if (live)
+      throw "Another server is listening on the socket.";
+    unlink( this->m_SocketFilename.c_str() );
+  }
+
+  this->m_ListeningSocket = socket( AF_UNIX, SOCK_STREAM, 0 );
+  if (this->m_ListeningSocket < 0)
+    throw "Cannot create socket.";
+
+  //! Created as 0600: clients run jobs with the rights of the server.
+  mode_t previousMask = umask( 0177 );
+  int bound = bind( this->m_ListeningSocket, (struct sockaddr *) &address,
+		    sizeof(address) );
+  umask( previousMask );
+  if ( bound != 0 ||
+       chmod( this->m_SocketFilename.c_str(), S_IRUSR | S_IWUSR ) != 0 ||
+       listen( this->m_ListeningSocket, 16 ) != 0 )
+    throw "Cannot bind socket.";
+
+  if ( pipe( this->m_WakeupPipe ) != 0 )
+    throw "Cannot create wakeup pipe.";
+  for (unsigned int i = 0; i < 2; i++)
+    fcntl( this->m_WakeupPipe[i], F_SETFL,
+	   fcntl( this->m_WakeupPipe[i], F_GETFL ) | O_NONBLOCK );
+}
+
+
+//! Server loop: accept connections and read commands.
+void PQCT_AnalysisServer::Run() {
+  this->OpenListeningSocket();
+  std::cout << "Listening on " << this->m_SocketFilename << " with "
+	    << this->m_NumberOfAnalyzers << " analyzers." << std::endl;
+
+  std::vector<struct pollfd> pollSockets;
+  std::vector<unsigned long> pollConnections;
+  while ( !PQCT_AtomicLoad( &this->m_ShutdownRequested ) ) {
+    pollSockets.clear();
+    pollConnections.clear();
+    struct pollfd listening = { this->m_ListeningSocket, POLLIN, 0 };
+    pollSockets.push_back( listening );
+    struct pollfd wakeup = { this->m_WakeupPipe[0], POLLIN, 0 };
+    pollSockets.push_back( wakeup );
+    {
+      itk::MutexLockHolder<itk::SimpleFastMutexLock> holder( this->m_SendLock );
+      std::map<unsigned long, ConnectionType>::iterator it;
+      for (it = this->m_Connections.begin(); it != this->m_Connections.end(); ++it) {
+	struct pollfd connection = { it->second.Socket, POLLIN, 0 };
+	std::map<unsigned long, OutputType>::iterator output =
+	  this->m_Outputs.find( it->first );
+	if ( output != this->m_Outputs.end() && !output->second.Buffer.empty() )
+	  connection.events |= POLLOUT;
+	pollSockets.push_back( connection );
+	pollConnections.push_back( it->first );
+      }
+    }
+
+    //! Wake up periodically to notice shutdown requests from signals.
+    int ready = poll( &pollSockets[0], pollSockets.size(), 500 );
+    if (ready < 0 && errno != EINTR)
+      throw "Cannot poll sockets.";
+    if (ready <= 0)
+      continue;
+
+    if (pollSockets[1].revents & POLLIN) {
+      char buffer[256];
+      while ( read( this->m_WakeupPipe[0], buffer, sizeof(buffer) ) > 0 )
+	;
+    }
+    for (unsigned int i = 0; i < pollConnections.size(); i++) {
+      short events = pollSockets[i + 2].revents;
+      if (events & POLLOUT)
+	this->FlushConnection( pollConnections[i] );
+      if (events & (POLLIN | POLLHUP | POLLERR))
+	if ( !this->ReadConnection( pollConnections[i] ) )
+	  this->CloseConnection( pollConnections[i] );
+    }
+    if (pollSockets[0].revents & POLLIN)
+      this->AcceptConnection();
+  }
+  std::cout << "Shutting down." << std::endl;
+}
+
+
+void PQCT_AnalysisServer::AcceptConnection() {
+  int clientSocket = accept( this->m_ListeningSocket, NULL, NULL );
+  if (clientSocket < 0)
+    return;
+
+  //! Replies must never block the server loop or a worker.
+  fcntl( clientSocket, F_SETFL, fcntl( clientSocket, F_GETFL ) | O_NONBLOCK );
+
+  unsigned long connectionID = this->m_NextConnectionID++;
+  ConnectionType connection;
+  connection.Socket = clientSocket;
+  OutputType output;
+  output.Socket = clientSocket;
+
+  itk::MutexLockHolder<itk::SimpleFastMutexLock> holder( this->m_SendLock );
+  this->m_Connections[connectionID] = connection;
+  this->m_Outputs[connectionID] = output;
+}
+
+
+//! Read available input and run complete command lines.
+//! Returns false when the client has closed the connection.
+bool PQCT_AnalysisServer::ReadConnection(unsigned long connectionID) {
+  ConnectionType & connection = this->m_Connections[connectionID];
+  char buffer[4096];
+  ssize_t length = recv( connection.Socket, buffer, sizeof(buffer), 0 );
+  if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    return true;
+  if (length <= 0)
+    return false;
+
+  connection.InputBuffer.append( buffer, length );
+  std::string::size_type end;
+  while ( (end = connection.InputBuffer.find( '\n' )) != std::string::npos ) {
+    std::string command = connection.InputBuffer.substr( 0, end );
+    connection.InputBuffer.erase( 0, end + 1 );
+    this->ProcessCommand( connectionID, command );
+  }
+  return true;
+}
+
+
+//! Jobs of a closed connection still run; their replies are dropped.
+void PQCT_AnalysisServer::CloseConnection(unsigned long connectionID) {
+  itk::MutexLockHolder<itk::SimpleFastMutexLock> holder( this->m_SendLock );
+  this->m_Outputs.erase( connectionID );
+  close( this->m_Connections[connectionID].Socket );
+  this->m_Connections.erase( connectionID );
+}
+
+
+void PQCT_AnalysisServer::ProcessCommand(unsigned long connectionID,
+					 const std::string & command) {
+  std::istringstream arguments( command );
+  std::string keyword;
+  if ( !(arguments >> keyword) )
+    return;
+
+  if (keyword == "SUBMIT")
+    this->SubmitJob( connectionID, command );
+  else if (keyword == "CANCEL") {
+    unsigned long jobID;
+    if (arguments >> jobID)
+      this->CancelJob( connectionID, jobID );
+    else
+      this->SendMessage( connectionID, "ERROR Missing job id" );
+  }
+  else if (keyword == "STATUS") {
+    std::ostringstream message;
+    this->m_Lock.Lock();
+    message << "STATUS " << this->m_Queue.size() << " "
+	    << this->m_NumberOfRunningJobs;
+    this->m_Lock.Unlock();
+    this->SendMessage( connectionID, message.str() );
+  }
+  else if (keyword == "SHUTDOWN")
+    this->RequestShutdown();
+  else
+    this->SendMessage( connectionID, "ERROR Unknown command " + keyword );
+}
+
+
+//! Queue a job. Tab-separated fields:
+//! SUBMIT <priority> <workflow> <image> <parameter file> [output path].
+void PQCT_AnalysisServer::SubmitJob(unsigned long connectionID,
+				    const std::string & command) {
+  std::vector<std::string> fields;
+  std::string::size_type start = 0, end;
+  while ( (end = command.find( '\t', start )) != std::string::npos ) {
+    fields.push_back( command.substr( start, end - start ) );
+    start = end + 1;
+  }
+  fields.push_back( command.substr( start ) );
+  if (fields.size() > 5 && fields[5].empty())
+    fields.pop_back();
+
+  AnalysisJobType * job = new AnalysisJobType;
+  std::istringstream priority( fields.size() > 1 ? fields[1] : "" );
+  std::istringstream workflow( fields.size() > 2 ? fields[2] : "" );
+  if ( fields.size() < 5 || fields.size() > 6 ||
+       !(priority >> job->Priority) || !(workflow >> job->WorkflowID) ||
+       fields[3].empty() || fields[4].empty() ) {
+    delete job;
+    this->SendMessage( connectionID, "ERROR Malformed SUBMIT" );
+    return;
+  }
+  job->ImageFilename = fields[3];
+  job->ParameterFilename = fields[4];
+  job->OutputPath = ( fields.size() > 5 ) ? fields[5] : "./";
+  job->ConnectionID = connectionID;
+
+  //! Reply before the job is queued, so that no worker can report it
+  //! as started first, and without holding the queue lock.
+  std::ostringstream message;
+  this->m_Lock.Lock();
+  job->JobID = this->m_NextJobID++;
+  this->m_Lock.Unlock();
+  message << "QUEUED " << job->JobID;
+  this->SendMessage( connectionID, message.str() );
+
+  this->m_Lock.Lock();
+  this->m_Jobs[job->JobID] = job;
+  this->m_Queue.insert( job );
+  this->m_QueueNotEmpty->Signal();
+  this->m_Lock.Unlock();
+}
+
+
+void PQCT_AnalysisServer::CancelJob(unsigned long connectionID,
+				    unsigned long jobID) {
+  std::ostringstream message;
+  this->m_Lock.Lock();
+  std::map<unsigned long, AnalysisJobType *>::iterator it = this->m_Jobs.find( jobID );
+  if (it == this->m_Jobs.end()) {
+    this->m_Lock.Unlock();
+    message << "ERROR Unknown job " << jobID;
+    this->SendMessage( connectionID, message.str() );
+    return;
+  }
+
+  AnalysisJobType * job = it->second;
+  if ( this->m_Queue.erase( job ) > 0 ) {
+    //! Not started yet: remove it now.
+    this->m_Jobs.erase( it );
+    this->m_Lock.Unlock();
+    message << "CANCELLED " << jobID;
+    this->SendMessage( job->ConnectionID, message.str() );
+    if (connectionID != job->ConnectionID)
+      this->SendMessage( connectionID, message.str() );
+    delete job;
+    return;
+  }
+
+  //! Running: the analysis cannot be interrupted.
+  this->m_Lock.Unlock();
+  message << "ERROR Job " << jobID << " is running";
+  this->SendMessage( connectionID, message.str() );
+}
+
+
+//! Queue one reply line, unless the client has gone away, and send what
+//! the socket takes now; the server loop sends the rest. A client with
+//! too much pending output is shut down, and closed by the server loop.
+void PQCT_AnalysisServer::SendMessage(unsigned long connectionID,
+				      const std::string & message) {
+  bool pending = false;
+  {
+    itk::MutexLockHolder<itk::SimpleFastMutexLock> holder( this->m_SendLock );
+    std::map<unsigned long, OutputType>::iterator it =
+      this->m_Outputs.find( connectionID );
+    if (it == this->m_Outputs.end())
+      return;
+
+    OutputType & output = it->second;
+    output.Buffer += message;
+    output.Buffer += '\n';
+    if ( !this->FlushOutput( output ) ||
+	 output.Buffer.size() > SERVEROUTPUTBUFFERSIZE ) {
+      shutdown( output.Socket, SHUT_RDWR );
+      this->m_Outputs.erase( it );
+      return;
+    }
+    pending = !output.Buffer.empty();
+  }
+
+  //! Have the server loop wait for the socket to take more.
+  if (pending && this->m_WakeupPipe[1] >= 0) {
+    char wakeup = 0;
+    if (write( this->m_WakeupPipe[1], &wakeup, 1 ) < 0) {
+      //! Full: the server loop is already due to wake up.
+    }
+  }
+}
+
+
+//! Send pending output without blocking; called with m_SendLock held.
+//! Returns false if the connection failed.
+bool PQCT_AnalysisServer::FlushOutput(OutputType & output) {
+  size_t sent = 0;
+  while (sent < output.Buffer.size()) {
+    ssize_t length = send( output.Socket, output.Buffer.data() + sent,
+			   output.Buffer.size() - sent, MSG_NOSIGNAL );
+    if (length < 0 && errno == EINTR)
+      continue;
+    if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break;
+    if (length <= 0)
+      return false;
+    sent += length;
+  }
+  output.Buffer.erase( 0, sent );
+  return true;
+}
+
+
+//! Send the pending output of a connection that the socket takes now.
+void PQCT_AnalysisServer::FlushConnection(unsigned long connectionID) {
+  itk::MutexLockHolder<itk::SimpleFastMutexLock> holder( this->m_SendLock );
+  std::map<unsigned long, OutputType>::iterator it =
+    this->m_Outputs.find( connectionID );
+  if (it == this->m_Outputs.end())
+    return;
+  if ( !this->FlushOutput( it->second ) ) {
+    shutdown( it->second.Socket, SHUT_RDWR );
+    this->m_Outputs.erase( it );
+  }
+}
+
+
+ITK_THREAD_RETURN_TYPE PQCT_AnalysisServer::WorkerThreadCallback(void * arg) {
+  itk::MultiThreader::ThreadInfoStruct * threadInfo =
+    static_cast<itk::MultiThreader::ThreadInfoStruct *>( arg );
+  PQCT_AnalysisServer * server =
+    static_cast<PQCT_AnalysisServer *>( threadInfo->UserData );
+  server->ProcessJobs();
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+
+//! Wait for the next job; returns NULL when the workers are stopped.
+PQCT_AnalysisServer::AnalysisJobType * PQCT_AnalysisServer::TakeNextJob() {
+  this->m_Lock.Lock();
+  while (this->m_Queue.empty() && !this->m_StopWorkers)
+    this->m_QueueNotEmpty->Wait( &this->m_Lock );
+  if (this->m_StopWorkers) {
+    this->m_Lock.Unlock();
+    return NULL;
+  }
+
+  AnalysisJobType * job = *this->m_Queue.begin();
+  this->m_Queue.erase( this->m_Queue.begin() );
+  this->m_NumberOfRunningJobs++;
+  this->m_Lock.Unlock();
+  return job;
+}
+
+
+//! Worker: run jobs on one analyzer that is kept for the life of the thread.
+void PQCT_AnalysisServer::ProcessJobs() {
+  PQCT_Analyzer* ITK_Analyzer = new PQCT_Analyzer();
+
+  AnalysisJobType * job;
+  while ( (job = this->TakeNextJob()) != NULL ) {
+    std::ostringstream message;
+    message << "STARTED " << job->JobID;
+    this->SendMessage( job->ConnectionID, message.str() );
+
+    int status = EXIT_FAILURE;
+    try {
+      std::vector<float> parameterValues;
+      if ( this->GetParameterValues( job->ParameterFilename, parameterValues ) ) {
+	ITK_Analyzer->SetParameterValues( parameterValues );
+	ITK_Analyzer->SetPQCTImageFilename( job->ImageFilename );
+	ITK_Analyzer->SetParameterFilename( job->ParameterFilename );
+	ITK_Analyzer->SetOutputPath( job->OutputPath );
+	ITK_Analyzer->SetWorkflowID( (short)job->WorkflowID );
+	status = ITK_Analyzer->Execute();
+      }
+    }
+    catch(const char * Message) {
+      std::cerr << "Error in job " << job->JobID << ": " << Message << std::endl;
+    }
+    catch(std::exception & e) {
+      std::cerr << "Exception in job " << job->JobID << ": " << e.what() << std::endl;
+    }
+
+    this->m_Lock.Lock();
+    this->m_Jobs.erase( job->JobID );
+    this->m_NumberOfRunningJobs--;
+    this->m_Lock.Unlock();
+
+    //! Stream the metrics rows, then the status.
+    if (status == EXIT_SUCCESS) {
+      const unsigned int numberOfTissueTypes = 
+	sizeof(TissueTypeString) / sizeof(TissueTypeString[0]);
+      const std::vector<PQCT_MetricsRecord> & records = ITK_Analyzer->GetMetricsRecords();
+      for (unsigned int i = 0; i < records.size(); i++) {
+	const PQCT_MetricsRecord & record = records[i];
+	message.str("");
+	message << "RESULT " << job->JobID << " "
+		<< (unsigned int) record.Label << '\t'
+		<< (record.Label < numberOfTissueTypes ? TissueTypeString[record.Label] : "UNKNOWN") << '\t'
+		<< record.Area << '\t'
+		<< record.PrincipalMoment1 << '\t'
+		<< record.PrincipalMoment2 << '\t'
+		<< record.EquivalentRadius << '\t'
+		<< record.DensityMean << '\t'
+		<< record.DensitySD;
+	this->SendMessage( job->ConnectionID, message.str() );
+      }
+    }
+
+    message.str("");
+    message << "DONE " << job->JobID << " "
+	    << ( status == EXIT_SUCCESS ? "OK" : "FAILED" );
+    this->SendMessage( job->ConnectionID, message.str() );
+    delete job;
+  }
+
+  delete ITK_Analyzer;
+}
+
+
+//! Look up parameter values, parsing the file on first use or when it
+//! has been modified. Returns false if the file cannot be read.
+bool PQCT_AnalysisServer::GetParameterValues(const std::string & parameterFilename,
+					     std::vector<float> & parameterValues) {
+  long modificationTime = itksys::SystemTools::ModifiedTime( parameterFilename );
+  {
+    itk::MutexLockHolder<itk::SimpleFastMutexLock> holder( this->m_ParameterCacheLock );
+    std::map<std::string, ParameterSetType>::iterator it =
+      this->m_ParameterCache.find( parameterFilename );
+    if (it != this->m_ParameterCache.end() &&
+	it->second.ModificationTime == modificationTime) {
+      parameterValues = it->second.Values;
+      return true;
+    }
+  }
+
+  //! Parse outside the lock; a concurrent miss parses the same file twice.
+  PQCT_Analyzer parameterReader;
+  if ( parameterReader.LoadParameterFile( parameterFilename ) == EXIT_FAILURE )
+    return false;
+  parameterValues = parameterReader.GetParameterValues();
+
+  ParameterSetType parameterSet;
+  parameterSet.ModificationTime = modificationTime;
+  parameterSet.Values = parameterValues;
+  itk::MutexLockHolder<itk::SimpleFastMutexLock> holder( this->m_ParameterCacheLock );
+  this->m_ParameterCache[parameterFilename] = parameterSet;
+  return true;
+}
@@ -0,0 +1,166 @@
+/*===========================================================================
+
+Program:   Bone, muscle and fat quantification from PQCT data.
+Module:    $RCSfile: PQCT_AnalysisServer.h,v $
+Language:  C++
+Date:      $Date: 2012/08/28 10:00:00 $
+Version:   $Revision: 0.1 $
+Author:    S. K. Makrogiannis
+3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+=============================================================================*/
+
+#ifndef __PQCT_AnalysisServer_h__
+#define __PQCT_AnalysisServer_h__
+
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <sstream>
+
+#include <itkMultiThreader.h>
+#include <itkSimpleMutexLock.h>
+#include <itkSimpleFastMutexLock.h>
+#include <itkConditionVariable.h>
+
+//! Largest reply backlog of a client before it is disconnected (bytes).
+#define SERVEROUTPUTBUFFERSIZE (1 << 20)
+
+//! Long-running analysis service on a Unix domain socket.
+//! A fixed set of worker threads, each holding a reusable analyzer, takes
+//! jobs from a priority queue. Parameter files are parsed once and cached
+//! until they are modified. Clients send one command per line; SUBMIT
+//! fields are separated by tabs, so that paths may contain spaces:
+//!
+//!   SUBMIT<tab><priority><tab><workflow><tab><image><tab><parameter file>[<tab><output path>]
+//!   CANCEL <job id>
+//!   STATUS
+//!   SHUTDOWN
+//!
+//! and receive one reply per line on the same connection:
+//!
+//!   QUEUED <job id>, STARTED <job id>,
+//!   RESULT <job id> <tab-separated metrics of one tissue region>,
+//!   DONE <job id> OK|FAILED, CANCELLED <job id>,
+//!   STATUS <queued> <running>, ERROR <message>
+//!
+//! Higher priorities run first; equal priorities run in submission order.
+//! Only queued jobs can be cancelled; a running job is answered with
+//! ERROR, and jobs still queued at shutdown with CANCELLED. Replies are
+//! buffered per client and sent without blocking; a client that stops
+//! reading is disconnected once SERVEROUTPUTBUFFERSIZE bytes are
+//! pending, without holding up the other clients. The socket is accessible to the server user only, and the
+//! server refuses to start while another server listens on it.
+class PQCT_AnalysisServer {
+
+ public:
+  PQCT_AnalysisServer(const std::string & socketFilename,
+		      unsigned int numberOfAnalyzers);
+  ~PQCT_AnalysisServer();
+
+  //! Serve clients until SHUTDOWN or RequestShutdown(); throws if the
+  //! socket cannot be created.
+  void Run();
+
+  //! Stop serving. Safe to call from a signal handler.
+  void RequestShutdown();
+
+ private:
+  PQCT_AnalysisServer(const PQCT_AnalysisServer &);  // Not implemented.
+  void operator=(const PQCT_AnalysisServer &);       // Not implemented.
+
+  //! One submitted analysis.
+  typedef struct t_AnalysisJobType
+  {
+    unsigned long JobID;
+    int Priority;
+    unsigned int WorkflowID;
+    std::string ImageFilename;
+    std::string ParameterFilename;
+    std::string OutputPath;
+    unsigned long ConnectionID;
+  }
+  AnalysisJobType;
+
+  //! Queue order: higher priority first, then submission order.
+  struct JobOrderType {
+    bool operator()(const AnalysisJobType * a, const AnalysisJobType * b) const {
+      if (a->Priority != b->Priority)
+	return a->Priority > b->Priority;
+      return a->JobID < b->JobID;
+    }
+  };
+
+  //! Parameter values of a file and its modification time.
+  typedef struct t_ParameterSetType
+  {
+    long ModificationTime;
+    std::vector<float> Values;
+  }
+  ParameterSetType;
+
+  //! Input state of a client connection, used by the server loop only.
+  typedef struct t_ConnectionType
+  {
+    int Socket;
+    std::string InputBuffer;
+  }
+  ConnectionType;
+
+  //! Output state of a client connection, shared with the workers.
+  typedef struct t_OutputType
+  {
+    int Socket;
+    std::string Buffer;
+  }
+  OutputType;
+
+  void OpenListeningSocket();
+  void AcceptConnection();
+  bool ReadConnection(unsigned long connectionID);
+  void CloseConnection(unsigned long connectionID);
+  void ProcessCommand(unsigned long connectionID, const std::string & command);
+  void SubmitJob(unsigned long connectionID, const std::string & command);
+  void CancelJob(unsigned long connectionID, unsigned long jobID);
+  void SendMessage(unsigned long connectionID, const std::string & message);
+  bool FlushOutput(OutputType & output);
+  void FlushConnection(unsigned long connectionID);
+
+  static ITK_THREAD_RETURN_TYPE WorkerThreadCallback(void * arg);
+  void ProcessJobs();
+  AnalysisJobType * TakeNextJob();
+  bool GetParameterValues(const std::string & parameterFilename,
+			  std::vector<float> & parameterValues);
+
+  std::string m_SocketFilename;
+  int m_ListeningSocket;
+  unsigned int m_NumberOfAnalyzers;
+  volatile long m_ShutdownRequested;
+
+  //! Connections by id; ids are not reused, unlike socket descriptors.
+  std::map<unsigned long, ConnectionType> m_Connections;
+  std::map<unsigned long, OutputType> m_Outputs;
+  unsigned long m_NextConnectionID;
+  itk::SimpleFastMutexLock m_SendLock;
+
+  //! Written by the workers to wake the server loop for pending output.
+  int m_WakeupPipe[2];
+
+  //! Job queue and jobs that are queued or running.
+  std::set<AnalysisJobType *, JobOrderType> m_Queue;
+  std::map<unsigned long, AnalysisJobType *> m_Jobs;
+  unsigned long m_NextJobID;
+  unsigned int m_NumberOfRunningJobs;
+  bool m_StopWorkers;
+  itk::SimpleMutexLock m_Lock;
+  itk::ConditionVariable::Pointer m_QueueNotEmpty;
+
+  std::map<std::string, ParameterSetType> m_ParameterCache;
+  itk::SimpleFastMutexLock m_ParameterCacheLock;
+
+  itk::MultiThreader::Pointer m_Threader;
+  std::vector<int> m_WorkerThreadIDs;
+};
+
+#endif
@@ -0,0 +1,71 @@
+/*===========================================================================
+
+Program:   Bone, muscle and fat quantification from PQCT data.
+Module:    $RCSfile: PQCT_AnalysisSession.cxx,v $
+Language:  C++
+Date:      $Date: 2012/08/30 10:00:00 $
+Version:   $Revision: 0.1 $
+Author:    S. K. Makrogiannis
+3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+=============================================================================*/
+
+#if defined(_MSC_VER)
+#pragma warning ( disable : 4786 )
+#endif
+
+#include <cstdlib>
+#include <string>
+#include <iostream>
+
+#include <itkMultiThreader.h>
+
+#include "PQCT_SubjectSession.h"
+
+
+//! Session routine: analyzes the site images of one subject together.
+
+int
+main( int argc, char ** argv )
+{
+  if (argc < 6 || (argc - 4) % 2 != 0) {
+    std::cerr << "Usage: "
+              << argv[0]
+              << " <subject ID> <parameter filename> <output path> <workflow {0,1,2,3}> <pqct image> [<workflow> <pqct image> ...]"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  PQCT_SubjectSession session;
+  session.SetSubjectID( (std::string) argv[1] );
+  session.SetParameterFilename( (std::string) argv[2] );
+  session.SetOutputPath( (std::string) argv[3] );
+
+  try {
+    for (int i = 4; i < argc; i += 2)
+      session.AddSite( (unsigned short) atoi(argv[i]), (std::string) argv[i+1] );
+  }
+  catch(const char * Message) {
+    std::cerr << "Error:" << Message << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  //! Split the processors between the sites, once for the process, as
+  //! the batch driver does between subjects.
+  unsigned int numberOfSites = (argc - 4) / 2;
+  unsigned int threadsPerSite =
+    itk::MultiThreader::GetGlobalDefaultNumberOfThreads() / numberOfSites;
+  if (threadsPerSite < 1)
+    threadsPerSite = 1;
+  itk::MultiThreader::SetGlobalDefaultNumberOfThreads( threadsPerSite );
+
+  //! Label images are written in the background while sites are analyzed.
+  PQCT_AsyncWriter outputWriter( argc - 4 );
+  session.SetOutputWriter( &outputWriter );
+
+  int status = session.Execute();
+  if (outputWriter.Flush() > 0)
+    status = EXIT_FAILURE;
+
+  return status;
+}
@@ -21,7 +21,7 @@ Author:    S. K. Makrogiannis
 
 //! This wrapper is expected to have interfaces to JNI and to regular C++ datatypes.
 //! This function uses as input the C++ datatypes.
-MYLIB_EXPORT void PQCT_AnalysisWrapperITK( std::string pqctimageFilename,
+MYLIB_EXPORT int PQCT_AnalysisWrapperITK( std::string pqctimageFilename,
 					   unsigned int workflowID,
 					   std::string parameterFilename)
 {
@@ -33,9 +33,10 @@ MYLIB_EXPORT void PQCT_AnalysisWrapperITK( std::string pqctimageFilename,
   //  ITK_Analyzer->SetLabelFilename( outputlabelimageFilename );
   //  ITK_Analyzer->SetQuantificationFilename( quantificationFilename );
   ITK_Analyzer->SetParameterFilename(parameterFilename);
-  ITK_Analyzer->Execute();
+  int status = ITK_Analyzer->Execute();
 
   delete ITK_Analyzer;
+  return status;
 }
 
 
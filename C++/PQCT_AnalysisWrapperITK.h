@@ -31,7 +31,7 @@ building a DLL on windows.
  #define MYLIB_EXPORT
 #endif
 
-MYLIB_EXPORT void PQCT_AnalysisWrapperITK(std::string pqctImage,
+MYLIB_EXPORT int PQCT_AnalysisWrapperITK(std::string pqctImage,
 					  unsigned int workflowID,
 					  std::string parameterFilename);
 
@@ -0,0 +1,283 @@
+/*===========================================================================
+
+  Program:   Bone, muscle and fat quantification from PQCT data.
+  Module:    $RCSfile: PQCT_Analysis_Catalog.cxx,v $
+  Language:  C++
+  Date:      $Date: 2012/08/22 10:00:00 $
+  Version:   $Revision: 0.1 $
+  Author:    S. K. Makrogiannis
+  3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+  =============================================================================*/
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include <itksys/Directory.hxx>
+#include <itksys/SystemTools.hxx>
+#include <gdcmReader.h>
+#include <gdcmStringFilter.h>
+#include <gdcmTag.h>
+
+#include "PQCT_Datatypes.h"
+#include "PQCT_Analysis.h"
+#include "PQCT_FileFormat.h"
+#include "PQCT_Threading.h"
+
+
+//! One catalog record, filled from the header only.
+typedef struct t_CatalogRecordType
+{
+  std::string Filename;
+  bool IsPQCTImage;
+  unsigned long FileLength;
+  HeaderPrefixType HeaderPrefix;
+  DetectorInformationType DetectorInformation;
+  PatientInformationType PatientInformation;
+  ImageInformationType ImageInformation;
+}
+CatalogRecordType;
+
+static bool CompareCatalogRecords(const CatalogRecordType & a,
+				  const CatalogRecordType & b) {
+  return a.Filename < b.Filename;
+}
+
+
+//! Collect the regular files of a directory tree.
+static void ListFilesRecursively(const std::string & directoryName,
+				 std::vector<std::string> & filenames) {
+  itksys::Directory directory;
+  if ( !directory.Load( directoryName.c_str() ) )
+    return;
+
+  for (unsigned long i = 0; i < directory.GetNumberOfFiles(); i++) {
+    std::string entry = directory.GetFile( i );
+    if (entry == "." || entry == "..")
+      continue;
+    std::string fullPath = directoryName + PathSeparator + entry;
+    if ( itksys::SystemTools::FileIsDirectory( fullPath.c_str() ) )
+      ListFilesRecursively( fullPath, filenames );
+    else
+      filenames.push_back( fullPath );
+  }
+}
+
+
+//! Job: read and parse the header block of one file.
+static void CatalogFileJob(unsigned int jobIndex, void * userData) {
+  std::vector<CatalogRecordType> & records = 
+    *static_cast<std::vector<CatalogRecordType> *>( userData );
+  CatalogRecordType & record = records[jobIndex];
+
+  record.IsPQCTImage = false;
+  char headerBlock[headerLength];
+  if ( !ReadPQCTHeaderBlock( record.Filename, headerBlock ) )
+    return;
+
+  PQCT_HeaderView headerView( headerBlock, headerLength );
+  headerView.Parse( record.HeaderPrefix,
+		    record.DetectorInformation,
+		    record.PatientInformation,
+		    record.ImageInformation );
+  record.FileLength = itksys::SystemTools::FileLength( record.Filename.c_str() );
+  record.IsPQCTImage = true;
+}
+
+
+//! Scan a directory tree and write one index line per pQCT scan.
+//! Only the header bytes are read; pixels are never decoded. The
+//! patient name is left out of the index.
+void PQCT_Analyzer::CatalogPQCTDirectory() {
+
+  std::string directoryName = this->m_PQCTImageFilename;
+  if ( !itksys::SystemTools::FileIsDirectory( directoryName.c_str() ) ) {
+    throw "Catalog input is not a directory";
+    return;
+  }
+
+  std::vector<std::string> filenames;
+  ListFilesRecursively( directoryName, filenames );
+  std::cout << "Files found: " << filenames.size() << std::endl;
+
+  std::vector<CatalogRecordType> records( filenames.size() );
+  for (unsigned int i = 0; i < filenames.size(); i++)
+    records[i].Filename = filenames[i];
+
+  //! Headers are independent: read them in parallel.
+  unsigned int failedJobs = 
+    PQCT_ParallelJobs::Run( records.size(), CatalogFileJob, &records );
+
+  std::sort( records.begin(), records.end(), CompareCatalogRecords );
+
+  //! Write the index.
+  std::string catalogFilename = this->m_outputPath + catalogFileName;
+  std::ofstream catalogFile;
+  catalogFile.open( catalogFilename.c_str() );
+  if (catalogFile.fail()) {
+    throw "Unable to open catalog file for writing";
+    return;
+  }
+
+  catalogFile << "Filename" << '\t'
+	      << "Patient_#" << '\t'
+	      << "Patient_ID" << '\t'
+	      << "Birthdate" << '\t'
+	      << "Scan_Date" << '\t'
+	      << "Voxel_Size" << '\t'
+	      << "Image_Origin" << '\t'
+	      << "Matrix_X" << '\t'
+	      << "Matrix_Y" << '\t'
+	      << "File_Length" << std::endl;
+
+  unsigned int numberOfScans = 0;
+  for (unsigned int i = 0; i < records.size(); i++) {
+    const CatalogRecordType & record = records[i];
+    if ( !record.IsPQCTImage )
+      continue;
+    catalogFile << record.Filename << '\t'
+		<< record.PatientInformation.PatientNumber << '\t'
+		<< record.PatientInformation.PatientID << '\t'
+		<< record.PatientInformation.PatientBirthDate << '\t'
+		<< record.DetectorInformation.ScanDate << '\t'
+		<< record.DetectorInformation.VoxelSize << '\t'
+		<< record.DetectorInformation.SliceOrigin << '\t'
+		<< record.ImageInformation.MatrixSize[0] << '\t'
+		<< record.ImageInformation.MatrixSize[1] << '\t'
+		<< record.FileLength << std::endl;
+    numberOfScans++;
+  }
+  catalogFile.close();
+
+  std::cout << "Scans cataloged: " << numberOfScans 
+	    << ", rejected: " << records.size() - numberOfScans - failedJobs
+	    << ", corrupted: " << failedJobs << std::endl;
+}
+
+
+//! One DICOM index record, filled from the header dictionary only.
+typedef struct t_DicomCatalogRecordType
+{
+  std::string Filename;
+  bool IsDicomImage;
+  std::string PatientID;
+  std::string BirthDate;
+  std::string AcquisitionDate;
+  std::string SeriesUID;
+  double SlicePosition;
+}
+DicomCatalogRecordType;
+
+//! Group by series, then order slices by position.
+static bool CompareDicomCatalogRecords(const DicomCatalogRecordType & a,
+				       const DicomCatalogRecordType & b) {
+  if (a.SeriesUID != b.SeriesUID)
+    return a.SeriesUID < b.SeriesUID;
+  if (a.SlicePosition != b.SlicePosition)
+    return a.SlicePosition < b.SlicePosition;
+  return a.Filename < b.Filename;
+}
+
+
+//! DICOM values are padded to even length with spaces or zeros.
+static std::string TrimDicomValue(const std::string & value) {
+  size_t end = value.find_last_not_of( std::string(" \0", 2) );
+  if (end == std::string::npos)
+    return "";
+  return value.substr( 0, end + 1 );
+}
+
+
+//! Job: parse the header dictionary of one file, stopping at the pixel data.
+static void CatalogDicomFileJob(unsigned int jobIndex, void * userData) {
+  std::vector<DicomCatalogRecordType> & records = 
+    *static_cast<std::vector<DicomCatalogRecordType> *>( userData );
+  DicomCatalogRecordType & record = records[jobIndex];
+
+  record.IsDicomImage = false;
+  record.SlicePosition = 0.0;
+
+  gdcm::Reader reader;
+  reader.SetFileName( record.Filename.c_str() );
+  if ( !reader.ReadUpToTag( gdcm::Tag(0x7fe0, 0x0010) ) )
+    return;
+
+  gdcm::StringFilter stringFilter;
+  stringFilter.SetFile( reader.GetFile() );
+  record.PatientID = TrimDicomValue( stringFilter.ToString( gdcm::Tag(0x0010, 0x0020) ) );
+  record.BirthDate = TrimDicomValue( stringFilter.ToString( gdcm::Tag(0x0010, 0x0030) ) );
+  record.AcquisitionDate = TrimDicomValue( stringFilter.ToString( gdcm::Tag(0x0008, 0x0022) ) );
+  record.SeriesUID = TrimDicomValue( stringFilter.ToString( gdcm::Tag(0x0020, 0x000e) ) );
+
+  //! Slice position: third component of the image position (0020|0032).
+  std::string imagePosition = stringFilter.ToString( gdcm::Tag(0x0020, 0x0032) );
+  std::replace( imagePosition.begin(), imagePosition.end(), '\\', ' ' );
+  std::stringstream positionStream( imagePosition );
+  double position[3] = {0.0, 0.0, 0.0};
+  positionStream >> position[0] >> position[1] >> position[2];
+  record.SlicePosition = position[2];
+
+  record.IsDicomImage = true;
+}
+
+
+//! Scan a directory tree and write one index line per DICOM file,
+//! grouped by series and sorted by slice position. Pixel data are
+//! never read.
+void PQCT_Analyzer::CatalogDicomDirectory() {
+
+  std::string directoryName = this->m_PQCTImageFilename;
+  if ( !itksys::SystemTools::FileIsDirectory( directoryName.c_str() ) ) {
+    throw "Catalog input is not a directory";
+    return;
+  }
+
+  std::vector<std::string> filenames;
+  ListFilesRecursively( directoryName, filenames );
+  std::cout << "Files found: " << filenames.size() << std::endl;
+
+  std::vector<DicomCatalogRecordType> records( filenames.size() );
+  for (unsigned int i = 0; i < filenames.size(); i++)
+    records[i].Filename = filenames[i];
+
+  unsigned int failedJobs = 
+    PQCT_ParallelJobs::Run( records.size(), CatalogDicomFileJob, &records );
+
+  std::sort( records.begin(), records.end(), CompareDicomCatalogRecords );
+
+  //! Write the index.
+  std::string catalogFilename = this->m_outputPath + dicomCatalogFileName;
+  std::ofstream catalogFile;
+  catalogFile.open( catalogFilename.c_str() );
+  if (catalogFile.fail()) {
+    throw "Unable to open catalog file for writing";
+    return;
+  }
+
+  catalogFile << "Series_UID" << '\t'
+	      << "Slice_Position" << '\t'
+	      << "Filename" << '\t'
+	      << "Patient_ID" << '\t'
+	      << "Birthdate" << '\t'
+	      << "Acquisition_Date" << std::endl;
+
+  unsigned int numberOfFiles = 0;
+  for (unsigned int i = 0; i < records.size(); i++) {
+    const DicomCatalogRecordType & record = records[i];
+    if ( !record.IsDicomImage )
+      continue;
+    catalogFile << record.SeriesUID << '\t'
+		<< record.SlicePosition << '\t'
+		<< record.Filename << '\t'
+		<< record.PatientID << '\t'
+		<< record.BirthDate << '\t'
+		<< record.AcquisitionDate << std::endl;
+    numberOfFiles++;
+  }
+  catalogFile.close();
+
+  std::cout << "DICOM files cataloged: " << numberOfFiles 
+	    << ", rejected: " << records.size() - numberOfFiles - failedJobs
+	    << ", failed: " << failedJobs << std::endl;
+}
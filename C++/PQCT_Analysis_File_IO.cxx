@@ -11,19 +11,23 @@
   =============================================================================*/
 
 
+#include <cmath>
+#include <algorithm>
+#include <sstream>
+
 #include <itkImageRegionIterator.h>
-#include <itkImportImageFilter.h>
-#include <itkImageDuplicator.h>
 #include <itkImageFileReader.h>
 #include <itkImageFileWriter.h>
-#include <itkConstantPadImageFilter.h>
 #include <itkGDCMImageIO.h>
+#include <itkGDCMSeriesFileNames.h>
 #include <itkMetaDataObject.h>
 #include <gdcmGlobal.h>
 #include <itkOrientImageFilter.h>
+#include <itksys/SystemTools.hxx>
 
 #include "PQCT_Datatypes.h"
 #include "PQCT_Analysis.h"
+#include "PQCT_Threading.h"
 
 
 //! Read dicom and retrieve specific information.
@@ -54,6 +58,7 @@ std::string PQCT_Analyzer::RetrieveDicomTagValue(std::string tagkey,
 
 //! Read dicom file of CT image.
 int PQCT_Analyzer::ReadDicomCTImage() {
+  PQCT_TraceScope traceScope( this->m_Tracer, TRACE_READ );
 
   typedef itk::ImageFileReader<PQCTImageType> CTImageFileReaderType;
   CTImageFileReaderType::Pointer reader = CTImageFileReaderType::New();
@@ -101,73 +106,125 @@ int PQCT_Analyzer::ReadDicomCTImage() {
 
 
   //! Write orginal image to nifti file.
-  itk::ImageFileWriter< PQCTImageType >::Pointer 
-    InputWriter = itk::ImageFileWriter< PQCTImageType >::New();
-  InputWriter->SetInput( this->m_PQCTImage );
-  InputWriter->SetFileName( this->m_outputPath + this->m_SubjectID + inputImageFileExtension );
-  InputWriter->Update();
-  InputWriter = 0;
+  this->WriteIntermediateImage( this->m_PQCTImage, inputImageFileExtension, OUTPUT_QC );
 
 
   return EXIT_SUCCESS;
 }
 
 
-//! Read the input image header.
-void PQCT_Analyzer::ReadpQCTImageHeader() {
+//! Slices of a DICOM series, decoded by the worker pool.
+typedef struct t_DicomSeriesJobType
+{
+  std::vector<std::string> Filenames;
+  std::vector<PQCTImageType::Pointer> Slices;
+  std::vector<double> SlicePositions;
+}
+DicomSeriesJobType;
 
-  //! Identify ID from filename.
-  this->ExtractSubjectID();
-  std::cout << "Subject ID: " << this->m_SubjectID << std::endl;
+static void ReadDicomSliceJob(unsigned int jobIndex, void * userData) {
+  DicomSeriesJobType & series = *static_cast<DicomSeriesJobType *>( userData );
 
-  //! Open input stream and set filename.
-  std::ifstream inputFile;
-  inputFile.open( this->m_PQCTImageFilename.c_str(), std::ios::binary );
-  if (inputFile.fail()) {
-    throw "Unable to open image file for reading";
-    return;
+  typedef itk::ImageFileReader<PQCTImageType> CTImageFileReaderType;
+  CTImageFileReaderType::Pointer reader = CTImageFileReaderType::New();
+  reader->SetFileName( series.Filenames[jobIndex].c_str() );
+  itk::GDCMImageIO::Pointer gdcmImageIO = itk::GDCMImageIO::New();
+  reader->SetImageIO( gdcmImageIO );
+  reader->Update();
+  series.Slices[jobIndex] = reader->GetOutput();
+
+  //! Slice position: third component of the image position (0020|0032).
+  std::string imagePosition;
+  double position[3] = {0.0, 0.0, 0.0};
+  if ( gdcmImageIO->GetValueFromTag( "0020|0032", imagePosition ) ) {
+    std::replace( imagePosition.begin(), imagePosition.end(), '\\', ' ' );
+    std::stringstream positionStream( imagePosition );
+    positionStream >> position[0] >> position[1] >> position[2];
   }
+  series.SlicePositions[jobIndex] = position[2];
+}
 
-  //! Read header structures of CT image.
-  
-  //! 1: FilePreFix (header version, size).
- 
-  //! Header version.
-  inputFile.read( (char*) &this->m_HeaderPrefix.HeaderVersion, sizeof(int) );
 
-  //! Header total length.
-  inputFile.read( (char*) &this->m_HeaderPrefix.HeaderLength, sizeof(int) );
+//! Read a DICOM series of CT slices from a directory.
+//! Slices are sorted by position, decoded in parallel and kept as a
+//! sequence of 2D images; patient metadata is read once per series.
+int PQCT_Analyzer::ReadDicomCTSeries() {
+  PQCT_TraceScope traceScope( this->m_Tracer, TRACE_READ );
 
-  //! Exception handling, return if this is not the expected file type.
-  if (this->m_HeaderPrefix.HeaderLength != headerLength) {\
-    throw("Unrecognized input file format.");
-    return;
-}
+  //! Series name from the directory name.
+  while (this->m_PQCTImageFilename.size() > 1 &&
+	 this->m_PQCTImageFilename.find_last_of( PathSeparator ) == 
+	 this->m_PQCTImageFilename.size() - 1)
+    this->m_PQCTImageFilename.erase( this->m_PQCTImageFilename.size() - 1 );
+  this->ExtractSubjectID();
+  std::cout << "Series ID (from directory): " << this->m_SubjectID << std::endl;
+
+  //! Sorted slice filenames of the first series in the directory.
+  itk::GDCMSeriesFileNames::Pointer seriesFileNames = itk::GDCMSeriesFileNames::New();
+  seriesFileNames->SetUseSeriesDetails( true );
+  seriesFileNames->SetDirectory( this->m_PQCTImageFilename );
+  const itk::GDCMSeriesFileNames::SeriesUIDContainerType & seriesUIDs = 
+    seriesFileNames->GetSeriesUIDs();
+  if (seriesUIDs.empty()) {
+    throw("No DICOM series found in input directory");
+    return EXIT_FAILURE;
+  }
+  if (seriesUIDs.size() > 1)
+    std::cout << "Found " << seriesUIDs.size() << " series, reading the first one." << std::endl;
 
-  std::cout << "Header info"
-  	    << "\t"
-  	    << this->m_HeaderPrefix.HeaderVersion
-  	    << "\t"
-  	    << this->m_HeaderPrefix.HeaderLength
-  	    << std::endl;
+  DicomSeriesJobType series;
+  series.Filenames = seriesFileNames->GetFileNames( seriesUIDs[0] );
+  series.Slices.resize( series.Filenames.size() );
+  series.SlicePositions.resize( series.Filenames.size() );
+  std::cout << "Number of slices: " << series.Filenames.size() << std::endl;
 
+  //! Retrieve relevant metadata once, from the first slice.
+  //! This also initializes the DICOM dictionary before the pool starts.
+  itk::GDCMImageIO::Pointer gdcmImageIO = itk::GDCMImageIO::New();
+  gdcmImageIO->SetFileName( series.Filenames[0].c_str() );
+  gdcmImageIO->ReadImageInformation();
 
-  //! 2: DetRec (detector's geometry).
+  std::string patientIDTagKey = "0010|0020";
+  std::string patientbirthdayTagKey = "0010|0030";
+  std::string sliceoriginTagKey = "0020|0032";
+  std::string scandateTagKey = "0008|0022";
+  this->m_PatientInformation.PatientNumber = atoi(this->RetrieveDicomTagValue(patientIDTagKey, gdcmImageIO).c_str());
+  this->m_PatientInformation.PatientName = "Anonymous";
+  this->m_PatientInformation.PatientBirthDate = atoi(this->RetrieveDicomTagValue(patientbirthdayTagKey, gdcmImageIO).c_str());
+  std::stringstream tempStringStream(this->RetrieveDicomTagValue(sliceoriginTagKey, gdcmImageIO));
+  tempStringStream >> this->m_DetectorInformation.SliceOrigin;  
+  this->m_DetectorInformation.ScanDate = atoi(this->RetrieveDicomTagValue(scandateTagKey, gdcmImageIO).c_str());
+
+  //! Decode the slices.
+  unsigned int failedJobs = 
+    PQCT_ParallelJobs::Run( series.Filenames.size(), ReadDicomSliceJob, &series );
+  if (failedJobs > 0) {
+    throw("Cannot read input series");
+    return EXIT_FAILURE;
+  }
 
-  //! Total length of detector's geometry section.
-  inputFile.read( (char*) &this->m_DetectorInformation.DetRecTypeLength, sizeof(int) );
+  this->m_CTSlices = series.Slices;
+  this->m_CTSlicePositions = series.SlicePositions;
+  this->m_PQCTImage = 0;
 
-  //! CT image voxel size.
-  inputFile.read( (char*) &this->m_DetectorInformation.VoxelSize, sizeof(double) );
+  return EXIT_SUCCESS;
+}
 
-  //! Jump a few places in the header.
-  inputFile.ignore(10, EOF);
 
-  //! CT image number of slices (should be 1).
-  inputFile.read( (char*) &this->m_DetectorInformation.NumberofSlices, sizeof(short) );
+//! Copy the fields of a validated header view to the class containers.
+void PQCT_Analyzer::CopyHeaderInformation(const PQCT_HeaderView & headerView) {
 
-  //! CT image slice origin on superior inferior axis.
-  inputFile.read( (char*) &this->m_DetectorInformation.SliceOrigin, sizeof(double) );
+  headerView.Parse( this->m_HeaderPrefix,
+		    this->m_DetectorInformation,
+		    this->m_PatientInformation,
+		    this->m_ImageInformation );
+
+  std::cout << "Header info"
+  	    << "\t"
+  	    << this->m_HeaderPrefix.HeaderVersion
+  	    << "\t"
+  	    << this->m_HeaderPrefix.HeaderLength
+  	    << std::endl;
 
   std::cout << "Header info"
   	    << "\t"
@@ -175,122 +232,31 @@ void PQCT_Analyzer::ReadpQCTImageHeader() {
   	    << "\t"
   	    << this->m_DetectorInformation.SliceOrigin
   	    << std::endl;
+}
 
-  //! Jump to the measurement info of this section.
-  int bytestoSectionEnd = this->m_DetectorInformation.DetRecTypeLength - 
-    (LONGINT + DOUBLE + WORD + DOUBLE + WORD + DOUBLE);
-  int measurementInfoFromSectionEnd = (3 * LONGINT + 4 * SHORTINT + 2 * BYTE + BOOLEAN +  
-				       MAXNUMDET * BYTE + 2 * SINGLE +
-				       BOOLEAN + SINGLE + 13 * CHAR + CHAR +
-				       2 * SINGLE + 2 * BYTE + 2 * BOOLEAN + BYTE);
-  int bytesToJump = bytestoSectionEnd - measurementInfoFromSectionEnd;
-  inputFile.ignore(bytesToJump, EOF);
-  
-  //! CT scan date.
-  inputFile.read( (char*) &this->m_DetectorInformation.ScanDate, sizeof(int) );
-  // std::cout << "Scan date: " << this->m_DetectorInformation.ScanDate << std::endl;
 
-  //! Jump to the end of this section.
-  bytestoSectionEnd = measurementInfoFromSectionEnd - LONGINT;
-  inputFile.ignore(bytestoSectionEnd, EOF);
-  
+//! Read the input image header only.
+void PQCT_Analyzer::ReadpQCTImageHeader() {
 
-  //! 3: PatInfoRec (patient information).
-  //! Total length of patient information section.
-  inputFile.read( (char*) &this->m_PatientInformation.PatInfoRecTypeLength, sizeof(int) );
-
-  //! // Jump a few places in the header.
-  //! int bytesToJump = 2;
-  //! inputFile.ignore(bytesToJump, EOF);
-
-  //! Patient gender, ethnic group, measurement number, patient number and birthdate.
-  inputFile.read( (char*) &this->m_PatientInformation.PatientGender, sizeof(short) );
-  inputFile.read( (char*) &this->m_PatientInformation.PatientEthnicGroup, sizeof(short) );
-  inputFile.read( (char*) &this->m_PatientInformation.PatientMeasurementNumber, sizeof(short) );
-  inputFile.read( (char*) &this->m_PatientInformation.PatientNumber, sizeof(int) );
-  inputFile.read( (char*) &this->m_PatientInformation.PatientBirthDate, sizeof(int) );
-
-  //! Jump a few places in the header.
-  bytesToJump = LONGINT;
-  inputFile.ignore(bytesToJump, EOF);
-
-  //! Patient name.
-  char * charBuffer;
-  charBuffer = new char[41];
-  inputFile.read( (char*) charBuffer, 41 );
-  int nameLength = static_cast<int> ( charBuffer[0] );
-  this->m_PatientInformation.PatientName =  charBuffer;
-  this->m_PatientInformation.PatientName = 
-    this->m_PatientInformation.PatientName.substr(1, nameLength);
-  delete [] charBuffer;
-
-  //! Jump a few places in the header.
-  bytesToJump = CHAR + 41 * CHAR + CHAR + 81 * CHAR + CHAR + LONGINT;
-  inputFile.ignore(bytesToJump, EOF);
-
-  //! User ID.
-  charBuffer = new char[13];
-  inputFile.read( (char*) charBuffer, 13 );
-  this->m_PatientInformation.UserID =  charBuffer;
-  delete [] charBuffer;
+  //! Identify ID from filename.
+  this->ExtractSubjectID();
+  std::cout << "Subject ID: " << this->m_SubjectID << std::endl;
 
-  //! Patient ID.
-  charBuffer = new char[13];
-  inputFile.read( (char*) charBuffer, 13 );
-  this->m_PatientInformation.PatientID = charBuffer;
-  delete [] charBuffer;
-
-  //! Jump to the end of this section.
-  // bytesToJump = 4 + 2 + 2 + 2 + 4 + 4 + 4 + 41 + 1 + 41 + 1 + 81 + 1 + 4 + 13 + 13;
-  bytesToJump = ( LONGINT + WORD + WORD + WORD + LONGINT + LONGINT + LONGINT + 41 * CHAR +
-		  CHAR + 41 * CHAR + CHAR + 81 * CHAR + CHAR + LONGINT + 13 * CHAR + 13 * CHAR );
-  bytestoSectionEnd = this->m_PatientInformation.PatInfoRecTypeLength - 
-    bytesToJump;
-  inputFile.ignore(bytestoSectionEnd, EOF);
- 
-  // std::cout << "Header info"
-  // 	    << "\t"
-  // 	    << this->m_PatientInformation.PatInfoRecTypeLength
-  // 	    << "\t"
-  // 	    << this->m_PatientInformation.PatientNumber
-  // 	    << "\t"
-  // 	    << this->m_PatientInformation.PatientID
-  // 	    << std::endl;
-
-
-  //! 4: PicInfoRec (CT image information).
-  // Total length of CT image information section.
-  inputFile.read( (char*) &this->m_ImageInformation.PicInfoRecLength, sizeof(int) );
-  //! Left edge of image.
-  inputFile.read( (char*) &this->m_ImageInformation.PicX0, sizeof(short) );
-  //! Upper edge of image.
-  inputFile.read( (char*) &this->m_ImageInformation.PicY0, sizeof(short) );
-  //! X-matrix size.
-  inputFile.read( (char*) &this->m_ImageInformation.MatrixSize[0], sizeof(short) );
-  //! Y-matrix size.
-  inputFile.read( (char*) &this->m_ImageInformation.MatrixSize[1], sizeof(short) );
-
-  //! Jump to the end of this section.
-  // bytestoSectionEnd = this->m_ImageInformation.PicInfoRecLength - 
-  //   (4 + 2 + 2 + 2 + 2);
-  bytestoSectionEnd = this->m_ImageInformation.PicInfoRecLength - 
-    ( LONGINT + WORD + WORD + WORD + WORD );
-  inputFile.ignore(bytestoSectionEnd, EOF);
-
-  // std::cout << "Header info"
-  // 	    << "\t"
-  // 	    << this->m_ImageInformation.PicInfoRecLength
-  // 	    << "\t"
-  // 	    << this->m_ImageInformation.MatrixSize
-  // 	    << std::endl;
-
-  //! Close file.
-  inputFile.close();
+  //! Read the header block in one call and parse it.
+  char headerBuffer[headerLength];
+  if ( !ReadPQCTHeaderBlock( this->m_PQCTImageFilename, headerBuffer ) ) {
+    throw("Unrecognized input file format.");
+    return;
+  }
+
+  PQCT_HeaderView headerView( headerBuffer, headerLength );
+  this->CopyHeaderInformation( headerView );
 }
 
 
 //! Calibrate PQCT image using pixel arithmetic.
 void PQCT_Analyzer::CalibrateImage() {
+  PQCT_TraceScope traceScope( this->m_Tracer, TRACE_CALIBRATE );
 
   //  Rectangle r = ip.getRoi();
   //  for (int y=r.y; y<(r.y+r.height); y++)
@@ -303,153 +269,137 @@ void PQCT_Analyzer::CalibrateImage() {
   //  }
   // }
 
-  typedef itk::ImageRegionIterator<PQCTImageType> PQCTImageIteratorType;
-  PQCTImageIteratorType itImage(this->m_PQCTImage, 
-				this->m_PQCTImage->GetBufferedRegion());
-
-  for(itImage.GoToBegin();!itImage.IsAtEnd();++itImage) {
-    float originalValue = (float) itImage.Get(); // - 32768.0F;
-    // int calibratedValue = (int) MY_ROUND(((slope * (float)originalValue) + intercept) /1000.0F );
-    int calibratedValue = (int) MY_ROUND((this->m_AUtoDensitySlope * 
-					  ((float)originalValue/1000.0F)) + 
-					 this->m_AUtoDensityIntercept); 
-    itImage.Set( (short) calibratedValue );
+  //! Table lookup over the contiguous pixel buffer.
+  this->m_CalibrationTable->CalibrateBuffer( this->m_PQCTImage->GetBufferPointer(),
+					     this->m_PQCTImage->GetBufferedRegion().GetNumberOfPixels() );
+
+}
+
+
+//! Decode the pixel block into a padded image and calibrate
+//! in the same pass. The layout matches the former import, duplicate,
+//! pad (constant 0) and calibrate sequence: buffered region starts at
+//! -INPUTPADDINGLENGTH and the border holds the calibrated zero value.
+PQCTImageType::Pointer 
+PQCT_Analyzer::ImportCalibratedPQCTPixels(const char * pixelData) {
+  PQCT_TraceScope traceScope( this->m_Tracer, TRACE_CALIBRATE );
+
+  const long padLength = INPUTPADDINGLENGTH;
+  const long width = this->m_ImageInformation.MatrixSize[0];
+  const long height = this->m_ImageInformation.MatrixSize[1];
+
+  PQCTImageType::RegionType paddedRegion;
+  PQCTImageType::SizeType size_var;
+  PQCTImageType::IndexType index_var;
+  double origin[ pixelDimensions ];
+  double spacing[ pixelDimensions ];
+  for (int i = 0; i < pixelDimensions; i++) {
+    size_var[i] = this->m_ImageInformation.MatrixSize[i] + 2 * padLength;
+    index_var[i] = -padLength;
+    origin[i] = 0.0;
+    spacing[i] = this->m_DetectorInformation.VoxelSize;
+  }
+  paddedRegion.SetIndex(index_var);
+  paddedRegion.SetSize(size_var);
+
+  //! Single allocation for the whole pipeline input.
+  PQCTImageType::Pointer paddedImage = PQCTImageType::New();
+  paddedImage->SetRegions( paddedRegion );
+  paddedImage->SetSpacing( spacing );
+  paddedImage->SetOrigin( origin );
+  paddedImage->Allocate();
+
+  const PQCTPixelType paddingValue = this->CalibratePixelValue( BACKGROUND );
+  const long paddedWidth = width + 2 * padLength;
+  PQCTPixelType * outputRow = paddedImage->GetBufferPointer();
+
+  for (long y = 0; y < height + 2 * padLength; y++, outputRow += paddedWidth) {
+    if (y < padLength || y >= height + padLength) {
+      std::fill( outputRow, outputRow + paddedWidth, paddingValue );
+      continue;
+    }
+    std::fill( outputRow, outputRow + padLength, paddingValue );
+    std::fill( outputRow + padLength + width, outputRow + paddedWidth, paddingValue );
+
+    //! Copy the (unaligned) row from the file, then calibrate while in cache.
+    PQCTPixelType * row = outputRow + padLength;
+    memcpy( row, pixelData + (y - padLength) * width * sizeof(PQCTPixelType), 
+	    width * sizeof(PQCTPixelType) );
+    this->m_CalibrationTable->CalibrateBuffer( row, width );
   }
 
+  return paddedImage;
 }
 
 
 //! Read the input image in the native format 
 //! including the header (new version).
 void PQCT_Analyzer::ReadPQCTImage() {
+  PQCT_TraceScope traceScope( this->m_Tracer, TRACE_READ );
 
-  // // Identify ID from filename.
-  // this->ExtractSubjectID();
-  // std::cout << "Subject ID: " << this->m_SubjectID << std::endl;
+  //! Identify ID from filename.
+  this->ExtractSubjectID();
+  std::cout << "Subject ID: " << this->m_SubjectID << std::endl;
 
-  // // Open input stream and set filename.
-  std::ifstream inputFile;
-  // inputFile.open( this->m_PQCTImageFilename.c_str(), std::ios::binary );
-  // if (inputFile.fail()) {
-  //   throw "Unable to open image file for reading";
-  //   return;
-  // }
+  //! Map the file once; header and pixels are read from the mapping.
+  PQCT_MappedFile mappedFile;
+  mappedFile.Open( this->m_PQCTImageFilename );
+  PQCT_HeaderView headerView( mappedFile.GetData(), mappedFile.GetLength() );
+  this->CopyHeaderInformation( headerView );
 
-  // // Set file size counters to 0.
-  // int number = 0;
-  // int count = 0;
-  // // int headerLength = 1609;
-
-  // // Skip the first 1609 elements.
-  // inputFile.ignore(headerLength, EOF);
-  // // Read until EOF and count number of elements.
-  // do{
-  //   inputFile.read( (char*) &number, sizeof(short) );
-  //   count++;
-  //   // std::cout << number << "," << count << std::endl;
-  // }
-  // while(!inputFile.eof());
-  // inputFile.close();
-  // std::cout << "Number of elements: " << count << std::endl;
+  //! Check that the declared matrix is present in the file.
+  int count = this->m_ImageInformation.MatrixSize[0] *
+    this->m_ImageInformation.MatrixSize[1];
+  if ( headerView.GetPixelOffset() + count * sizeof(short) > mappedFile.GetLength() ) {
+    throw "Image file is shorter than its declared matrix size";
+    return;
+  }
 
-  // // Compute image dimensions.
-  // int imageSide = (int) sqrt( (double)count );
-  // // imageSide = 283;
+  //! Decode, pad and calibrate (convert from attenutation units to densities)
+  //! straight from the mapping.
+  this->m_PQCTImage = 
+    this->ImportCalibratedPQCTPixels( mappedFile.GetData() + headerView.GetPixelOffset() );
+  mappedFile.Close();
 
-  //! New header reader.
-  this->ReadpQCTImageHeader();
 
-  //! Read-in the file and store pixels in array.
-  inputFile.open( m_PQCTImageFilename.c_str(),  std::ios::binary );
-  if (inputFile.fail()) {
-    throw "Unable to open image file for reading";
-    return;
-  }
-  inputFile.ignore(headerLength, EOF);
+  //! Write image to file (QC).
+  this->WriteIntermediateImage( this->m_PQCTImage, inputImageFileExtension, OUTPUT_QC );
+}
 
-  int count = this->m_ImageInformation.MatrixSize[0] *
-    this->m_ImageInformation.MatrixSize[1];
-  short* buffer =  new short[count];
-  count = 0;
-  // Read until EOF and count number of elements.
-  do{
-    inputFile.read( (char*)buffer+sizeof(short)*count, sizeof(short) );
-    count++;
-  }
-  while(!inputFile.eof());
 
-  //! Close file.
-  inputFile.close();
-  // std::cout << "Image side: " << imageSide << std::endl;
-  
+//! Write an image to a NIfTI file.
+template<class ImageType>
+static void WriteImageToFile(typename ImageType::Pointer image,
+			     const std::string & filename) {
+  typename itk::ImageFileWriter< ImageType >::Pointer 
+    writer = itk::ImageFileWriter< ImageType >::New();
+  writer->SetInput( image );
+  writer->SetFileName( filename );
+  writer->Update();
+  writer = 0;
+}
 
-  //! Then create an itk image  
-  //! copy pixel intensities and
-  //! add metadata.
-  PQCTImageType::RegionType inputRegion;
-  PQCTImageType::SizeType size_var;
-  PQCTImageType::IndexType index_var;
-  double origin[ pixelDimensions ];
 
-  for (int i = 0; i < pixelDimensions; i++) {
-    size_var[i] = this->m_ImageInformation.MatrixSize[i];
-    index_var[i] = 0;
-    origin[i] = 0.0;	
-  }
-  inputRegion.SetIndex(index_var);
-  inputRegion.SetSize(size_var);
-
-  //! Import PQCT image using itk's import image filter.
-  typedef itk::ImportImageFilter<PQCTPixelType, pixelDimensions> PQCTImportFilter;
-  PQCTImportFilter::Pointer importPQCT = PQCTImportFilter::New();
-
-  importPQCT->SetRegion(inputRegion);
-  importPQCT->SetSpacing( this->m_DetectorInformation.VoxelSize );
-  importPQCT->SetOrigin( origin );
-  importPQCT->ReleaseDataFlagOn();
-  importPQCT->SetImportPointer(buffer, count, false); 
-  importPQCT->Update();
-
-
-  //! Use duplicator to detach from file stream.
-  typedef itk::ImageDuplicator< PQCTImageType > PQCTDuplicatorType;
-  PQCTDuplicatorType::Pointer pqctDuplicator = PQCTDuplicatorType::New();
-  pqctDuplicator->SetInputImage( importPQCT->GetOutput() );
-  pqctDuplicator->Update();
-
-
-  //! Pad image to facilitate subsequent segmentation.
-  typedef itk::ConstantPadImageFilter <PQCTImageType, PQCTImageType>
-    ConstantPadImageFilterType;
-  unsigned int padLength = 5;
-  PQCTImageType::SizeType extendRegion;
-  extendRegion[0] = padLength;
-  extendRegion[1] = padLength;
-  PQCTImageType::PixelType backgroundValue = BACKGROUND;
-  ConstantPadImageFilterType::Pointer padFilter
-    = ConstantPadImageFilterType::New();
-  padFilter->SetInput(pqctDuplicator->GetOutput());
-  padFilter->SetPadBound(extendRegion); // Calls SetPadLowerBound(region) and SetPadUpperBound(region)
-  // padFilter->SetPadLowerBound(extendRegion);
-  // padFilter->SetPadUpperBound(extendRegion);
-  padFilter->SetConstant(backgroundValue);
-  padFilter->Update();
-  this->m_PQCTImage = padFilter->GetOutput();
-
-
-  //! Calibrate itk image (convert from attenutation units to densities).
-  this->CalibrateImage();
-
-
-  //! Write image to file (debug).
-  itk::ImageFileWriter< PQCTImageType >::Pointer 
-    InputWriter = itk::ImageFileWriter< PQCTImageType >::New();
-  InputWriter->SetInput( this->m_PQCTImage );
-  InputWriter->SetFileName( this->m_outputPath + this->m_SubjectID + inputImageFileExtension );
-  InputWriter->Update();
-  InputWriter = 0;
-
-  delete[] buffer;
+//! Write an intermediate image named <output path><subject ID><suffix>
+//! when the output policy is at least minimumPolicy.
+void PQCT_Analyzer::WriteIntermediateImage(PQCTImageType::Pointer image,
+					   const std::string & suffix,
+					   OutputPolicyType minimumPolicy) {
+  if (this->m_OutputPolicy < minimumPolicy)
+    return;
+  PQCT_TraceScope traceScope( this->m_Tracer, TRACE_WRITE );
+  WriteImageToFile<PQCTImageType>( image, 
+				   this->m_outputPath + this->m_SubjectID + suffix );
+}
+
+void PQCT_Analyzer::WriteIntermediateImage(LabelImageType::Pointer image,
+					   const std::string & suffix,
+					   OutputPolicyType minimumPolicy) {
+  if (this->m_OutputPolicy < minimumPolicy)
+    return;
+  PQCT_TraceScope traceScope( this->m_Tracer, TRACE_WRITE );
+  WriteImageToFile<LabelImageType>( image, 
+				    this->m_outputPath + this->m_SubjectID + suffix );
 }
 
 
@@ -460,136 +410,150 @@ void PQCT_Analyzer::AnonymizePQCTImage() {
   this->ExtractSubjectID();
   std::cout << "Subject ID: " << this->m_SubjectID << std::endl;
 
-  //! Open input stream.
-  std::ifstream inputFile;
-  inputFile.open( this->m_PQCTImageFilename.c_str(), std::ios::binary );
-  if (inputFile.fail()) {
-    throw "Unable to open image file for reading";
-    return;
-  }
-
-  //! Open output stream.
-  std::ofstream outputFile;
   std::string fullPath = this->m_outputPath + 
     this->m_SubjectID + 
     anonymizedImageFileExtension ;
 
-  outputFile.open( fullPath.c_str(), std::ios::binary );
-  if (outputFile.fail()) {
-    throw "Unable to open image file for writing";
-    return;
-  }
-
-  //! Write input to output file and close both files.
-  if(inputFile.is_open() && outputFile.is_open())
-      while(!inputFile.eof())
-	  outputFile.put(inputFile.get());
- 
-  // outputFile << inputFile.rdbuf();
-
-  // Close both files.
-  inputFile.close();
-  outputFile.close();
+  //! Clone input to output file, then overwrite the name.
+  CopyPQCTFile( this->m_PQCTImageFilename, fullPath );
+  AnonymizePQCTHeader( fullPath );
 
+  std::cout << "Anonymization completed." << std::endl;
+}
 
-  //! Then open again the output file.
-  std::fstream anonymizationFile;
-  anonymizationFile.open( fullPath.c_str(), std::ios::in|std::ios::out|std::ios::binary );
-  if (anonymizationFile.fail()) {
-    throw "Unable to open image file for reading/writing";
-    return;
-  }
 
-  //! Read header structures of CT image.
-  
-  //! 1: FilePreFix (header version, size).
-  //! Header version.
-  anonymizationFile.read( (char*) &this->m_HeaderPrefix.HeaderVersion, sizeof(int) );
+//! Input/output pair of the bulk anonymizer.
+typedef struct t_AnonymizationJobType
+{
+  std::string InputFilename;
+  std::string OutputFilename;
+}
+AnonymizationJobType;
 
-  //! Header total length.
-  anonymizationFile.read( (char*) &this->m_HeaderPrefix.HeaderLength, sizeof(int) );
+static void AnonymizeFileJob(unsigned int jobIndex, void * userData) {
+  const AnonymizationJobType & job = 
+    (*static_cast<std::vector<AnonymizationJobType> *>( userData ))[jobIndex];
 
-  //! Exception handling, return if this is not the expected file type.
-  if (this->m_HeaderPrefix.HeaderLength != headerLength) {\
-    throw("Unrecognized input file format.");
-    return;
+  //! Same input and output file: no copy, the name is patched in place.
+  //! CopyPQCTFile also recognizes the file under another name.
+  if ( job.OutputFilename != job.InputFilename )
+    CopyPQCTFile( job.InputFilename, job.OutputFilename );
+  AnonymizePQCTHeader( job.OutputFilename );
 }
-  std::cout << "Header info"
-  	    << "\t"
-  	    << this->m_HeaderPrefix.HeaderVersion
-  	    << "\t"
-  	    << this->m_HeaderPrefix.HeaderLength
-  	    << std::endl;
-
-  //! 2: DetRec (detector's geometry).
-  //! Total length of detector's geometry section.
-  anonymizationFile.read( (char*) &this->m_DetectorInformation.DetRecTypeLength, sizeof(int) );
 
-  //! Jump to the end of this section.
-  int bytestoSectionEnd = this->m_DetectorInformation.DetRecTypeLength - 4;
-  anonymizationFile.ignore(bytestoSectionEnd, EOF);
-  // std::cout << "Bytes to section's end: " << bytestoSectionEnd << std::endl;
 
-  //! 3: PatInfoRec (patient information).
-  //! Total length of patient information section.
-  anonymizationFile.read( (char*) &this->m_PatientInformation.PatInfoRecTypeLength, sizeof(int) );
+//! Anonymize the images of a file list.
+//! Each line holds an input filename and optionally an output filename;
+//! by default the output is written to the output path with the
+//! anonymized extension. Output equal to input anonymizes in place.
+void PQCT_Analyzer::BulkAnonymizePQCTImages() {
 
-  //! Jump a few places in the header.
-  int bytestoJump = WORD + WORD + WORD + LONGINT + LONGINT + LONGINT;
-  anonymizationFile.ignore(bytestoJump, EOF);
+  std::ifstream listFile;
+  listFile.open( this->m_PQCTImageFilename.c_str() );
+  if (listFile.fail()) {
+    throw "Unable to open file list for reading";
+    return;
+  }
 
-  //! Count bytes to end and write the anonymization character to file.
-  char anonymizationString[40] = "Anonymoys";
-  char anonymizationLength = static_cast<char>( strlen(anonymizationString) );
-  
-  //! Get read position and set to write position.
-  int position = (int) anonymizationFile.tellg();
-  anonymizationFile.seekp( position, std::ios::beg );
-
-  //! Write string of characters.
-  anonymizationFile.write((char*) &anonymizationLength, sizeof(char));
-  anonymizationFile.write((char*) anonymizationString, 40);
-  anonymizationFile.seekg( 0, std::fstream::end );
-
-  //! Alternate way of anonymization.
-  // int bytestoAnonymize = 40;
-  // char anonymizationCharacter = '-';
-  // char stringEnd = '\0';
-  // std::cout << "Bytes to anonymize: " << bytestoAnonymize 
-  // 	    << "\t Get pointer position: " << position
-  // 	    << std::endl;
-  // int count = 0;
-  // while( count < bytestoAnonymize ) {
-  //   anonymizationFile.write((char*) &anonymizationCharacter, sizeof(char));
-  //   count++;
-  // }
-  // anonymizationFile.write((char*) &stringEnd, sizeof(char));
+  std::vector<AnonymizationJobType> jobs;
+  std::string line;
+  while (std::getline( listFile, line )) {
+    std::istringstream lineStream( line );
+    AnonymizationJobType job;
+    if ( !(lineStream >> job.InputFilename) )
+      continue;
+    if ( !(lineStream >> job.OutputFilename) )
+      job.OutputFilename = this->m_outputPath + 
+	this->ExtractFilename( job.InputFilename ) + 
+	anonymizedImageFileExtension;
+    jobs.push_back( job );
+  }
+  listFile.close();
+  std::cout << "Files to anonymize: " << jobs.size() << std::endl;
+
+  //! Parallel jobs must not write the same file, e.g. the default
+  //! outputs of two inputs with the same name in different directories.
+  std::vector<std::string> outputFilenames;
+  for (unsigned int i = 0; i < jobs.size(); i++)
+    outputFilenames.push_back( itksys::SystemTools::CollapseFullPath( jobs[i].OutputFilename.c_str() ) );
+  std::sort( outputFilenames.begin(), outputFilenames.end() );
+  std::vector<std::string>::iterator duplicate = 
+    std::adjacent_find( outputFilenames.begin(), outputFilenames.end() );
+  if (duplicate != outputFilenames.end()) {
+    std::cerr << "Output written by more than one file: " << *duplicate << std::endl;
+    throw "Duplicate output files in file list.";
+  }
 
-  //! Close file.
-  anonymizationFile.close();
-  std::cout << "Anonymization completed." << std::endl;
+  unsigned int failedJobs = 
+    PQCT_ParallelJobs::Run( jobs.size(), AnonymizeFileJob, &jobs );
 
+  std::cout << "Anonymization completed: " 
+	    << jobs.size() - failedJobs << " files, "
+	    << failedJobs << " failed." << std::endl;
 }
 
 
-//! Copy all parameter names and values to text file for validation.
-void PQCT_Analyzer::WriteToTextFile() {
+//! Copy all parameter names and values to text file for validation,
+//! or append the metrics records to the cohort results file.
+void PQCT_Analyzer::WriteQuantification(const std::string & filename) {
+  PQCT_TraceScope traceScope( this->m_Tracer, TRACE_WRITE );
+
+  if (this->m_MetricsAppender != NULL) {
+    this->m_MetricsAppender->Append( this->m_MetricsRecords );
+    return;
+  }
 
   //! Set format of output file.
-  this->m_textFile.setf(std::ios::fixed, std::ios::floatfield);
-  this->m_textFile.precision(FLOAT_PRECISION);
+  std::ostringstream textFile;
+  textFile.setf(std::ios::fixed, std::ios::floatfield);
+  textFile.precision(FLOAT_PRECISION);
 
   // Form the measurement text file.
   // Pass headers
-  this->m_textFile << this->m_TissueShapeEntries.headerString.str();
-  this->m_textFile << this->m_TissueIntensityEntries.headerString.str();
-  this->m_textFile << std::endl;
+  textFile << this->m_TissueShapeEntries.headerString.str();
+  textFile << this->m_TissueIntensityEntries.headerString.str();
+  textFile << std::endl;
 
   // Pass values.
-  this->m_textFile << this->m_TissueShapeEntries.valueString.str();
-  this->m_textFile << this->m_TissueIntensityEntries.valueString.str();
-  this->m_textFile << std::endl;
+  textFile << this->m_TissueShapeEntries.valueString.str();
+  textFile << this->m_TissueIntensityEntries.valueString.str();
+  textFile << std::endl;
 
+  if (this->m_KeepQuantification) {
+    this->m_QuantificationText = textFile.str();
+    return;
+  }
+
+  //! Hand over to the output stage, or write now.
+  if (this->m_OutputWriter != NULL)
+    this->m_OutputWriter->WriteTextFile( filename, textFile.str() );
+  else
+    PQCT_AsyncWriter::WriteTextFileNow( filename, textFile.str() );
+}
+
+
+//! Write the stage trace of the last Execute() if requested.
+void PQCT_Analyzer::WriteTrace() {
+  if ( !this->m_TraceOutput || this->m_Tracer.IsEmpty() )
+    return;
+
+  std::string filename = this->m_outputPath + this->m_SubjectID + traceFileExtension;
+  std::string trace = this->m_Tracer.GetChromeTrace( this->m_SubjectID );
+  if (this->m_OutputWriter != NULL)
+    this->m_OutputWriter->WriteTextFile( filename, trace );
+  else
+    PQCT_AsyncWriter::WriteTextFileNow( filename, trace );
+}
+
+
+//! Save a final label image; the image must not be modified afterwards.
+void PQCT_Analyzer::WriteLabelImage(LabelImageType::Pointer labelImage,
+				    const std::string & filename) {
+  PQCT_TraceScope traceScope( this->m_Tracer, TRACE_WRITE );
+  if (this->m_OutputWriter != NULL)
+    this->m_OutputWriter->WriteLabelImage( labelImage, filename );
+  else
+    PQCT_AsyncWriter::WriteLabelImageNow( labelImage, filename );
 }
 
 
@@ -676,20 +640,88 @@ int PQCT_Analyzer::ParseSegmentationParameterFile(std::string paramsFilename,
 
 
 
+//! Read a parameter file starting from the default values, so that no
+//! setting of a previously loaded file remains.
+int PQCT_Analyzer::LoadParameterFile(const std::string & parameterFilename)
+{
+  this->m_parameterValues.assign( parameterValues,
+				  parameterValues + this->m_numberofParameters );
+  int status = EXIT_FAILURE;
+  try {
+    status = this->ParseSegmentationParameterFile( parameterFilename, false );
+  }
+  catch(const char * Message) {
+    std::cerr << "Error:" << Message << std::endl;
+    this->m_parameterValues.assign( parameterValues,
+				    parameterValues + this->m_numberofParameters );
+  }
+  if ( status == EXIT_FAILURE ) {
+    this->CopyParameterValuesToClassVariables();
+    return EXIT_FAILURE;
+  }
+
+  this->m_ParameterValuesAreSet = true;
+  return EXIT_SUCCESS;
+}
+
+
+//! Set all parameter values at once.
+void PQCT_Analyzer::SetParameterValues(const std::vector<float> & parameterValues)
+{
+  if ( parameterValues.size() != this->m_parameterValues.size() )
+    throw "Wrong number of parameter values.";
+  CheckParameterValues( parameterValues );
+
+  this->m_parameterValues = parameterValues;
+  this->CopyParameterValuesToClassVariables();
+  this->m_ParameterValuesAreSet = true;
+}
+
+
+//! Reject parameter values that select no algorithm.
+void PQCT_Analyzer::CheckParameterValues(const std::vector<float> & parameterValues) {
+  float clusteringMethod = parameterValues[CLUSTERING_METHOD_PARAMETER];
+  if ( clusteringMethod < KMEANS_CLUSTERING ||
+       clusteringMethod > FCM_CLUSTERING ||
+       clusteringMethod != floor( clusteringMethod ) )
+    throw "Unacceptable clustering method.";
+}
+
+
 //! Copy parameter values to program's variables.
 void PQCT_Analyzer::CopyParameterValuesToClassVariables() {
-  this->m_AUtoDensitySlope = this->m_parameterValues[0];
-  this->m_AUtoDensityIntercept = this->m_parameterValues[1];
-  this->m_gradientSigma = this->m_parameterValues[2];
-  this->m_medianFilterKernelLength = this->m_parameterValues[3];
-  this->m_sigmoidBeta = this->m_parameterValues[4];
-  this->m_sigmoidAlpha = (-1) * (this->m_sigmoidBeta / this->m_parameterValues[5] );
-  this->m_fastmarchingStoppingTime = this->m_parameterValues[6];
-  this->m_levelsetPropagationScalingFactor = this->m_parameterValues[7];
-  this->m_levelsetCurvatureScalingFactor = this->m_parameterValues[8];
-  this->m_levelsetAdvectionScalingFactor = this->m_parameterValues[9];
-  this->m_levelsetMaximumIterations = this->m_parameterValues[10];
-  this->m_levelsetMaximumRMSError = this->m_parameterValues[11];
-  this->m_SAT_IMFAT_SeparationAlgorithm = this->m_parameterValues[12];
-  this->m_CT_LegThreshold = this->m_parameterValues[13];
+  CheckParameterValues( this->m_parameterValues );
+  this->m_AUtoDensitySlope = this->m_parameterValues[AUTODENSITY_SLOPE_PARAMETER];
+  this->m_AUtoDensityIntercept = this->m_parameterValues[AUTODENSITY_INTERCEPT_PARAMETER];
+  this->m_CalibrationTable = 
+    PQCT_CalibrationTable::GetTable( this->m_AUtoDensitySlope,
+				     this->m_AUtoDensityIntercept );
+  this->m_gradientSigma = this->m_parameterValues[SMOOTHING_SIGMA_PARAMETER];
+  this->m_medianFilterKernelLength = this->m_parameterValues[MEDIAN_FILTER_RADIUS_PARAMETER];
+  this->m_sigmoidBeta = this->m_parameterValues[SIGMOID_BETA_PARAMETER];
+  this->m_sigmoidAlpha = (-1) * (this->m_sigmoidBeta / this->m_parameterValues[SIGMOID_BETA_ALPHA_RATIO_PARAMETER] );
+  this->m_fastmarchingStoppingTime = this->m_parameterValues[FASTMARCHING_STOPPING_TIME_PARAMETER];
+  this->m_levelsetPropagationScalingFactor = this->m_parameterValues[LEVELSET_PROPAGATION_PARAMETER];
+  this->m_levelsetCurvatureScalingFactor = this->m_parameterValues[LEVELSET_CURVATURE_PARAMETER];
+  this->m_levelsetAdvectionScalingFactor = this->m_parameterValues[LEVELSET_ADVECTION_PARAMETER];
+  this->m_levelsetMaximumIterations = this->m_parameterValues[LEVELSET_MAXIMUM_ITERATIONS_PARAMETER];
+  this->m_levelsetMaximumRMSError = this->m_parameterValues[LEVELSET_MAXIMUM_RMS_ERROR_PARAMETER];
+  this->m_SAT_IMFAT_SeparationAlgorithm = this->m_parameterValues[SAT_IMFAT_SEPARATION_PARAMETER];
+  this->m_CT_LegThreshold = this->m_parameterValues[CT_LEG_THRESHOLD_PARAMETER];
+  //! An output policy set by the caller overrides the parameters.
+  if (this->m_OutputPolicyIsSet)
+    this->m_parameterValues[OUTPUT_POLICY_PARAMETER] = this->m_ExplicitOutputPolicy;
+  this->m_OutputPolicy = this->m_parameterValues[OUTPUT_POLICY_PARAMETER];
+  this->m_TraceOutput = ( this->m_parameterValues[TRACE_OUTPUT_PARAMETER] != 0 );
+  this->m_ClusteringMethod = this->m_parameterValues[CLUSTERING_METHOD_PARAMETER];
+}
+
+
+//! Export a cohort results file to comma-separated text.
+void PQCT_Analyzer::ExportMetricsToCSV() {
+  std::string csvFilename = this->m_outputPath + 
+    this->ExtractFilename( this->ChangeExtension( this->m_PQCTImageFilename, 
+						  metricsCSVFileExtension ) );
+  PQCT_MetricsAppender::ExportCSV( this->m_PQCTImageFilename, csvFilename );
+  std::cout << "Metrics exported to " << csvFilename << std::endl;
 }
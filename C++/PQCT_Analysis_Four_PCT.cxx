@@ -12,23 +12,10 @@
 
 #include <itkSignedMaurerDistanceMapImageFilter.h>
 #include <itkImageRegionIteratorWithIndex.h>
-#include <itkConnectedComponentImageFilter.h>
-#include <itkRelabelComponentImageFilter.h>
 #include <itkBinaryThresholdImageFilter.h>
 #include <itkGrayscaleFillholeImageFilter.h>
 #include <itkImageFileWriter.h>
 
-#include <itkDecisionRule.h>
-#include <itkVector.h>
-#include <itkListSample.h>
-#include <itkKdTree.h>
-#include <itkWeightedCentroidKdTreeGenerator.h>
-#include <itkKdTreeBasedKmeansEstimator.h>
-#include <itkMinimumDecisionRule.h>
-#include <itkEuclideanDistanceMetric.h>
-#include <itkDistanceToCentroidMembershipFunction.h>
-#include <itkSampleClassifierFilter.h>
-#include <ctime>
 
 #include "PQCT_Datatypes.h"
 #include "PQCT_Analysis.h"
@@ -45,7 +32,8 @@ SelectAreaFraction( int label ) {
     LabelDistanceTransformType;
   LabelDistanceTransformType::Pointer ROIDistFilter2 = 
     LabelDistanceTransformType::New();
-  ROIDistFilter2->SetInput( this->m_TissueLabelImage );
+  //! Grafted input: fractions may be selected by concurrent stages.
+  ROIDistFilter2->SetInput( PQCT_GraftImage( this->m_TissueLabelImage.GetPointer() ) );
   ROIDistFilter2->SetUseImageSpacing( true );
   ROIDistFilter2->SetSquaredDistance( true );
   // ROIDistFilter2->SetInsideIsPositive( true );
@@ -121,217 +109,68 @@ void PQCT_Analyzer::Separate_Four_PCT_Tissues() {
 
   //! Apply denoising.
   FloatImageType::Pointer smoothedImage = 
-    this->SmoothInputVolume( this->m_PQCTImage, 
-			     DIFFUSION );
-
-  //! Create vector of samples.
-  typedef itk::Vector<PQCTPixelType, 1> MeasurementVectorType;
-  typedef itk::Statistics::ListSample< MeasurementVectorType > SampleType;
-
-  SampleType::Pointer samples = SampleType::New();
-  MeasurementVectorType mv;
-
-  typedef itk::ImageRegionIteratorWithIndex<LabelImageType> LabelImageIteratorType;
-  LabelImageIteratorType itImage(this->m_TissueLabelImage, 
-				 this->m_TissueLabelImage->GetLargestPossibleRegion());
-  typedef LabelImageType::IndexType LabelImageIndexType;
-  std::vector<LabelImageIndexType> sampleIndices;
-
+    this->GetSmoothedImage( DIFFUSION );
 
   //! Samples are pixel intensities corresponding to 
-  //! previously detected muscle and imfat pixels.
-  //! For each no-background pixel
-  //! add pixel index and intensity to corresponding vectors.
-  for(itImage.GoToBegin();!itImage.IsAtEnd();++itImage) {
-    if ( itImage.Get() != AIR) {
-      sampleIndices.push_back(itImage.GetIndex());  
-      samples->PushBack(smoothedImage->GetPixel(itImage.GetIndex())); // previously: this->m_PQCTImage
-    }
-  }
-  
-  
-  //! Create a kd-tree.
-  typedef itk::Statistics::WeightedCentroidKdTreeGenerator< SampleType >
-    TreeGeneratorType;
-  TreeGeneratorType::Pointer treeGenerator = TreeGeneratorType::New();
-  
-  treeGenerator->SetSample( samples );
-  treeGenerator->SetBucketSize( 16 );
-  treeGenerator->Update();
- 
-  //! Create and run kmeans estimator.
-  typedef TreeGeneratorType::KdTreeType TreeType;
-  typedef itk::Statistics::KdTreeBasedKmeansEstimator<TreeType> EstimatorType;
-  EstimatorType::Pointer estimator = EstimatorType::New();
- 
+  //! previously detected muscle and imfat pixels:
+  //! every non-background pixel.
+  PQCT_LabelLUT sampleLabels( 1 );
+  sampleLabels.Set( AIR, 0 );
+
+  //! Cluster numbers to tissue labels.
+  std::vector<LabelPixelType> classLabels;
+  classLabels.push_back( FAT );
+  classLabels.push_back( MUSCLE );
+  classLabels.push_back( TRAB_BONE );
+  classLabels.push_back( CORT_BONE );
+  classLabels.push_back( H_CORT_BONE );
+
+  //! K-means on the sample histogram, from the priors, and
+  //! classification of the samples in place.
   this->SetTissueClassesNoAir();
-  EstimatorType::ParametersType initialMeans(this->m_TissueClassesVectorNoAir.size());
-  for(int i=0; i<this->m_TissueClassesVectorNoAir.size(); i++)
-    initialMeans[i] = static_cast<double>(this->m_TissueClassesVectorNoAir[i]);
-
-  estimator->SetParameters( initialMeans );
-  estimator->SetKdTree( treeGenerator->GetOutput() );
-  estimator->SetMaximumIteration( 200 );
-  estimator->SetCentroidPositionChangesThreshold(0.0);
-  estimator->StartOptimization();
-
-  EstimatorType::ParametersType estimatedMeans = estimator->GetParameters();
+  std::vector<double> estimatedMeans( this->m_TissueClassesVectorNoAir.begin(),
+				      this->m_TissueClassesVectorNoAir.end() );
+  if ( !PQCT_HistogramKMeans::ClassifyLabels<PQCTPixelType>( smoothedImage->GetBufferPointer(),
+							     this->m_TissueLabelImage->GetBufferPointer(),
+							     PQCT_LabelKernels::GetNumberOfPixels( this->m_TissueLabelImage.GetPointer() ),
+							     sampleLabels,
+							     classLabels,
+							     estimatedMeans ) )
+    throw "K-means clustering failed.";
 
   std::cout << "[";
-  for ( unsigned int i = 0 ; i < this->m_TissueClassesVectorNoAir.size() ; i++ )
+  for ( unsigned int i = 0 ; i < estimatedMeans.size() ; i++ )
     {
     std::cout << estimatedMeans[i] << ", ";
     }
   std::cout << "]" << std::endl;
 
-  //! Create classifier.
-
-  //! Membership function is distance to cluster's centroid.
-  typedef itk::Statistics::DistanceToCentroidMembershipFunction< MeasurementVectorType >
-    MembershipFunctionType;
-  typedef MembershipFunctionType::Pointer                      MembershipFunctionPointer;
-
-  //! Decision rule is minimum distance.
-  typedef itk::Statistics::MinimumDecisionRule DecisionRuleType;
-  DecisionRuleType::Pointer decisionRule = DecisionRuleType::New();
-
-  //! Configure classifier.
-  typedef itk::Statistics::SampleClassifierFilter< SampleType > ClassifierType;
-  ClassifierType::Pointer classifier = ClassifierType::New();
- 
-  classifier->SetDecisionRule(decisionRule);
-  classifier->SetInput( samples );
-  classifier->SetNumberOfClasses( this->m_TissueClassesVectorNoAir.size() );
- 
-  typedef ClassifierType::ClassLabelVectorObjectType               ClassLabelVectorObjectType;
-  typedef ClassifierType::ClassLabelVectorType                     ClassLabelVectorType;
-  typedef ClassifierType::MembershipFunctionVectorObjectType       MembershipFunctionVectorObjectType;
-  typedef ClassifierType::MembershipFunctionVectorType             MembershipFunctionVectorType;
- 
-  ClassLabelVectorObjectType::Pointer  classLabelsObject = ClassLabelVectorObjectType::New();
-  classifier->SetClassLabels( classLabelsObject );
- 
-  ClassLabelVectorType &  classLabelsVector = classLabelsObject->Get();
-  classLabelsVector.push_back( FAT );
-  classLabelsVector.push_back( MUSCLE );
-  classLabelsVector.push_back( TRAB_BONE );
-  classLabelsVector.push_back( CORT_BONE );
-  classLabelsVector.push_back( H_CORT_BONE );
-
-  MembershipFunctionVectorObjectType::Pointer membershipFunctionsObject =
-    MembershipFunctionVectorObjectType::New();
-  classifier->SetMembershipFunctions( membershipFunctionsObject );
- 
-  MembershipFunctionVectorType &  membershipFunctionsVector = membershipFunctionsObject->Get();
- 
-  MembershipFunctionType::CentroidType origin( samples->GetMeasurementVectorSize() );
-  int index = 0;
-  for ( unsigned int i = 0 ; i < this->m_TissueClassesVectorNoAir.size() ; i++ )
-    {
-    MembershipFunctionPointer membershipFunction = MembershipFunctionType::New();
-    for ( unsigned int j = 0 ; j < samples->GetMeasurementVectorSize(); j++ )
-      {
-      origin[j] = estimatedMeans[index++];
-      }
-    membershipFunction->SetCentroid( origin );
-    membershipFunctionsVector.push_back( membershipFunction.GetPointer() );
-    }
-
-  //! Classify samples and set pixel values in label map.
-
-  classifier->Update();
- 
-  const ClassifierType::MembershipSampleType* membershipSample = classifier->GetOutput();
-  ClassifierType::MembershipSampleType::ConstIterator iter = membershipSample->Begin();
-  unsigned int count;
-
-  while ( iter != membershipSample->End() )
-    {
-    // std::cout << "measurement vector = " << iter.GetMeasurementVector()
-    //           << "class label = " << iter.GetClassLabel()
-    //           << std::endl;
-    
-    this->m_TissueLabelImage->SetPixel(sampleIndices[count], iter.GetClassLabel());
-    ++count;
-    ++iter;
-    }
-
 }
 
 
-//! Analysis at 4% tibia.
-void PQCT_Analyzer::Analyze4PCT(){
-
-  //! Open output csv file for writing.
-  std::string prefix = this->m_outputPath + this->m_SubjectID + "_4pct";
-  std::string tempFilename = prefix + quantificationFileExtension;
-  this->m_textFile.open(tempFilename.c_str());
-  if (this->m_textFile.fail()) {
-    std::cerr << "unable to open file for writing" << std::endl;
-    return;
-  }
-
-  //! Start clock.
-  std::clock_t begin = std::clock();
-
-  //! Foreground background segmentation.
-  std::cout << "--------Quantification at 4% Tibia--------" << std::endl;
-
-  //! Segment tissue types using K-means clustering.
-  this->ApplyKMeans();
-
-
-  // //! Re-cluster all leg tissues (no air).
-  // this->Separate_Four_PCT_Tissues();
-
+//! Segment the bone at 4%: largest bone component of the K-means
+//! labels, hole filling and level sets from its median point.
+void PQCT_Analyzer::Segment4PCTBone(){
 
   //! Pick trabecular-cortical bone class and
-  //! apply threshold to mask out other connected components.
-  typedef itk::BinaryThresholdImageFilter<LabelImageType, 
-    LabelImageType> 
-    SelectBoneFilterType;
-  SelectBoneFilterType::Pointer boneThresholdFilter = 
-    SelectBoneFilterType::New();
-  boneThresholdFilter->SetInput( this->m_KmeansLabelImage );
-  boneThresholdFilter->SetInsideValue( 1 );
-  boneThresholdFilter->SetOutsideValue( 0 );
-  boneThresholdFilter->SetLowerThreshold( TRAB_BONE );
-  boneThresholdFilter->SetUpperThreshold( H_CORT_BONE );  // number of regions we want detected.
-  boneThresholdFilter->Update();
-
-  //! Apply connected component labeling on bone.
-  typedef itk::ConnectedComponentImageFilter<LabelImageType, 
-    LabelImageType, 
-    LabelImageType> 
-    ConnectedComponentLabelFilterType;
-  ConnectedComponentLabelFilterType::Pointer labelMaskFilter = 
-    ConnectedComponentLabelFilterType::New();
-  labelMaskFilter->SetInput( boneThresholdFilter->GetOutput() );
-  labelMaskFilter->SetMaskImage( boneThresholdFilter->GetOutput() );
-  labelMaskFilter->SetFullyConnected( true );
-  labelMaskFilter->Update();
-
-  //! Rank components wrt to size and relabel.
-  typedef itk::RelabelComponentImageFilter<LabelImageType, 
-    LabelImageType> 
-    RelabelFilterType;
-  RelabelFilterType::Pointer  sortLabelsImageFilter = 
-    RelabelFilterType::New();
-  sortLabelsImageFilter->SetInput( labelMaskFilter->GetOutput() );
-  sortLabelsImageFilter->Update();
+  //! label its connected components, ranked by size.
+  size_t numberOfPixels =
+    PQCT_LabelKernels::GetNumberOfPixels( this->m_TissueLabelImage.GetPointer() );
+  LabelImageType::Pointer boneComponents;
+  std::vector<PQCT_ComponentType> components;
+  {
+    PQCT_TraceScope traceScope( this->m_Tracer, TRACE_CCL );
+    boneComponents = 
+      PQCT_ConnectedComponents::Label( this->m_KmeansLabelImage.GetPointer(),
+				       (LabelPixelType) TRAB_BONE, (LabelPixelType) H_CORT_BONE,
+				       components );
+  }
 
   //! Pick the largest component.
-  typedef itk::ImageRegionIteratorWithIndex<LabelImageType> LabelImageIteratorType;
-  LabelImageIteratorType itImage(this->m_TissueLabelImage, 
-				 this->m_TissueLabelImage->GetBufferedRegion());
-
-  for(itImage.GoToBegin();!itImage.IsAtEnd();++itImage) {
-    LabelImageType::IndexType idx = itImage.GetIndex();
-    if( sortLabelsImageFilter->GetOutput()->GetPixel(idx) == 1 )
-      itImage.Set( BONE_4PCT );
-    else 
-      itImage.Set( AIR );
-  }
+  PQCT_LabelKernels::ThresholdToMask<LabelPixelType>( boneComponents->GetBufferPointer(),
+						      this->m_TissueLabelImage->GetBufferPointer(),
+						      numberOfPixels,
+						      1, 1, BONE_4PCT, AIR );
 
   //! Hole filling.
   typedef itk::GrayscaleFillholeImageFilter<LabelImageType,LabelImageType> 
@@ -343,15 +182,15 @@ void PQCT_Analyzer::Analyze4PCT(){
   // binaryHoleFillingFilter->InPlaceOn(); 
   binaryHoleFillingFilter->Update();
 
-  for(itImage.GoToBegin();!itImage.IsAtEnd();++itImage) {
-    LabelImageType::IndexType idx = itImage.GetIndex();
-    if( binaryHoleFillingFilter->GetOutput()->GetPixel(idx) == BONE_4PCT )
-      itImage.Set( BONE_4PCT );
-    else 
-      itImage.Set( AIR );
-  }
+  PQCT_LabelKernels::ThresholdToMask<LabelPixelType>( binaryHoleFillingFilter->GetOutput()->GetBufferPointer(),
+						      this->m_TissueLabelImage->GetBufferPointer(),
+						      numberOfPixels,
+						      BONE_4PCT, BONE_4PCT, BONE_4PCT, AIR );
 
   //! Initial ROI around the median point.
+  typedef itk::ImageRegionIteratorWithIndex<LabelImageType> LabelImageIteratorType;
+  LabelImageIteratorType itImage(this->m_TissueLabelImage, 
+				 this->m_TissueLabelImage->GetBufferedRegion());
   //! Compute median point of ROI.
   std::vector<int> xCoordinates,yCoordinates;
   LabelImageType::IndexType medianIdx;
@@ -379,73 +218,81 @@ void PQCT_Analyzer::Analyze4PCT(){
   //! Segmentation by level sets.
   this->m_TissueLabelImage = 
     this->SegmentbyLevelSets( medianIdx, BONE_4PCT );
+}
 
-  //! Compute centroid and density over whole detected bone.
-  this->LogHeaderInfo();
-  this->ComputeTissueShapeAttributes();
-  this->ComputeTissueIntensityAttributes();
-
-  //! Label 50% trab. bone area.
-  LabelImageType::Pointer outputlabelImage = 
-    this->SelectAreaFraction( BONE_4PCT_50PCT );
-
-  //! Compute centroid and density over 50% trabecular bone.
-  //! radius using itk iterator.
-  this->ComputeTissueShapeAttributes( outputlabelImage );
-  this->ComputeTissueIntensityAttributes( outputlabelImage );
-
-   //! Label 10% trab. bone area.
-  LabelImageType::Pointer outputlabelImage2 = 
-    this->SelectAreaFraction( BONE_4PCT_10PCT );
 
-  //! Compute centroid and density over 10% trabecular bone.
-  //! radius using itk iterator.
-  this->ComputeTissueShapeAttributes( outputlabelImage2 );
-  this->ComputeTissueIntensityAttributes( outputlabelImage2 );
+//! Analysis at 4% tibia.
+void PQCT_Analyzer::Analyze4PCT(){
 
-  //! Foreground/background segmentation and computation of region attributes.
-  LabelImageType::Pointer totalLegCrosssectionImage = 
-    // this->ForegroundBackgroundSegmentationByFastMarching();
-    this->ForegroundBackgroundSegmentationAfterKMeans();
+  //! Output filename prefix.
+  std::string prefix = this->m_outputPath + this->m_SubjectID + "_4pct";
 
-  //! Compute centroid and density over total leg.
-  this->ComputeTissueShapeAttributes( totalLegCrosssectionImage );
-  this->ComputeTissueIntensityAttributes( totalLegCrosssectionImage );
+  //! Start clock.
+  double begin = this->m_Tracer.GetElapsedTime();
 
- //! Stop the clock.
-  std::clock_t end = std::clock();
-  double elapsed_secs = double(end - begin) / CLOCKS_PER_SEC;
+  //! Foreground background segmentation.
+  std::cout << "--------Quantification at 4% Tibia--------" << std::endl;
 
-  //! Pass Elapsed_Time to stringstream.
-  std::stringstream tempStringstream;
-  tempStringstream.str("");
-  tempStringstream <<  "Elapsed_Time";
-  this->m_TissueIntensityEntries.headerString.width(STRING_LENGTH);
-  this->m_TissueIntensityEntries.headerString << tempStringstream.str();
+  //! Workflow stages. The total leg needs only the K-means labels and
+  //! runs alongside the bone segmentation; the whole bone, 50% and 10%
+  //! trabecular areas are measured concurrently.
+  MeasurementType boneMeasurement, area50Measurement, area10Measurement,
+    totalLegMeasurement;
+  area50Measurement.Label = BONE_4PCT_50PCT;
+  area10Measurement.Label = BONE_4PCT_10PCT;
+
+  typedef PQCT_MemberStage<PQCT_Analyzer> StageType;
+  typedef PQCT_MemberDataStage<PQCT_Analyzer, MeasurementType> MeasurementStageType;
+  PQCT_StageGraph stages;
+  //! Segment tissue types using K-means clustering.
+  stages.AddStage( "KMeans",
+		   new StageType( this, &PQCT_Analyzer::ApplyKMeans ),
+		   "", "KmeansLabels" );
+  stages.AddStage( "BoneSegmentation",
+		   new StageType( this, &PQCT_Analyzer::Segment4PCTBone ),
+		   "KmeansLabels", "TissueLabels" );
+  //! Centroid and density over whole detected bone.
+  stages.AddStage( "Bone",
+		   new MeasurementStageType( this, &PQCT_Analyzer::MeasureTissueLabels,
+					     &boneMeasurement ),
+		   "TissueLabels", "BoneMeasurement" );
+  //! Centroid and density over 50% and 10% trabecular bone.
+  stages.AddStage( "Area50PCT",
+		   new MeasurementStageType( this, &PQCT_Analyzer::MeasureAreaFraction,
+					     &area50Measurement ),
+		   "TissueLabels", "Area50PCTMeasurement" );
+  stages.AddStage( "Area10PCT",
+		   new MeasurementStageType( this, &PQCT_Analyzer::MeasureAreaFraction,
+					     &area10Measurement ),
+		   "TissueLabels", "Area10PCTMeasurement" );
+  //! Centroid and density over total leg.
+  stages.AddStage( "TotalLeg",
+		   new MeasurementStageType( this, &PQCT_Analyzer::MeasureTotalLeg,
+					     &totalLegMeasurement ),
+		   "KmeansLabels", "TotalLegMeasurement" );
+  stages.Execute();
+
+  //! Quantification entries in workflow order.
+  this->LogHeaderInfo();
+  this->MergeTissueAttributes( boneMeasurement.Results );
+  this->MergeTissueAttributes( area50Measurement.Results );
+  this->MergeTissueAttributes( area10Measurement.Results );
+  this->MergeTissueAttributes( totalLegMeasurement.Results );
 
-  this->m_TissueIntensityEntries.valueString.width(STRING_LENGTH); 
-  this->m_TissueIntensityEntries.valueString << elapsed_secs;
+  //! Pass Elapsed_Time, stage times and memory to the quantification entries.
+  this->AddProcessingStatistics( begin );
 
   // Write results to text file.
-  this->WriteToTextFile();
+  this->WriteQuantification( prefix + quantificationFileExtension );
 
   //! Create label map that shows regions.
-  LabelImageType::Pointer outputlabelImage3 = 
-    this->OverlayLabelImages(this->m_TissueLabelImage,
-  			     outputlabelImage);
-
-  LabelImageType::Pointer outputlabelImage4 = 
-    this->OverlayLabelImages(outputlabelImage2,
-  			     outputlabelImage3);
+  std::vector<LabelImageType::Pointer> regionImages;
+  regionImages.push_back( this->m_TissueLabelImage );
+  regionImages.push_back( area50Measurement.LabelImage );
+  regionImages.push_back( area10Measurement.LabelImage );
+  LabelImageType::Pointer outputlabelImage = 
+    this->OverlayLabelImages( regionImages );
 
   //! Save output image to file.
-  itk::ImageFileWriter<LabelImageType>::Pointer labelWriter2 = 
-    itk::ImageFileWriter<LabelImageType>::New();
-  labelWriter2->SetInput( outputlabelImage4 ); 
-  labelWriter2->SetFileName( prefix + labelImageFileExtension );
-  labelWriter2->Update();
-  labelWriter2 = 0;
-
-  // Close output stream before exiting.
-  this->m_textFile.close();
+  this->WriteLabelImage( outputlabelImage, prefix + labelImageFileExtension );
 }
@@ -15,10 +15,7 @@
 #include <itkBinaryMorphologicalClosingImageFilter.h>
 // #include <itkBinaryFillholeImageFilter.h>
 #include <itkVotingBinaryIterativeHoleFillingImageFilter.h>
-#include <itkConnectedComponentImageFilter.h>
-#include <itkRelabelComponentImageFilter.h>
 #include <itkImageFileWriter.h>
-#include <ctime>
 
 #include "PQCT_Datatypes.h"
 #include "PQCT_Analysis.h"
@@ -29,17 +26,14 @@
 void PQCT_Analyzer::CloseSubcutaneousFatRegion() {
 
   //! Apply threshold to select subcutaneous fat region.
-  typedef itk::BinaryThresholdImageFilter<LabelImageType, 
-    LabelImageType> 
-    SelectSubcutaneousFatRegionFilterType;
-  SelectSubcutaneousFatRegionFilterType::Pointer subcutaneousfatRegionThresholdFilter = 
-    SelectSubcutaneousFatRegionFilterType::New();
-  subcutaneousfatRegionThresholdFilter->SetInput( this->m_TissueLabelImage );
-  subcutaneousfatRegionThresholdFilter->SetInsideValue( 1 );
-  subcutaneousfatRegionThresholdFilter->SetOutsideValue( 0 );
-  subcutaneousfatRegionThresholdFilter->SetLowerThreshold( SUB_FAT );
-  subcutaneousfatRegionThresholdFilter->SetUpperThreshold( SUB_FAT );  
-  subcutaneousfatRegionThresholdFilter->Update();
+  size_t numberOfPixels =
+    PQCT_LabelKernels::GetNumberOfPixels( this->m_TissueLabelImage.GetPointer() );
+  LabelImageType::Pointer subcutaneousFatMask =
+    PQCT_LabelKernels::CreateLabelImage( this->m_TissueLabelImage.GetPointer() );
+  PQCT_LabelKernels::ThresholdToMask<LabelPixelType>( this->m_TissueLabelImage->GetBufferPointer(),
+						      subcutaneousFatMask->GetBufferPointer(),
+						      numberOfPixels,
+						      SUB_FAT, SUB_FAT, 1, 0 );
 
 
   //! Hole filling using iterative binary voting.
@@ -50,7 +44,7 @@ void PQCT_Analyzer::CloseSubcutaneousFatRegion() {
 
   LabelImageType::SizeType indexRadius;
   indexRadius.Fill( 5 );
-  votingBinaryIterativeHoleFillingImageFilter->SetInput( subcutaneousfatRegionThresholdFilter->GetOutput() );
+  votingBinaryIterativeHoleFillingImageFilter->SetInput( subcutaneousFatMask );
   votingBinaryIterativeHoleFillingImageFilter->SetForegroundValue( 1 );
   votingBinaryIterativeHoleFillingImageFilter->SetBackgroundValue( 0 );
   votingBinaryIterativeHoleFillingImageFilter->SetRadius( indexRadius );
@@ -60,16 +54,14 @@ void PQCT_Analyzer::CloseSubcutaneousFatRegion() {
 
 
   //! Update tissue label map.
-  typedef itk::ImageRegionIteratorWithIndex<LabelImageType> LabelImageIteratorType;
-  LabelImageIteratorType itImage(this->m_TissueLabelImage, 
-  				 this->m_TissueLabelImage->GetBufferedRegion());
-  for(itImage.GoToBegin();!itImage.IsAtEnd();++itImage) {
-    LabelImageType::IndexType idx = itImage.GetIndex();
-    // if( binaryHoleFillingFilter->GetOutput()->GetPixel(idx) == 1 )
-    if( votingBinaryIterativeHoleFillingImageFilter->GetOutput()->GetPixel(idx) == 
-    	votingBinaryIterativeHoleFillingImageFilter->GetForegroundValue() )
-      itImage.Set( SUB_FAT );
-  }
+  LabelPixelType foregroundValue = 
+    votingBinaryIterativeHoleFillingImageFilter->GetForegroundValue();
+  PQCT_LabelKernels::MaskedRemapLabels<LabelPixelType>( this->m_TissueLabelImage->GetBufferPointer(),
+							votingBinaryIterativeHoleFillingImageFilter->GetOutput()->GetBufferPointer(),
+							numberOfPixels,
+							foregroundValue, foregroundValue,
+							PQCT_LabelLUT( SUB_FAT ),
+							PQCT_LabelLUT() );
 
 
 }
@@ -79,17 +71,14 @@ void PQCT_Analyzer::CloseSubcutaneousFatRegion() {
 void PQCT_Analyzer::RemoveSkinByMorphologicalErosion() {
 
   //! Threshold background.
-  typedef itk::BinaryThresholdImageFilter<LabelImageType, 
-    LabelImageType> 
-    SelectWholeLegFilterType;
-  SelectWholeLegFilterType::Pointer selectWholeLegFilter = 
-    SelectWholeLegFilterType::New();
-  selectWholeLegFilter->SetInput( this->m_TissueLabelImage );
-  selectWholeLegFilter->SetInsideValue( 1 );
-  selectWholeLegFilter->SetOutsideValue( 0 );
-  selectWholeLegFilter->SetLowerThreshold( FAT ); // FAT
-  selectWholeLegFilter->SetUpperThreshold( TOT_AREA );  // TOT_AREA
-  selectWholeLegFilter->Update();
+  size_t numberOfPixels =
+    PQCT_LabelKernels::GetNumberOfPixels( this->m_TissueLabelImage.GetPointer() );
+  LabelImageType::Pointer wholeLegMask =
+    PQCT_LabelKernels::CreateLabelImage( this->m_TissueLabelImage.GetPointer() );
+  PQCT_LabelKernels::ThresholdToMask<LabelPixelType>( this->m_TissueLabelImage->GetBufferPointer(),
+						      wholeLegMask->GetBufferPointer(),
+						      numberOfPixels,
+						      FAT, TOT_AREA, 1, 0 );
 
   //! Generate structuring element.
   float structureElementRadius = 2.0F;
@@ -110,51 +99,40 @@ void PQCT_Analyzer::RemoveSkinByMorphologicalErosion() {
   BinaryErosionFilterType::Pointer binaryErosionFilter = 
     BinaryErosionFilterType::New();
   binaryErosionFilter->SetKernel( structuringElement );
-  binaryErosionFilter->SetInput( selectWholeLegFilter->GetOutput() );
+  binaryErosionFilter->SetInput( wholeLegMask );
   binaryErosionFilter->SetForegroundValue( 1 );
   binaryErosionFilter->Update();
 
   //! Update tissue label map.
-  typedef itk::ImageRegionIteratorWithIndex<LabelImageType> LabelImageIteratorType;
-  LabelImageIteratorType itImage(this->m_TissueLabelImage, 
-				 this->m_TissueLabelImage->GetBufferedRegion());
-  for(itImage.GoToBegin();!itImage.IsAtEnd();++itImage) {
-    LabelImageType::IndexType idx = itImage.GetIndex();
-    if( binaryErosionFilter->GetOutput()->GetPixel(idx) == AIR &&
-	itImage.Get() == SUB_FAT )
-      itImage.Set( AIR );
-  }
+  PQCT_LabelLUT skinLUT;
+  skinLUT.Set( SUB_FAT, AIR );
+  PQCT_LabelKernels::MaskedRemapLabels<LabelPixelType>( this->m_TissueLabelImage->GetBufferPointer(),
+							binaryErosionFilter->GetOutput()->GetBufferPointer(),
+							numberOfPixels,
+							AIR, AIR,
+							skinLUT,
+							PQCT_LabelLUT() );
 }
 
 
 //! Apply fat threshold to remove outliers.
 void PQCT_Analyzer::ApplyFatThreshold()
 {
-  //! Pick trabecular bone class and
-  //! apply threshold to mask out other connected components.
-  typedef itk::BinaryThresholdImageFilter<PQCTImageType, 
-    LabelImageType> 
-    SelectFatFilterType;
-  SelectFatFilterType::Pointer selectFatFilter = 
-    SelectFatFilterType::New();
-  selectFatFilter->SetInput( this->m_PQCTImage );
-  selectFatFilter->SetInsideValue( 1 );
-  selectFatFilter->SetOutsideValue( 0 );
-  selectFatFilter->SetLowerThreshold( -179 );
-  selectFatFilter->SetUpperThreshold( 0 );
-  selectFatFilter->Update();
-
-  //! Remove fat pixels outside this range.
-  typedef itk::ImageRegionIteratorWithIndex<LabelImageType> LabelImageIteratorType;
-  LabelImageIteratorType itImage(this->m_TissueLabelImage, 
-				 this->m_TissueLabelImage->GetBufferedRegion());
-
-  for(itImage.GoToBegin();!itImage.IsAtEnd();++itImage) {
-    LabelImageType::IndexType idx = itImage.GetIndex();
-    if( selectFatFilter->GetOutput()->GetPixel(idx) == 0 && 
-	( itImage.Get() == SUB_FAT || itImage.Get() == IM_FAT) )
-      itImage.Set( AIR );
-  }
+  //! Remove fat pixels outside the fat density range, thresholding
+  //! and relabeling in one pass.
+  size_t numberOfPixels =
+    PQCT_LabelKernels::GetNumberOfPixels( this->m_TissueLabelImage.GetPointer() );
+  if ( PQCT_LabelKernels::GetNumberOfPixels( this->m_PQCTImage.GetPointer() ) != numberOfPixels )
+    throw "Density and label images differ in size.";
+  PQCT_LabelLUT outlierLUT;
+  outlierLUT.Set( SUB_FAT, AIR );
+  outlierLUT.Set( IM_FAT, AIR );
+  PQCT_LabelKernels::MaskedRemapLabels<PQCTPixelType>( this->m_TissueLabelImage->GetBufferPointer(),
+						       this->m_PQCTImage->GetBufferPointer(),
+						       numberOfPixels,
+						       -179, 0,
+						       PQCT_LabelLUT(),
+						       outlierLUT );
 
 }
 
@@ -163,15 +141,13 @@ void PQCT_Analyzer::ApplyFatThreshold()
 void PQCT_Analyzer::MergeSubcutaneousWithInterMuscularFat() {
   
   //! Label fat pixels.
-  typedef itk::ImageRegionIteratorWithIndex<LabelImageType> LabelImageIteratorType;
-  LabelImageIteratorType itImage(this->m_TissueLabelImage, 
-				 this->m_TissueLabelImage->GetBufferedRegion());
-
-  for(itImage.GoToBegin();!itImage.IsAtEnd();++itImage) {
-    LabelImageType::IndexType idx = itImage.GetIndex();
-    if( itImage.Get() == SUB_FAT | itImage.Get() == IM_FAT)
-      itImage.Set( FAT ); 
-  }
+  PQCT_LabelLUT fatLUT;
+  fatLUT.Set( SUB_FAT, FAT );
+  fatLUT.Set( IM_FAT, FAT );
+  PQCT_LabelKernels::RemapLabels( this->m_TissueLabelImage->GetBufferPointer(),
+				  this->m_TissueLabelImage->GetBufferPointer(),
+				  PQCT_LabelKernels::GetNumberOfPixels( this->m_TissueLabelImage.GetPointer() ),
+				  fatLUT );
 
 }
 
@@ -180,53 +156,31 @@ void PQCT_Analyzer::MergeSubcutaneousWithInterMuscularFat() {
 void PQCT_Analyzer::IdentifySubcutaneousAndInterMuscularFat() {
 
   //! Select fat region and
-  //! apply threshold to mask out other connected components.
-  typedef itk::BinaryThresholdImageFilter<LabelImageType, 
-    LabelImageType> 
-    SelectFatRegionFilterType;
-  SelectFatRegionFilterType::Pointer fattyRegionThresholdFilter = 
-    SelectFatRegionFilterType::New();
-  fattyRegionThresholdFilter->SetInput( this->m_KmeansLabelImage );
-  fattyRegionThresholdFilter->SetInsideValue( 1 );
-  fattyRegionThresholdFilter->SetOutsideValue( 0 );
-  fattyRegionThresholdFilter->SetLowerThreshold( FAT );
-  fattyRegionThresholdFilter->SetUpperThreshold( FAT );  // number of regions we want detected.
-  fattyRegionThresholdFilter->Update();
-
-  //! Apply connected component labeling on fat.
-  typedef itk::ConnectedComponentImageFilter<LabelImageType, 
-    LabelImageType, 
-    LabelImageType> 
-    ConnectedComponentLabelFilterType;
-  ConnectedComponentLabelFilterType::Pointer labelMaskFilter = 
-    ConnectedComponentLabelFilterType::New();
-  labelMaskFilter->SetInput( fattyRegionThresholdFilter->GetOutput() );
-  labelMaskFilter->SetMaskImage( fattyRegionThresholdFilter->GetOutput() );
-  labelMaskFilter->SetFullyConnected( true );
-  labelMaskFilter->Update();
-
-  //! Rank components wrt to size and relabel.
-  typedef itk::RelabelComponentImageFilter<LabelImageType, 
-    LabelImageType> 
-    RelabelFilterType;
-  RelabelFilterType::Pointer  sortLabelsImageFilter = 
-    RelabelFilterType::New();
-  sortLabelsImageFilter->SetInput( labelMaskFilter->GetOutput() );
-  sortLabelsImageFilter->Update();
+  //! label its connected components, ranked by size.
+  size_t numberOfPixels =
+    PQCT_LabelKernels::GetNumberOfPixels( this->m_TissueLabelImage.GetPointer() );
+  LabelImageType::Pointer fatComponents;
+  std::vector<PQCT_ComponentType> components;
+  {
+    PQCT_TraceScope traceScope( this->m_Tracer, TRACE_CCL );
+    fatComponents = 
+      PQCT_ConnectedComponents::Label( this->m_KmeansLabelImage.GetPointer(),
+				       (LabelPixelType) FAT, (LabelPixelType) FAT,
+				       components );
+  }
 
   //! Pick the largest component as subcutaneous and rest as inter-muscular.
   //! Label subcutaneous and inter-muscular fat pixels.
-  typedef itk::ImageRegionIteratorWithIndex<LabelImageType> LabelImageIteratorType;
-  LabelImageIteratorType itImage(this->m_TissueLabelImage, 
-				 this->m_TissueLabelImage->GetBufferedRegion());
-
-  for(itImage.GoToBegin();!itImage.IsAtEnd();++itImage) {
-    LabelImageType::IndexType idx = itImage.GetIndex();
-    if( sortLabelsImageFilter->GetOutput()->GetPixel(idx) == 1 )
-      itImage.Set( SUB_FAT ); // previously: FAT, SUB_FAT
-    else if( sortLabelsImageFilter->GetOutput()->GetPixel(idx) > 1 )
-      itImage.Set( IM_FAT );  // previously: FAT, MUSCLE, IM_FAT
-  }
+  PQCT_LabelLUT componentClasses( 0 );
+  componentClasses.Set( 1, 1 );
+  componentClasses.SetRange( 2, LABELLUTSIZE - 1, 2 );
+  std::vector<PQCT_LabelLUT> classLUTs( 3 );
+  classLUTs[1] = PQCT_LabelLUT( SUB_FAT ); // previously: FAT, SUB_FAT
+  classLUTs[2] = PQCT_LabelLUT( IM_FAT );  // previously: FAT, MUSCLE, IM_FAT
+  PQCT_LabelKernels::RemapLabelsByMask( this->m_TissueLabelImage->GetBufferPointer(),
+					fatComponents->GetBufferPointer(),
+					numberOfPixels,
+					componentClasses, classLUTs );
 
 
   //! Morphological closing to subcutaneous fat region.
@@ -290,17 +244,16 @@ void PQCT_Analyzer::IdentifySubcutaneousAndInterMuscularFatByGAC() {
 			      FOREGROUND );
 
   //! Label fat compartments according to separation mask.
-  typedef itk::ImageRegionIteratorWithIndex<LabelImageType> LabelImageIteratorType;
-  LabelImageIteratorType itImage(this->m_TissueLabelImage, 
-				 this->m_TissueLabelImage->GetBufferedRegion());
-  for(itImage.GoToBegin();!itImage.IsAtEnd();++itImage) {
-    LabelImageType::IndexType idx = itImage.GetIndex();
-    if( NonSubcutaneousMask->GetPixel(idx) != FOREGROUND && 
-	( itImage.Get() == FAT || itImage.Get() == MUSCLE ) )
-      itImage.Set( SUB_FAT ); // previously: FAT, SUB_FAT
-    else if( NonSubcutaneousMask->GetPixel(idx) == FOREGROUND && itImage.Get() == FAT )
-      itImage.Set( IM_FAT );  // previously: FAT, MUSCLE, IM_FAT
-  }
+  PQCT_LabelLUT interMuscularLUT, subcutaneousLUT;
+  interMuscularLUT.Set( FAT, IM_FAT );  // previously: FAT, MUSCLE, IM_FAT
+  subcutaneousLUT.Set( FAT, SUB_FAT );  // previously: FAT, SUB_FAT
+  subcutaneousLUT.Set( MUSCLE, SUB_FAT );
+  PQCT_LabelKernels::MaskedRemapLabels<LabelPixelType>( this->m_TissueLabelImage->GetBufferPointer(),
+							NonSubcutaneousMask->GetBufferPointer(),
+							PQCT_LabelKernels::GetNumberOfPixels( this->m_TissueLabelImage.GetPointer() ),
+							FOREGROUND, FOREGROUND,
+							interMuscularLUT,
+							subcutaneousLUT );
 
   //! Morphological closing to subcutaneous fat region.
   this->CloseSubcutaneousFatRegion();
@@ -315,26 +268,8 @@ void PQCT_Analyzer::IdentifySubcutaneousAndInterMuscularFatByGAC() {
 }
 
 
-//! Analyze at 66% Tibia.
-void PQCT_Analyzer::Analyze66PCT(){
-
-  // Open output csv file for writing.
-  std::string prefix = this->m_outputPath + this->m_SubjectID + "_66pct";
-  std::string tempFilename = prefix + quantificationFileExtension;
-  this->m_textFile.open(tempFilename.c_str());
-  if (this->m_textFile.fail()) {
-    std::cerr << "unable to open file for writing" << std::endl;
-    return;
-  }
-  
-  //! Start clock.
-  std::clock_t begin = std::clock();
-
-  //! Foreground background segmentation.
-  std::cout << "--------Quantification at 66% Tibia--------" << std::endl;
-
-  // 1. Segment tissue types.
-  this->ApplyKMeans();
+//! Separate fat types, bone marrow and bones at 66% from the K-means labels.
+void PQCT_Analyzer::Segment66PCTTissues(){
 
   //! 2. Separate intermuscular from subcutaneous fat.
   //! Label connected fat components.
@@ -383,50 +318,36 @@ void PQCT_Analyzer::Analyze66PCT(){
   //  else 
   //    itImage.Set( AIR );
   //}
+}
 
 
- // //! 5. Compute: bone, muscle, fat areas, and bone, muscle density.
-  // // Display results.
-  this->LogHeaderInfo();
-  this->ComputeTissueShapeAttributes();
-  this->ComputeTissueIntensityAttributes();
-
-  //! Foreground/background segmentation and computation of region attributes.
-  LabelImageType::Pointer totalLegCrosssectionImage = 
-    // this->ForegroundBackgroundSegmentationByFastMarching();
-    this->ForegroundBackgroundSegmentationAfterKMeans();
+//! Analyze at 66% tibia.
+void PQCT_Analyzer::Analyze66PCT(){
 
-  //! Compute centroid and density over total leg.
-  this->ComputeTissueShapeAttributes( totalLegCrosssectionImage );
-  this->ComputeTissueIntensityAttributes( totalLegCrosssectionImage );
+  //! Output filename prefix.
+  std::string prefix = this->m_outputPath + this->m_SubjectID + "_66pct";
+  
+  //! Start clock.
+  double begin = this->m_Tracer.GetElapsedTime();
 
- //! Stop the clock.
-  std::clock_t end = std::clock();
-  double elapsed_secs = double(end - begin) / CLOCKS_PER_SEC;
+  //! Foreground background segmentation.
+  std::cout << "--------Quantification at 66% Tibia--------" << std::endl;
 
-  //! Pass Elapsed_Time to stringstream.
-  std::stringstream tempStringstream;
-  tempStringstream.str("");
-  tempStringstream <<  "Elapsed_Time";
-  this->m_TissueIntensityEntries.headerString.width(STRING_LENGTH);
-  this->m_TissueIntensityEntries.headerString << tempStringstream.str();
+  //! 1. Segment tissue types, then 2.-4. separate fat, marrow and bones,
+  //! while the total leg is measured from the K-means labels.
+  //! 5. Compute: bone, muscle, fat areas, and bone, muscle density.
+  MeasurementType tissueMeasurement, totalLegMeasurement;
+  this->ExecuteTissueStages( &PQCT_Analyzer::Segment66PCTTissues,
+			     tissueMeasurement,
+			     totalLegMeasurement );
 
-  this->m_TissueIntensityEntries.valueString.width(STRING_LENGTH); 
-  this->m_TissueIntensityEntries.valueString << elapsed_secs;
+  //! Pass Elapsed_Time, stage times and memory to the quantification entries.
+  this->AddProcessingStatistics( begin );
 
   // Write results to text file.
-  this->WriteToTextFile();
+  this->WriteQuantification( prefix + quantificationFileExtension );
 
   // Save output image to file.
-  itk::ImageFileWriter<LabelImageType>::Pointer labelWriter2 = 
-    itk::ImageFileWriter<LabelImageType>::New();
-  labelWriter2->SetInput( this->m_TissueLabelImage ); 
-  labelWriter2->SetFileName( prefix + 
-			     labelImageFileExtension );
-  labelWriter2->Update();
-  labelWriter2 = 0;
-
-  // Close output stream before exiting.
-  this->m_textFile.close();
+  this->WriteLabelImage( this->m_TissueLabelImage, prefix + labelImageFileExtension );
 
 }
@@ -0,0 +1,171 @@
+/*===========================================================================
+
+  Program:   Bone, muscle and fat quantification from PQCT data.
+  Module:    $RCSfile: PQCT_AsyncWriter.cxx,v $
+  Language:  C++
+  Date:      $Date: 2012/08/24 10:00:00 $
+  Version:   $Revision: 0.1 $
+  Author:    S. K. Makrogiannis
+  3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+  =============================================================================*/
+
+#include <iostream>
+#include <fstream>
+
+#include <itkImageFileWriter.h>
+
+#include "PQCT_AsyncWriter.h"
+
+
+//! Start the writer thread.
+PQCT_AsyncWriter::PQCT_AsyncWriter(unsigned int queueCapacity) {
+  this->m_QueueCapacity = (queueCapacity > 0) ? queueCapacity : 1;
+  this->m_JobsInProgress = 0;
+  this->m_NumberOfFailedWrites = 0;
+  this->m_StopRequested = false;
+
+  this->m_QueueNotFull = itk::ConditionVariable::New();
+  this->m_QueueNotEmpty = itk::ConditionVariable::New();
+  this->m_QueueDrained = itk::ConditionVariable::New();
+
+  this->m_Threader = itk::MultiThreader::New();
+  this->m_ThreadID = this->m_Threader->SpawnThread( WriterThreadCallback, this );
+}
+
+
+//! Drain the queue, then join the writer thread.
+PQCT_AsyncWriter::~PQCT_AsyncWriter() {
+  this->Flush();
+
+  this->m_Lock.Lock();
+  this->m_StopRequested = true;
+  this->m_QueueNotEmpty->Broadcast();
+  this->m_Lock.Unlock();
+
+  this->m_Threader->TerminateThread( this->m_ThreadID );
+}
+
+
+void PQCT_AsyncWriter::WriteLabelImage(LabelImageType::Pointer labelImage,
+				       const std::string & filename) {
+  OutputJobType job;
+  job.LabelImage = labelImage;
+  job.Filename = filename;
+  this->Enqueue( job );
+}
+
+
+void PQCT_AsyncWriter::WriteTextFile(const std::string & filename,
+				     const std::string & contents) {
+  OutputJobType job;
+  job.Filename = filename;
+  job.Contents = contents;
+  this->Enqueue( job );
+}
+
+
+//! Add a job, waiting while the queue is full.
+void PQCT_AsyncWriter::Enqueue(const OutputJobType & job) {
+  this->m_Lock.Lock();
+  while (this->m_Queue.size() >= this->m_QueueCapacity)
+    this->m_QueueNotFull->Wait( &this->m_Lock );
+  this->m_Queue.push_back( job );
+  this->m_QueueNotEmpty->Signal();
+  this->m_Lock.Unlock();
+}
+
+
+//! Wait for the queue to drain.
+unsigned int PQCT_AsyncWriter::Flush() {
+  this->m_Lock.Lock();
+  while (!this->m_Queue.empty() || this->m_JobsInProgress > 0)
+    this->m_QueueDrained->Wait( &this->m_Lock );
+  unsigned int numberOfFailedWrites = this->m_NumberOfFailedWrites;
+  this->m_NumberOfFailedWrites = 0;
+  this->m_Lock.Unlock();
+  return numberOfFailedWrites;
+}
+
+
+ITK_THREAD_RETURN_TYPE PQCT_AsyncWriter::WriterThreadCallback(void * arg) {
+  itk::MultiThreader::ThreadInfoStruct * threadInfo = 
+    static_cast<itk::MultiThreader::ThreadInfoStruct *>( arg );
+  static_cast<PQCT_AsyncWriter *>( threadInfo->UserData )->ProcessQueue();
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+
+//! Writer thread: take jobs until stopped; the lock is released while writing.
+void PQCT_AsyncWriter::ProcessQueue() {
+  this->m_Lock.Lock();
+  while (true) {
+    while (this->m_Queue.empty() && !this->m_StopRequested)
+      this->m_QueueNotEmpty->Wait( &this->m_Lock );
+    if (this->m_Queue.empty())
+      break;
+
+    OutputJobType job = this->m_Queue.front();
+    this->m_Queue.pop_front();
+    this->m_JobsInProgress++;
+    this->m_QueueNotFull->Signal();
+    this->m_Lock.Unlock();
+
+    bool failed = false;
+    try {
+      if (job.LabelImage.IsNotNull())
+	WriteLabelImageNow( job.LabelImage, job.Filename );
+      else
+	WriteTextFileNow( job.Filename, job.Contents );
+    }
+    catch(const char * Message) {
+      std::cerr << "Error writing " << job.Filename << ": " << Message << std::endl;
+      failed = true;
+    }
+    catch(itk::ExceptionObject & e) {
+      std::cerr << "Exception writing " << job.Filename << std::endl;
+      std::cerr << e << std::endl;
+      failed = true;
+    }
+    //! Release the image before taking the lock again.
+    job.LabelImage = 0;
+
+    this->m_Lock.Lock();
+    this->m_JobsInProgress--;
+    if (failed)
+      this->m_NumberOfFailedWrites++;
+    if (this->m_Queue.empty() && this->m_JobsInProgress == 0)
+      this->m_QueueDrained->Broadcast();
+  }
+  this->m_Lock.Unlock();
+}
+
+
+//! Synchronous label image write.
+void PQCT_AsyncWriter::WriteLabelImageNow(LabelImageType::Pointer labelImage,
+					  const std::string & filename) {
+  itk::ImageFileWriter<LabelImageType>::Pointer labelWriter = 
+    itk::ImageFileWriter<LabelImageType>::New();
+  labelWriter->SetInput( labelImage ); 
+  labelWriter->SetFileName( filename );
+  labelWriter->Update();
+  labelWriter = 0;
+}
+
+
+//! Synchronous text file write.
+void PQCT_AsyncWriter::WriteTextFileNow(const std::string & filename,
+					const std::string & contents) {
+  std::ofstream textFile;
+  textFile.open( filename.c_str() );
+  if (textFile.fail()) {
+    throw "unable to open file for writing";
+    return;
+  }
+  textFile << contents;
+  textFile.close();
+  if (textFile.fail()) {
+    throw "unable to write file";
+    return;
+  }
+}
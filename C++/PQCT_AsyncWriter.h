@@ -0,0 +1,85 @@
+/*===========================================================================
+
+Program:   Bone, muscle and fat quantification from PQCT data.
+Module:    $RCSfile: PQCT_AsyncWriter.h,v $
+Language:  C++
+Date:      $Date: 2012/08/24 10:00:00 $
+Version:   $Revision: 0.1 $
+Author:    S. K. Makrogiannis
+3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+=============================================================================*/
+
+#ifndef __PQCT_AsyncWriter_h__
+#define __PQCT_AsyncWriter_h__
+
+#include <string>
+#include <deque>
+
+#include <itkMultiThreader.h>
+#include <itkSimpleMutexLock.h>
+#include <itkConditionVariable.h>
+
+#include "PQCT_Datatypes.h"
+
+
+//! Output stage that writes finished label images and quantification
+//! files on a background thread. The queue is bounded: when it is full
+//! the producer waits, so memory stays limited when the file system is
+//! slower than the analysis. Queued images must not be modified by the
+//! caller afterwards.
+class PQCT_AsyncWriter {
+
+ public:
+  PQCT_AsyncWriter(unsigned int queueCapacity = 8);
+  //! Flushes pending writes and stops the thread.
+  ~PQCT_AsyncWriter();
+
+  void WriteLabelImage(LabelImageType::Pointer labelImage,
+		       const std::string & filename);
+  void WriteTextFile(const std::string & filename,
+		     const std::string & contents);
+
+  //! Wait until every queued write has completed. Returns the number of
+  //! writes that failed since the previous flush.
+  unsigned int Flush();
+
+  //! Synchronous writes, used when no writer is attached. Throw on failure.
+  static void WriteLabelImageNow(LabelImageType::Pointer labelImage,
+				 const std::string & filename);
+  static void WriteTextFileNow(const std::string & filename,
+			       const std::string & contents);
+
+ private:
+  PQCT_AsyncWriter(const PQCT_AsyncWriter &);  // Not implemented.
+  void operator=(const PQCT_AsyncWriter &);    // Not implemented.
+
+  //! One pending write: a label image, or text contents when no image.
+  typedef struct t_OutputJobType
+  {
+    LabelImageType::Pointer LabelImage;
+    std::string Filename;
+    std::string Contents;
+  }
+  OutputJobType;
+
+  void Enqueue(const OutputJobType & job);
+  static ITK_THREAD_RETURN_TYPE WriterThreadCallback(void * arg);
+  void ProcessQueue();
+
+  std::deque<OutputJobType> m_Queue;
+  unsigned int m_QueueCapacity;
+  unsigned int m_JobsInProgress;
+  unsigned int m_NumberOfFailedWrites;
+  bool m_StopRequested;
+
+  itk::SimpleMutexLock m_Lock;
+  itk::ConditionVariable::Pointer m_QueueNotFull;
+  itk::ConditionVariable::Pointer m_QueueNotEmpty;
+  itk::ConditionVariable::Pointer m_QueueDrained;
+
+  itk::MultiThreader::Pointer m_Threader;
+  int m_ThreadID;
+};
+
+#endif
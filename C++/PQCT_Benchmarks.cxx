@@ -0,0 +1,957 @@
+/*===========================================================================
+
+Program:   Bone, muscle and fat quantification from PQCT data.
+Module:    $RCSfile: PQCT_Benchmarks.cxx,v $
+Language:  C++
+Date:      $Date: 2012/09/04 10:00:00 $
+Version:   $Revision: 0.1 $
+Author:    S. K. Makrogiannis
+3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+=============================================================================*/
+
+#if defined(_MSC_VER)
+#pragma warning ( disable : 4786 )
+#endif
+
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+#include <itkMultiThreader.h>
+#include <itkRealTimeClock.h>
+#include <itkImageDuplicator.h>
+#include <itkBinaryThresholdImageFilter.h>
+#include <itkConnectedComponentImageFilter.h>
+#include <itkRelabelComponentImageFilter.h>
+#include <itkScalarImageKmeansImageFilter.h>
+#include <itkVector.h>
+#include <itkListSample.h>
+#include <itkWeightedCentroidKdTreeGenerator.h>
+#include <itkKdTreeBasedKmeansEstimator.h>
+#include <itkMinimumDecisionRule.h>
+#include <itkDistanceToCentroidMembershipFunction.h>
+#include <itkSampleClassifierFilter.h>
+
+#include "PQCT_Datatypes.h"
+#include "PQCT_Analysis.h"
+#include "PQCT_Phantom.h"
+#include "PQCT_HistogramKMeans.h"
+#include "PQCT_CohortBenchmark.h"
+
+
+//! A kernel is slower than its baseline when its median exceeds the
+//! baseline median by more than this fraction.
+#define REGRESSIONTOLERANCE 0.10
+
+//! Noise of the phantom images (mg/cm^3).
+#define PHANTOMNOISESD 20.0F
+
+//! Pixel spacing of the phantom images (mm).
+#define PHANTOMSPACING 0.5F
+
+
+//! Discards std::cout for the life of the silencer, also when an
+//! exception leaves the scope.
+class StandardOutputSilencer {
+
+ public:
+  StandardOutputSilencer() {
+    this->m_Buffer = std::cout.rdbuf( NULL );
+  };
+  ~StandardOutputSilencer() {
+    std::cout.rdbuf( this->m_Buffer );
+  };
+
+ private:
+  StandardOutputSilencer(const StandardOutputSilencer &);  // Not implemented.
+  void operator=(const StandardOutputSilencer &);          // Not implemented.
+
+  std::streambuf * m_Buffer;
+};
+
+
+//! Timing of one kernel at one image size and thread count.
+typedef struct t_BenchmarkResultType
+{
+  std::string Kernel;
+  unsigned int Size;
+  unsigned int Threads;
+  double MedianTime;  // ms
+  double P95Time;     // ms
+  double Throughput;  // Mpixels/s at the median
+}
+BenchmarkResultType;
+
+
+//! Times the analyzer primitives on a phantom image. Each kernel runs on
+//! the state that the analyzer would have at that stage; the state is
+//! restored before each run, outside the timed region.
+class PQCT_AnalyzerBenchmark {
+
+ public:
+  PQCT_AnalyzerBenchmark(unsigned int size, unsigned int repetitions);
+
+  //! Time all kernels with the given number of ITK threads.
+  void Run(unsigned int threads, std::vector<BenchmarkResultType> & results);
+
+  //! Run the primitives and the ITK filters they replace on the same
+  //! inputs. Returns the number of pixels labeled differently.
+  unsigned long Compare();
+
+ private:
+  typedef void (PQCT_AnalyzerBenchmark::*KernelType)();
+
+  //! Comparisons.
+  unsigned long CompareConnectedComponents(unsigned int threads);
+  unsigned long CompareKMeans();
+  unsigned long CompareLabelClassifier();
+  template<class TImage>
+    unsigned long CompareLabelClassifier(const std::string & name,
+					 const TImage * image,
+					 const PQCT_LabelLUT & sampleLabels,
+					 const std::vector<LabelPixelType> & classLabels,
+					 const std::vector<double> & initialMeans);
+
+  void TimeKernel(const std::string & name,
+		  KernelType setup,
+		  KernelType kernel,
+		  unsigned int threads,
+		  std::vector<BenchmarkResultType> & results);
+
+  //! Setups.
+  void NoSetup() {};
+  void RestoreRawImage();
+  void ClearTissueClasses();
+
+  //! Kernels.
+  void Calibrate();
+  void SmoothGaussian();
+  void SmoothDiffusion();
+  void SmoothMedian();
+  void KMeans();
+  void ConnectedComponents();
+  void ConnectedComponentsITK();
+  void FastMarching();
+  void GeodesicActiveContours();
+  void AreaFraction();
+  void LabelStatistics();
+
+  PQCT_Analyzer m_Analyzer;
+  unsigned int m_Size, m_Repetitions;
+  PQCTImageType::Pointer m_RawImage;
+  LabelImageType::Pointer m_LabelImage, m_AreaLabelImage, m_ROIImage;
+  FloatImageType::Pointer m_SpeedImage;
+  LabelImageType::IndexType m_Seed;
+};
+
+
+PQCT_AnalyzerBenchmark::PQCT_AnalyzerBenchmark(unsigned int size,
+					       unsigned int repetitions) {
+  this->m_Size = size;
+  this->m_Repetitions = repetitions;
+
+  //! Analyze as 38% tibia, without writing any image.
+  this->m_Analyzer.SetWorkflowID( PQCT_THIRTYEIGHT_PCT_TIBIA );
+  this->m_Analyzer.SetOutputPolicy( OUTPUT_PRODUCTION );
+  std::ostringstream subjectID;
+  subjectID << "Phantom" << size;
+  this->m_Analyzer.m_SubjectID = subjectID.str();
+
+  //! The phantom stands in for the raw attenuation image too: the cost of
+  //! the calibration table lookup does not depend on the pixel values.
+  this->m_RawImage = PQCT_Phantom::CreateLegImage( size, PHANTOMSPACING,
+						   PHANTOMNOISESD, size );
+  typedef itk::ImageDuplicator< PQCTImageType > DuplicatorType;
+  DuplicatorType::Pointer duplicator = DuplicatorType::New();
+  duplicator->SetInputImage( this->m_RawImage );
+  duplicator->Update();
+  this->m_Analyzer.m_PQCTImage = duplicator->GetOutput();
+
+  this->m_LabelImage = PQCT_Phantom::CreateLegLabelImage( size, PHANTOMSPACING );
+  this->m_Seed = PQCT_Phantom::GetTibiaCenter( size );
+
+  //! Bone of the 4% workflow, for the area fraction.
+  this->m_AreaLabelImage = PQCT_Phantom::CreateLegLabelImage( size, PHANTOMSPACING );
+  LabelPixelType * labels = this->m_AreaLabelImage->GetBufferPointer();
+  const size_t numberOfPixels =
+    this->m_AreaLabelImage->GetBufferedRegion().GetNumberOfPixels();
+  for (size_t i = 0; i < numberOfPixels; i++)
+    labels[i] = ( labels[i] == CORT_BONE || labels[i] == BONE_INT ) ? BONE_4PCT : AIR;
+}
+
+
+void PQCT_AnalyzerBenchmark::RestoreRawImage() {
+  memcpy( this->m_Analyzer.m_PQCTImage->GetBufferPointer(),
+	  this->m_RawImage->GetBufferPointer(),
+	  this->m_RawImage->GetBufferedRegion().GetNumberOfPixels() *
+	  sizeof( PQCTPixelType ) );
+}
+
+
+void PQCT_AnalyzerBenchmark::ClearTissueClasses() {
+  this->m_Analyzer.m_TissueClassesVector.clear();
+}
+
+
+void PQCT_AnalyzerBenchmark::Calibrate() {
+  this->m_Analyzer.CalibrateImage();
+}
+
+
+void PQCT_AnalyzerBenchmark::SmoothGaussian() {
+  this->m_Analyzer.SmoothInputVolume( this->m_Analyzer.m_PQCTImage, GAUSSIAN );
+}
+
+
+void PQCT_AnalyzerBenchmark::SmoothDiffusion() {
+  this->m_Analyzer.SmoothInputVolume( this->m_Analyzer.m_PQCTImage, DIFFUSION );
+}
+
+
+void PQCT_AnalyzerBenchmark::SmoothMedian() {
+  this->m_Analyzer.SmoothInputVolume( this->m_Analyzer.m_PQCTImage, MEDIAN );
+}
+
+
+//! Clustering only: the smoothed image is cached before timing.
+void PQCT_AnalyzerBenchmark::KMeans() {
+  this->m_Analyzer.ApplyKMeans();
+}
+
+
+//! The bone labeling of IdentifyTibiaAndFibula().
+void PQCT_AnalyzerBenchmark::ConnectedComponents() {
+  std::vector<PQCT_ComponentType> components;
+  PQCT_ConnectedComponents::Label( this->m_LabelImage.GetPointer(),
+				   (LabelPixelType) CORT_BONE,
+				   (LabelPixelType) BONE_INT,
+				   components );
+}
+
+
+//! The same with the ITK filters, for reference: threshold, fully
+//! connected components and relabeling by size.
+static LabelImageType::Pointer LabelComponentsITK(LabelImageType::Pointer labelImage) {
+  typedef itk::BinaryThresholdImageFilter<LabelImageType, LabelImageType>
+    ThresholdFilterType;
+  ThresholdFilterType::Pointer thresholdFilter = ThresholdFilterType::New();
+  thresholdFilter->SetInput( labelImage );
+  thresholdFilter->SetInsideValue( 1 );
+  thresholdFilter->SetOutsideValue( 0 );
+  thresholdFilter->SetLowerThreshold( CORT_BONE );
+  thresholdFilter->SetUpperThreshold( BONE_INT );
+  thresholdFilter->Update();
+
+  typedef itk::ConnectedComponentImageFilter<LabelImageType,
+    LabelImageType,
+    LabelImageType>
+    ConnectedComponentLabelFilterType;
+  ConnectedComponentLabelFilterType::Pointer labelFilter =
+    ConnectedComponentLabelFilterType::New();
+  labelFilter->SetInput( thresholdFilter->GetOutput() );
+  labelFilter->SetMaskImage( thresholdFilter->GetOutput() );
+  labelFilter->SetFullyConnected( true );
+
+  typedef itk::RelabelComponentImageFilter<LabelImageType, LabelImageType>
+    RelabelFilterType;
+  RelabelFilterType::Pointer relabelFilter = RelabelFilterType::New();
+  relabelFilter->SetInput( labelFilter->GetOutput() );
+  relabelFilter->Update();
+  return relabelFilter->GetOutput();
+}
+
+
+void PQCT_AnalyzerBenchmark::ConnectedComponentsITK() {
+  LabelComponentsITK( this->m_LabelImage );
+}
+
+
+void PQCT_AnalyzerBenchmark::FastMarching() {
+  this->m_Analyzer.InitializeROIbyFastMarching( this->m_SpeedImage,
+						this->m_Seed,
+						this->m_Analyzer.m_fastmarchingStoppingTime );
+}
+
+
+void PQCT_AnalyzerBenchmark::GeodesicActiveContours() {
+  this->m_Analyzer.ApplyGeodesicActiveContoursToLabelImage( this->m_ROIImage,
+							    this->m_SpeedImage,
+							    FOREGROUND );
+}
+
+
+void PQCT_AnalyzerBenchmark::AreaFraction() {
+  this->m_Analyzer.SelectAreaFraction( BONE_4PCT_50PCT );
+}
+
+
+void PQCT_AnalyzerBenchmark::LabelStatistics() {
+  AttributeResultsType results;
+  this->m_Analyzer.ComputeTissueAttributes( this->m_LabelImage, results );
+}
+
+
+void PQCT_AnalyzerBenchmark::TimeKernel(const std::string & name,
+					KernelType setup,
+					KernelType kernel,
+					unsigned int threads,
+					std::vector<BenchmarkResultType> & results) {
+  itk::RealTimeClock::Pointer clock = itk::RealTimeClock::New();
+  std::vector<double> samples;
+
+  //! One untimed run to warm caches and lazily built tables.
+  (this->*setup)();
+  (this->*kernel)();
+
+  for (unsigned int i = 0; i < this->m_Repetitions; i++) {
+    (this->*setup)();
+    this->m_Analyzer.m_Tracer.Reset();
+
+    //! Progress messages of the analyzer are not timed.
+    double start, stop;
+    {
+      StandardOutputSilencer silencer;
+      start = clock->GetTimeInSeconds();
+      (this->*kernel)();
+      stop = clock->GetTimeInSeconds();
+    }
+
+    samples.push_back( ( stop - start ) * 1000.0 );
+  }
+  std::sort( samples.begin(), samples.end() );
+
+  BenchmarkResultType result;
+  result.Kernel = name;
+  result.Size = this->m_Size;
+  result.Threads = threads;
+  result.MedianTime = samples[ samples.size() / 2 ];
+  if ( samples.size() % 2 == 0 )
+    result.MedianTime = 0.5 * ( result.MedianTime + samples[ samples.size() / 2 - 1 ] );
+  result.P95Time =
+    samples[ (size_t) ceil( 0.95 * samples.size() ) - 1 ];
+  result.Throughput = result.MedianTime > 0 ?
+    (double) this->m_Size * this->m_Size / ( result.MedianTime * 1000.0 ) : 0.0;
+  results.push_back( result );
+
+  std::cout << name << " " << this->m_Size << "x" << this->m_Size
+	    << " threads " << threads
+	    << ": median " << result.MedianTime << " ms"
+	    << ", p95 " << result.P95Time << " ms"
+	    << ", " << result.Throughput << " Mpixels/s" << std::endl;
+}
+
+
+void PQCT_AnalyzerBenchmark::Run(unsigned int threads,
+				 std::vector<BenchmarkResultType> & results) {
+  itk::MultiThreader::SetGlobalDefaultNumberOfThreads( threads );
+  {
+    StandardOutputSilencer silencer;
+    this->RestoreRawImage();
+    this->m_Analyzer.m_DerivedImages.Clear();
+
+    //! Inputs of the later stages, computed once per thread count.
+    this->m_Analyzer.GetSmoothedImage( MEDIAN );
+    this->m_SpeedImage =
+      this->m_Analyzer.GetSpeedImage( this->m_Analyzer.m_sigmoidAlpha,
+				      this->m_Analyzer.m_sigmoidBeta );
+    this->m_ROIImage =
+      this->m_Analyzer.InitializeROIbyFastMarching( this->m_SpeedImage,
+						    this->m_Seed,
+						    this->m_Analyzer.m_fastmarchingStoppingTime );
+  }
+
+  this->TimeKernel( "Calibrate", &PQCT_AnalyzerBenchmark::RestoreRawImage,
+		    &PQCT_AnalyzerBenchmark::Calibrate, threads, results );
+  this->RestoreRawImage();
+  this->TimeKernel( "SmoothGaussian", &PQCT_AnalyzerBenchmark::NoSetup,
+		    &PQCT_AnalyzerBenchmark::SmoothGaussian, threads, results );
+  this->TimeKernel( "SmoothDiffusion", &PQCT_AnalyzerBenchmark::NoSetup,
+		    &PQCT_AnalyzerBenchmark::SmoothDiffusion, threads, results );
+  this->TimeKernel( "SmoothMedian", &PQCT_AnalyzerBenchmark::NoSetup,
+		    &PQCT_AnalyzerBenchmark::SmoothMedian, threads, results );
+  this->TimeKernel( "KMeans", &PQCT_AnalyzerBenchmark::ClearTissueClasses,
+		    &PQCT_AnalyzerBenchmark::KMeans, threads, results );
+  this->TimeKernel( "ConnectedComponents", &PQCT_AnalyzerBenchmark::NoSetup,
+		    &PQCT_AnalyzerBenchmark::ConnectedComponents, threads, results );
+  this->TimeKernel( "ConnectedComponentsITK", &PQCT_AnalyzerBenchmark::NoSetup,
+		    &PQCT_AnalyzerBenchmark::ConnectedComponentsITK, threads, results );
+  this->TimeKernel( "FastMarching", &PQCT_AnalyzerBenchmark::NoSetup,
+		    &PQCT_AnalyzerBenchmark::FastMarching, threads, results );
+  this->TimeKernel( "GeodesicActiveContours", &PQCT_AnalyzerBenchmark::NoSetup,
+		    &PQCT_AnalyzerBenchmark::GeodesicActiveContours, threads, results );
+
+  this->m_Analyzer.m_TissueLabelImage = this->m_AreaLabelImage;
+  this->TimeKernel( "SelectAreaFraction", &PQCT_AnalyzerBenchmark::NoSetup,
+		    &PQCT_AnalyzerBenchmark::AreaFraction, threads, results );
+  this->TimeKernel( "LabelStatistics", &PQCT_AnalyzerBenchmark::NoSetup,
+		    &PQCT_AnalyzerBenchmark::LabelStatistics, threads, results );
+}
+
+
+//! 1, 2, 4, ... and all processors.
+static void GetConcurrencyLevels(std::vector<unsigned int> & levels) {
+  unsigned int processors =
+    itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+  for (unsigned int level = 1; level < processors; level *= 2)
+    levels.push_back( level );
+  levels.push_back( processors );
+}
+
+
+//! Number of pixels where two label images differ, reported per check.
+static unsigned long CountDifferences(const std::string & name,
+				      const LabelImageType * image,
+				      const LabelImageType * referenceImage) {
+  if ( image->GetBufferedRegion() != referenceImage->GetBufferedRegion() )
+    throw "Compared images differ in size.";
+  const LabelPixelType * labels = image->GetBufferPointer();
+  const LabelPixelType * referenceLabels = referenceImage->GetBufferPointer();
+  const size_t numberOfPixels = image->GetBufferedRegion().GetNumberOfPixels();
+  unsigned long differences = 0;
+  for (size_t i = 0; i < numberOfPixels; i++)
+    if ( labels[i] != referenceLabels[i] )
+      differences++;
+  std::cout << ( differences > 0 ? "MISMATCH " : "MATCH " ) << name << ": "
+	    << differences << " of " << numberOfPixels
+	    << " pixels differ" << std::endl;
+  return differences;
+}
+
+
+//! Bone components of IdentifyTibiaAndFibula(), against the ITK chain.
+unsigned long PQCT_AnalyzerBenchmark::CompareConnectedComponents(unsigned int threads) {
+  std::vector<PQCT_ComponentType> components;
+  LabelImageType::Pointer labelImage =
+    PQCT_ConnectedComponents::Label( this->m_LabelImage.GetPointer(),
+				     (LabelPixelType) CORT_BONE,
+				     (LabelPixelType) BONE_INT,
+				     components,
+				     threads );
+  LabelImageType::Pointer referenceImage = LabelComponentsITK( this->m_LabelImage );
+
+  std::ostringstream name;
+  name << "ConnectedComponents " << this->m_Size << "x" << this->m_Size
+       << " threads " << threads;
+  return CountDifferences( name.str(), labelImage, referenceImage );
+}
+
+
+//! Clustering of ApplyKMeans(), from the same priors, against the
+//! scalar image k-means filter.
+unsigned long PQCT_AnalyzerBenchmark::CompareKMeans() {
+  FloatImageType::Pointer smoothedImage;
+  {
+    StandardOutputSilencer silencer;
+    this->RestoreRawImage();
+    this->m_Analyzer.m_DerivedImages.Clear();
+    smoothedImage = this->m_Analyzer.GetSmoothedImage( MEDIAN );
+  }
+
+  this->ClearTissueClasses();
+  this->m_Analyzer.SetTissueClasses();
+  std::vector<double> means( this->m_Analyzer.m_TissueClassesVector.begin(),
+			     this->m_Analyzer.m_TissueClassesVector.end() );
+  LabelImageType::Pointer labelImage =
+    PQCT_LabelKernels::CreateLabelImage( smoothedImage.GetPointer() );
+  if ( !PQCT_HistogramKMeans::Classify( smoothedImage->GetBufferPointer(),
+					labelImage->GetBufferPointer(),
+					PQCT_LabelKernels::GetNumberOfPixels( smoothedImage.GetPointer() ),
+					means ) )
+    throw "Histogram k-means does not apply to the phantom.";
+
+  typedef itk::ScalarImageKmeansImageFilter<FloatImageType>
+    ScalarImageKmeansImageFilterType;
+  ScalarImageKmeansImageFilterType::Pointer scalarImageKmeansImageFilter =
+    ScalarImageKmeansImageFilterType::New();
+  scalarImageKmeansImageFilter->SetInput( smoothedImage );
+  for (unsigned int i = 0; i < this->m_Analyzer.m_TissueClassesVector.size(); i++)
+    scalarImageKmeansImageFilter->AddClassWithInitialMean( this->m_Analyzer.m_TissueClassesVector[i] );
+  scalarImageKmeansImageFilter->Update();
+
+  std::ostringstream name;
+  name << "KMeans " << this->m_Size << "x" << this->m_Size;
+  return CountDifferences( name.str(), labelImage,
+			   scalarImageKmeansImageFilter->GetOutput() );
+}
+
+
+//! Clustering and classification of the selected pixels with a list
+//! sample, the kd-tree k-means estimator and the sample classifier, as
+//! Separate_Four_PCT_Tissues() and SeparateIMFATFromMuscle() did.
+template<class TImage>
+static LabelImageType::Pointer
+ClassifyLabelsITK(const TImage * image,
+		  const LabelImageType * labelImage,
+		  const PQCT_LabelLUT & sampleLabels,
+		  const std::vector<LabelPixelType> & classLabels,
+		  const std::vector<double> & initialMeans) {
+  typedef itk::ImageDuplicator< LabelImageType > DuplicatorType;
+  DuplicatorType::Pointer duplicator = DuplicatorType::New();
+  duplicator->SetInputImage( labelImage );
+  duplicator->Update();
+  LabelImageType::Pointer outputImage = duplicator->GetOutput();
+
+  //! Samples in buffer order.
+  typedef itk::Vector<PQCTPixelType, 1> MeasurementVectorType;
+  typedef itk::Statistics::ListSample< MeasurementVectorType > SampleType;
+  SampleType::Pointer samples = SampleType::New();
+  const typename TImage::PixelType * values = image->GetBufferPointer();
+  LabelPixelType * labels = outputImage->GetBufferPointer();
+  const LabelPixelType * selected = sampleLabels.GetTable();
+  const size_t numberOfPixels = PQCT_LabelKernels::GetNumberOfPixels( labelImage );
+  for (size_t i = 0; i < numberOfPixels; i++)
+    if ( selected[ labels[i] ] ) {
+      MeasurementVectorType mv;
+      mv[0] = (PQCTPixelType) values[i];
+      samples->PushBack( mv );
+    }
+
+  typedef itk::Statistics::WeightedCentroidKdTreeGenerator< SampleType >
+    TreeGeneratorType;
+  typename TreeGeneratorType::Pointer treeGenerator = TreeGeneratorType::New();
+  treeGenerator->SetSample( samples );
+  treeGenerator->SetBucketSize( 16 );
+  treeGenerator->Update();
+
+  typedef typename TreeGeneratorType::KdTreeType TreeType;
+  typedef itk::Statistics::KdTreeBasedKmeansEstimator<TreeType> EstimatorType;
+  typename EstimatorType::Pointer estimator = EstimatorType::New();
+  typename EstimatorType::ParametersType means( initialMeans.size() );
+  for (unsigned int i = 0; i < initialMeans.size(); i++)
+    means[i] = initialMeans[i];
+  estimator->SetParameters( means );
+  estimator->SetKdTree( treeGenerator->GetOutput() );
+  estimator->SetMaximumIteration( KMEANSMAXIMUMITERATIONS );
+  estimator->SetCentroidPositionChangesThreshold( 0.0 );
+  estimator->StartOptimization();
+  means = estimator->GetParameters();
+
+  //! Nearest centroid.
+  typedef itk::Statistics::DistanceToCentroidMembershipFunction< MeasurementVectorType >
+    MembershipFunctionType;
+  typedef itk::Statistics::SampleClassifierFilter< SampleType > ClassifierType;
+  typedef itk::Statistics::MinimumDecisionRule DecisionRuleType;
+  DecisionRuleType::Pointer decisionRule = DecisionRuleType::New();
+  typename ClassifierType::Pointer classifier = ClassifierType::New();
+  classifier->SetDecisionRule( decisionRule );
+  classifier->SetInput( samples );
+  classifier->SetNumberOfClasses( classLabels.size() );
+
+  typename ClassifierType::ClassLabelVectorObjectType::Pointer classLabelsObject =
+    ClassifierType::ClassLabelVectorObjectType::New();
+  for (unsigned int i = 0; i < classLabels.size(); i++)
+    classLabelsObject->Get().push_back( classLabels[i] );
+  classifier->SetClassLabels( classLabelsObject );
+
+  typename ClassifierType::MembershipFunctionVectorObjectType::Pointer membershipFunctionsObject =
+    ClassifierType::MembershipFunctionVectorObjectType::New();
+  typename MembershipFunctionType::CentroidType centroid( samples->GetMeasurementVectorSize() );
+  for (unsigned int i = 0; i < classLabels.size(); i++) {
+    typename MembershipFunctionType::Pointer membershipFunction = MembershipFunctionType::New();
+    centroid[0] = means[i];
+    membershipFunction->SetCentroid( centroid );
+    membershipFunctionsObject->Get().push_back( membershipFunction.GetPointer() );
+  }
+  classifier->SetMembershipFunctions( membershipFunctionsObject );
+  classifier->Update();
+
+  //! Write back in the order the samples were taken.
+  typename ClassifierType::MembershipSampleType::ConstIterator iter =
+    classifier->GetOutput()->Begin();
+  for (size_t i = 0; i < numberOfPixels; i++)
+    if ( selected[ labels[i] ] ) {
+      labels[i] = (LabelPixelType) iter.GetClassLabel();
+      ++iter;
+    }
+  return outputImage;
+}
+
+
+template<class TImage>
+unsigned long
+PQCT_AnalyzerBenchmark::CompareLabelClassifier(const std::string & name,
+					       const TImage * image,
+					       const PQCT_LabelLUT & sampleLabels,
+					       const std::vector<LabelPixelType> & classLabels,
+					       const std::vector<double> & initialMeans) {
+  LabelImageType::Pointer referenceImage =
+    ClassifyLabelsITK( image, this->m_LabelImage.GetPointer(),
+		       sampleLabels, classLabels, initialMeans );
+
+  typedef itk::ImageDuplicator< LabelImageType > DuplicatorType;
+  DuplicatorType::Pointer duplicator = DuplicatorType::New();
+  duplicator->SetInputImage( this->m_LabelImage );
+  duplicator->Update();
+  LabelImageType::Pointer labelImage = duplicator->GetOutput();
+  std::vector<double> means( initialMeans );
+  if ( !PQCT_HistogramKMeans::ClassifyLabels<PQCTPixelType>( image->GetBufferPointer(),
+							     labelImage->GetBufferPointer(),
+							     PQCT_LabelKernels::GetNumberOfPixels( labelImage.GetPointer() ),
+							     sampleLabels,
+							     classLabels,
+							     means ) )
+    throw "Histogram k-means does not apply to the phantom.";
+
+  std::ostringstream fullName;
+  fullName << name << " " << this->m_Size << "x" << this->m_Size;
+  return CountDifferences( fullName.str(), labelImage, referenceImage );
+}
+
+
+//! The two classifications of labeled pixels: every tissue of the 4%
+//! tibia on the smoothed image, and muscle against IMFAT of the mid
+//! thigh on the raw image.
+unsigned long PQCT_AnalyzerBenchmark::CompareLabelClassifier() {
+  FloatImageType::Pointer smoothedImage;
+  {
+    StandardOutputSilencer silencer;
+    this->RestoreRawImage();
+    this->m_Analyzer.m_DerivedImages.Clear();
+    smoothedImage = this->m_Analyzer.GetSmoothedImage( DIFFUSION );
+  }
+
+  //! Priors of the 4% tibia.
+  this->m_Analyzer.SetWorkflowID( PQCT_FOUR_PCT_TIBIA );
+  this->m_Analyzer.SetTissueClassesNoAir();
+  this->m_Analyzer.SetWorkflowID( PQCT_THIRTYEIGHT_PCT_TIBIA );
+  std::vector<double> means( this->m_Analyzer.m_TissueClassesVectorNoAir.begin(),
+			     this->m_Analyzer.m_TissueClassesVectorNoAir.end() );
+
+  PQCT_LabelLUT sampleLabels( 1 );
+  sampleLabels.Set( AIR, 0 );
+  std::vector<LabelPixelType> classLabels;
+  classLabels.push_back( FAT );
+  classLabels.push_back( MUSCLE );
+  classLabels.push_back( TRAB_BONE );
+  classLabels.push_back( CORT_BONE );
+  classLabels.push_back( H_CORT_BONE );
+  unsigned long differences =
+    this->CompareLabelClassifier( "TissueClassifier", smoothedImage.GetPointer(),
+				  sampleLabels, classLabels, means );
+
+  PQCT_LabelLUT muscleLabels( 0 );
+  muscleLabels.Set( MUSCLE, 1 );
+  muscleLabels.Set( IM_FAT, 1 );
+  std::vector<LabelPixelType> muscleClassLabels;
+  muscleClassLabels.push_back( IM_FAT );
+  muscleClassLabels.push_back( MUSCLE );
+  std::vector<double> muscleMeans( 2 );
+  muscleMeans[0] = -20.0;
+  muscleMeans[1] = 50.0;
+  differences +=
+    this->CompareLabelClassifier( "MuscleClassifier", this->m_RawImage.GetPointer(),
+				  muscleLabels, muscleClassLabels, muscleMeans );
+  return differences;
+}
+
+
+unsigned long PQCT_AnalyzerBenchmark::Compare() {
+  std::vector<unsigned int> threadCounts;
+  GetConcurrencyLevels( threadCounts );
+
+  unsigned long differences = 0;
+  for (unsigned int i = 0; i < threadCounts.size(); i++)
+    differences += this->CompareConnectedComponents( threadCounts[i] );
+  differences += this->CompareKMeans();
+  differences += this->CompareLabelClassifier();
+  return differences;
+}
+
+
+//! Results as JSON, one benchmark per line.
+static void WriteResults(const std::string & filename,
+			 const std::vector<BenchmarkResultType> & results) {
+  std::ofstream output( filename.c_str() );
+  if ( !output )
+    throw "Cannot open benchmark output file.";
+  output.setf(std::ios::fixed, std::ios::floatfield);
+  output.precision(4);
+  output << "{\"benchmarks\":[" << std::endl;
+  for (unsigned int i = 0; i < results.size(); i++) {
+    output << "{\"kernel\":\"" << results[i].Kernel << "\","
+	   << "\"size\":" << results[i].Size << ","
+	   << "\"threads\":" << results[i].Threads << ","
+	   << "\"median_ms\":" << results[i].MedianTime << ","
+	   << "\"p95_ms\":" << results[i].P95Time << ","
+	   << "\"mpix_per_s\":" << results[i].Throughput << "}";
+    if (i + 1 < results.size())
+      output << ",";
+    output << std::endl;
+  }
+  output << "]}" << std::endl;
+}
+
+
+//! Value of a field on a line written by WriteResults().
+static std::string GetField(const std::string & line, const std::string & field) {
+  std::string key = "\"" + field + "\":";
+  size_t start = line.find( key );
+  if (start == std::string::npos)
+    return "";
+  start += key.size();
+  if (line[start] == '"') {
+    start++;
+    return line.substr( start, line.find( '"', start ) - start );
+  }
+  return line.substr( start, line.find_first_of( ",}", start ) - start );
+}
+
+
+//! Key of a benchmark in the baseline.
+static std::string GetBenchmarkKey(const std::string & kernel,
+				   unsigned int size,
+				   unsigned int threads) {
+  std::ostringstream key;
+  key << kernel << " " << size << "x" << size << " threads " << threads;
+  return key.str();
+}
+
+
+//! Compare medians with a baseline written by WriteResults(). Returns
+//! the number of regressions.
+static unsigned int CompareWithBaseline(const std::string & filename,
+					const std::vector<BenchmarkResultType> & results) {
+  std::ifstream input( filename.c_str() );
+  if ( !input )
+    throw "Cannot open benchmark baseline file.";
+
+  std::map<std::string, double> baseline;
+  std::string line;
+  while ( std::getline( input, line ) ) {
+    std::string kernel = GetField( line, "kernel" );
+    if ( kernel.empty() )
+      continue;
+    baseline[ GetBenchmarkKey( kernel,
+			       atoi( GetField( line, "size" ).c_str() ),
+			       atoi( GetField( line, "threads" ).c_str() ) ) ] =
+      atof( GetField( line, "median_ms" ).c_str() );
+  }
+
+  unsigned int regressions = 0;
+  for (unsigned int i = 0; i < results.size(); i++) {
+    std::string key = GetBenchmarkKey( results[i].Kernel,
+				       results[i].Size,
+				       results[i].Threads );
+    std::map<std::string, double>::const_iterator it = baseline.find( key );
+    if ( it == baseline.end() )
+      continue;
+    double ratio = it->second > 0 ? results[i].MedianTime / it->second : 1.0;
+    if ( ratio > 1.0 + REGRESSIONTOLERANCE ) {
+      std::cout << "REGRESSION " << key << ": " << results[i].MedianTime
+		<< " ms, baseline " << it->second << " ms" << std::endl;
+      regressions++;
+    }
+  }
+  return regressions;
+}
+
+
+//! Cohort results as JSON, one run per line.
+static void WriteCohortResults(const std::string & filename,
+			       const std::vector<CohortResultType> & results) {
+  std::ofstream output( filename.c_str() );
+  if ( !output )
+    throw "Cannot open benchmark output file.";
+  output.setf(std::ios::fixed, std::ios::floatfield);
+  output.precision(3);
+  output << "{\"cohort\":[" << std::endl;
+  for (unsigned int i = 0; i < results.size(); i++) {
+    output << "{\"workflow\":\"" << AnatomicalSite[results[i].WorkflowID] << "\","
+	   << "\"subjects\":" << results[i].NumberOfSubjects << ","
+	   << "\"analyzers\":" << results[i].NumberOfAnalyzers << ","
+	   << "\"threads_per_analyzer\":" << results[i].ThreadsPerAnalyzer << ","
+	   << "\"failed_subjects\":" << results[i].NumberOfFailedSubjects << ","
+	   << "\"failed_writes\":" << results[i].NumberOfFailedWrites << ","
+	   << "\"wall_time_s\":" << results[i].WallTime << ","
+	   << "\"subjects_per_hour\":" << results[i].SubjectsPerHour << ","
+	   << "\"latency_p50_s\":" << results[i].LatencyP50 << ","
+	   << "\"latency_p95_s\":" << results[i].LatencyP95 << ","
+	   << "\"latency_p99_s\":" << results[i].LatencyP99 << ","
+	   << "\"bytes_read\":" << results[i].BytesRead << ","
+	   << "\"bytes_written\":" << results[i].BytesWritten << "}";
+    if (i + 1 < results.size())
+      output << ",";
+    output << std::endl;
+  }
+  output << "]}" << std::endl;
+}
+
+
+//! Cohort mode: subjects/hour of each analysis workflow over a synthetic
+//! corpus, with 1, 2, 4, ... concurrent analyzers.
+static int RunCohortBenchmark( int argc, char ** argv )
+{
+  if (argc < 4) {
+    std::cerr << "Usage: "
+              << argv[0]
+              << " cohort <corpus path> <output json> [<subjects, default 100>] [<image size, default 256>] [<parameter filename>]"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+  PQCT_CohortBenchmark benchmark;
+  benchmark.SetCorpusPath( (std::string) argv[2] );
+  std::string outputFilename = argv[3];
+  if (argc > 4)
+    benchmark.SetNumberOfSubjects( (unsigned int) atoi( argv[4] ) );
+  if (argc > 5)
+    benchmark.SetImageSize( (unsigned int) atoi( argv[5] ) );
+  if (argc > 6)
+    benchmark.SetParameterFilename( (std::string) argv[6] );
+
+  std::vector<unsigned int> levels;
+  GetConcurrencyLevels( levels );
+
+  std::vector<CohortResultType> results;
+  try {
+    for (unsigned short workflowID = PQCT_FOUR_PCT_TIBIA;
+	 workflowID <= CT_MID_THIGH; workflowID++) {
+      benchmark.GenerateCorpus( workflowID );
+      for (unsigned int i = 0; i < levels.size(); i++) {
+	CohortResultType result = benchmark.Run( workflowID, levels[i] );
+	results.push_back( result );
+	std::cout << AnatomicalSite[workflowID] << " with "
+		  << result.NumberOfAnalyzers << " analyzers of "
+		  << result.ThreadsPerAnalyzer << " threads: "
+		  << result.SubjectsPerHour << " subjects/hour, latency p50 "
+		  << result.LatencyP50 << " s, p95 " << result.LatencyP95
+		  << " s, p99 " << result.LatencyP99 << " s, "
+		  << result.BytesRead << " bytes read, "
+		  << result.BytesWritten << " bytes written, "
+		  << result.NumberOfFailedSubjects << " subjects failed." << std::endl;
+      }
+    }
+    WriteCohortResults( outputFilename, results );
+    std::cout << "Cohort benchmark written to " << outputFilename << std::endl;
+  }
+  catch(const char * Message) {
+    std::cerr << "Error:" << Message << std::endl;
+    return EXIT_FAILURE;
+  }
+  catch(itk::ExceptionObject & err) {
+    std::cerr << "ExceptionObject caught !" << std::endl;
+    std::cerr << err << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+
+//! Compare mode: labels of the primitives against the ITK filters they
+//! replace, on the phantom. Fails if any pixel differs.
+static int RunComparison( int argc, char ** argv )
+{
+  unsigned int size = argc > 2 ? atoi( argv[2] ) : 256;
+  if (size < 1) {
+    std::cerr << "Usage: "
+              << argv[0]
+              << " compare [<image size, default 256>]"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  unsigned long differences = 0;
+  try {
+    PQCT_AnalyzerBenchmark benchmark( size, 1 );
+    differences = benchmark.Compare();
+  }
+  catch(const char * Message) {
+    std::cerr << "Error:" << Message << std::endl;
+    return EXIT_FAILURE;
+  }
+  catch(itk::ExceptionObject & err) {
+    std::cerr << "ExceptionObject caught !" << std::endl;
+    std::cerr << err << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if (differences > 0) {
+    std::cout << differences << " pixels differ from the ITK filters." << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::cout << "All labels match the ITK filters." << std::endl;
+  return EXIT_SUCCESS;
+}
+
+
+//! Benchmark routine: times the analyzer primitives on phantom images of
+//! increasing size, with one thread up to all processors, the whole
+//! analysis of a synthetic cohort (cohort mode), or checks the labels of
+//! the primitives against ITK (compare mode).
+
+int
+main( int argc, char ** argv )
+{
+  if (argc > 1 && std::string( argv[1] ) == "cohort")
+    return RunCohortBenchmark( argc, argv );
+  if (argc > 1 && std::string( argv[1] ) == "compare")
+    return RunComparison( argc, argv );
+
+  if (argc < 2) {
+    std::cerr << "Usage: "
+              << argv[0]
+              << " <output json> [<baseline json>] [<repetitions, default 5>] [<maximum image size, default 1024>]"
+              << std::endl
+              << "       "
+              << argv[0]
+              << " cohort <corpus path> <output json> [<subjects, default 100>] [<image size, default 256>] [<parameter filename>]"
+              << std::endl
+              << "       "
+              << argv[0]
+              << " compare [<image size, default 256>]"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::string outputFilename = argv[1];
+  std::string baselineFilename;
+  if (argc > 2)
+    baselineFilename = argv[2];
+  unsigned int repetitions = argc > 3 ? atoi( argv[3] ) : 5;
+  unsigned int maximumSize = argc > 4 ? atoi( argv[4] ) : 1024;
+  if (repetitions < 1)
+    repetitions = 1;
+
+  const unsigned int sizes[] = { 200, 256, 512, 768, 1024 };
+  const unsigned int numberOfSizes = sizeof(sizes) / sizeof(sizes[0]);
+
+  unsigned int processors =
+    itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+  std::vector<unsigned int> threadCounts;
+  GetConcurrencyLevels( threadCounts );
+
+  std::vector<BenchmarkResultType> results;
+  try {
+    for (unsigned int i = 0; i < numberOfSizes && sizes[i] <= maximumSize; i++) {
+      PQCT_AnalyzerBenchmark benchmark( sizes[i], repetitions );
+      for (unsigned int j = 0; j < threadCounts.size(); j++)
+	benchmark.Run( threadCounts[j], results );
+    }
+    itk::MultiThreader::SetGlobalDefaultNumberOfThreads( processors );
+
+    WriteResults( outputFilename, results );
+    std::cout << "Benchmarks written to " << outputFilename << std::endl;
+
+    if ( !baselineFilename.empty() &&
+	 CompareWithBaseline( baselineFilename, results ) > 0 )
+      return EXIT_FAILURE;
+  }
+  catch(const char * Message) {
+    std::cerr << "Error:" << Message << std::endl;
+    return EXIT_FAILURE;
+  }
+  catch(itk::ExceptionObject & err) {
+    std::cerr << "ExceptionObject caught !" << std::endl;
+    std::cerr << err << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
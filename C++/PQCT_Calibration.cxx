@@ -0,0 +1,63 @@
+/*===========================================================================
+
+  Program:   Bone, muscle and fat quantification from PQCT data.
+  Module:    $RCSfile: PQCT_Calibration.cxx,v $
+  Language:  C++
+  Date:      $Date: 2012/08/21 10:00:00 $
+  Version:   $Revision: 0.1 $
+  Author:    S. K. Makrogiannis
+  3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+  =============================================================================*/
+
+#include <map>
+#include <utility>
+
+#include <itkSimpleFastMutexLock.h>
+#include <itkMutexLockHolder.h>
+
+#include "PQCT_Calibration.h"
+
+
+//! Process-wide cache of calibration tables.
+typedef std::map< std::pair<float, float>, PQCT_CalibrationTable * > CalibrationTableMapType;
+static CalibrationTableMapType calibrationTables;
+static itk::SimpleFastMutexLock calibrationTablesLock;
+
+
+//! Tabulate the conversion for every 16-bit input value.
+PQCT_CalibrationTable::PQCT_CalibrationTable(float slope, float intercept) {
+  this->m_Slope = slope;
+  this->m_Intercept = intercept;
+  this->m_Table.resize( 65536 );
+  for (int i = 0; i < 65536; i++) {
+    PQCTPixelType originalValue = (PQCTPixelType) (unsigned short) i;
+    this->m_Table[i] = ComputeCalibratedValue( originalValue, slope, intercept );
+  }
+}
+
+
+//! Look up or build the table of a parameter pair.
+const PQCT_CalibrationTable * 
+PQCT_CalibrationTable::GetTable(float slope, float intercept) {
+
+  itk::MutexLockHolder<itk::SimpleFastMutexLock> holder( calibrationTablesLock );
+
+  std::pair<float, float> key( slope, intercept );
+  CalibrationTableMapType::iterator it = calibrationTables.find( key );
+  if ( it != calibrationTables.end() )
+    return it->second;
+
+  PQCT_CalibrationTable * table = new PQCT_CalibrationTable( slope, intercept );
+  calibrationTables[key] = table;
+  return table;
+}
+
+
+//! Table lookup over a contiguous buffer.
+void PQCT_CalibrationTable::CalibrateBuffer(PQCTPixelType * buffer, 
+					    size_t numberOfPixels) const {
+  const PQCTPixelType * table = &this->m_Table[0];
+  for (size_t i = 0; i < numberOfPixels; i++)
+    buffer[i] = table[ (unsigned short) buffer[i] ];
+}
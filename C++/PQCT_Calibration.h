@@ -0,0 +1,69 @@
+/*===========================================================================
+
+Program:   Bone, muscle and fat quantification from PQCT data.
+Module:    $RCSfile: PQCT_Calibration.h,v $
+Language:  C++
+Date:      $Date: 2012/08/21 10:00:00 $
+Version:   $Revision: 0.1 $
+Author:    S. K. Makrogiannis
+3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+=============================================================================*/
+
+#ifndef __PQCT_Calibration_h__
+#define __PQCT_Calibration_h__
+
+#include <vector>
+#include <cstddef>
+
+#include "PQCT_Datatypes.h"
+
+
+//! Attenuation unit to density conversion.
+//! Pixels are 16-bit, so the whole mapping is tabulated once per
+//! (slope, intercept) pair and shared by all analyzers of the process.
+class PQCT_CalibrationTable {
+
+ public:
+  //! Return the cached table for these parameters, building it on first use.
+  //! Tables are never released; there are only a few parameter files per run.
+  static const PQCT_CalibrationTable * GetTable(float slope, float intercept);
+
+  //! Reference conversion, rounding half up as MY_ROUND does.
+  static PQCTPixelType ComputeCalibratedValue(PQCTPixelType originalValue,
+					      float slope,
+					      float intercept) {
+    int calibratedValue = (int) MY_ROUND((slope * 
+					  ((float)originalValue/1000.0F)) + 
+					 intercept); 
+    return (PQCTPixelType) calibratedValue;
+  };
+
+  //! Inverse conversion, from density to attenuation units (e.g. to
+  //! write synthetic images).
+  static PQCTPixelType ComputeAttenuationValue(float density,
+					       float slope,
+					       float intercept) {
+    float attenuation = (density - intercept) * 1000.0F / slope;
+    return (PQCTPixelType) MY_ROUND( attenuation );
+  };
+
+  PQCTPixelType Calibrate(PQCTPixelType originalValue) const {
+    return this->m_Table[ (unsigned short) originalValue ];
+  };
+
+  //! Calibrate a contiguous buffer in place.
+  void CalibrateBuffer(PQCTPixelType * buffer, size_t numberOfPixels) const;
+
+  float GetSlope() const { return this->m_Slope; };
+  float GetIntercept() const { return this->m_Intercept; };
+
+ private:
+  PQCT_CalibrationTable(float slope, float intercept);
+
+  float m_Slope, m_Intercept;
+  //! Indexed by the raw 16-bit pattern of the input pixel.
+  std::vector<PQCTPixelType> m_Table;
+};
+
+#endif
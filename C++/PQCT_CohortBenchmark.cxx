@@ -0,0 +1,291 @@
+/*===========================================================================
+
+Program:   Bone, muscle and fat quantification from PQCT data.
+Module:    $RCSfile: PQCT_CohortBenchmark.cxx,v $
+Language:  C++
+Date:      $Date: 2012/09/05 10:00:00 $
+Version:   $Revision: 0.1 $
+Author:    S. K. Makrogiannis
+3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+=============================================================================*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+#include <itkMultiThreader.h>
+#include <itkRealTimeClock.h>
+#include <itkImageFileWriter.h>
+#include <itkGDCMImageIO.h>
+#include <itkMetaDataObject.h>
+#include <itksys/SystemTools.hxx>
+#include <itksys/Directory.hxx>
+
+#include "PQCT_CohortBenchmark.h"
+#include "PQCT_Analysis.h"
+#include "PQCT_AsyncWriter.h"
+#include "PQCT_Phantom.h"
+#include "PQCT_Threading.h"
+
+
+//! Noise of the corpus images (mg/cm^3 or HU).
+#define CORPUSNOISESD 20.0F
+
+//! Pixel spacing of the mid thigh CT slices (mm).
+static const float pixelSpacingMidThigh = 0.8F;
+
+
+//! State shared by the analyzers of one run.
+typedef struct t_CohortJobType
+{
+  std::vector<std::string> ImageFilenames;
+  unsigned short WorkflowID;
+  std::vector<float> ParameterValues;
+  std::string OutputPath;
+  PQCT_AsyncWriter * OutputWriter;
+  itk::RealTimeClock::Pointer Clock;
+  std::vector<double> Latencies;
+  std::vector<int> Status;
+}
+CohortJobType;
+
+
+//! Analyze one subject and record its latency, from reading the image
+//! to queuing the outputs.
+static void AnalyzeCohortSubject(unsigned int jobIndex, void * userData) {
+  CohortJobType * job = static_cast<CohortJobType *>( userData );
+
+  double start = job->Clock->GetTimeInSeconds();
+  PQCT_Analyzer analyzer;
+  analyzer.SetParameterValues( job->ParameterValues );
+  analyzer.SetPQCTImageFilename( job->ImageFilenames[jobIndex] );
+  analyzer.SetWorkflowID( job->WorkflowID );
+  analyzer.SetOutputPath( job->OutputPath );
+  analyzer.SetOutputWriter( job->OutputWriter );
+  job->Status[jobIndex] = analyzer.Execute();
+  job->Latencies[jobIndex] = job->Clock->GetTimeInSeconds() - start;
+}
+
+
+//! Value at a fraction of sorted samples (nearest rank).
+static double GetPercentile(const std::vector<double> & sortedSamples, double fraction) {
+  if ( sortedSamples.empty() )
+    return 0.0;
+  size_t rank = (size_t) ceil( fraction * sortedSamples.size() );
+  if (rank < 1)
+    rank = 1;
+  return sortedSamples[rank - 1];
+}
+
+
+//! True if a corpus CT slice can be read and has the requested size.
+static bool IsCTSliceOfSize(const std::string & filename, unsigned int imageSize) {
+  if ( !itksys::SystemTools::FileExists( filename.c_str(), true ) )
+    return false;
+  itk::GDCMImageIO::Pointer gdcmImageIO = itk::GDCMImageIO::New();
+  if ( !gdcmImageIO->CanReadFile( filename.c_str() ) )
+    return false;
+  try {
+    gdcmImageIO->SetFileName( filename.c_str() );
+    gdcmImageIO->ReadImageInformation();
+  }
+  catch(itk::ExceptionObject &) {
+    return false;
+  }
+  return gdcmImageIO->GetDimensions( 0 ) == imageSize &&
+    gdcmImageIO->GetDimensions( 1 ) == imageSize;
+}
+
+
+//! Total size of the regular files of a directory.
+static PQCT_MemorySizeType GetDirectorySize(const std::string & directoryName) {
+  PQCT_MemorySizeType directorySize = 0;
+  itksys::Directory directory;
+  if ( !directory.Load( directoryName.c_str() ) )
+    return 0;
+  for (unsigned long i = 0; i < directory.GetNumberOfFiles(); i++) {
+    std::string fullPath = directoryName + directory.GetFile( i );
+    if ( !itksys::SystemTools::FileIsDirectory( fullPath.c_str() ) )
+      directorySize += itksys::SystemTools::FileLength( fullPath.c_str() );
+  }
+  return directorySize;
+}
+
+
+PQCT_CohortBenchmark::PQCT_CohortBenchmark() {
+  this->SetCorpusPath( "./PQCT_Corpus/" );
+  this->m_NumberOfSubjects = 100;
+  this->m_ImageSize = 256;
+}
+
+
+void PQCT_CohortBenchmark::SetCorpusPath(const std::string & corpusPath) {
+  this->m_CorpusPath = corpusPath;
+  if (this->m_CorpusPath.empty() ||
+      this->m_CorpusPath.substr( this->m_CorpusPath.size() - 1 ) != PathSeparator)
+    this->m_CorpusPath += PathSeparator;
+}
+
+
+std::string PQCT_CohortBenchmark::GetSubjectFilename(unsigned short workflowID,
+						     unsigned int subject) const {
+  char subjectName[32];
+  sprintf( subjectName, "Phantom%05u", subject );
+  return this->m_CorpusPath + AnatomicalSite[workflowID] + PathSeparator +
+    subjectName + ( workflowID == CT_MID_THIGH ? ".dcm" : ".I00" );
+}
+
+
+std::string PQCT_CohortBenchmark::GetOutputPath(unsigned short workflowID,
+						unsigned int numberOfAnalyzers) const {
+  std::ostringstream outputPath;
+  outputPath << this->m_CorpusPath << "Output_" << AnatomicalSite[workflowID]
+	     << "_" << numberOfAnalyzers << PathSeparator;
+  return outputPath.str();
+}
+
+
+//! pQCT files hold attenuation values: the phantom densities go through
+//! the inverse of the default calibration.
+void PQCT_CohortBenchmark::GenerateCorpus(unsigned short workflowID) {
+  std::string directoryName = this->m_CorpusPath + AnatomicalSite[workflowID];
+  if ( !itksys::SystemTools::MakeDirectory( directoryName.c_str() ) )
+    throw "Cannot create corpus directory.";
+
+  float spacing = pixelSpacing4PCT;
+  if (workflowID == PQCT_SIXTYSIX_PCT_TIBIA)
+    spacing = pixelSpacing66PCT;
+  else if (workflowID == CT_MID_THIGH)
+    spacing = pixelSpacingMidThigh;
+
+  const size_t numberOfPixels = (size_t) this->m_ImageSize * this->m_ImageSize;
+  unsigned int numberOfGeneratedSubjects = 0;
+  for (unsigned int subject = 0; subject < this->m_NumberOfSubjects; subject++) {
+    std::string filename = this->GetSubjectFilename( workflowID, subject );
+    if ( workflowID != CT_MID_THIGH &&
+	 itksys::SystemTools::FileExists( filename.c_str(), true ) &&
+	 itksys::SystemTools::FileLength( filename.c_str() ) ==
+	 headerLength + numberOfPixels * sizeof(PQCTPixelType) )
+      continue;
+    if ( workflowID == CT_MID_THIGH &&
+	 IsCTSliceOfSize( filename, this->m_ImageSize ) )
+      continue;
+
+    char patientID[16];
+    sprintf( patientID, "%u", subject + 1 );
+
+    if (workflowID == CT_MID_THIGH) {
+      PQCTImageType::Pointer image =
+	PQCT_Phantom::CreateLegCTImage( this->m_ImageSize, spacing,
+					CORPUSNOISESD, subject + 1 );
+
+      //! Tags read by the analyzer.
+      itk::GDCMImageIO::Pointer gdcmImageIO = itk::GDCMImageIO::New();
+      itk::MetaDataDictionary & dictionary = gdcmImageIO->GetMetaDataDictionary();
+      itk::EncapsulateMetaData<std::string>( dictionary, "0008|0060", "CT" );
+      itk::EncapsulateMetaData<std::string>( dictionary, "0010|0020", patientID );
+      itk::EncapsulateMetaData<std::string>( dictionary, "0010|0030", "19500101" );
+      itk::EncapsulateMetaData<std::string>( dictionary, "0008|0022", "20120905" );
+      itk::EncapsulateMetaData<std::string>( dictionary, "0020|0032", "0\\0\\0" );
+
+      typedef itk::ImageFileWriter<PQCTImageType> CTImageFileWriterType;
+      CTImageFileWriterType::Pointer writer = CTImageFileWriterType::New();
+      writer->SetInput( image );
+      writer->SetFileName( filename.c_str() );
+      writer->SetImageIO( gdcmImageIO );
+      writer->UseInputMetaDataDictionaryOff();
+      writer->Update();
+    }
+    else {
+      PQCT_PhantomParametersType parameters =
+	PQCT_Phantom::GetDefaultParameters( this->m_ImageSize, spacing );
+      parameters.NoiseSD = CORPUSNOISESD;
+      parameters.Seed = subject + 1;
+      PQCT_Phantom::WritePQCTFile( parameters, filename, patientID,
+				   slope, intercept );
+    }
+    numberOfGeneratedSubjects++;
+  }
+
+  std::cout << "Corpus " << directoryName << ": "
+	    << numberOfGeneratedSubjects << " of "
+	    << this->m_NumberOfSubjects << " subjects generated." << std::endl;
+}
+
+
+CohortResultType PQCT_CohortBenchmark::Run(unsigned short workflowID,
+					   unsigned int numberOfAnalyzers) {
+  if (numberOfAnalyzers < 1)
+    numberOfAnalyzers = 1;
+
+  CohortJobType job;
+  job.WorkflowID = workflowID;
+  job.OutputPath = this->GetOutputPath( workflowID, numberOfAnalyzers );
+  job.Clock = itk::RealTimeClock::New();
+  job.Latencies.assign( this->m_NumberOfSubjects, 0.0 );
+  job.Status.assign( this->m_NumberOfSubjects, EXIT_FAILURE );
+
+  //! Parse the parameters once for all subjects.
+  //! Outputs are always production outputs, whatever the file sets.
+  PQCT_Analyzer parameterReader;
+  if ( !this->m_ParameterFilename.empty() &&
+       parameterReader.LoadParameterFile( this->m_ParameterFilename ) == EXIT_FAILURE )
+    throw "Cannot read benchmark parameter file.";
+  parameterReader.SetOutputPolicy( OUTPUT_PRODUCTION );
+  job.ParameterValues = parameterReader.GetParameterValues();
+
+  //! Inputs are read once each.
+  CohortResultType result;
+  result.BytesRead = 0;
+  for (unsigned int i = 0; i < this->m_NumberOfSubjects; i++) {
+    job.ImageFilenames.push_back( this->GetSubjectFilename( workflowID, i ) );
+    result.BytesRead += itksys::SystemTools::FileLength( job.ImageFilenames[i].c_str() );
+  }
+
+  //! Fresh output directory, so that its size is what this run wrote.
+  itksys::SystemTools::RemoveADirectory( job.OutputPath.c_str() );
+  if ( !itksys::SystemTools::MakeDirectory( job.OutputPath.c_str() ) )
+    throw "Cannot create benchmark output directory.";
+
+  //! Split the processors between the analyzers as the batch driver
+  //! does, for this run only, also if it throws.
+  unsigned int numberOfProcessors =
+    itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+  unsigned int threadsPerAnalyzer = numberOfProcessors / numberOfAnalyzers;
+  if (threadsPerAnalyzer < 1)
+    threadsPerAnalyzer = 1;
+  PQCT_GlobalThreadsGuard threadsGuard( threadsPerAnalyzer );
+
+  PQCT_AsyncWriter outputWriter( 2 * numberOfAnalyzers );
+  job.OutputWriter = &outputWriter;
+
+  double start = job.Clock->GetTimeInSeconds();
+  PQCT_ParallelJobs::Run( this->m_NumberOfSubjects, AnalyzeCohortSubject,
+			  &job, numberOfAnalyzers );
+  unsigned int numberOfFailedWrites = outputWriter.Flush();
+  double wallTime = job.Clock->GetTimeInSeconds() - start;
+
+  result.WorkflowID = workflowID;
+  result.NumberOfSubjects = this->m_NumberOfSubjects;
+  result.NumberOfAnalyzers = numberOfAnalyzers;
+  result.ThreadsPerAnalyzer = threadsPerAnalyzer;
+  result.NumberOfFailedSubjects = 0;
+  result.NumberOfFailedWrites = numberOfFailedWrites;
+  for (unsigned int i = 0; i < job.Status.size(); i++)
+    if (job.Status[i] != EXIT_SUCCESS)
+      result.NumberOfFailedSubjects++;
+  result.WallTime = wallTime;
+  result.SubjectsPerHour = wallTime > 0 ?
+    this->m_NumberOfSubjects * 3600.0 / wallTime : 0.0;
+  std::sort( job.Latencies.begin(), job.Latencies.end() );
+  result.LatencyP50 = GetPercentile( job.Latencies, 0.50 );
+  result.LatencyP95 = GetPercentile( job.Latencies, 0.95 );
+  result.LatencyP99 = GetPercentile( job.Latencies, 0.99 );
+  result.BytesWritten = GetDirectorySize( job.OutputPath );
+  return result;
+}
@@ -0,0 +1,85 @@
+/*===========================================================================
+
+Program:   Bone, muscle and fat quantification from PQCT data.
+Module:    $RCSfile: PQCT_CohortBenchmark.h,v $
+Language:  C++
+Date:      $Date: 2012/09/05 10:00:00 $
+Version:   $Revision: 0.1 $
+Author:    S. K. Makrogiannis
+3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+=============================================================================*/
+
+#ifndef __PQCT_CohortBenchmark_h__
+#define __PQCT_CohortBenchmark_h__
+
+#include <string>
+#include <vector>
+
+#include "PQCT_Datatypes.h"
+#include "PQCT_Memory.h"
+
+
+//! Throughput of one workflow at one concurrency level.
+typedef struct t_CohortResultType
+{
+  unsigned short WorkflowID;
+  unsigned int NumberOfSubjects;
+  unsigned int NumberOfAnalyzers;
+  unsigned int ThreadsPerAnalyzer;
+  unsigned int NumberOfFailedSubjects;
+  unsigned int NumberOfFailedWrites;
+  double WallTime;          // s
+  double SubjectsPerHour;
+  double LatencyP50;        // s
+  double LatencyP95;        // s
+  double LatencyP99;        // s
+  PQCT_MemorySizeType BytesRead;
+  PQCT_MemorySizeType BytesWritten;
+}
+CohortResultType;
+
+
+//! End-to-end benchmark: analyzes a synthetic cohort through Execute()
+//! with several analyzers at a time, as the batch driver does.
+//! The corpus holds one directory per workflow with phantom images in
+//! the input format of the workflow: pQCT files for the tibia sites, a
+//! DICOM slice per subject for the mid thigh. Existing corpus files are
+//! reused.
+class PQCT_CohortBenchmark {
+
+ public:
+  PQCT_CohortBenchmark();
+
+  void SetCorpusPath(const std::string & corpusPath);
+  void SetNumberOfSubjects(unsigned int numberOfSubjects) {
+    this->m_NumberOfSubjects = numberOfSubjects;
+  };
+  void SetImageSize(unsigned int imageSize) {
+    this->m_ImageSize = imageSize;
+  };
+  //! Parameter file of all subjects; the default parameters with the
+  //! production output policy are used when none is set.
+  void SetParameterFilename(const std::string & parameterFilename) {
+    this->m_ParameterFilename = parameterFilename;
+  };
+
+  //! Write the phantom images of a workflow that are not on disk yet.
+  void GenerateCorpus(unsigned short workflowID);
+
+  //! Analyze the corpus of a workflow with numberOfAnalyzers concurrent
+  //! analyzers, sharing the processors between them. Outputs go to a
+  //! fresh directory of the corpus.
+  CohortResultType Run(unsigned short workflowID, unsigned int numberOfAnalyzers);
+
+ private:
+  std::string GetSubjectFilename(unsigned short workflowID, unsigned int subject) const;
+  std::string GetOutputPath(unsigned short workflowID, unsigned int numberOfAnalyzers) const;
+
+  std::string m_CorpusPath;
+  std::string m_ParameterFilename;
+  unsigned int m_NumberOfSubjects;
+  unsigned int m_ImageSize;
+};
+
+#endif
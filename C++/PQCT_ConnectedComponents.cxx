@@ -0,0 +1,236 @@
+/*===========================================================================
+
+Program:   Bone, muscle and fat quantification from PQCT data.
+Module:    $RCSfile: PQCT_ConnectedComponents.cxx,v $
+Language:  C++
+Date:      $Date: 2012/09/10 10:00:00 $
+Version:   $Revision: 0.1 $
+Author:    S. K. Makrogiannis
+3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+=============================================================================*/
+
+#include <algorithm>
+#include <limits>
+
+#include <itkMultiThreader.h>
+
+#include "PQCT_ConnectedComponents.h"
+#include "PQCT_Threading.h"
+
+
+//! Parent of the pixels outside the threshold range.
+static const unsigned int BACKGROUNDPARENT = 0xFFFFFFFFU;
+
+//! Strips are at least this many rows, so that merging stays cheap.
+#define MINIMUMSTRIPHEIGHT 32
+
+
+//! State shared by the strip jobs.
+template<class TPixel> struct ComponentJobType
+{
+  const TPixel * Input;
+  size_t Width;
+  TPixel Lower;
+  TPixel Upper;
+  unsigned int * Parents;
+  std::vector<size_t> StripStarts;  // First row of each strip, then the height.
+};
+
+
+//! Root of a pixel, halving the path on the way. Roots are the
+//! smallest pixel index of their tree, so parents never exceed the
+//! pixel index.
+static inline unsigned int FindRoot(unsigned int * parents, unsigned int pixel) {
+  while (parents[pixel] != pixel) {
+    parents[pixel] = parents[ parents[pixel] ];
+    pixel = parents[pixel];
+  }
+  return pixel;
+}
+
+
+static inline void MergeTrees(unsigned int * parents, unsigned int pixel1, unsigned int pixel2) {
+  unsigned int root1 = FindRoot( parents, pixel1 );
+  unsigned int root2 = FindRoot( parents, pixel2 );
+  if (root1 < root2)
+    parents[root2] = root1;
+  else if (root2 < root1)
+    parents[root1] = root2;
+}
+
+
+//! Join a pixel with its upper neighbours (NW, N, NE).
+static inline void MergeWithUpperRow(unsigned int * parents, unsigned int pixel,
+				     size_t x, size_t width) {
+  unsigned int up = pixel - (unsigned int) width;
+  //! N touches NW, NE and W: nothing else to merge.
+  if (parents[up] != BACKGROUNDPARENT) {
+    MergeTrees( parents, up, pixel );
+    return;
+  }
+  if (x > 0 && parents[up - 1] != BACKGROUNDPARENT)
+    MergeTrees( parents, up - 1, pixel );
+  if (x + 1 < width && parents[up + 1] != BACKGROUNDPARENT)
+    MergeTrees( parents, up + 1, pixel );
+}
+
+
+//! Label one strip. Trees only span the rows of the strip, so strips
+//! do not share parents.
+template<class TPixel> static void LabelStrip(unsigned int strip, void * userData) {
+  ComponentJobType<TPixel> * job = static_cast<ComponentJobType<TPixel> *>( userData );
+  const TPixel * input = job->Input;
+  unsigned int * parents = job->Parents;
+  const size_t width = job->Width;
+  const TPixel lower = job->Lower;
+  const TPixel upper = job->Upper;
+
+  for (size_t y = job->StripStarts[strip]; y < job->StripStarts[strip + 1]; y++) {
+    unsigned int pixel = (unsigned int) (y * width);
+    for (size_t x = 0; x < width; x++, pixel++) {
+      if ( input[pixel] < lower || input[pixel] > upper ) {
+	parents[pixel] = BACKGROUNDPARENT;
+	continue;
+      }
+      parents[pixel] = pixel;
+      if (x > 0 && parents[pixel - 1] != BACKGROUNDPARENT)
+	MergeTrees( parents, pixel - 1, pixel );
+      if (y > job->StripStarts[strip])
+	MergeWithUpperRow( parents, pixel, x, width );
+    }
+  }
+}
+
+
+template<class TPixel>
+void PQCT_ConnectedComponents::LabelBuffer(const TPixel * input,
+					   size_t width,
+					   size_t height,
+					   TPixel lower,
+					   TPixel upper,
+					   LabelPixelType * output,
+					   std::vector<PQCT_ComponentType> & components,
+					   unsigned int numberOfThreads) {
+  const size_t numberOfPixels = width * height;
+  components.clear();
+  if (numberOfPixels == 0)
+    return;
+  if (numberOfPixels >= BACKGROUNDPARENT)
+    throw "Image too large for component labeling.";
+
+  std::vector<unsigned int> parentBuffer( numberOfPixels );
+  unsigned int * parents = &parentBuffer[0];
+
+  //! 1. Label strips in parallel.
+  if (numberOfThreads == 0)
+    numberOfThreads = itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+  size_t numberOfStrips = height / MINIMUMSTRIPHEIGHT;
+  if (numberOfStrips > numberOfThreads)
+    numberOfStrips = numberOfThreads;
+  if (numberOfStrips < 1)
+    numberOfStrips = 1;
+
+  ComponentJobType<TPixel> job;
+  job.Input = input;
+  job.Width = width;
+  job.Lower = lower;
+  job.Upper = upper;
+  job.Parents = parents;
+  for (size_t i = 0; i <= numberOfStrips; i++)
+    job.StripStarts.push_back( i * height / numberOfStrips );
+  if ( PQCT_ParallelJobs::Run( (unsigned int) numberOfStrips, LabelStrip<TPixel>,
+			       &job, (unsigned int) numberOfStrips ) > 0 )
+    throw "Component labeling failed.";
+
+  //! 2. Merge trees across the first row of each strip.
+  for (size_t i = 1; i < numberOfStrips; i++) {
+    unsigned int pixel = (unsigned int) (job.StripStarts[i] * width);
+    for (size_t x = 0; x < width; x++, pixel++)
+      if (parents[pixel] != BACKGROUNDPARENT)
+	MergeWithUpperRow( parents, pixel, x, width );
+  }
+
+  //! 3. Number the trees in raster order of their roots and measure
+  //! them. A pixel's parent precedes it, so its component is known by
+  //! then; parents are replaced by component numbers on the way.
+  std::vector<double> sumX, sumY;
+  std::vector<size_t> minX, minY, maxX, maxY;
+  std::vector<unsigned long> areas;
+  unsigned int pixel = 0;
+  for (size_t y = 0; y < height; y++)
+    for (size_t x = 0; x < width; x++, pixel++) {
+      unsigned int parent = parents[pixel];
+      if (parent == BACKGROUNDPARENT)
+	continue;
+      unsigned int component;
+      if (parent == pixel) {
+	component = (unsigned int) areas.size();
+	areas.push_back( 0 );
+	sumX.push_back( 0.0 );
+	sumY.push_back( 0.0 );
+	minX.push_back( x );
+	maxX.push_back( x );
+	minY.push_back( y );
+	maxY.push_back( y );
+      }
+      else
+	component = parents[parent];
+      parents[pixel] = component;
+
+      areas[component]++;
+      sumX[component] += x;
+      sumY[component] += y;
+      if (x < minX[component])
+	minX[component] = x;
+      if (x > maxX[component])
+	maxX[component] = x;
+      maxY[component] = y;
+    }
+
+  //! 4. Rank by decreasing area; stable, so ties keep raster order.
+  std::vector< std::pair<long, unsigned int> > order( areas.size() );
+  for (unsigned int i = 0; i < areas.size(); i++)
+    order[i] = std::make_pair( -(long) areas[i], i );
+  std::stable_sort( order.begin(), order.end() );
+
+  const unsigned int maximumLabel = std::numeric_limits<LabelPixelType>::max();
+  std::vector<LabelPixelType> componentLabels( areas.size() );
+  components.resize( areas.size() );
+  for (unsigned int rank = 0; rank < order.size(); rank++) {
+    unsigned int i = order[rank].second;
+    componentLabels[i] = (LabelPixelType) std::min( rank + 1, maximumLabel );
+
+    PQCT_ComponentType & component = components[rank];
+    component.Area = areas[i];
+    component.PhysicalSize = (double) areas[i];
+    component.Centroid[0] = sumX[i] / areas[i];
+    component.Centroid[1] = sumY[i] / areas[i];
+    LabelImageType::IndexType boundingBoxIndex;
+    LabelImageType::SizeType boundingBoxSize;
+    boundingBoxIndex[0] = (long) minX[i];
+    boundingBoxIndex[1] = (long) minY[i];
+    boundingBoxSize[0] = maxX[i] - minX[i] + 1;
+    boundingBoxSize[1] = maxY[i] - minY[i] + 1;
+    component.BoundingBox.SetIndex( boundingBoxIndex );
+    component.BoundingBox.SetSize( boundingBoxSize );
+  }
+
+  //! 5. Write the ranked labels.
+  for (size_t i = 0; i < numberOfPixels; i++)
+    output[i] = parents[i] == BACKGROUNDPARENT ? 0 : componentLabels[ parents[i] ];
+}
+
+
+template void PQCT_ConnectedComponents::LabelBuffer<PQCTPixelType>(const PQCTPixelType *,
+								   size_t, size_t,
+								   PQCTPixelType, PQCTPixelType,
+								   LabelPixelType *,
+								   std::vector<PQCT_ComponentType> &,
+								   unsigned int);
+template void PQCT_ConnectedComponents::LabelBuffer<LabelPixelType>(const LabelPixelType *,
+								    size_t, size_t,
+								    LabelPixelType, LabelPixelType,
+								    LabelPixelType *,
+								    std::vector<PQCT_ComponentType> &,
+								    unsigned int);
@@ -0,0 +1,103 @@
+/*===========================================================================
+
+Program:   Bone, muscle and fat quantification from PQCT data.
+Module:    $RCSfile: PQCT_ConnectedComponents.h,v $
+Language:  C++
+Date:      $Date: 2012/09/10 10:00:00 $
+Version:   $Revision: 0.1 $
+Author:    S. K. Makrogiannis
+3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+=============================================================================*/
+
+#ifndef __PQCT_ConnectedComponents_h__
+#define __PQCT_ConnectedComponents_h__
+
+#include <vector>
+#include <cstddef>
+
+#include <itkContinuousIndex.h>
+
+#include "PQCT_Datatypes.h"
+
+
+//! Size and position of one connected component.
+typedef struct t_PQCT_ComponentType
+{
+  unsigned long Area;                    // pixels
+  double PhysicalSize;                   // mm^2
+  double Centroid[pixelDimensions];      // Physical coordinates.
+  LabelImageType::RegionType BoundingBox;
+}
+PQCT_ComponentType;
+
+
+//! Fully connected (8-neighbour) component labeling of a threshold
+//! range, in place of the binary threshold, connected component and
+//! relabel filters. Components are numbered 1, 2, ... by decreasing
+//! area, ties in raster order of their first pixel, as the relabel
+//! filter does; 0 is outside the range. Ranks beyond the label range
+//! share the largest label; the component list is complete.
+//! Union-find over pixel indices: horizontal strips are labeled in
+//! parallel, then merged along their boundary rows.
+class PQCT_ConnectedComponents {
+
+ public:
+  //! Label the pixels lower <= value <= upper of the buffered region.
+  //! components[i] describes label i+1. numberOfThreads = 0 uses the
+  //! ITK global default.
+  template<class TImage>
+    static LabelImageType::Pointer Label(const TImage * image,
+					 typename TImage::PixelType lower,
+					 typename TImage::PixelType upper,
+					 std::vector<PQCT_ComponentType> & components,
+					 unsigned int numberOfThreads = 0) {
+    typename TImage::RegionType region = image->GetBufferedRegion();
+    LabelImageType::Pointer labelImage = LabelImageType::New();
+    labelImage->CopyInformation( image );
+    labelImage->SetRegions( region );
+    labelImage->Allocate();
+
+    LabelBuffer( image->GetBufferPointer(),
+		 region.GetSize()[0], region.GetSize()[1],
+		 lower, upper,
+		 labelImage->GetBufferPointer(),
+		 components,
+		 numberOfThreads );
+
+    //! Index to physical space.
+    double pixelArea = image->GetSpacing()[0] * image->GetSpacing()[1];
+    for (unsigned int i = 0; i < components.size(); i++) {
+      PQCT_ComponentType & component = components[i];
+      LabelImageType::IndexType boundingBoxIndex = component.BoundingBox.GetIndex();
+      for (unsigned int j = 0; j < pixelDimensions; j++)
+	boundingBoxIndex[j] += region.GetIndex()[j];
+      component.BoundingBox.SetIndex( boundingBoxIndex );
+
+      itk::ContinuousIndex<double, pixelDimensions> centroidIndex;
+      for (unsigned int j = 0; j < pixelDimensions; j++)
+	centroidIndex[j] = component.Centroid[j] + region.GetIndex()[j];
+      typename TImage::PointType centroid;
+      image->TransformContinuousIndexToPhysicalPoint( centroidIndex, centroid );
+      for (unsigned int j = 0; j < pixelDimensions; j++)
+	component.Centroid[j] = centroid[j];
+      component.PhysicalSize = component.Area * pixelArea;
+    }
+    return labelImage;
+  };
+
+  //! Buffer version: width x height pixels in raster order. Components
+  //! are in index space (PhysicalSize is the area, bounding boxes start
+  //! at index 0).
+  template<class TPixel>
+    static void LabelBuffer(const TPixel * input,
+			    size_t width,
+			    size_t height,
+			    TPixel lower,
+			    TPixel upper,
+			    LabelPixelType * output,
+			    std::vector<PQCT_ComponentType> & components,
+			    unsigned int numberOfThreads = 0);
+};
+
+#endif
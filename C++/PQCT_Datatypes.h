@@ -43,6 +43,10 @@ typedef enum{PQCT_FOUR_PCT_TIBIA=0,
 	     PQCT_SIXTYSIX_PCT_TIBIA,
 	     CT_MID_THIGH,
 	     PQCT_ANONYMIZE,
+	     PQCT_CATALOG,
+	     PQCT_BULK_ANONYMIZE,
+	     DICOM_CATALOG,
+	     METRICS_EXPORT,
 } PQCTWorkflow;
 
 //! String array of different workflows.
@@ -52,12 +56,48 @@ static const std::string AnatomicalSite[] = {
   "66_PCT",
   "MID_THIGH",
   "UNUSED",
+  "UNUSED",
+  "UNUSED",
+  "UNUSED",
+  "UNUSED",
 };
 
+//! Enumeration of output policies: production runs write only the label
+//! image and the quantification file, QC adds the images needed to
+//! review a run, debug writes every intermediate image.
+typedef enum{OUTPUT_PRODUCTION=0,
+	     OUTPUT_QC,
+	     OUTPUT_DEBUG} OutputPolicyType;
+
 //! Enumeration of subcutaneous/inter-muscular fat separation method.
 typedef enum{CONNECTED_COMPONENTS=1,
 	     GAC} SAT_IMFAT_SEPARATION_ALGORITHM;
 
+//! Enumeration of tissue clustering methods.
+typedef enum{KMEANS_CLUSTERING=0,
+	     EMGMM_CLUSTERING,
+	     FCM_CLUSTERING} ClusteringMethodType;
+
+//! Positions of the segmentation parameters in parameterIDs and
+//! parameterValues.
+typedef enum{AUTODENSITY_SLOPE_PARAMETER=0,
+	     AUTODENSITY_INTERCEPT_PARAMETER,
+	     SMOOTHING_SIGMA_PARAMETER,
+	     MEDIAN_FILTER_RADIUS_PARAMETER,
+	     SIGMOID_BETA_PARAMETER,
+	     SIGMOID_BETA_ALPHA_RATIO_PARAMETER,
+	     FASTMARCHING_STOPPING_TIME_PARAMETER,
+	     LEVELSET_PROPAGATION_PARAMETER,
+	     LEVELSET_CURVATURE_PARAMETER,
+	     LEVELSET_ADVECTION_PARAMETER,
+	     LEVELSET_MAXIMUM_ITERATIONS_PARAMETER,
+	     LEVELSET_MAXIMUM_RMS_ERROR_PARAMETER,
+	     SAT_IMFAT_SEPARATION_PARAMETER,
+	     CT_LEG_THRESHOLD_PARAMETER,
+	     OUTPUT_POLICY_PARAMETER,
+	     TRACE_OUTPUT_PARAMETER,
+	     CLUSTERING_METHOD_PARAMETER} ParameterIndexType;
+
 //! Enumeration of tissue types.
 typedef enum{AIR=0, 
 	     FAT, 
@@ -144,6 +184,7 @@ static const float intercept = -322.0F; // My calibration: -265.06F; AU: -355.0F
 #define CTLEGTHRESHOLD -200
 #define SIGNEDSHORTMAX 32767
 #define PADDINGLENGTH 2
+#define INPUTPADDINGLENGTH 5
 #define LEGPHYSICALSIZETHRESHOLD 500
 
 //! ITK Data type definitions used in the application.
@@ -158,7 +199,14 @@ typedef itk::Image<LabelPixelType, pixelDimensions> LabelImageType;
 static const std::string labelImageFileExtension = ".Labels.nii";
 static const std::string quantificationFileExtension = ".Quantification.txt";
 static const std::string inputImageFileExtension = ".Input.nii";
+static const std::string kmeansImageFileExtension = "_Kmeans_output.nii";
+static const std::string foregroundMaskFileExtension = "_FB_Mask.nii";
+static const std::string oneLegImageFileExtension = "_OneLeg.nii";
 static const std::string anonymizedImageFileExtension = ".Anon";
+static const std::string catalogFileName = "PQCT_Catalog.txt";
+static const std::string dicomCatalogFileName = "DICOM_Catalog.txt";
+static const std::string metricsCSVFileExtension = ".csv";
+static const std::string traceFileExtension = ".Trace.json";
 static const std::string anonymizedImageFilePrefix = "Anon_";
 
 //! Segmentation parameter keys.
@@ -175,7 +223,10 @@ static const std::string parameterIDs[] = { "AUtoDensitySlope",
 					    "LevelsetMaximumIterations",
 					    "LevelsetMaximumRMSError",
 					    "SAT_IMFAT_SeparationAlgorithm",
-					    "CT_LegThreshold"};
+					    "CT_LegThreshold",
+					    "OutputPolicy",
+					    "TraceOutput",
+					    "ClusteringMethod"};
 
 //! Segmentation parameter values.
 static const float parameterValues[] = { 1724.0,
@@ -191,7 +242,10 @@ static const float parameterValues[] = { 1724.0,
 					 250,
 					 0.0015,
 					 1,
-					 -200 };
+					 -200,
+					 OUTPUT_DEBUG,
+					 0,
+					 KMEANS_CLUSTERING };
 
 
 /* //! Function that re-orients input image. */
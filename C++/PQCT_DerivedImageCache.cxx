@@ -0,0 +1,53 @@
+/*===========================================================================
+
+Program:   Bone, muscle and fat quantification from PQCT data.
+Module:    $RCSfile: PQCT_DerivedImageCache.cxx,v $
+Language:  C++
+Date:      $Date: 2012/08/29 10:00:00 $
+Version:   $Revision: 0.1 $
+Author:    S. K. Makrogiannis
+3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+=============================================================================*/
+
+#include "PQCT_DerivedImageCache.h"
+
+
+void PQCT_DerivedImageCache::Validate(PQCTImageType::Pointer source) {
+  if (source.GetPointer() == this->m_Source.GetPointer() &&
+      ( source.IsNull() || source->GetMTime() == this->m_SourceMTime ))
+    return;
+
+  this->m_Images.clear();
+  this->m_Source = source;
+  this->m_SourceMTime = source.IsNull() ? 0 : source->GetMTime();
+}
+
+
+FloatImageType::Pointer
+PQCT_DerivedImageCache::Find(PQCTImageType::Pointer source,
+			     const DerivedImageKeyType & key) {
+  this->Validate( source );
+  std::map<DerivedImageKeyType, FloatImageType::Pointer>::iterator it =
+    this->m_Images.find( key );
+  if (it == this->m_Images.end())
+    return NULL;
+  return it->second;
+}
+
+
+void PQCT_DerivedImageCache::Insert(PQCTImageType::Pointer source,
+				    const DerivedImageKeyType & key,
+				    FloatImageType::Pointer image) {
+  this->Validate( source );
+  //! Detach from the producing filter so that the entry is plain data.
+  image->DisconnectPipeline();
+  this->m_Images[key] = image;
+}
+
+
+void PQCT_DerivedImageCache::Clear() {
+  this->m_Images.clear();
+  this->m_Source = NULL;
+  this->m_SourceMTime = 0;
+}
@@ -0,0 +1,88 @@
+/*===========================================================================
+
+Program:   Bone, muscle and fat quantification from PQCT data.
+Module:    $RCSfile: PQCT_DerivedImageCache.h,v $
+Language:  C++
+Date:      $Date: 2012/08/29 10:00:00 $
+Version:   $Revision: 0.1 $
+Author:    S. K. Makrogiannis
+3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+=============================================================================*/
+
+#ifndef __PQCT_DerivedImageCache_h__
+#define __PQCT_DerivedImageCache_h__
+
+#include <map>
+
+#include "PQCT_Datatypes.h"
+
+
+//! Images derived from the analyzed image (smoothed, gradient magnitude,
+//! speed), kept so that segmentation steps do not recompute them.
+//! Entries belong to one source image; a lookup with another image, or
+//! with the same image after it was modified, drops all entries.
+//! Cached images are shared and must not be modified by the caller.
+class PQCT_DerivedImageCache {
+
+ public:
+  typedef enum {SMOOTHED_IMAGE=0,
+		GRADIENT_MAGNITUDE_IMAGE,
+		SPEED_IMAGE}
+  DerivedImageKindType;
+
+  //! Identifies a derived image: kind, method and parameter values.
+  typedef struct t_DerivedImageKeyType
+  {
+    int Kind;
+    int Method;
+    double Parameters[3];
+
+    bool operator<(const t_DerivedImageKeyType & other) const {
+      if (this->Kind != other.Kind)
+	return this->Kind < other.Kind;
+      if (this->Method != other.Method)
+	return this->Method < other.Method;
+      for (unsigned int i = 0; i < 3; i++)
+	if (this->Parameters[i] != other.Parameters[i])
+	  return this->Parameters[i] < other.Parameters[i];
+      return false;
+    }
+  }
+  DerivedImageKeyType;
+
+  static DerivedImageKeyType MakeKey(int kind, int method,
+				     double parameter0 = 0.0,
+				     double parameter1 = 0.0,
+				     double parameter2 = 0.0) {
+    DerivedImageKeyType key;
+    key.Kind = kind;
+    key.Method = method;
+    key.Parameters[0] = parameter0;
+    key.Parameters[1] = parameter1;
+    key.Parameters[2] = parameter2;
+    return key;
+  };
+
+  PQCT_DerivedImageCache() : m_SourceMTime(0) {};
+
+  //! Returns NULL when the image has not been computed for this source.
+  FloatImageType::Pointer Find(PQCTImageType::Pointer source,
+			       const DerivedImageKeyType & key);
+  void Insert(PQCTImageType::Pointer source,
+	      const DerivedImageKeyType & key,
+	      FloatImageType::Pointer image);
+  void Clear();
+
+ private:
+  //! Drop entries computed from another image or an older version of it.
+  void Validate(PQCTImageType::Pointer source);
+
+  //! The source is held so that its address cannot be reused by a new
+  //! image while entries refer to it.
+  PQCTImageType::Pointer m_Source;
+  unsigned long m_SourceMTime;
+  std::map<DerivedImageKeyType, FloatImageType::Pointer> m_Images;
+};
+
+#endif
@@ -0,0 +1,596 @@
+/*===========================================================================
+
+  Program:   Bone, muscle and fat quantification from PQCT data.
+  Module:    $RCSfile: PQCT_FileFormat.cxx,v $
+  Language:  C++
+  Date:      $Date: 2012/08/20 10:00:00 $
+  Version:   $Revision: 0.1 $
+  Author:    S. K. Makrogiannis
+  3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+  =============================================================================*/
+
+#include <fstream>
+#include <vector>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#include <itksys/SystemTools.hxx>
+#endif
+
+#if defined(__linux__)
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#include <errno.h>
+#endif
+
+#include "PQCT_FileFormat.h"
+
+
+//! Header-only read with early rejection after the 8-byte prefix.
+bool ReadPQCTHeaderBlock(const std::string & filename, char * headerBlock) {
+
+  std::ifstream inputFile;
+  inputFile.open( filename.c_str(), std::ios::binary );
+  if (inputFile.fail())
+    return false;
+
+  //! 1: FilePreFix (header version, size).
+  inputFile.read( headerBlock, headerPrefixLength );
+  if (inputFile.gcount() != (std::streamsize) headerPrefixLength)
+    return false;
+  int declaredHeaderLength;
+  memcpy( &declaredHeaderLength, headerBlock + LONGINT, sizeof(int) );
+  if (declaredHeaderLength != headerLength)
+    return false;
+
+  //! Remaining header sections.
+  inputFile.read( headerBlock + headerPrefixLength, headerLength - headerPrefixLength );
+  return inputFile.gcount() == (std::streamsize) (headerLength - headerPrefixLength);
+}
+
+
+//! File copy.
+void CopyPQCTFile(const std::string & inputFilename,
+		  const std::string & outputFilename) {
+
+#ifndef _WIN32
+  int inputDescriptor = open( inputFilename.c_str(), O_RDONLY );
+  if (inputDescriptor < 0) {
+    throw "Unable to open image file for reading";
+    return;
+  }
+  struct stat fileStatus;
+  if (fstat( inputDescriptor, &fileStatus ) != 0) {
+    close( inputDescriptor );
+    throw "Unable to open image file for reading";
+    return;
+  }
+
+  //! The output is the input under another name (./a, a symbolic or a
+  //! hard link): truncating it would destroy the input, and there is
+  //! nothing to copy.
+  struct stat outputStatus;
+  if (stat( outputFilename.c_str(), &outputStatus ) == 0 &&
+      outputStatus.st_dev == fileStatus.st_dev &&
+      outputStatus.st_ino == fileStatus.st_ino) {
+    close( inputDescriptor );
+    return;
+  }
+
+  int outputDescriptor = open( outputFilename.c_str(),
+			       O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+  if (outputDescriptor < 0) {
+    close( inputDescriptor );
+    throw "Unable to open image file for writing";
+    return;
+  }
+
+  bool copied = false;
+#if defined(__linux__)
+  //! 1: Share the extents (btrfs, XFS with reflink).
+#ifdef FICLONE
+  copied = ( ioctl( outputDescriptor, FICLONE, inputDescriptor ) == 0 );
+#endif
+
+  //! 2: In-kernel copy.
+#ifdef __NR_copy_file_range
+  if (!copied) {
+    off_t remaining = fileStatus.st_size;
+    while (remaining > 0) {
+      long bytesCopied = syscall( __NR_copy_file_range,
+				  inputDescriptor, NULL,
+				  outputDescriptor, NULL,
+				  (size_t) remaining, 0u );
+      if (bytesCopied <= 0)
+	break;
+      remaining -= bytesCopied;
+    }
+    copied = ( remaining == 0 );
+    if (!copied) {
+      //! Restart from the beginning with the buffered copy.
+      lseek( inputDescriptor, 0, SEEK_SET );
+      lseek( outputDescriptor, 0, SEEK_SET );
+      if (ftruncate( outputDescriptor, 0 ) != 0) {
+	close( inputDescriptor );
+	close( outputDescriptor );
+	throw "Unable to write image file";
+	return;
+      }
+    }
+  }
+#endif
+#endif
+
+  //! 3: Buffered copy.
+  if (!copied) {
+    std::vector<char> buffer( 1 << 20 );
+    ssize_t bytesRead;
+    copied = true;
+    while ((bytesRead = read( inputDescriptor, &buffer[0], buffer.size() )) > 0) {
+      if (write( outputDescriptor, &buffer[0], bytesRead ) != bytesRead) {
+	copied = false;
+	break;
+      }
+    }
+    if (bytesRead < 0)
+      copied = false;
+  }
+
+  close( inputDescriptor );
+  if (close( outputDescriptor ) != 0)
+    copied = false;
+  if (!copied) {
+    throw "Unable to write image file";
+    return;
+  }
+#else
+  //! Same file check by volume and file index, as above.
+  if ( itksys::SystemTools::FileExists( outputFilename.c_str(), true ) &&
+       itksys::SystemTools::SameFile( inputFilename.c_str(), outputFilename.c_str() ) )
+    return;
+
+  std::ifstream inputFile;
+  inputFile.open( inputFilename.c_str(), std::ios::binary );
+  if (inputFile.fail()) {
+    throw "Unable to open image file for reading";
+    return;
+  }
+  std::ofstream outputFile;
+  outputFile.open( outputFilename.c_str(), std::ios::binary );
+  if (outputFile.fail()) {
+    throw "Unable to open image file for writing";
+    return;
+  }
+  outputFile << inputFile.rdbuf();
+  if (outputFile.fail()) {
+    throw "Unable to write image file";
+    return;
+  }
+#endif
+}
+
+
+//! Anonymization of the patient record.
+void AnonymizePQCTHeader(const std::string & filename) {
+
+  //! Name field: length byte followed by 40 characters.
+  char nameField[patientNameFieldLength];
+  memset( nameField, 0, patientNameFieldLength );
+  size_t nameLength = strlen( anonymizedPatientName );
+  nameField[0] = static_cast<char>( nameLength );
+  memcpy( nameField + 1, anonymizedPatientName, nameLength );
+
+  char headerBlock[headerLength];
+
+#ifndef _WIN32
+  int fileDescriptor = open( filename.c_str(), O_RDWR );
+  if (fileDescriptor < 0) {
+    throw "Unable to open image file for reading/writing";
+    return;
+  }
+  if (pread( fileDescriptor, headerBlock, headerLength, 0 ) != headerLength) {
+    close( fileDescriptor );
+    throw("Unrecognized input file format.");
+    return;
+  }
+
+  size_t nameOffset;
+  try {
+    PQCT_HeaderView headerView( headerBlock, headerLength );
+    nameOffset = headerView.GetPatientNameOffset();
+  }
+  catch(const char *) {
+    close( fileDescriptor );
+    throw;
+  }
+
+  ssize_t bytesWritten = pwrite( fileDescriptor, nameField,
+				 patientNameFieldLength, nameOffset );
+  if (close( fileDescriptor ) != 0 ||
+      bytesWritten != (ssize_t) patientNameFieldLength) {
+    throw "Unable to write image file";
+    return;
+  }
+#else
+  std::fstream anonymizationFile;
+  anonymizationFile.open( filename.c_str(), std::ios::in|std::ios::out|std::ios::binary );
+  if (anonymizationFile.fail()) {
+    throw "Unable to open image file for reading/writing";
+    return;
+  }
+  anonymizationFile.read( headerBlock, headerLength );
+  if (anonymizationFile.gcount() != headerLength) {
+    throw("Unrecognized input file format.");
+    return;
+  }
+  PQCT_HeaderView headerView( headerBlock, headerLength );
+  anonymizationFile.seekp( headerView.GetPatientNameOffset(), std::ios::beg );
+  anonymizationFile.write( nameField, patientNameFieldLength );
+  anonymizationFile.close();
+#endif
+}
+
+
+//! Copy a field of type T to a given byte offset.
+template<class T> static void WriteHeaderField(char * header, size_t offset, const T & value) {
+  memcpy( header + offset, &value, sizeof(T) );
+}
+
+
+//! Copy a character field, truncated to length - 1 characters so that
+//! it stays zero terminated.
+static void WriteHeaderString(char * header, size_t offset, size_t length,
+			      const std::string & value) {
+  memcpy( header + offset, value.data(), std::min( value.size(), length - 1 ) );
+}
+
+
+//! Record length to write: the declared length, at least the length of
+//! the fields that the header view requires.
+static int GetRecordLength(int declaredLength, size_t minimumLength) {
+  return declaredLength > (int) minimumLength ? declaredLength : (int) minimumLength;
+}
+
+
+//! Header of consecutive detector, patient and image records, zero
+//! padded to headerLength, followed by the pixel block.
+void WritePQCTImageFile(const std::string & filename,
+			const HeaderPrefixType & headerPrefix,
+			const DetectorInformationType & detectorInformation,
+			const PatientInformationType & patientInformation,
+			const ImageInformationType & imageInformation,
+			const PQCTPixelType * pixels) {
+
+  int detectorRecordLength = 
+    GetRecordLength( detectorInformation.DetRecTypeLength,
+		     detectorLeadingFieldsLength + measurementInfoFromSectionEnd );
+  int patientRecordLength = 
+    GetRecordLength( patientInformation.PatInfoRecTypeLength, patientFieldsLength );
+  int imageRecordLength = 
+    GetRecordLength( imageInformation.PicInfoRecLength, imageInformationFieldsLength );
+  if (headerPrefixLength + detectorRecordLength + patientRecordLength + 
+      imageRecordLength > (size_t) headerLength) {
+    throw "Header records do not fit in the image header";
+    return;
+  }
+
+  std::vector<char> headerBlock( headerLength, 0 );
+  char * header = &headerBlock[0];
+
+  //! 1: FilePreFix (header version, size).
+  WriteHeaderField<int>( header, 0, headerPrefix.HeaderVersion );
+  WriteHeaderField<int>( header, LONGINT, headerLength );
+
+  //! 2: DetRec (detector's geometry); 10 bytes after the voxel size
+  //! are not used by the analyzer.
+  size_t offset = headerPrefixLength;
+  WriteHeaderField<int>( header, offset, detectorRecordLength );
+  WriteHeaderField<double>( header, offset + LONGINT, detectorInformation.VoxelSize );
+  WriteHeaderField<unsigned short>( header, offset + LONGINT + DOUBLE + 10,
+				    detectorInformation.NumberofSlices );
+  WriteHeaderField<double>( header, offset + LONGINT + DOUBLE + 10 + WORD,
+			    detectorInformation.SliceOrigin );
+  offset += detectorRecordLength;
+  //! CT scan date, at the beginning of the measurement info.
+  WriteHeaderField<int>( header, offset - measurementInfoFromSectionEnd,
+			 detectorInformation.ScanDate );
+
+  //! 3: PatInfoRec (patient information).
+  WriteHeaderField<int>( header, offset, patientRecordLength );
+  size_t fieldOffset = offset + LONGINT;
+  WriteHeaderField<unsigned short>( header, fieldOffset, patientInformation.PatientGender );
+  fieldOffset += WORD;
+  WriteHeaderField<unsigned short>( header, fieldOffset, patientInformation.PatientEthnicGroup );
+  fieldOffset += WORD;
+  WriteHeaderField<unsigned short>( header, fieldOffset,
+				    patientInformation.PatientMeasurementNumber );
+  fieldOffset += WORD;
+  WriteHeaderField<int>( header, fieldOffset, patientInformation.PatientNumber );
+  fieldOffset += LONGINT;
+  WriteHeaderField<int>( header, fieldOffset, patientInformation.PatientBirthDate );
+  fieldOffset += LONGINT + LONGINT;
+
+  //! Patient name (length byte followed by the characters).
+  size_t nameLength = std::min( patientInformation.PatientName.size(), 
+				patientNameFieldLength - 1 );
+  header[fieldOffset] = static_cast<char>( nameLength );
+  memcpy( header + fieldOffset + 1, patientInformation.PatientName.data(), nameLength );
+  fieldOffset += patientNameFieldLength;
+
+  //! User and patient IDs.
+  fieldOffset += CHAR + 41 * CHAR + CHAR + 81 * CHAR + CHAR + LONGINT;
+  WriteHeaderString( header, fieldOffset, 13, patientInformation.UserID );
+  fieldOffset += 13 * CHAR;
+  WriteHeaderString( header, fieldOffset, 13, patientInformation.PatientID );
+  offset += patientRecordLength;
+
+  //! 4: PicInfoRec (CT image information).
+  WriteHeaderField<int>( header, offset, imageRecordLength );
+  fieldOffset = offset + LONGINT;
+  WriteHeaderField<unsigned short>( header, fieldOffset, imageInformation.PicX0 );
+  fieldOffset += WORD;
+  WriteHeaderField<unsigned short>( header, fieldOffset, imageInformation.PicY0 );
+  fieldOffset += WORD;
+  WriteHeaderField<unsigned short>( header, fieldOffset, imageInformation.MatrixSize[0] );
+  fieldOffset += WORD;
+  WriteHeaderField<unsigned short>( header, fieldOffset, imageInformation.MatrixSize[1] );
+
+  std::ofstream outputFile;
+  outputFile.open( filename.c_str(), std::ios::binary );
+  if (outputFile.fail()) {
+    throw "Unable to open image file for writing";
+    return;
+  }
+  outputFile.write( header, headerLength );
+  outputFile.write( reinterpret_cast<const char *>( pixels ),
+		    (std::streamsize) imageInformation.MatrixSize[0] * 
+		    imageInformation.MatrixSize[1] * sizeof(PQCTPixelType) );
+  outputFile.close();
+  if (outputFile.fail()) {
+    throw "Unable to write image file";
+    return;
+  }
+}
+
+
+//! Memory-mapped file.
+PQCT_MappedFile::PQCT_MappedFile() {
+  this->m_Data = NULL;
+  this->m_Length = 0;
+  this->m_IsMapped = false;
+}
+
+
+PQCT_MappedFile::~PQCT_MappedFile() {
+  this->Close();
+}
+
+
+//! Map the whole file in one call.
+void PQCT_MappedFile::Open(const std::string & filename) {
+
+  this->Close();
+
+#ifndef _WIN32
+  int fileDescriptor = open( filename.c_str(), O_RDONLY );
+  if (fileDescriptor < 0) {
+    throw "Unable to open image file for reading";
+    return;
+  }
+
+  struct stat fileStatus;
+  if (fstat( fileDescriptor, &fileStatus ) != 0 || fileStatus.st_size <= 0) {
+    close( fileDescriptor );
+    throw "Unable to open image file for reading";
+    return;
+  }
+
+  size_t fileLength = static_cast<size_t>( fileStatus.st_size );
+  void * mapping = mmap( NULL, fileLength, PROT_READ, MAP_PRIVATE,
+			 fileDescriptor, 0 );
+  //! The mapping stays valid after the descriptor is closed.
+  close( fileDescriptor );
+  if (mapping == MAP_FAILED) {
+    throw "Unable to map image file";
+    return;
+  }
+  madvise( mapping, fileLength, MADV_SEQUENTIAL );
+
+  this->m_Data = static_cast<const char *>( mapping );
+  this->m_Length = fileLength;
+  this->m_IsMapped = true;
+#else
+  //! No mmap: read the file in one call.
+  std::ifstream inputFile;
+  inputFile.open( filename.c_str(), std::ios::binary );
+  if (inputFile.fail()) {
+    throw "Unable to open image file for reading";
+    return;
+  }
+  inputFile.seekg( 0, std::ios::end );
+  std::streamoff fileLength = inputFile.tellg();
+  inputFile.seekg( 0, std::ios::beg );
+  if (fileLength <= 0) {
+    throw "Unable to open image file for reading";
+    return;
+  }
+
+  char * buffer = new char[ static_cast<size_t>(fileLength) ];
+  inputFile.read( buffer, fileLength );
+  if (inputFile.gcount() != fileLength) {
+    delete [] buffer;
+    throw "Unable to read image file";
+    return;
+  }
+  inputFile.close();
+
+  this->m_Data = buffer;
+  this->m_Length = static_cast<size_t>( fileLength );
+  this->m_IsMapped = false;
+#endif
+}
+
+
+//! Release mapping or buffer.
+void PQCT_MappedFile::Close() {
+  if (this->m_Data == NULL)
+    return;
+
+#ifndef _WIN32
+  if (this->m_IsMapped)
+    munmap( const_cast<char *>( this->m_Data ), this->m_Length );
+  else
+    delete [] this->m_Data;
+#else
+  delete [] this->m_Data;
+#endif
+
+  this->m_Data = NULL;
+  this->m_Length = 0;
+  this->m_IsMapped = false;
+}
+
+
+//! Header view.
+//! Validate the prefix and the section lengths before any field is decoded.
+PQCT_HeaderView::PQCT_HeaderView(const char * data, size_t length) {
+
+  this->m_Data = data;
+  this->m_Length = length;
+
+  //! Exception handling, return if this is not the expected file type.
+  if (data == NULL || length < (size_t) headerLength) {
+    throw("Unrecognized input file format.");
+    return;
+  }
+  if (this->ReadField<int>( LONGINT ) != headerLength) {
+    throw("Unrecognized input file format.");
+    return;
+  }
+
+  //! Detector record must contain the fields read and the measurement info.
+  int detectorRecordLength = this->ReadField<int>( this->GetDetectorOffset() );
+  if (detectorRecordLength < 0 ||
+      (size_t) detectorRecordLength < detectorLeadingFieldsLength + measurementInfoFromSectionEnd) {
+    throw("Corrupted detector record in image header.");
+    return;
+  }
+  this->m_PatientOffset = this->GetDetectorOffset() + detectorRecordLength;
+
+  //! Patient record.
+  if (this->m_PatientOffset + LONGINT > (size_t) headerLength) {
+    throw("Corrupted patient record in image header.");
+    return;
+  }
+  int patientRecordLength = this->ReadField<int>( this->m_PatientOffset );
+  if (patientRecordLength < 0 ||
+      (size_t) patientRecordLength < patientFieldsLength) {
+    throw("Corrupted patient record in image header.");
+    return;
+  }
+  this->m_ImageInformationOffset = this->m_PatientOffset + patientRecordLength;
+
+  //! Image record.
+  if (this->m_ImageInformationOffset + LONGINT > (size_t) headerLength) {
+    throw("Corrupted image record in image header.");
+    return;
+  }
+  int imageRecordLength = this->ReadField<int>( this->m_ImageInformationOffset );
+  if (imageRecordLength < 0 ||
+      (size_t) imageRecordLength < imageInformationFieldsLength ||
+      this->m_ImageInformationOffset + imageRecordLength > (size_t) headerLength) {
+    throw("Corrupted image record in image header.");
+    return;
+  }
+}
+
+
+//! Copy a character field up to its first terminating zero.
+std::string PQCT_HeaderView::ReadString(size_t offset, size_t length) const {
+  const char * field = this->m_Data + offset;
+  size_t fieldLength = 0;
+  while (fieldLength < length && field[fieldLength] != '\0')
+    fieldLength++;
+  return std::string( field, fieldLength );
+}
+
+
+//! Number of pixels of the image matrix.
+size_t PQCT_HeaderView::GetNumberOfPixels() const {
+  size_t offset = this->m_ImageInformationOffset + LONGINT + WORD + WORD;
+  return (size_t) this->ReadField<unsigned short>( offset ) *
+    (size_t) this->ReadField<unsigned short>( offset + WORD );
+}
+
+
+//! Decode the header fields.
+void PQCT_HeaderView::Parse(HeaderPrefixType & headerPrefix,
+			    DetectorInformationType & detectorInformation,
+			    PatientInformationType & patientInformation,
+			    ImageInformationType & imageInformation) const {
+
+  //! 1: FilePreFix (header version, size).
+  headerPrefix.HeaderVersion = this->ReadField<int>( 0 );
+  headerPrefix.HeaderLength = this->ReadField<int>( LONGINT );
+
+  //! 2: DetRec (detector's geometry).
+  size_t offset = this->GetDetectorOffset();
+  detectorInformation.DetRecTypeLength = this->ReadField<int>( offset );
+  detectorInformation.VoxelSize = this->ReadField<double>( offset + LONGINT );
+  //! Skip 10 bytes after the voxel size.
+  detectorInformation.NumberofSlices =
+    this->ReadField<unsigned short>( offset + LONGINT + DOUBLE + 10 );
+  detectorInformation.SliceOrigin =
+    this->ReadField<double>( offset + LONGINT + DOUBLE + 10 + WORD );
+  //! CT scan date, at the beginning of the measurement info.
+  detectorInformation.ScanDate =
+    this->ReadField<int>( this->m_PatientOffset - measurementInfoFromSectionEnd );
+
+  //! 3: PatInfoRec (patient information).
+  offset = this->m_PatientOffset;
+  patientInformation.PatInfoRecTypeLength = this->ReadField<int>( offset );
+  offset += LONGINT;
+  patientInformation.PatientGender = this->ReadField<unsigned short>( offset );
+  offset += WORD;
+  patientInformation.PatientEthnicGroup = this->ReadField<unsigned short>( offset );
+  offset += WORD;
+  patientInformation.PatientMeasurementNumber = this->ReadField<unsigned short>( offset );
+  offset += WORD;
+  patientInformation.PatientNumber = this->ReadField<int>( offset );
+  offset += LONGINT;
+  patientInformation.PatientBirthDate = this->ReadField<int>( offset );
+  offset += LONGINT + LONGINT;
+
+  //! Patient name (length byte followed by the characters).
+  size_t nameLength = static_cast<unsigned char>( this->m_Data[offset] );
+  if (nameLength > patientNameFieldLength - 1)
+    nameLength = patientNameFieldLength - 1;
+  patientInformation.PatientName = this->ReadString( offset + 1, nameLength );
+  offset += patientNameFieldLength;
+
+  //! User and patient IDs.
+  offset += CHAR + 41 * CHAR + CHAR + 81 * CHAR + CHAR + LONGINT;
+  patientInformation.UserID = this->ReadString( offset, 13 );
+  offset += 13 * CHAR;
+  patientInformation.PatientID = this->ReadString( offset, 13 );
+
+  //! 4: PicInfoRec (CT image information).
+  offset = this->m_ImageInformationOffset;
+  imageInformation.PicInfoRecLength = this->ReadField<int>( offset );
+  offset += LONGINT;
+  imageInformation.PicX0 = this->ReadField<unsigned short>( offset );
+  offset += WORD;
+  imageInformation.PicY0 = this->ReadField<unsigned short>( offset );
+  offset += WORD;
+  imageInformation.MatrixSize[0] = this->ReadField<unsigned short>( offset );
+  offset += WORD;
+  imageInformation.MatrixSize[1] = this->ReadField<unsigned short>( offset );
+}
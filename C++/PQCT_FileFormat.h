@@ -0,0 +1,193 @@
+/*===========================================================================
+
+Program:   Bone, muscle and fat quantification from PQCT data.
+Module:    $RCSfile: PQCT_FileFormat.h,v $
+Language:  C++
+Date:      $Date: 2012/08/20 10:00:00 $
+Version:   $Revision: 0.1 $
+Author:    S. K. Makrogiannis
+3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+=============================================================================*/
+
+#ifndef __PQCT_FileFormat_h__
+#define __PQCT_FileFormat_h__
+
+#include <string>
+#include <cstring>
+#include <cstddef>
+
+#include "PQCT_Datatypes.h"
+
+
+//! Image header containers of the Stratec pQCT (.I0x) format.
+
+typedef struct t_HeaderPrefixType
+{
+  int HeaderVersion;
+  int HeaderLength;
+}
+HeaderPrefixType;
+
+typedef struct t_DetectorInformationType
+{
+  int DetRecTypeLength;
+  double VoxelSize;
+  unsigned short NumberofSlices;
+  double SliceOrigin;
+  int ScanDate;
+}
+DetectorInformationType;
+
+typedef struct t_PatientInformationType
+{
+  int PatInfoRecTypeLength;
+  unsigned short PatientGender;
+  unsigned short PatientEthnicGroup;
+  unsigned short PatientMeasurementNumber;
+  int PatientNumber;
+  int PatientBirthDate;
+  std::string PatientName;
+  std::string UserID;
+  std::string PatientID;
+}
+PatientInformationType;
+
+typedef struct t_ImageInformationType
+{
+  int PicInfoRecLength;
+  unsigned short int PicX0;
+  unsigned short PicY0;
+  unsigned short MatrixSize[2];
+}
+ImageInformationType;
+
+
+//! Byte layout of the header sections (Borland Pascal records).
+//! Header prefix: version and total length.
+static const size_t headerPrefixLength = LONGINT + LONGINT;
+//! Detector record: fields read before the measurement info.
+static const size_t detectorLeadingFieldsLength =
+  LONGINT + DOUBLE + WORD + DOUBLE + WORD + DOUBLE;
+//! Detector record: measurement info, counted from the end of the section.
+static const size_t measurementInfoFromSectionEnd =
+  3 * LONGINT + 4 * SHORTINT + 2 * BYTE + BOOLEAN +
+  MAXNUMDET * BYTE + 2 * SINGLE +
+  BOOLEAN + SINGLE + 13 * CHAR + CHAR +
+  2 * SINGLE + 2 * BYTE + 2 * BOOLEAN + BYTE;
+//! Patient record: offset of the name (Pascal string[40]).
+static const size_t patientNameOffsetInSection =
+  LONGINT + WORD + WORD + WORD + LONGINT + LONGINT + LONGINT;
+static const size_t patientNameFieldLength = 41 * CHAR;
+//! Patient record: fields read by the analyzer.
+static const size_t patientFieldsLength =
+  LONGINT + WORD + WORD + WORD + LONGINT + LONGINT + LONGINT + 41 * CHAR +
+  CHAR + 41 * CHAR + CHAR + 81 * CHAR + CHAR + LONGINT + 13 * CHAR + 13 * CHAR;
+//! Image record: fields read by the analyzer.
+static const size_t imageInformationFieldsLength =
+  LONGINT + WORD + WORD + WORD + WORD;
+
+
+//! Read only the header block of an image file (headerLength bytes).
+//! Returns false without throwing when the file cannot be opened, is
+//! too short or its prefix does not declare the expected header length,
+//! so that directory scans can reject foreign files quickly.
+bool ReadPQCTHeaderBlock(const std::string & filename, char * headerBlock);
+
+
+//! Name written to the patient record by the anonymizer.
+static const char anonymizedPatientName[] = "Anonymoys";
+
+//! Copy a file without passing its bytes through user space where the
+//! platform allows it (reflink clone, then copy_file_range), otherwise
+//! with a buffered copy. An output that is the input file, by whatever
+//! path, is left as it is. Throws on failure.
+void CopyPQCTFile(const std::string & inputFilename,
+		  const std::string & outputFilename);
+
+//! Overwrite the patient name of an image file in place: the header is
+//! read and validated, then the name field is written with one
+//! positional write. Throws on failure.
+void AnonymizePQCTHeader(const std::string & filename);
+
+//! Write an image file: the header holds every field that
+//! PQCT_HeaderView::Parse() decodes, the other bytes are zero, and the
+//! pixels (raw attenuation values, row by row) follow. Record lengths
+//! below the lengths of the decoded fields are raised to them; the
+//! header length is always headerLength. Throws on failure.
+void WritePQCTImageFile(const std::string & filename,
+			const HeaderPrefixType & headerPrefix,
+			const DetectorInformationType & detectorInformation,
+			const PatientInformationType & patientInformation,
+			const ImageInformationType & imageInformation,
+			const PQCTPixelType * pixels);
+
+
+//! Read-only memory mapping of a whole file.
+//! Falls back to a single buffered read where mmap is unavailable.
+class PQCT_MappedFile {
+
+ public:
+  PQCT_MappedFile();
+  ~PQCT_MappedFile();
+
+  //! Map file; throws on failure.
+  void Open(const std::string & filename);
+  void Close();
+
+  const char * GetData() const { return this->m_Data; };
+  size_t GetLength() const { return this->m_Length; };
+
+ private:
+  PQCT_MappedFile(const PQCT_MappedFile &);  // Not implemented.
+  void operator=(const PQCT_MappedFile &);   // Not implemented.
+
+  const char * m_Data;
+  size_t m_Length;
+  bool m_IsMapped;
+};
+
+
+//! Validated view of a pQCT header over raw bytes
+//! (e.g. a memory mapping). No bytes are copied until Parse().
+class PQCT_HeaderView {
+
+ public:
+  //! Check section lengths against the buffer; throws on failure.
+  PQCT_HeaderView(const char * data, size_t length);
+
+  //! Decode header fields into the analyzer's containers.
+  void Parse(HeaderPrefixType & headerPrefix,
+	     DetectorInformationType & detectorInformation,
+	     PatientInformationType & patientInformation,
+	     ImageInformationType & imageInformation) const;
+
+  //! Section offsets from the beginning of the file.
+  size_t GetDetectorOffset() const { return headerPrefixLength; };
+  size_t GetPatientOffset() const { return this->m_PatientOffset; };
+  size_t GetPatientNameOffset() const {
+    return this->m_PatientOffset + patientNameOffsetInSection;
+  };
+  size_t GetImageInformationOffset() const { return this->m_ImageInformationOffset; };
+  size_t GetPixelOffset() const { return headerLength; };
+
+  //! Number of pixels declared by the image record.
+  size_t GetNumberOfPixels() const;
+
+ private:
+  //! Copy a field of type T located at a given byte offset.
+  template<class T> T ReadField(size_t offset) const {
+    T value;
+    memcpy( &value, this->m_Data + offset, sizeof(T) );
+    return value;
+  };
+  //! Read fixed length, possibly unterminated character field.
+  std::string ReadString(size_t offset, size_t length) const;
+
+  const char * m_Data;
+  size_t m_Length;
+  size_t m_PatientOffset;
+  size_t m_ImageInformationOffset;
+};
+
+#endif
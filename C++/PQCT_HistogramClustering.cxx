@@ -0,0 +1,236 @@
+/*===========================================================================
+
+Program:   Bone, muscle and fat quantification from PQCT data.
+Module:    $RCSfile: PQCT_HistogramClustering.cxx,v $
+Language:  C++
+Date:      $Date: 2012/09/12 10:00:00 $
+Version:   $Revision: 0.1 $
+Author:    S. K. Makrogiannis
+3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+=============================================================================*/
+
+#include <cmath>
+
+#include "PQCT_HistogramClustering.h"
+#include "PQCT_LabelKernels.h"
+
+
+//! log( 2 pi ).
+static const double LOGTWOPI = 1.8378770664093453;
+
+
+//! Log of prior times density of each component at a value; false
+//! for the components without prior.
+static void GetLogDensities(const PQCT_GaussianMixtureType & mixture,
+			    double value,
+			    std::vector<double> & logDensities,
+			    std::vector<bool> & valid) {
+  for (unsigned int k = 0; k < mixture.Means.size(); k++) {
+    valid[k] = mixture.Priors[k] > 0.0;
+    if ( !valid[k] )
+      continue;
+    double difference = value - mixture.Means[k];
+    logDensities[k] = std::log( mixture.Priors[k] )
+      - 0.5 * ( LOGTWOPI + std::log( mixture.Variances[k] ) )
+      - 0.5 * difference * difference / mixture.Variances[k];
+  }
+}
+
+
+PQCT_HistogramType PQCT_HistogramClustering::GetUpperHistogram(const PQCT_HistogramType & histogram,
+							       long lower) {
+  PQCT_HistogramType upperHistogram;
+  if (lower < histogram.Minimum)
+    lower = histogram.Minimum;
+  upperHistogram.Minimum = lower;
+  long first = lower - histogram.Minimum;
+  if ( first < (long) histogram.Counts.size() )
+    upperHistogram.Counts.assign( histogram.Counts.begin() + first, histogram.Counts.end() );
+  return upperHistogram;
+}
+
+
+unsigned int PQCT_HistogramClustering::EstimateGaussianMixture(const PQCT_HistogramType & histogram,
+							       PQCT_GaussianMixtureType & mixture,
+							       unsigned int maximumIterations) {
+  const unsigned int numberOfClasses = (unsigned int) mixture.Means.size();
+  if (numberOfClasses == 0 || numberOfClasses > LABELLUTSIZE)
+    throw "Unacceptable number of mixture components.";
+
+  //! 1. Initialization by k-means.
+  PQCT_HistogramKMeans::EstimateMeans( histogram, mixture.Means );
+  std::vector<LabelPixelType> binClasses;
+  PQCT_HistogramKMeans::ClassifyBins( histogram, mixture.Means, binClasses );
+
+  std::vector<double> sizes( numberOfClasses, 0.0 );
+  mixture.Variances.assign( numberOfClasses, 0.0 );
+  mixture.Priors.assign( numberOfClasses, 0.0 );
+  double total = 0.0;
+  for (size_t b = 0; b < histogram.Counts.size(); b++) {
+    if (histogram.Counts[b] == 0)
+      continue;
+    double count = (double) histogram.Counts[b];
+    double difference = (double) ( histogram.Minimum + (long) b ) - mixture.Means[ binClasses[b] ];
+    sizes[ binClasses[b] ] += count;
+    mixture.Variances[ binClasses[b] ] += count * difference * difference;
+    total += count;
+  }
+  if (total == 0.0)
+    return 0;
+  for (unsigned int k = 0; k < numberOfClasses; k++) {
+    mixture.Priors[k] = sizes[k] / total;
+    if (sizes[k] > 0.0)
+      mixture.Variances[k] /= sizes[k];
+    if (mixture.Variances[k] < EMGMMMINIMUMVARIANCE)
+      mixture.Variances[k] = EMGMMMINIMUMVARIANCE;
+  }
+
+  //! 2. EM: responsibilities of each bin, then weighted moments.
+  std::vector<double> logDensities( numberOfClasses );
+  std::vector<bool> valid( numberOfClasses );
+  std::vector<double> weights( numberOfClasses ), sums( numberOfClasses ), squares( numberOfClasses );
+  double previousLogLikelihood = 0.0;
+  unsigned int iteration = 0;
+  while (iteration < maximumIterations) {
+    iteration++;
+
+    weights.assign( numberOfClasses, 0.0 );
+    sums.assign( numberOfClasses, 0.0 );
+    squares.assign( numberOfClasses, 0.0 );
+    double logLikelihood = 0.0;
+    for (size_t b = 0; b < histogram.Counts.size(); b++) {
+      if (histogram.Counts[b] == 0)
+	continue;
+      double count = (double) histogram.Counts[b];
+      double value = (double) ( histogram.Minimum + (long) b );
+      GetLogDensities( mixture, value, logDensities, valid );
+
+      //! Log-sum-exp, so that far bins do not underflow.
+      double maximum = -HUGE_VAL;
+      for (unsigned int k = 0; k < numberOfClasses; k++)
+	if (valid[k] && logDensities[k] > maximum)
+	  maximum = logDensities[k];
+      double sum = 0.0;
+      for (unsigned int k = 0; k < numberOfClasses; k++)
+	if (valid[k])
+	  sum += std::exp( logDensities[k] - maximum );
+      logLikelihood += count * ( maximum + std::log( sum ) );
+
+      for (unsigned int k = 0; k < numberOfClasses; k++) {
+	if ( !valid[k] )
+	  continue;
+	double weight = count * std::exp( logDensities[k] - maximum ) / sum;
+	weights[k] += weight;
+	sums[k] += weight * value;
+	squares[k] += weight * value * value;
+      }
+    }
+
+    for (unsigned int k = 0; k < numberOfClasses; k++) {
+      mixture.Priors[k] = weights[k] / total;
+      if (weights[k] == 0.0)
+	continue;
+      mixture.Means[k] = sums[k] / weights[k];
+      mixture.Variances[k] = squares[k] / weights[k] - mixture.Means[k] * mixture.Means[k];
+      if (mixture.Variances[k] < EMGMMMINIMUMVARIANCE)
+	mixture.Variances[k] = EMGMMMINIMUMVARIANCE;
+    }
+
+    if ( iteration > 1 &&
+	 std::fabs( logLikelihood - previousLogLikelihood ) <= EMGMMTOLERANCE * std::fabs( logLikelihood ) )
+      break;
+    previousLogLikelihood = logLikelihood;
+  }
+  return iteration;
+}
+
+
+void PQCT_HistogramClustering::ClassifyBinsBayes(const PQCT_HistogramType & histogram,
+						 const PQCT_GaussianMixtureType & mixture,
+						 std::vector<LabelPixelType> & binClasses) {
+  const unsigned int numberOfClasses = (unsigned int) mixture.Means.size();
+  if (numberOfClasses == 0 || numberOfClasses > LABELLUTSIZE)
+    throw "Unacceptable number of mixture components.";
+
+  std::vector<double> logDensities( numberOfClasses );
+  std::vector<bool> valid( numberOfClasses );
+  binClasses.resize( histogram.Counts.size() );
+  for (size_t b = 0; b < histogram.Counts.size(); b++) {
+    GetLogDensities( mixture, (double) ( histogram.Minimum + (long) b ), logDensities, valid );
+    unsigned int best = 0;
+    double bestLogDensity = -HUGE_VAL;
+    for (unsigned int k = 0; k < numberOfClasses; k++)
+      if (valid[k] && logDensities[k] > bestLogDensity) {
+	best = k;
+	bestLogDensity = logDensities[k];
+      }
+    binClasses[b] = (LabelPixelType) best;
+  }
+}
+
+
+unsigned int PQCT_HistogramClustering::EstimateFuzzyCMeans(const PQCT_HistogramType & histogram,
+							   std::vector<double> & centers,
+							   double fuzziness,
+							   unsigned int maximumIterations) {
+  const unsigned int numberOfClasses = (unsigned int) centers.size();
+  if (numberOfClasses == 0 || numberOfClasses > LABELLUTSIZE)
+    throw "Unacceptable number of fuzzy c-means classes.";
+  if (fuzziness <= 1.0)
+    throw "Fuzziness exponent must exceed 1.";
+
+  //! u_k = 1 / sum_j (d_k^2 / d_j^2)^(1/(m-1)).
+  const double exponent = -1.0 / ( fuzziness - 1.0 );
+  std::vector<double> memberships( numberOfClasses );
+  std::vector<double> weights( numberOfClasses ), sums( numberOfClasses );
+  unsigned int iteration = 0;
+  while (iteration < maximumIterations) {
+    iteration++;
+
+    weights.assign( numberOfClasses, 0.0 );
+    sums.assign( numberOfClasses, 0.0 );
+    for (size_t b = 0; b < histogram.Counts.size(); b++) {
+      if (histogram.Counts[b] == 0)
+	continue;
+      double count = (double) histogram.Counts[b];
+      double value = (double) ( histogram.Minimum + (long) b );
+
+      //! A value on a center belongs to it only.
+      unsigned int onCenter = numberOfClasses;
+      double sum = 0.0;
+      for (unsigned int k = 0; k < numberOfClasses && onCenter == numberOfClasses; k++) {
+	double difference = value - centers[k];
+	if (difference == 0.0)
+	  onCenter = k;
+	else {
+	  memberships[k] = std::pow( difference * difference, exponent );
+	  sum += memberships[k];
+	}
+      }
+      for (unsigned int k = 0; k < numberOfClasses; k++) {
+	double membership;
+	if (onCenter < numberOfClasses)
+	  membership = ( k == onCenter ) ? 1.0 : 0.0;
+	else
+	  membership = memberships[k] / sum;
+	double weight = count * std::pow( membership, fuzziness );
+	weights[k] += weight;
+	sums[k] += weight * value;
+      }
+    }
+
+    double largestMove = 0.0;
+    for (unsigned int k = 0; k < numberOfClasses; k++) {
+      if (weights[k] == 0.0)
+	continue;
+      double center = sums[k] / weights[k];
+      if (std::fabs( center - centers[k] ) > largestMove)
+	largestMove = std::fabs( center - centers[k] );
+      centers[k] = center;
+    }
+    if (largestMove <= FCMTOLERANCE)
+      break;
+  }
+  return iteration;
+}
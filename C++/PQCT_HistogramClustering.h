@@ -0,0 +1,97 @@
+/*===========================================================================
+
+Program:   Bone, muscle and fat quantification from PQCT data.
+Module:    $RCSfile: PQCT_HistogramClustering.h,v $
+Language:  C++
+Date:      $Date: 2012/09/12 10:00:00 $
+Version:   $Revision: 0.1 $
+Author:    S. K. Makrogiannis
+3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+=============================================================================*/
+
+#ifndef __PQCT_HistogramClustering_h__
+#define __PQCT_HistogramClustering_h__
+
+#include <vector>
+#include <cstddef>
+
+#include "PQCT_Datatypes.h"
+#include "PQCT_HistogramKMeans.h"
+
+
+//! EM iterations, and the relative log-likelihood change that stops them.
+#define EMGMMMAXIMUMITERATIONS 500
+#define EMGMMTOLERANCE 1.0e-9
+
+//! Smallest variance of a mixture component: densities are integers,
+//! a narrower component would fit a single bin.
+#define EMGMMMINIMUMVARIANCE 1.0
+
+//! Fuzzy c-means iterations, the largest center move that stops them,
+//! and the fuzziness exponent (as FCMclust).
+#define FCMMAXIMUMITERATIONS 500
+#define FCMTOLERANCE 1.0e-6
+#define FCMFUZZINESS 2.0
+
+
+//! 1D Gaussian mixture.
+typedef struct t_PQCT_GaussianMixtureType
+{
+  std::vector<double> Means;
+  std::vector<double> Variances;
+  std::vector<double> Priors;
+}
+PQCT_GaussianMixtureType;
+
+
+//! Tissue clustering on the density histogram, the native form of the
+//! emgmmbaycls and fcm options of AnalyzePQCTImageInFeatureSpace.m:
+//! EM of a Gaussian mixture with Bayesian classification, and fuzzy
+//! c-means with classification by the largest membership. Every
+//! iteration visits the bins, weighted by their counts, not the pixels.
+class PQCT_HistogramClustering {
+
+ public:
+  //! The bins of values >= lower.
+  static PQCT_HistogramType GetUpperHistogram(const PQCT_HistogramType & histogram,
+					      long lower);
+
+  //! EM from mixture.Means. As the cmeans initialization of emgmm, the
+  //! means are first moved by k-means, and the variances and priors
+  //! taken from its partition. Returns the number of EM iterations.
+  static unsigned int EstimateGaussianMixture(const PQCT_HistogramType & histogram,
+					      PQCT_GaussianMixtureType & mixture,
+					      unsigned int maximumIterations = EMGMMMAXIMUMITERATIONS);
+
+  //! Class of each bin, the largest posterior (ties to the first class).
+  static void ClassifyBinsBayes(const PQCT_HistogramType & histogram,
+				const PQCT_GaussianMixtureType & mixture,
+				std::vector<LabelPixelType> & binClasses);
+
+  //! Fuzzy c-means from the centers. Largest membership is nearest
+  //! center, so PQCT_HistogramKMeans::ClassifyBins classifies the bins.
+  //! Returns the number of iterations.
+  static unsigned int EstimateFuzzyCMeans(const PQCT_HistogramType & histogram,
+					  std::vector<double> & centers,
+					  double fuzziness = FCMFUZZINESS,
+					  unsigned int maximumIterations = FCMMAXIMUMITERATIONS);
+
+  //! output = binClasses[bin of input], in one pass; the input is within
+  //! the histogram range.
+  template<class TPixel>
+    static void LabelPixels(const TPixel * input,
+			    LabelPixelType * output,
+			    size_t numberOfPixels,
+			    const PQCT_HistogramType & histogram,
+			    const std::vector<LabelPixelType> & binClasses) {
+    if ( binClasses.empty() )
+      return;
+    const LabelPixelType * table = &binClasses[0];
+    const long minimum = histogram.Minimum;
+    for (size_t i = 0; i < numberOfPixels; i++)
+      output[i] = table[ (long) input[i] - minimum ];
+  };
+};
+
+#endif
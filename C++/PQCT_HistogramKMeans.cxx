@@ -0,0 +1,144 @@
+/*===========================================================================
+
+Program:   Bone, muscle and fat quantification from PQCT data.
+Module:    $RCSfile: PQCT_HistogramKMeans.cxx,v $
+Language:  C++
+Date:      $Date: 2012/09/11 10:00:00 $
+Version:   $Revision: 0.1 $
+Author:    S. K. Makrogiannis
+3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+=============================================================================*/
+
+#include <cmath>
+
+#include "PQCT_HistogramKMeans.h"
+#include "PQCT_LabelKernels.h"
+
+
+template<class TPixel>
+bool PQCT_HistogramKMeans::BuildHistogram(const TPixel * input,
+					  size_t numberOfPixels,
+					  PQCT_HistogramType & histogram) {
+  histogram.Minimum = 0;
+  histogram.Counts.clear();
+  if (numberOfPixels == 0)
+    return true;
+
+  //! Range, and integer values only.
+  TPixel minimum = input[0], maximum = input[0];
+  for (size_t i = 0; i < numberOfPixels; i++) {
+    if (input[i] < minimum)
+      minimum = input[i];
+    else if (input[i] > maximum)
+      maximum = input[i];
+  }
+  if ( (double) maximum - (double) minimum >= KMEANSMAXIMUMHISTOGRAMBINS )
+    return false;
+  for (size_t i = 0; i < numberOfPixels; i++)
+    if ( (double) input[i] != std::floor( (double) input[i] ) )
+      return false;
+
+  histogram.Minimum = (long) minimum;
+  histogram.Counts.assign( (size_t) ( (long) maximum - (long) minimum + 1 ), 0 );
+  unsigned long * counts = &histogram.Counts[0];
+  for (size_t i = 0; i < numberOfPixels; i++)
+    counts[ (long) input[i] - histogram.Minimum ]++;
+  return true;
+}
+
+
+unsigned int PQCT_HistogramKMeans::EstimateMeans(const PQCT_HistogramType & histogram,
+						 std::vector<double> & means,
+						 unsigned int maximumIterations) {
+  const unsigned int numberOfClasses = (unsigned int) means.size();
+  std::vector<LabelPixelType> binClasses;
+  std::vector<double> sums( numberOfClasses );
+  std::vector<double> sizes( numberOfClasses );
+
+  unsigned int iteration = 0;
+  while (iteration < maximumIterations) {
+    iteration++;
+
+    //! Class sums and sizes from the bins.
+    ClassifyBins( histogram, means, binClasses );
+    sums.assign( numberOfClasses, 0.0 );
+    sizes.assign( numberOfClasses, 0.0 );
+    for (size_t b = 0; b < histogram.Counts.size(); b++) {
+      if (histogram.Counts[b] == 0)
+	continue;
+      double count = (double) histogram.Counts[b];
+      sums[ binClasses[b] ] += count * (double) ( histogram.Minimum + (long) b );
+      sizes[ binClasses[b] ] += count;
+    }
+
+    //! New means; stop when none moves.
+    bool changed = false;
+    for (unsigned int k = 0; k < numberOfClasses; k++) {
+      if (sizes[k] == 0.0)
+	continue;
+      double mean = sums[k] / sizes[k];
+      if (mean != means[k])
+	changed = true;
+      means[k] = mean;
+    }
+    if (!changed)
+      break;
+  }
+  return iteration;
+}
+
+
+void PQCT_HistogramKMeans::ClassifyBins(const PQCT_HistogramType & histogram,
+					const std::vector<double> & means,
+					std::vector<LabelPixelType> & binClasses) {
+  if (means.empty() || means.size() > LABELLUTSIZE)
+    throw "Unacceptable number of k-means classes.";
+
+  binClasses.resize( histogram.Counts.size() );
+  for (size_t b = 0; b < histogram.Counts.size(); b++) {
+    double value = (double) ( histogram.Minimum + (long) b );
+    unsigned int closest = 0;
+    double closestDistance = std::fabs( value - means[0] );
+    for (unsigned int k = 1; k < means.size(); k++) {
+      double distance = std::fabs( value - means[k] );
+      if (distance < closestDistance) {
+	closest = k;
+	closestDistance = distance;
+      }
+    }
+    binClasses[b] = (LabelPixelType) closest;
+  }
+}
+
+
+template<class TPixel>
+bool PQCT_HistogramKMeans::Classify(const TPixel * input,
+				    LabelPixelType * output,
+				    size_t numberOfPixels,
+				    std::vector<double> & means) {
+  PQCT_HistogramType histogram;
+  if ( !BuildHistogram( input, numberOfPixels, histogram ) )
+    return false;
+  if (numberOfPixels == 0)
+    return true;
+
+  EstimateMeans( histogram, means );
+
+  std::vector<LabelPixelType> binClasses;
+  ClassifyBins( histogram, means, binClasses );
+  const LabelPixelType * table = &binClasses[0];
+  for (size_t i = 0; i < numberOfPixels; i++)
+    output[i] = table[ (long) input[i] - histogram.Minimum ];
+  return true;
+}
+
+
+template bool PQCT_HistogramKMeans::BuildHistogram<float>(const float *, size_t,
+							  PQCT_HistogramType &);
+template bool PQCT_HistogramKMeans::BuildHistogram<PQCTPixelType>(const PQCTPixelType *, size_t,
+								  PQCT_HistogramType &);
+template bool PQCT_HistogramKMeans::Classify<float>(const float *, LabelPixelType *, size_t,
+						    std::vector<double> &);
+template bool PQCT_HistogramKMeans::Classify<PQCTPixelType>(const PQCTPixelType *, LabelPixelType *, size_t,
+							    std::vector<double> &);
@@ -0,0 +1,120 @@
+/*===========================================================================
+
+Program:   Bone, muscle and fat quantification from PQCT data.
+Module:    $RCSfile: PQCT_HistogramKMeans.h,v $
+Language:  C++
+Date:      $Date: 2012/09/11 10:00:00 $
+Version:   $Revision: 0.1 $
+Author:    S. K. Makrogiannis
+3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+=============================================================================*/
+
+#ifndef __PQCT_HistogramKMeans_h__
+#define __PQCT_HistogramKMeans_h__
+
+#include <vector>
+#include <cstddef>
+
+#include "PQCT_Datatypes.h"
+#include "PQCT_LabelKernels.h"
+
+
+//! Iterations of the scalar image k-means filter.
+#define KMEANSMAXIMUMITERATIONS 200
+
+//! Widest histogram, the range of the calibrated densities.
+#define KMEANSMAXIMUMHISTOGRAMBINS 65536
+
+
+//! Integer value histogram.
+typedef struct t_PQCT_HistogramType
+{
+  long Minimum;                        // Value of the first bin.
+  std::vector<unsigned long> Counts;
+}
+PQCT_HistogramType;
+
+
+//! 1D k-means on the value histogram, in place of the scalar image
+//! k-means filter: same initial means, nearest mean assignment with
+//! ties to the first class, empty classes keep their mean, and
+//! iterations stop when no mean moves. Clusters are updated per bin
+//! instead of per pixel, and the labels are written by a bin to class
+//! table in one pass. Labels are the class numbers, 0 up.
+class PQCT_HistogramKMeans {
+
+ public:
+  //! Histogram of the input. False if a value is not an integer or
+  //! the range needs more than KMEANSMAXIMUMHISTOGRAMBINS bins.
+  template<class TPixel>
+    static bool BuildHistogram(const TPixel * input,
+			       size_t numberOfPixels,
+			       PQCT_HistogramType & histogram);
+
+  //! Move the means to convergence; means holds the initial means.
+  //! Returns the number of iterations.
+  static unsigned int EstimateMeans(const PQCT_HistogramType & histogram,
+				    std::vector<double> & means,
+				    unsigned int maximumIterations = KMEANSMAXIMUMITERATIONS);
+
+  //! Class of each bin, the nearest mean.
+  static void ClassifyBins(const PQCT_HistogramType & histogram,
+			   const std::vector<double> & means,
+			   std::vector<LabelPixelType> & binClasses);
+
+  //! Histogram, means and labels. False if the input does not suit
+  //! the histogram (see BuildHistogram), with nothing written.
+  template<class TPixel>
+    static bool Classify(const TPixel * input,
+			 LabelPixelType * output,
+			 size_t numberOfPixels,
+			 std::vector<double> & means);
+
+  //! K-means of the pixels whose label is selected (sampleLabels[label]
+  //! != 0), which are relabeled classLabels[class]; other labels are
+  //! kept. Values are converted to TValue first, as samples of a list
+  //! of TValue measurements would be. Two passes over the buffers: the
+  //! gather, and the write back through the bin to label table.
+  template<class TValue, class TPixel>
+    static bool ClassifyLabels(const TPixel * input,
+			       LabelPixelType * labels,
+			       size_t numberOfPixels,
+			       const PQCT_LabelLUT & sampleLabels,
+			       const std::vector<LabelPixelType> & classLabels,
+			       std::vector<double> & means) {
+    if (classLabels.size() != means.size())
+      throw "Unacceptable number of k-means classes.";
+
+    //! Gather.
+    const LabelPixelType * selected = sampleLabels.GetTable();
+    std::vector<TValue> samples;
+    for (size_t i = 0; i < numberOfPixels; i++)
+      if ( selected[ labels[i] ] )
+	samples.push_back( (TValue) input[i] );
+
+    PQCT_HistogramType histogram;
+    if ( !BuildHistogram( samples.empty() ? (const TValue *) 0 : &samples[0],
+			  samples.size(), histogram ) )
+      return false;
+    if ( samples.empty() )
+      return true;
+    EstimateMeans( histogram, means );
+
+    //! Bin to label table.
+    std::vector<LabelPixelType> binLabels;
+    ClassifyBins( histogram, means, binLabels );
+    for (size_t b = 0; b < binLabels.size(); b++)
+      binLabels[b] = classLabels[ binLabels[b] ];
+
+    //! Write back.
+    const LabelPixelType * table = &binLabels[0];
+    const long minimum = histogram.Minimum;
+    for (size_t i = 0; i < numberOfPixels; i++)
+      if ( selected[ labels[i] ] )
+	labels[i] = table[ (long) (TValue) input[i] - minimum ];
+    return true;
+  };
+};
+
+#endif
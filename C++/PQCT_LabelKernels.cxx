@@ -0,0 +1,98 @@
+/*===========================================================================
+
+Program:   Bone, muscle and fat quantification from PQCT data.
+Module:    $RCSfile: PQCT_LabelKernels.cxx,v $
+Language:  C++
+Date:      $Date: 2012/09/07 10:00:00 $
+Version:   $Revision: 0.1 $
+Author:    S. K. Makrogiannis
+3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+=============================================================================*/
+
+#include "PQCT_LabelKernels.h"
+
+
+//! Class LUTs one after the other, indexed by class * LABELLUTSIZE + label.
+static std::vector<LabelPixelType> GetJointTable(const std::vector<PQCT_LabelLUT> & classLUTs,
+						 unsigned int numberOfClasses) {
+  if (numberOfClasses > classLUTs.size())
+    throw "Label class without a LUT.";
+  std::vector<LabelPixelType> jointTable( numberOfClasses * LABELLUTSIZE );
+  for (unsigned int c = 0; c < numberOfClasses; c++)
+    for (unsigned int i = 0; i < LABELLUTSIZE; i++)
+      jointTable[c * LABELLUTSIZE + i] = classLUTs[c][ (LabelPixelType) i ];
+  return jointTable;
+}
+
+
+//! Largest class of a class LUT, plus one.
+static unsigned int GetNumberOfClasses(const PQCT_LabelLUT & maskClasses) {
+  unsigned int numberOfClasses = 0;
+  for (unsigned int i = 0; i < LABELLUTSIZE; i++)
+    if (maskClasses[ (LabelPixelType) i ] >= numberOfClasses)
+      numberOfClasses = maskClasses[ (LabelPixelType) i ] + 1;
+  return numberOfClasses;
+}
+
+
+void PQCT_LabelKernels::RemapLabelsByMask(LabelPixelType * labels,
+					  const LabelPixelType * mask,
+					  size_t numberOfPixels,
+					  const PQCT_LabelLUT & maskClasses,
+					  const std::vector<PQCT_LabelLUT> & classLUTs) {
+  std::vector<LabelPixelType> jointTable =
+    GetJointTable( classLUTs, GetNumberOfClasses( maskClasses ) );
+
+  //! Class offsets in the joint table.
+  unsigned int classOffsets[LABELLUTSIZE];
+  for (unsigned int i = 0; i < LABELLUTSIZE; i++)
+    classOffsets[i] = maskClasses[ (LabelPixelType) i ] * LABELLUTSIZE;
+
+  const LabelPixelType * table = &jointTable[0];
+  for (size_t i = 0; i < numberOfPixels; i++)
+    labels[i] = table[ classOffsets[ mask[i] ] + labels[i] ];
+}
+
+
+void PQCT_LabelKernels::RemapLabelsByMasks(LabelPixelType * labels,
+					   const LabelPixelType * mask,
+					   const LabelPixelType * secondMask,
+					   size_t numberOfPixels,
+					   const PQCT_LabelLUT & maskClasses,
+					   const PQCT_LabelLUT & secondMaskClasses,
+					   const std::vector<PQCT_LabelLUT> & classLUTs) {
+  std::vector<LabelPixelType> jointTable =
+    GetJointTable( classLUTs,
+		   GetNumberOfClasses( maskClasses ) +
+		   GetNumberOfClasses( secondMaskClasses ) - 1 );
+
+  unsigned int classOffsets[LABELLUTSIZE], secondClassOffsets[LABELLUTSIZE];
+  for (unsigned int i = 0; i < LABELLUTSIZE; i++) {
+    classOffsets[i] = maskClasses[ (LabelPixelType) i ] * LABELLUTSIZE;
+    secondClassOffsets[i] = secondMaskClasses[ (LabelPixelType) i ] * LABELLUTSIZE;
+  }
+
+  const LabelPixelType * table = &jointTable[0];
+  for (size_t i = 0; i < numberOfPixels; i++)
+    labels[i] = table[ classOffsets[ mask[i] ] +
+		       secondClassOffsets[ secondMask[i] ] + labels[i] ];
+}
+
+
+void PQCT_LabelKernels::MaximumOverlay(const std::vector<const LabelPixelType *> & inputs,
+				       LabelPixelType * output,
+				       size_t numberOfPixels) {
+  if ( inputs.empty() )
+    return;
+
+  //! One pass over the output; an input may be the output.
+  const size_t numberOfInputs = inputs.size();
+  for (size_t i = 0; i < numberOfPixels; i++) {
+    LabelPixelType maximum = inputs[0][i];
+    for (size_t k = 1; k < numberOfInputs; k++)
+      if (inputs[k][i] > maximum)
+	maximum = inputs[k][i];
+    output[i] = maximum;
+  }
+}
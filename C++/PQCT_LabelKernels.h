@@ -0,0 +1,152 @@
+/*===========================================================================
+
+Program:   Bone, muscle and fat quantification from PQCT data.
+Module:    $RCSfile: PQCT_LabelKernels.h,v $
+Language:  C++
+Date:      $Date: 2012/09/07 10:00:00 $
+Version:   $Revision: 0.1 $
+Author:    S. K. Makrogiannis
+3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+=============================================================================*/
+
+#ifndef __PQCT_LabelKernels_h__
+#define __PQCT_LabelKernels_h__
+
+#include <vector>
+#include <cstddef>
+
+#include "PQCT_Datatypes.h"
+
+
+//! Number of label values.
+#define LABELLUTSIZE 256
+
+
+//! Label to label mapping, identity unless set.
+class PQCT_LabelLUT {
+
+ public:
+  PQCT_LabelLUT() {
+    for (unsigned int i = 0; i < LABELLUTSIZE; i++)
+      this->m_Table[i] = (LabelPixelType) i;
+  };
+  //! Every label to one label.
+  explicit PQCT_LabelLUT(LabelPixelType label) {
+    for (unsigned int i = 0; i < LABELLUTSIZE; i++)
+      this->m_Table[i] = label;
+  };
+
+  void Set(LabelPixelType label, LabelPixelType mappedLabel) {
+    this->m_Table[label] = mappedLabel;
+  };
+  void SetRange(LabelPixelType lower, LabelPixelType upper, LabelPixelType mappedLabel) {
+    for (unsigned int i = lower; i <= upper; i++)
+      this->m_Table[i] = mappedLabel;
+  };
+
+  LabelPixelType operator[](LabelPixelType label) const {
+    return this->m_Table[label];
+  };
+  const LabelPixelType * GetTable() const { return this->m_Table; };
+
+ private:
+  LabelPixelType m_Table[LABELLUTSIZE];
+};
+
+
+//! Label rules on contiguous pixel buffers, one pass per call and no
+//! index arithmetic. Several rules are applied in one pass by tables:
+//! the value of a mask picks a class, the class picks the LUT applied
+//! to the label. All buffers hold numberOfPixels pixels; the label
+//! buffer may also be the input buffer.
+class PQCT_LabelKernels {
+
+ public:
+  //! inside where lower <= input <= upper, outside elsewhere (as the
+  //! binary threshold filter).
+  template<class TPixel>
+    static void ThresholdToMask(const TPixel * input,
+				LabelPixelType * output,
+				size_t numberOfPixels,
+				TPixel lower,
+				TPixel upper,
+				LabelPixelType inside,
+				LabelPixelType outside) {
+    for (size_t i = 0; i < numberOfPixels; i++)
+      output[i] = ( input[i] >= lower && input[i] <= upper ) ? inside : outside;
+  };
+
+  //! output = lut[input].
+  static void RemapLabels(const LabelPixelType * input,
+			  LabelPixelType * output,
+			  size_t numberOfPixels,
+			  const PQCT_LabelLUT & lut) {
+    const LabelPixelType * table = lut.GetTable();
+    for (size_t i = 0; i < numberOfPixels; i++)
+      output[i] = table[ input[i] ];
+  };
+
+  //! labels = insideLUT[labels] where lower <= mask <= upper,
+  //! outsideLUT[labels] elsewhere. The mask may be of any pixel type,
+  //! e.g. the densities.
+  template<class TMask>
+    static void MaskedRemapLabels(LabelPixelType * labels,
+				  const TMask * mask,
+				  size_t numberOfPixels,
+				  TMask lower,
+				  TMask upper,
+				  const PQCT_LabelLUT & insideLUT,
+				  const PQCT_LabelLUT & outsideLUT) {
+    const LabelPixelType * insideTable = insideLUT.GetTable();
+    const LabelPixelType * outsideTable = outsideLUT.GetTable();
+    for (size_t i = 0; i < numberOfPixels; i++)
+      labels[i] = ( mask[i] >= lower && mask[i] <= upper ) ?
+	insideTable[ labels[i] ] : outsideTable[ labels[i] ];
+  };
+
+  //! labels = classLUTs[ maskClasses[mask] ][labels], e.g. with the
+  //! ranked components as mask: one class for the background, one for
+  //! the largest component and one for the rest. The class tables
+  //! default to identity, keeping the labels of a class; only the
+  //! class-selection table maskClasses starts from PQCT_LabelLUT( 0 ),
+  //! with classes numbered from 0 up.
+  static void RemapLabelsByMask(LabelPixelType * labels,
+				const LabelPixelType * mask,
+				size_t numberOfPixels,
+				const PQCT_LabelLUT & maskClasses,
+				const std::vector<PQCT_LabelLUT> & classLUTs);
+
+  //! As RemapLabelsByMask, with the class of a pixel from two masks:
+  //! maskClasses[mask] + secondMaskClasses[secondMask].
+  static void RemapLabelsByMasks(LabelPixelType * labels,
+				 const LabelPixelType * mask,
+				 const LabelPixelType * secondMask,
+				 size_t numberOfPixels,
+				 const PQCT_LabelLUT & maskClasses,
+				 const PQCT_LabelLUT & secondMaskClasses,
+				 const std::vector<PQCT_LabelLUT> & classLUTs);
+
+  //! output = maximum of the inputs, e.g. to overlay region labels.
+  static void MaximumOverlay(const std::vector<const LabelPixelType *> & inputs,
+			     LabelPixelType * output,
+			     size_t numberOfPixels);
+
+  //! Pixels in the buffered region.
+  template<class TImage>
+    static size_t GetNumberOfPixels(const TImage * image) {
+    return (size_t) image->GetBufferedRegion().GetNumberOfPixels();
+  };
+
+  //! Uninitialized label image on the grid of an image.
+  template<class TImage>
+    static LabelImageType::Pointer CreateLabelImage(const TImage * image) {
+    LabelImageType::Pointer labelImage = LabelImageType::New();
+    labelImage->CopyInformation( image );
+    labelImage->SetRegions( image->GetBufferedRegion() );
+    labelImage->Allocate();
+    return labelImage;
+  };
+};
+
+#endif
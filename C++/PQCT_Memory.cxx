@@ -0,0 +1,163 @@
+/*===========================================================================
+
+Program:   Bone, muscle and fat quantification from PQCT data.
+Module:    $RCSfile: PQCT_Memory.cxx,v $
+Language:  C++
+Date:      $Date: 2012/09/03 10:00:00 $
+Version:   $Revision: 0.1 $
+Author:    S. K. Makrogiannis
+3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+=============================================================================*/
+
+#include "PQCT_Memory.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+
+//! Zero-initialized before any allocation can happen.
+volatile long PQCT_MemoryMonitor::m_HeapAccountingEnabled = 0;
+volatile PQCT_MemorySizeType PQCT_MemoryMonitor::m_AllocatedBytes = 0;
+volatile PQCT_MemorySizeType PQCT_MemoryMonitor::m_LiveBytes = 0;
+volatile PQCT_MemorySizeType PQCT_MemoryMonitor::m_LiveImageBuffers = 0;
+volatile PQCT_MemorySizeType PQCT_MemoryMonitor::m_PeakLiveBytes = 0;
+volatile PQCT_MemorySizeType PQCT_MemoryMonitor::m_PeakLiveImageBuffers = 0;
+
+
+//! 64-bit atomic helpers (full barriers); the counters are shared by all
+//! allocating threads. Returns the value after the addition.
+static inline PQCT_MemorySizeType
+AtomicAdd64(volatile PQCT_MemorySizeType * value, PQCT_MemorySizeType increment) {
+#if defined(_WIN32)
+  return InterlockedExchangeAdd64( (volatile LONGLONG *) value, increment ) + increment;
+#else
+  return __sync_add_and_fetch( value, increment );
+#endif
+}
+
+static inline PQCT_MemorySizeType
+AtomicLoad64(volatile PQCT_MemorySizeType * value) {
+  return AtomicAdd64( value, 0 );
+}
+
+//! Raise a peak to newValue unless another thread raised it higher.
+static inline void
+AtomicMaximum64(volatile PQCT_MemorySizeType * peak, PQCT_MemorySizeType newValue) {
+  PQCT_MemorySizeType oldValue = AtomicLoad64( peak );
+  while (newValue > oldValue) {
+#if defined(_WIN32)
+    PQCT_MemorySizeType previous =
+      InterlockedCompareExchange64( (volatile LONGLONG *) peak, newValue, oldValue );
+#else
+    PQCT_MemorySizeType previous =
+      __sync_val_compare_and_swap( peak, oldValue, newValue );
+#endif
+    if (previous == oldValue)
+      break;
+    oldValue = previous;
+  }
+}
+
+
+bool PQCT_MemoryMonitor::IsHeapAccountingEnabled() {
+  return m_HeapAccountingEnabled != 0;
+}
+
+
+void PQCT_MemoryMonitor::EnableHeapAccounting() {
+  m_HeapAccountingEnabled = 1;
+}
+
+
+void PQCT_MemoryMonitor::RecordAllocation(size_t size) {
+  AtomicAdd64( &m_AllocatedBytes, size );
+  AtomicMaximum64( &m_PeakLiveBytes, AtomicAdd64( &m_LiveBytes, size ) );
+  if (size >= IMAGE_BUFFER_MINIMUM_SIZE)
+    AtomicMaximum64( &m_PeakLiveImageBuffers, AtomicAdd64( &m_LiveImageBuffers, 1 ) );
+}
+
+
+void PQCT_MemoryMonitor::RecordDeallocation(size_t size) {
+  AtomicAdd64( &m_LiveBytes, -(PQCT_MemorySizeType) size );
+  if (size >= IMAGE_BUFFER_MINIMUM_SIZE)
+    AtomicAdd64( &m_LiveImageBuffers, -1 );
+}
+
+
+PQCT_MemorySizeType PQCT_MemoryMonitor::GetAllocatedBytes() {
+  return AtomicLoad64( &m_AllocatedBytes );
+}
+
+
+PQCT_MemorySizeType PQCT_MemoryMonitor::GetLiveBytes() {
+  return AtomicLoad64( &m_LiveBytes );
+}
+
+
+PQCT_MemorySizeType PQCT_MemoryMonitor::GetLiveImageBuffers() {
+  return AtomicLoad64( &m_LiveImageBuffers );
+}
+
+
+PQCT_MemorySizeType PQCT_MemoryMonitor::GetPeakLiveBytes() {
+  return AtomicLoad64( &m_PeakLiveBytes );
+}
+
+
+PQCT_MemorySizeType PQCT_MemoryMonitor::GetPeakLiveImageBuffers() {
+  return AtomicLoad64( &m_PeakLiveImageBuffers );
+}
+
+
+//! Peaks restart from the current usage. Allocations racing with the
+//! reset may be missed by the new peak.
+void PQCT_MemoryMonitor::ResetPeaks() {
+  PQCT_MemorySizeType liveBytes = GetLiveBytes();
+  PQCT_MemorySizeType liveImageBuffers = GetLiveImageBuffers();
+  AtomicAdd64( &m_PeakLiveBytes, liveBytes - GetPeakLiveBytes() );
+  AtomicAdd64( &m_PeakLiveImageBuffers, liveImageBuffers - GetPeakLiveImageBuffers() );
+}
+
+
+PQCT_MemorySizeType PQCT_MemoryMonitor::GetPeakResidentSetSize() {
+#if defined(_WIN32)
+  PROCESS_MEMORY_COUNTERS counters;
+  if ( !GetProcessMemoryInfo( GetCurrentProcess(), &counters, sizeof(counters) ) )
+    return 0;
+  return counters.PeakWorkingSetSize;
+#else
+  struct rusage usage;
+  if ( getrusage( RUSAGE_SELF, &usage ) != 0 )
+    return 0;
+#if defined(__APPLE__)
+  return usage.ru_maxrss;                                // bytes
+#else
+  return (PQCT_MemorySizeType) usage.ru_maxrss * 1024;   // kilobytes
+#endif
+#endif
+}
+
+
+PQCT_MemorySizeType PQCT_MemoryMonitor::GetPhysicalMemorySize() {
+#if defined(_WIN32)
+  MEMORYSTATUSEX status;
+  status.dwLength = sizeof(status);
+  if ( !GlobalMemoryStatusEx( &status ) )
+    return 0;
+  return status.ullTotalPhys;
+#elif defined(_SC_PHYS_PAGES)
+  long pages = sysconf( _SC_PHYS_PAGES );
+  long pageSize = sysconf( _SC_PAGESIZE );
+  if (pages < 0 || pageSize < 0)
+    return 0;
+  return (PQCT_MemorySizeType) pages * pageSize;
+#else
+  return 0;
+#endif
+}
@@ -0,0 +1,75 @@
+/*===========================================================================
+
+Program:   Bone, muscle and fat quantification from PQCT data.
+Module:    $RCSfile: PQCT_Memory.h,v $
+Language:  C++
+Date:      $Date: 2012/09/03 10:00:00 $
+Version:   $Revision: 0.1 $
+Author:    S. K. Makrogiannis
+3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+=============================================================================*/
+
+#ifndef __PQCT_Memory_h__
+#define __PQCT_Memory_h__
+
+#include <cstddef>
+
+//! Byte counts; 64-bit on all platforms.
+typedef long long PQCT_MemorySizeType;
+
+//! Heap blocks of at least this size are counted as image buffers.
+#define IMAGE_BUFFER_MINIMUM_SIZE 65536
+
+//! Memory used by one analysis.
+typedef struct t_PQCT_MemoryFootprintType
+{
+  PQCT_MemorySizeType PeakHeapBytes;
+  PQCT_MemorySizeType PeakImageBuffers;
+  PQCT_MemorySizeType PeakResidentSetSize;
+}
+PQCT_MemoryFootprintType;
+
+
+//! Process-wide heap and resident memory statistics.
+//! The heap counters are kept by the allocation functions of
+//! PQCT_MemoryHooks.cxx; executables that do not link it report zero
+//! heap usage and resident memory only. Counters cover all threads, so
+//! they describe one analysis exactly only while it runs alone.
+class PQCT_MemoryMonitor {
+
+ public:
+  static bool IsHeapAccountingEnabled();
+
+  //! Total bytes allocated since the process started.
+  static PQCT_MemorySizeType GetAllocatedBytes();
+  static PQCT_MemorySizeType GetLiveBytes();
+  static PQCT_MemorySizeType GetLiveImageBuffers();
+
+  //! Highest live heap bytes and image buffers since ResetPeaks().
+  static PQCT_MemorySizeType GetPeakLiveBytes();
+  static PQCT_MemorySizeType GetPeakLiveImageBuffers();
+  static void ResetPeaks();
+
+  //! Resident set size high-water mark of the process, in bytes;
+  //! 0 if the platform does not report it.
+  static PQCT_MemorySizeType GetPeakResidentSetSize();
+
+  //! Installed physical memory in bytes; 0 if unknown.
+  static PQCT_MemorySizeType GetPhysicalMemorySize();
+
+  //! Called by the allocation hooks only.
+  static void EnableHeapAccounting();
+  static void RecordAllocation(size_t size);
+  static void RecordDeallocation(size_t size);
+
+ private:
+  static volatile long m_HeapAccountingEnabled;
+  static volatile PQCT_MemorySizeType m_AllocatedBytes;
+  static volatile PQCT_MemorySizeType m_LiveBytes;
+  static volatile PQCT_MemorySizeType m_LiveImageBuffers;
+  static volatile PQCT_MemorySizeType m_PeakLiveBytes;
+  static volatile PQCT_MemorySizeType m_PeakLiveImageBuffers;
+};
+
+#endif
@@ -0,0 +1,115 @@
+/*===========================================================================
+
+Program:   Bone, muscle and fat quantification from PQCT data.
+Module:    $RCSfile: PQCT_MemoryHooks.cxx,v $
+Language:  C++
+Date:      $Date: 2012/09/03 10:00:00 $
+Version:   $Revision: 0.1 $
+Author:    S. K. Makrogiannis
+3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+=============================================================================*/
+
+//! Replacement global allocation functions that keep the heap counters
+//! of PQCT_MemoryMonitor. Linked into the executables only, so that the
+//! JNI library does not replace the allocator of its host process.
+
+#include <new>
+#include <cstdlib>
+
+#include "PQCT_Memory.h"
+
+#if __cplusplus >= 201103L
+#define PQCT_THROW_BAD_ALLOC
+#define PQCT_NO_THROW noexcept
+#else
+#define PQCT_THROW_BAD_ALLOC throw(std::bad_alloc)
+#define PQCT_NO_THROW throw()
+#endif
+
+
+//! Each block starts with its size, padded to keep the malloc alignment.
+static const size_t BlockHeaderSize = 16;
+
+
+//! Turn the counters on before main() runs.
+namespace {
+struct HeapAccountingEnabler {
+  HeapAccountingEnabler() { PQCT_MemoryMonitor::EnableHeapAccounting(); }
+};
+HeapAccountingEnabler heapAccountingEnabler;
+}
+
+
+void * operator new(size_t size) PQCT_THROW_BAD_ALLOC {
+  for (;;) {
+    void * block = malloc( size + BlockHeaderSize );
+    if (block != NULL) {
+      *static_cast<size_t *>( block ) = size;
+      PQCT_MemoryMonitor::RecordAllocation( size );
+      return static_cast<char *>( block ) + BlockHeaderSize;
+    }
+    std::new_handler handler = std::set_new_handler( 0 );
+    std::set_new_handler( handler );
+    if (handler == 0)
+      throw std::bad_alloc();
+    handler();
+  }
+}
+
+
+void * operator new[](size_t size) PQCT_THROW_BAD_ALLOC {
+  return operator new( size );
+}
+
+
+void * operator new(size_t size, const std::nothrow_t &) PQCT_NO_THROW {
+  try {
+    return operator new( size );
+  }
+  catch(...) {
+    return NULL;
+  }
+}
+
+
+void * operator new[](size_t size, const std::nothrow_t &) PQCT_NO_THROW {
+  return operator new( size, std::nothrow );
+}
+
+
+void operator delete(void * memory) PQCT_NO_THROW {
+  if (memory == NULL)
+    return;
+  char * block = static_cast<char *>( memory ) - BlockHeaderSize;
+  PQCT_MemoryMonitor::RecordDeallocation( *reinterpret_cast<size_t *>( block ) );
+  free( block );
+}
+
+
+void operator delete[](void * memory) PQCT_NO_THROW {
+  operator delete( memory );
+}
+
+
+void operator delete(void * memory, const std::nothrow_t &) PQCT_NO_THROW {
+  operator delete( memory );
+}
+
+
+void operator delete[](void * memory, const std::nothrow_t &) PQCT_NO_THROW {
+  operator delete( memory );
+}
+
+
+//! Sized deallocation (C++14): the block header holds the size.
+#ifdef __cpp_sized_deallocation
+void operator delete(void * memory, size_t) PQCT_NO_THROW {
+  operator delete( memory );
+}
+
+
+void operator delete[](void * memory, size_t) PQCT_NO_THROW {
+  operator delete( memory );
+}
+#endif
@@ -0,0 +1,239 @@
+/*===========================================================================
+
+  Program:   Bone, muscle and fat quantification from PQCT data.
+  Module:    $RCSfile: PQCT_Metrics.cxx,v $
+  Language:  C++
+  Date:      $Date: 2012/08/27 10:00:00 $
+  Version:   $Revision: 0.1 $
+  Author:    S. K. Makrogiannis
+  3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+  =============================================================================*/
+
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+
+#include "PQCT_Metrics.h"
+#include "PQCT_Threading.h"
+
+
+//! File signature (format version in the last byte).
+static const char metricsFileSignature[8] = {'P','Q','C','T','M','E','T','1'};
+
+
+void SetMetricsSubjectID(PQCT_MetricsRecord & record, const std::string & subjectID) {
+  memset( record.SubjectID, 0, METRICS_SUBJECT_ID_LENGTH );
+  size_t length = std::min( subjectID.size(), (size_t) METRICS_SUBJECT_ID_LENGTH - 1 );
+  memcpy( record.SubjectID, subjectID.c_str(), length );
+}
+
+
+//! Column access.
+template<class T>
+static bool WriteColumn(FILE * file, const PQCT_MetricsRecord * records, long numberOfRows,
+			T PQCT_MetricsRecord::* member) {
+  std::vector<T> column( numberOfRows );
+  for (long i = 0; i < numberOfRows; i++)
+    column[i] = records[i].*member;
+  return fwrite( &column[0], sizeof(T), numberOfRows, file ) == (size_t) numberOfRows;
+}
+
+template<class T>
+static bool ReadColumn(std::ifstream & file, PQCT_MetricsRecord * records, long numberOfRows,
+		       T PQCT_MetricsRecord::* member) {
+  std::vector<T> column( numberOfRows );
+  file.read( (char*) &column[0], numberOfRows * sizeof(T) );
+  if (file.gcount() != (std::streamsize) (numberOfRows * sizeof(T)))
+    return false;
+  for (long i = 0; i < numberOfRows; i++)
+    records[i].*member = column[i];
+  return true;
+}
+
+
+//! Results appender.
+PQCT_MetricsAppender::PQCT_MetricsAppender(const std::string & filename,
+					   unsigned int rowGroupSize) {
+  this->m_RowGroupSize = (rowGroupSize > 0) ? rowGroupSize : 1;
+  this->m_RowGroup.resize( this->m_RowGroupSize );
+  this->m_ReservedRows = 0;
+  this->m_CommittedRows = 0;
+  this->m_Generation = 0;
+
+  this->m_File = fopen( filename.c_str(), "ab" );
+  if (this->m_File == NULL) {
+    throw "Unable to open metrics file for writing";
+    return;
+  }
+  //! New file: write the signature.
+  fseek( this->m_File, 0, SEEK_END );
+  if (ftell( this->m_File ) == 0)
+    fwrite( metricsFileSignature, 1, sizeof(metricsFileSignature), this->m_File );
+}
+
+
+PQCT_MetricsAppender::~PQCT_MetricsAppender() {
+  this->Flush();
+  fclose( this->m_File );
+}
+
+
+//! Split into chunks that fit a row group.
+void PQCT_MetricsAppender::Append(const std::vector<PQCT_MetricsRecord> & records) {
+  long offset = 0;
+  long remaining = records.size();
+  while (remaining > 0) {
+    long chunk = std::min( remaining, this->m_RowGroupSize );
+    this->AppendChunk( &records[offset], chunk );
+    offset += chunk;
+    remaining -= chunk;
+  }
+}
+
+
+//! Reserve, copy, commit. The writer whose reservation first reaches the
+//! end of the group writes it out once every earlier reservation is
+//! committed, then resets the counters and advances the generation.
+void PQCT_MetricsAppender::AppendChunk(const PQCT_MetricsRecord * records,
+				       long numberOfRecords) {
+  while (true) {
+    long generation = PQCT_AtomicLoad( &this->m_Generation );
+    long end = PQCT_AtomicAdd( &this->m_ReservedRows, numberOfRecords );
+    long start = end - numberOfRecords;
+
+    bool fits = (end <= this->m_RowGroupSize);
+    if (fits) {
+      std::copy( records, records + numberOfRecords, &this->m_RowGroup[start] );
+      PQCT_AtomicAdd( &this->m_CommittedRows, numberOfRecords );
+    }
+
+    //! This writer closes the group.
+    if (start < this->m_RowGroupSize && end >= this->m_RowGroupSize) {
+      long groupRows = fits ? end : start;
+      while (PQCT_AtomicLoad( &this->m_CommittedRows ) < groupRows)
+	PQCT_YieldThread();
+      this->WriteRowGroup( groupRows );
+      PQCT_AtomicStore( &this->m_CommittedRows, 0 );
+      PQCT_AtomicStore( &this->m_ReservedRows, 0 );
+      PQCT_AtomicAdd( &this->m_Generation, 1 );
+    }
+    if (fits)
+      return;
+
+    //! Group was full: wait for the next one and retry.
+    while (PQCT_AtomicLoad( &this->m_Generation ) == generation)
+      PQCT_YieldThread();
+  }
+}
+
+
+void PQCT_MetricsAppender::Flush() {
+  long numberOfRows = PQCT_AtomicLoad( &this->m_CommittedRows );
+  if (numberOfRows > 0)
+    this->WriteRowGroup( numberOfRows );
+  PQCT_AtomicStore( &this->m_CommittedRows, 0 );
+  PQCT_AtomicStore( &this->m_ReservedRows, 0 );
+  fflush( this->m_File );
+}
+
+
+//! Row group: row count, then one column after the other.
+void PQCT_MetricsAppender::WriteRowGroup(long numberOfRows) {
+  const PQCT_MetricsRecord * rows = &this->m_RowGroup[0];
+  unsigned int rowCount = numberOfRows;
+  bool written = fwrite( &rowCount, sizeof(rowCount), 1, this->m_File ) == 1;
+
+  for (long i = 0; i < numberOfRows && written; i++)
+    written = fwrite( rows[i].SubjectID, 1, METRICS_SUBJECT_ID_LENGTH, this->m_File ) == 
+      METRICS_SUBJECT_ID_LENGTH;
+  written = written &&
+    WriteColumn( this->m_File, rows, numberOfRows, &PQCT_MetricsRecord::Site ) &&
+    WriteColumn( this->m_File, rows, numberOfRows, &PQCT_MetricsRecord::Label ) &&
+    WriteColumn( this->m_File, rows, numberOfRows, &PQCT_MetricsRecord::Area ) &&
+    WriteColumn( this->m_File, rows, numberOfRows, &PQCT_MetricsRecord::PrincipalMoment1 ) &&
+    WriteColumn( this->m_File, rows, numberOfRows, &PQCT_MetricsRecord::PrincipalMoment2 ) &&
+    WriteColumn( this->m_File, rows, numberOfRows, &PQCT_MetricsRecord::EquivalentRadius ) &&
+    WriteColumn( this->m_File, rows, numberOfRows, &PQCT_MetricsRecord::DensityMean ) &&
+    WriteColumn( this->m_File, rows, numberOfRows, &PQCT_MetricsRecord::DensitySD ) &&
+    WriteColumn( this->m_File, rows, numberOfRows, &PQCT_MetricsRecord::ElapsedTime );
+
+  if (!written)
+    std::cerr << "Error writing metrics row group." << std::endl;
+}
+
+
+//! CSV export of all row groups.
+void PQCT_MetricsAppender::ExportCSV(const std::string & metricsFilename,
+				     const std::string & csvFilename) {
+  std::ifstream metricsFile;
+  metricsFile.open( metricsFilename.c_str(), std::ios::binary );
+  if (metricsFile.fail()) {
+    throw "Unable to open metrics file for reading";
+    return;
+  }
+  char signature[sizeof(metricsFileSignature)];
+  metricsFile.read( signature, sizeof(signature) );
+  if (metricsFile.gcount() != (std::streamsize) sizeof(signature) ||
+      memcmp( signature, metricsFileSignature, sizeof(signature) ) != 0) {
+    throw "Unrecognized metrics file format.";
+    return;
+  }
+
+  std::ofstream csvFile;
+  csvFile.open( csvFilename.c_str() );
+  if (csvFile.fail()) {
+    throw "Unable to open file for writing";
+    return;
+  }
+  csvFile.setf(std::ios::fixed, std::ios::floatfield);
+  csvFile.precision(FLOAT_PRECISION);
+  csvFile << "Subject_ID,Site,Label,Tissue,Area(mm^2),Princ.Mom.1,Princ.Mom.2,"
+	  << "Eq.Radius,Den.M.,Den.SD.,Elapsed_Time" << std::endl;
+
+  const unsigned int numberOfSites = sizeof(AnatomicalSite) / sizeof(AnatomicalSite[0]);
+  const unsigned int numberOfTissueTypes = sizeof(TissueTypeString) / sizeof(TissueTypeString[0]);
+
+  unsigned int rowCount;
+  while (metricsFile.read( (char*) &rowCount, sizeof(rowCount) )) {
+    long numberOfRows = rowCount;
+    std::vector<PQCT_MetricsRecord> rows( numberOfRows );
+    bool valid = true;
+    for (long i = 0; i < numberOfRows && valid; i++) {
+      metricsFile.read( rows[i].SubjectID, METRICS_SUBJECT_ID_LENGTH );
+      rows[i].SubjectID[METRICS_SUBJECT_ID_LENGTH - 1] = '\0';
+      valid = metricsFile.gcount() == METRICS_SUBJECT_ID_LENGTH;
+    }
+    valid = valid &&
+      ReadColumn( metricsFile, &rows[0], numberOfRows, &PQCT_MetricsRecord::Site ) &&
+      ReadColumn( metricsFile, &rows[0], numberOfRows, &PQCT_MetricsRecord::Label ) &&
+      ReadColumn( metricsFile, &rows[0], numberOfRows, &PQCT_MetricsRecord::Area ) &&
+      ReadColumn( metricsFile, &rows[0], numberOfRows, &PQCT_MetricsRecord::PrincipalMoment1 ) &&
+      ReadColumn( metricsFile, &rows[0], numberOfRows, &PQCT_MetricsRecord::PrincipalMoment2 ) &&
+      ReadColumn( metricsFile, &rows[0], numberOfRows, &PQCT_MetricsRecord::EquivalentRadius ) &&
+      ReadColumn( metricsFile, &rows[0], numberOfRows, &PQCT_MetricsRecord::DensityMean ) &&
+      ReadColumn( metricsFile, &rows[0], numberOfRows, &PQCT_MetricsRecord::DensitySD ) &&
+      ReadColumn( metricsFile, &rows[0], numberOfRows, &PQCT_MetricsRecord::ElapsedTime );
+    if (!valid) {
+      throw "Truncated metrics file.";
+      return;
+    }
+
+    for (long i = 0; i < numberOfRows; i++) {
+      const PQCT_MetricsRecord & row = rows[i];
+      csvFile << row.SubjectID << ','
+	      << (row.Site < numberOfSites ? AnatomicalSite[row.Site] : "UNKNOWN") << ','
+	      << (unsigned int) row.Label << ','
+	      << (row.Label < numberOfTissueTypes ? TissueTypeString[row.Label] : "UNKNOWN") << ','
+	      << row.Area << ','
+	      << row.PrincipalMoment1 << ','
+	      << row.PrincipalMoment2 << ','
+	      << row.EquivalentRadius << ','
+	      << row.DensityMean << ','
+	      << row.DensitySD << ','
+	      << row.ElapsedTime << std::endl;
+    }
+  }
+  csvFile.close();
+}
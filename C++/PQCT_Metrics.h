@@ -0,0 +1,90 @@
+/*===========================================================================
+
+Program:   Bone, muscle and fat quantification from PQCT data.
+Module:    $RCSfile: PQCT_Metrics.h,v $
+Language:  C++
+Date:      $Date: 2012/08/27 10:00:00 $
+Version:   $Revision: 0.1 $
+Author:    S. K. Makrogiannis
+3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+=============================================================================*/
+
+#ifndef __PQCT_Metrics_h__
+#define __PQCT_Metrics_h__
+
+#include <string>
+#include <vector>
+#include <cstdio>
+
+#include "PQCT_Datatypes.h"
+
+
+//! Maximum length of the subject ID stored in a metrics record.
+#define METRICS_SUBJECT_ID_LENGTH 64
+
+//! Metrics of one tissue region of one subject.
+typedef struct t_PQCT_MetricsRecord
+{
+  char SubjectID[METRICS_SUBJECT_ID_LENGTH];
+  unsigned char Site;    // PQCTWorkflow
+  unsigned char Label;   // TISSUE_TYPES
+  float Area;
+  float PrincipalMoment1;
+  float PrincipalMoment2;
+  float EquivalentRadius;
+  float DensityMean;
+  float DensitySD;
+  float ElapsedTime;
+}
+PQCT_MetricsRecord;
+
+//! Fill the fixed-length subject ID (truncated, zero padded).
+void SetMetricsSubjectID(PQCT_MetricsRecord & record, const std::string & subjectID);
+
+
+//! Appends metrics records of many subjects to one columnar binary file.
+//!
+//! File layout: an 8-byte signature, then row groups. Each row group is
+//! a 4-byte row count n followed by the columns in record order, each
+//! stored contiguously (n subject IDs, n sites, n labels, n areas, ...).
+//!
+//! Append() is lock-free: writers reserve rows of the current row group
+//! with an atomic add and copy their rows in parallel. The writer whose
+//! reservation does not fit writes the full group to disk and opens the
+//! next one; writers that arrive meanwhile spin until it is done.
+class PQCT_MetricsAppender {
+
+ public:
+  //! Opens (or creates) the file for appending; throws on failure.
+  PQCT_MetricsAppender(const std::string & filename,
+		       unsigned int rowGroupSize = 4096);
+  //! Writes the last partial row group.
+  ~PQCT_MetricsAppender();
+
+  void Append(const std::vector<PQCT_MetricsRecord> & records);
+
+  //! Write the current partial row group. Not to be called concurrently
+  //! with Append().
+  void Flush();
+
+  //! Convert a results file to comma-separated text; throws on failure.
+  static void ExportCSV(const std::string & metricsFilename,
+			const std::string & csvFilename);
+
+ private:
+  PQCT_MetricsAppender(const PQCT_MetricsAppender &);  // Not implemented.
+  void operator=(const PQCT_MetricsAppender &);        // Not implemented.
+
+  void AppendChunk(const PQCT_MetricsRecord * records, long numberOfRecords);
+  void WriteRowGroup(long numberOfRows);
+
+  FILE * m_File;
+  std::vector<PQCT_MetricsRecord> m_RowGroup;
+  long m_RowGroupSize;
+  volatile long m_ReservedRows;
+  volatile long m_CommittedRows;
+  volatile long m_Generation;
+};
+
+#endif
@@ -0,0 +1,281 @@
+/*===========================================================================
+
+Program:   Bone, muscle and fat quantification from PQCT data.
+Module:    $RCSfile: PQCT_Phantom.cxx,v $
+Language:  C++
+Date:      $Date: 2012/09/04 10:00:00 $
+Version:   $Revision: 0.1 $
+Author:    S. K. Makrogiannis
+3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+=============================================================================*/
+
+#include <cmath>
+#include <cstdlib>
+
+#include <itkImageRegionIteratorWithIndex.h>
+
+#include "PQCT_Phantom.h"
+#include "PQCT_Calibration.h"
+#include "PQCT_FileFormat.h"
+
+
+//! Is (x, y) inside the ellipse of center (cx, cy) and semi-axes (a, b)?
+static inline bool InsideEllipse(double x, double y,
+				 double cx, double cy,
+				 double a, double b) {
+  if (a <= 0 || b <= 0)
+    return false;
+  double dx = (x - cx) / a;
+  double dy = (y - cy) / b;
+  return dx * dx + dy * dy <= 1.0;
+}
+
+
+PQCT_PhantomParametersType PQCT_Phantom::GetDefaultParameters(unsigned int size,
+							      float spacing) {
+  PQCT_PhantomParametersType parameters;
+  const float fieldOfView = size * spacing;
+
+  parameters.Size = size;
+  parameters.Spacing = spacing;
+  parameters.NoiseSD = 0.0F;
+  parameters.Seed = 1;
+
+  parameters.LegSemiAxes[0] = 0.42F * fieldOfView;
+  parameters.LegSemiAxes[1] = 0.36F * fieldOfView;
+  parameters.SubcutaneousFatThickness = 0.06F * fieldOfView;
+  parameters.InterMuscularFatScale = 0.8F;
+  parameters.InterMuscularFatThickness = 0.01F * fieldOfView;
+
+  //! The tibia is anterior-medial, the fibula lateral.
+  parameters.TibiaCenter[0] = -0.06F * fieldOfView;
+  parameters.TibiaCenter[1] = -0.10F * fieldOfView;
+  parameters.TibiaRadius = 0.11F * fieldOfView;
+  parameters.TibiaCorticalThickness = 0.035F * fieldOfView;
+  parameters.FibulaCenter[0] = 0.16F * fieldOfView;
+  parameters.FibulaCenter[1] = 0.02F * fieldOfView;
+  parameters.FibulaRadius = 0.045F * fieldOfView;
+  parameters.FibulaCorticalThickness = 0.02F * fieldOfView;
+
+  for (int i = 0; i <= TOT_AREA; i++)
+    parameters.Density[i] = 0.0F;
+  parameters.Density[AIR] = -400.0F;
+  parameters.Density[SUB_FAT] = -22.0F;
+  parameters.Density[IM_FAT] = -22.0F;
+  parameters.Density[MUSCLE] = 72.0F;
+  parameters.Density[CORT_BONE] = 993.0F;
+  parameters.Density[BONE_INT] = -22.0F;
+  return parameters;
+}
+
+
+void PQCT_Phantom::SetCTDensities(PQCT_PhantomParametersType & parameters) {
+  parameters.Density[AIR] = -940.0F;
+  parameters.Density[SUB_FAT] = -20.0F;
+  parameters.Density[IM_FAT] = -20.0F;
+  parameters.Density[MUSCLE] = 50.0F;
+  parameters.Density[CORT_BONE] = 1200.0F;
+  parameters.Density[BONE_INT] = -20.0F;
+}
+
+
+//! Bones over the IMFAT ring over muscle over SAT over air.
+LabelPixelType PQCT_Phantom::GetLegLabel(const PQCT_PhantomParametersType & parameters,
+					 long x, long y) {
+  const double px = ( x - 0.5 * parameters.Size ) * parameters.Spacing;
+  const double py = ( y - 0.5 * parameters.Size ) * parameters.Spacing;
+
+  const double tibiaX = parameters.TibiaCenter[0], tibiaY = parameters.TibiaCenter[1];
+  const double tibiaMarrowRadius = parameters.TibiaRadius - parameters.TibiaCorticalThickness;
+  if ( InsideEllipse( px, py, tibiaX, tibiaY, tibiaMarrowRadius, tibiaMarrowRadius ) )
+    return BONE_INT;
+  if ( InsideEllipse( px, py, tibiaX, tibiaY, parameters.TibiaRadius, parameters.TibiaRadius ) )
+    return CORT_BONE;
+
+  const double fibulaX = parameters.FibulaCenter[0], fibulaY = parameters.FibulaCenter[1];
+  const double fibulaMarrowRadius = parameters.FibulaRadius - parameters.FibulaCorticalThickness;
+  if ( InsideEllipse( px, py, fibulaX, fibulaY, fibulaMarrowRadius, fibulaMarrowRadius ) )
+    return BONE_INT;
+  if ( InsideEllipse( px, py, fibulaX, fibulaY, parameters.FibulaRadius, parameters.FibulaRadius ) )
+    return CORT_BONE;
+
+  const double muscleA = parameters.LegSemiAxes[0] - parameters.SubcutaneousFatThickness;
+  const double muscleB = parameters.LegSemiAxes[1] - parameters.SubcutaneousFatThickness;
+  if ( InsideEllipse( px, py, 0, 0, muscleA, muscleB ) ) {
+    const double ringA = parameters.InterMuscularFatScale * muscleA;
+    const double ringB = parameters.InterMuscularFatScale * muscleB;
+    const double thickness = parameters.InterMuscularFatThickness;
+    if ( thickness > 0 &&
+	 InsideEllipse( px, py, 0, 0, ringA, ringB ) &&
+	 !InsideEllipse( px, py, 0, 0, ringA - thickness, ringB - thickness ) )
+      return IM_FAT;
+    return MUSCLE;
+  }
+  if ( InsideEllipse( px, py, 0, 0, parameters.LegSemiAxes[0], parameters.LegSemiAxes[1] ) )
+    return SUB_FAT;
+  return AIR;
+}
+
+
+LabelImageType::IndexType
+PQCT_Phantom::GetTibiaCenter(const PQCT_PhantomParametersType & parameters) {
+  LabelImageType::IndexType center;
+  for (int i = 0; i < pixelDimensions; i++)
+    center[i] = (long) MY_ROUND( 0.5 * parameters.Size +
+				 parameters.TibiaCenter[i] / parameters.Spacing );
+  return center;
+}
+
+
+//! Allocate a size x size image with the given spacing at the origin.
+template<class TImage>
+static typename TImage::Pointer AllocatePhantomImage(unsigned int size, float spacing) {
+  typename TImage::RegionType region;
+  typename TImage::SizeType regionSize;
+  typename TImage::IndexType regionIndex;
+  double imageSpacing[ pixelDimensions ];
+  double origin[ pixelDimensions ];
+  for (int i = 0; i < pixelDimensions; i++) {
+    regionSize[i] = size;
+    regionIndex[i] = 0;
+    imageSpacing[i] = spacing;
+    origin[i] = 0.0;
+  }
+  region.SetSize( regionSize );
+  region.SetIndex( regionIndex );
+
+  typename TImage::Pointer image = TImage::New();
+  image->SetRegions( region );
+  image->SetSpacing( imageSpacing );
+  image->SetOrigin( origin );
+  image->Allocate();
+  return image;
+}
+
+
+LabelImageType::Pointer
+PQCT_Phantom::CreateLabelImage(const PQCT_PhantomParametersType & parameters) {
+  LabelImageType::Pointer labelImage =
+    AllocatePhantomImage<LabelImageType>( parameters.Size, parameters.Spacing );
+  typedef itk::ImageRegionIteratorWithIndex<LabelImageType> LabelImageIteratorType;
+  LabelImageIteratorType itImage( labelImage, labelImage->GetBufferedRegion() );
+  for (itImage.GoToBegin(); !itImage.IsAtEnd(); ++itImage)
+    itImage.Set( GetLegLabel( parameters, itImage.GetIndex()[0], itImage.GetIndex()[1] ) );
+  return labelImage;
+}
+
+
+PQCTImageType::Pointer
+PQCT_Phantom::CreateImage(const PQCT_PhantomParametersType & parameters) {
+  PQCTImageType::Pointer image =
+    AllocatePhantomImage<PQCTImageType>( parameters.Size, parameters.Spacing );
+
+  //! xorshift generator and Box-Muller transform; reproducible and
+  //! independent of the C library.
+  unsigned int state = 2463534242U ^ parameters.Seed;
+  if (state == 0)
+    state = 2463534242U;
+  typedef itk::ImageRegionIteratorWithIndex<PQCTImageType> PQCTImageIteratorType;
+  PQCTImageIteratorType itImage( image, image->GetBufferedRegion() );
+  for (itImage.GoToBegin(); !itImage.IsAtEnd(); ++itImage) {
+    double value = parameters.Density[ GetLegLabel( parameters,
+						    itImage.GetIndex()[0],
+						    itImage.GetIndex()[1] ) ];
+    if (parameters.NoiseSD > 0) {
+      double u[2];
+      for (int i = 0; i < 2; i++) {
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	u[i] = ( state + 1.0 ) / 4294967297.0;
+      }
+      value += parameters.NoiseSD * sqrt( -2.0 * log( u[0] ) ) * cos( 2.0 * M_PI * u[1] );
+    }
+    itImage.Set( (PQCTPixelType) MY_ROUND( value ) );
+  }
+  return image;
+}
+
+
+//! Header of a single slice with the phantom's voxel size and matrix.
+void PQCT_Phantom::WritePQCTFile(const PQCT_PhantomParametersType & parameters,
+				 const std::string & filename,
+				 const std::string & patientID,
+				 float slope,
+				 float intercept) {
+  PQCTImageType::Pointer image = CreateImage( parameters );
+  PQCTPixelType * pixels = image->GetBufferPointer();
+  const size_t numberOfPixels = image->GetBufferedRegion().GetNumberOfPixels();
+  for (size_t i = 0; i < numberOfPixels; i++)
+    pixels[i] = PQCT_CalibrationTable::ComputeAttenuationValue( pixels[i], slope, intercept );
+
+  HeaderPrefixType headerPrefix;
+  headerPrefix.HeaderVersion = 1;
+  headerPrefix.HeaderLength = headerLength;
+
+  //! Zero record lengths: the writer uses the lengths of the fields.
+  DetectorInformationType detectorInformation;
+  detectorInformation.DetRecTypeLength = 0;
+  detectorInformation.VoxelSize = parameters.Spacing;
+  detectorInformation.NumberofSlices = 1;
+  detectorInformation.SliceOrigin = 0.0;
+  detectorInformation.ScanDate = 20120905;
+
+  PatientInformationType patientInformation;
+  patientInformation.PatInfoRecTypeLength = 0;
+  patientInformation.PatientGender = 0;
+  patientInformation.PatientEthnicGroup = 0;
+  patientInformation.PatientMeasurementNumber = 1;
+  patientInformation.PatientNumber = atoi( patientID.c_str() );
+  patientInformation.PatientBirthDate = 19500101;
+  patientInformation.PatientName = "Phantom";
+  patientInformation.UserID = "PQCT_Phantom";
+  patientInformation.PatientID = patientID;
+
+  ImageInformationType imageInformation;
+  imageInformation.PicInfoRecLength = 0;
+  imageInformation.PicX0 = 0;
+  imageInformation.PicY0 = 0;
+  imageInformation.MatrixSize[0] = (unsigned short) parameters.Size;
+  imageInformation.MatrixSize[1] = (unsigned short) parameters.Size;
+
+  WritePQCTImageFile( filename, headerPrefix, detectorInformation,
+		      patientInformation, imageInformation, pixels );
+}
+
+
+PQCTImageType::Pointer PQCT_Phantom::CreateLegImage(unsigned int size,
+						    float spacing,
+						    float noiseSD,
+						    unsigned int seed) {
+  PQCT_PhantomParametersType parameters = GetDefaultParameters( size, spacing );
+  parameters.NoiseSD = noiseSD;
+  parameters.Seed = seed;
+  return CreateImage( parameters );
+}
+
+
+PQCTImageType::Pointer PQCT_Phantom::CreateLegCTImage(unsigned int size,
+						      float spacing,
+						      float noiseSD,
+						      unsigned int seed) {
+  PQCT_PhantomParametersType parameters = GetDefaultParameters( size, spacing );
+  SetCTDensities( parameters );
+  parameters.NoiseSD = noiseSD;
+  parameters.Seed = seed;
+  return CreateImage( parameters );
+}
+
+
+LabelImageType::Pointer PQCT_Phantom::CreateLegLabelImage(unsigned int size,
+							  float spacing) {
+  return CreateLabelImage( GetDefaultParameters( size, spacing ) );
+}
+
+
+//! The default geometry is in proportion to the image, so the center
+//! does not depend on the spacing.
+LabelImageType::IndexType PQCT_Phantom::GetTibiaCenter(unsigned int size) {
+  return GetTibiaCenter( GetDefaultParameters( size, 1.0F ) );
+}
@@ -0,0 +1,102 @@
+/*===========================================================================
+
+Program:   Bone, muscle and fat quantification from PQCT data.
+Module:    $RCSfile: PQCT_Phantom.h,v $
+Language:  C++
+Date:      $Date: 2012/09/04 10:00:00 $
+Version:   $Revision: 0.1 $
+Author:    S. K. Makrogiannis
+3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+=============================================================================*/
+
+#ifndef __PQCT_Phantom_h__
+#define __PQCT_Phantom_h__
+
+#include <string>
+
+#include "PQCT_Datatypes.h"
+
+
+//! Geometry and densities of a leg phantom. Lengths are in mm; centers
+//! are offsets from the center of the image.
+typedef struct t_PQCT_PhantomParametersType
+{
+  unsigned int Size;                    // Pixels per side.
+  float Spacing;                        // mm
+  float NoiseSD;                        // Standard deviation of the noise.
+  unsigned int Seed;                    // Same seed, same noise.
+
+  //! Leg: subcutaneous fat (SAT) ring around the muscle ellipse.
+  float LegSemiAxes[2];
+  float SubcutaneousFatThickness;
+  //! Inter-muscular fat (IMFAT) ring inside the muscle, on the muscle
+  //! ellipse scaled by InterMuscularFatScale; no ring at zero thickness.
+  float InterMuscularFatScale;
+  float InterMuscularFatThickness;
+
+  //! Bones: cortical ring around the marrow.
+  float TibiaCenter[2];
+  float TibiaRadius;
+  float TibiaCorticalThickness;
+  float FibulaCenter[2];
+  float FibulaRadius;
+  float FibulaCorticalThickness;
+
+  //! Mean value per label (AIR, SUB_FAT, MUSCLE, IM_FAT, CORT_BONE and
+  //! BONE_INT are drawn).
+  float Density[ TOT_AREA + 1 ];
+}
+PQCT_PhantomParametersType;
+
+
+//! Synthetic cross-sections of the lower leg for benchmarks and accuracy
+//! checks, so that tests do not need patient data.
+class PQCT_Phantom {
+
+ public:
+  //! A tibial shaft filling the image: geometry in proportion to the
+  //! field of view, densities (mg/cm^3) at the K-means priors of 38%/66%.
+  static PQCT_PhantomParametersType GetDefaultParameters(unsigned int size,
+							 float spacing);
+
+  //! Set the densities to the K-means priors of the mid thigh (HU).
+  static void SetCTDensities(PQCT_PhantomParametersType & parameters);
+
+  //! Calibrated densities (or HU) with Gaussian noise.
+  static PQCTImageType::Pointer CreateImage(const PQCT_PhantomParametersType & parameters);
+
+  //! Ground truth labels of CreateImage().
+  static LabelImageType::Pointer CreateLabelImage(const PQCT_PhantomParametersType & parameters);
+
+  //! Center of the tibia, e.g. as a seed for fast marching.
+  static LabelImageType::IndexType GetTibiaCenter(const PQCT_PhantomParametersType & parameters);
+
+  //! Write CreateImage() as a native pQCT file: densities are converted
+  //! to attenuation units with the given calibration. Throws on failure.
+  static void WritePQCTFile(const PQCT_PhantomParametersType & parameters,
+			    const std::string & filename,
+			    const std::string & patientID,
+			    float slope,
+			    float intercept);
+
+  //! Shorthands for the default parameters.
+  static PQCTImageType::Pointer CreateLegImage(unsigned int size,
+					       float spacing,
+					       float noiseSD,
+					       unsigned int seed);
+  static PQCTImageType::Pointer CreateLegCTImage(unsigned int size,
+						 float spacing,
+						 float noiseSD,
+						 unsigned int seed);
+  static LabelImageType::Pointer CreateLegLabelImage(unsigned int size,
+						     float spacing);
+  static LabelImageType::IndexType GetTibiaCenter(unsigned int size);
+
+ private:
+  //! Label of pixel (x, y).
+  static LabelPixelType GetLegLabel(const PQCT_PhantomParametersType & parameters,
+				    long x, long y);
+};
+
+#endif
@@ -0,0 +1,74 @@
+/*===========================================================================
+
+Program:   Bone, muscle and fat quantification from PQCT data.
+Module:    $RCSfile: PQCT_PhantomGenerator.cxx,v $
+Language:  C++
+Date:      $Date: 2012/09/06 10:00:00 $
+Version:   $Revision: 0.1 $
+Author:    S. K. Makrogiannis
+3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+=============================================================================*/
+
+#if defined(_MSC_VER)
+#pragma warning ( disable : 4786 )
+#endif
+
+#include <cstdlib>
+#include <string>
+#include <iostream>
+
+#include "PQCT_Datatypes.h"
+#include "PQCT_Phantom.h"
+#include "PQCT_AsyncWriter.h"
+
+
+//! Phantom routine: writes a leg phantom as a native pQCT file, and its
+//! ground truth labels for accuracy checks.
+
+int
+main( int argc, char ** argv )
+{
+  if (argc < 2) {
+    std::cerr << "Usage: "
+              << argv[0]
+              << " <output pqct image> [<size, default 256>] [<spacing (mm), default 0.5>] [<noise SD (mg/cm^3), default 20>] [<seed, default 1>] [<label image>]"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::string imageFilename = argv[1];
+  unsigned int size = argc > 2 ? (unsigned int) atoi( argv[2] ) : 256;
+  float spacing = argc > 3 ? (float) atof( argv[3] ) : pixelSpacing4PCT;
+  if (size < 1 || size > 65535 || spacing <= 0) {
+    std::cerr << "Error:Unacceptable phantom size or spacing." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  PQCT_PhantomParametersType parameters =
+    PQCT_Phantom::GetDefaultParameters( size, spacing );
+  parameters.NoiseSD = argc > 4 ? (float) atof( argv[4] ) : 20.0F;
+  parameters.Seed = argc > 5 ? (unsigned int) atoi( argv[5] ) : 1;
+
+  try {
+    //! Attenuation units with the default calibration.
+    PQCT_Phantom::WritePQCTFile( parameters, imageFilename, "1", slope, intercept );
+    std::cout << "Phantom written to " << imageFilename << std::endl;
+
+    if (argc > 6) {
+      PQCT_AsyncWriter::WriteLabelImageNow( PQCT_Phantom::CreateLabelImage( parameters ),
+					    (std::string) argv[6] );
+      std::cout << "Labels written to " << argv[6] << std::endl;
+    }
+  }
+  catch(const char * Message) {
+    std::cerr << "Error:" << Message << std::endl;
+    return EXIT_FAILURE;
+  }
+  catch(itk::ExceptionObject & err) {
+    std::cerr << "ExceptionObject caught !" << std::endl;
+    std::cerr << err << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,172 @@
+/*===========================================================================
+
+Program:   Bone, muscle and fat quantification from PQCT data.
+Module:    $RCSfile: PQCT_StageGraph.cxx,v $
+Language:  C++
+Date:      $Date: 2012/08/30 10:00:00 $
+Version:   $Revision: 0.1 $
+Author:    S. K. Makrogiannis
+3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+=============================================================================*/
+
+#include <sstream>
+#include <exception>
+
+#include "PQCT_StageGraph.h"
+
+
+PQCT_StageGraph::PQCT_StageGraph() {
+  this->m_NumberOfRunningStages = 0;
+  this->m_Failed = false;
+  this->m_FailureMessage = NULL;
+  this->m_StageCompleted = itk::ConditionVariable::New();
+}
+
+
+PQCT_StageGraph::~PQCT_StageGraph() {
+  for (unsigned int i = 0; i < this->m_Stages.size(); i++)
+    delete this->m_Stages[i].Stage;
+}
+
+
+//! Link the new stage to the latest producers of its inputs. The graph
+//! owns the stage, also when it is rejected.
+void PQCT_StageGraph::AddStage(const std::string & name,
+			       PQCT_Stage * stage,
+			       const std::string & inputs,
+			       const std::string & outputs) {
+  unsigned int stageIndex = this->m_Stages.size();
+
+  //! Find the producers before changing the graph.
+  std::vector<unsigned int> producers;
+  std::istringstream inputStream( inputs );
+  std::string input;
+  while (inputStream >> input) {
+    int producer = -1;
+    for (int i = (int)stageIndex - 1; i >= 0 && producer < 0; i--)
+      for (unsigned int j = 0; j < this->m_Stages[i].Outputs.size(); j++)
+	if (this->m_Stages[i].Outputs[j] == input)
+	  producer = i;
+    if (producer < 0) {
+      delete stage;
+      throw "Stage input is not produced by an earlier stage.";
+    }
+    producers.push_back( producer );
+  }
+
+  StageNodeType node;
+  node.Name = name;
+  node.Stage = stage;
+  node.NumberOfDependencies = producers.size();
+  this->m_Stages.push_back( node );
+  for (unsigned int i = 0; i < producers.size(); i++)
+    this->m_Stages[ producers[i] ].Dependents.push_back( stageIndex );
+
+  std::istringstream outputStream( outputs );
+  std::string output;
+  while (outputStream >> output)
+    this->m_Stages[stageIndex].Outputs.push_back( output );
+}
+
+
+void PQCT_StageGraph::Execute(unsigned int numberOfThreads) {
+  this->m_ReadyStages.clear();
+  for (unsigned int i = 0; i < this->m_Stages.size(); i++)
+    if (this->m_Stages[i].NumberOfDependencies == 0)
+      this->m_ReadyStages.push_back( i );
+
+  if (numberOfThreads == 0)
+    numberOfThreads = itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+  if (numberOfThreads > this->m_Stages.size())
+    numberOfThreads = this->m_Stages.size();
+
+  if (numberOfThreads <= 1)
+    this->ProcessStages();
+  else {
+    itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+    threader->SetNumberOfThreads( numberOfThreads );
+    threader->SetSingleMethod( ThreaderCallback, this );
+    threader->SingleMethodExecute();
+  }
+
+  if (!this->m_Failed)
+    return;
+  if (this->m_FailureMessage != NULL)
+    throw this->m_FailureMessage;
+  throw this->m_FailureException;
+}
+
+
+ITK_THREAD_RETURN_TYPE PQCT_StageGraph::ThreaderCallback(void * arg) {
+  itk::MultiThreader::ThreadInfoStruct * threadInfo = 
+    static_cast<itk::MultiThreader::ThreadInfoStruct *>( arg );
+  PQCT_StageGraph * graph = static_cast<PQCT_StageGraph *>( threadInfo->UserData );
+  graph->ProcessStages();
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+
+//! Take ready stages until every stage has run or one has failed.
+void PQCT_StageGraph::ProcessStages() {
+  this->m_Lock.Lock();
+  while (true) {
+    while (this->m_ReadyStages.empty() && this->m_NumberOfRunningStages > 0 &&
+	   !this->m_Failed)
+      this->m_StageCompleted->Wait( &this->m_Lock );
+    if (this->m_ReadyStages.empty() || this->m_Failed)
+      break;
+
+    unsigned int stageIndex = this->m_ReadyStages.front();
+    this->m_ReadyStages.pop_front();
+    this->m_NumberOfRunningStages++;
+    this->m_Lock.Unlock();
+
+    this->RunStage( stageIndex );
+
+    this->m_Lock.Lock();
+    this->m_NumberOfRunningStages--;
+    StageNodeType & node = this->m_Stages[stageIndex];
+    for (unsigned int i = 0; i < node.Dependents.size(); i++)
+      if (--this->m_Stages[node.Dependents[i]].NumberOfDependencies == 0)
+	this->m_ReadyStages.push_back( node.Dependents[i] );
+    this->m_StageCompleted->Broadcast();
+  }
+  this->m_Lock.Unlock();
+}
+
+
+//! Run one stage and keep its failure for Execute().
+void PQCT_StageGraph::RunStage(unsigned int stageIndex) {
+  const char * failureMessage = NULL;
+  itk::ExceptionObject failureException;
+  bool failed = true;
+  try {
+    this->m_Stages[stageIndex].Stage->Run();
+    failed = false;
+  }
+  catch(const char * Message) {
+    failureMessage = Message;
+  }
+  catch(itk::ExceptionObject & e) {
+    failureException = e;
+  }
+  catch(std::exception & e) {
+    failureException = itk::ExceptionObject( __FILE__, __LINE__, e.what() );
+  }
+  catch(...) {
+    //! Must not escape the worker thread.
+    failureMessage = "Unknown exception in analysis stage.";
+  }
+  if (!failed)
+    return;
+
+  std::cerr << "Stage " << this->m_Stages[stageIndex].Name << " failed." << std::endl;
+  this->m_Lock.Lock();
+  if (!this->m_Failed) {
+    this->m_Failed = true;
+    this->m_FailureMessage = failureMessage;
+    this->m_FailureException = failureException;
+  }
+  this->m_Lock.Unlock();
+}
@@ -0,0 +1,123 @@
+/*===========================================================================
+
+Program:   Bone, muscle and fat quantification from PQCT data.
+Module:    $RCSfile: PQCT_StageGraph.h,v $
+Language:  C++
+Date:      $Date: 2012/08/30 10:00:00 $
+Version:   $Revision: 0.1 $
+Author:    S. K. Makrogiannis
+3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+=============================================================================*/
+
+#ifndef __PQCT_StageGraph_h__
+#define __PQCT_StageGraph_h__
+
+#include <string>
+#include <vector>
+#include <deque>
+
+#include <itkMultiThreader.h>
+#include <itkSimpleMutexLock.h>
+#include <itkConditionVariable.h>
+#include <itkExceptionObject.h>
+
+
+//! One step of a workflow.
+class PQCT_Stage {
+ public:
+  virtual ~PQCT_Stage() {};
+  virtual void Run() = 0;
+};
+
+//! Stage calling a method without arguments.
+template<class T> class PQCT_MemberStage : public PQCT_Stage {
+ public:
+  typedef void (T::*MethodType)();
+  PQCT_MemberStage(T * object, MethodType method) :
+    m_Object(object), m_Method(method) {};
+  void Run() { (this->m_Object->*this->m_Method)(); };
+ private:
+  T * m_Object;
+  MethodType m_Method;
+};
+
+//! Stage calling a method on its own data (e.g. one measurement).
+template<class T, class TData> class PQCT_MemberDataStage : public PQCT_Stage {
+ public:
+  typedef void (T::*MethodType)(TData &);
+  PQCT_MemberDataStage(T * object, MethodType method, TData * data) :
+    m_Object(object), m_Method(method), m_Data(data) {};
+  void Run() { (this->m_Object->*this->m_Method)( *this->m_Data ); };
+ private:
+  T * m_Object;
+  MethodType m_Method;
+  TData * m_Data;
+};
+
+
+//! Shallow copy of an image for use as filter input in concurrent
+//! stages: the pixel buffer is shared, pipeline state is not.
+template<class TImage> typename TImage::Pointer PQCT_GraftImage(TImage * image) {
+  typename TImage::Pointer graftedImage = TImage::New();
+  graftedImage->Graft( image );
+  return graftedImage;
+}
+
+
+//! Dependency graph of workflow stages. Each stage names the data it
+//! reads and writes; a stage starts when the stages producing its
+//! inputs have completed, so independent stages run concurrently.
+//! Stages must only write their own outputs.
+class PQCT_StageGraph {
+
+ public:
+  PQCT_StageGraph();
+  //! Deletes the stages.
+  ~PQCT_StageGraph();
+
+  //! Inputs and outputs are whitespace-separated names. Inputs must be
+  //! produced by stages added before. The graph takes ownership, and
+  //! deletes a rejected stage before throwing.
+  void AddStage(const std::string & name,
+		PQCT_Stage * stage,
+		const std::string & inputs,
+		const std::string & outputs);
+
+  //! Run every stage. numberOfThreads = 0 uses the ITK global default.
+  //! After a failure no further stage is started; the exception of the
+  //! first failed stage is thrown once running stages have finished.
+  void Execute(unsigned int numberOfThreads = 0);
+
+ private:
+  PQCT_StageGraph(const PQCT_StageGraph &);  // Not implemented.
+  void operator=(const PQCT_StageGraph &);   // Not implemented.
+
+  typedef struct t_StageNodeType
+  {
+    std::string Name;
+    PQCT_Stage * Stage;
+    std::vector<std::string> Outputs;
+    std::vector<unsigned int> Dependents;
+    unsigned int NumberOfDependencies;
+  }
+  StageNodeType;
+
+  static ITK_THREAD_RETURN_TYPE ThreaderCallback(void * arg);
+  void ProcessStages();
+  void RunStage(unsigned int stageIndex);
+
+  std::vector<StageNodeType> m_Stages;
+  std::deque<unsigned int> m_ReadyStages;
+  unsigned int m_NumberOfRunningStages;
+
+  //! First failure: a message (string literal) or an ITK exception.
+  bool m_Failed;
+  const char * m_FailureMessage;
+  itk::ExceptionObject m_FailureException;
+
+  itk::SimpleMutexLock m_Lock;
+  itk::ConditionVariable::Pointer m_StageCompleted;
+};
+
+#endif
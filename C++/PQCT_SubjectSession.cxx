@@ -0,0 +1,144 @@
+/*===========================================================================
+
+Program:   Bone, muscle and fat quantification from PQCT data.
+Module:    $RCSfile: PQCT_SubjectSession.cxx,v $
+Language:  C++
+Date:      $Date: 2012/08/30 10:00:00 $
+Version:   $Revision: 0.1 $
+Author:    S. K. Makrogiannis
+3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+=============================================================================*/
+
+#include <cstdlib>
+#include <iostream>
+
+#include <itksys/SystemTools.hxx>
+
+#include "PQCT_SubjectSession.h"
+#include "PQCT_Analysis.h"
+#include "PQCT_Threading.h"
+
+
+PQCT_SubjectSession::PQCT_SubjectSession() {
+  this->m_ParameterFilename = "./PQCT_Analysis_Params.txt";
+  this->m_OutputPath = "./";
+  this->m_OutputWriter = NULL;
+  this->m_MetricsAppender = NULL;
+}
+
+
+PQCT_SubjectSession::~PQCT_SubjectSession() {
+  for (unsigned int i = 0; i < this->m_Sites.size(); i++)
+    delete this->m_Sites[i].Analyzer;
+}
+
+
+void PQCT_SubjectSession::AddSite(unsigned short workflowID,
+				  const std::string & imageFilename) {
+  switch (workflowID) {
+  case PQCT_FOUR_PCT_TIBIA:
+  case PQCT_THIRTYEIGHT_PCT_TIBIA:
+  case PQCT_SIXTYSIX_PCT_TIBIA:
+  case CT_MID_THIGH:
+    break;
+  default:
+    throw "Session sites must be pQCT or CT analysis workflows.";
+  }
+
+  SessionSiteType site;
+  site.WorkflowID = workflowID;
+  site.ImageFilename = imageFilename;
+  site.Analyzer = NULL;
+  site.Status = EXIT_FAILURE;
+  this->m_Sites.push_back( site );
+}
+
+
+//! Run one site on its own analyzer.
+void PQCT_SubjectSession::AnalyzeSite(unsigned int siteIndex, void * userData) {
+  PQCT_SubjectSession * session = static_cast<PQCT_SubjectSession *>( userData );
+  SessionSiteType & site = session->m_Sites[siteIndex];
+  site.Status = site.Analyzer->Execute();
+}
+
+
+int PQCT_SubjectSession::Execute() {
+  if ( this->m_Sites.empty() )
+    return EXIT_SUCCESS;
+  if ( this->m_SubjectID.empty() )
+    this->m_SubjectID =
+      itksys::SystemTools::GetFilenameName( this->m_Sites[0].ImageFilename );
+
+  //! Parse the parameter file once for all sites.
+  PQCT_Analyzer parameterReader;
+  if ( parameterReader.LoadParameterFile( this->m_ParameterFilename ) == EXIT_FAILURE )
+    return EXIT_FAILURE;
+
+  for (unsigned int i = 0; i < this->m_Sites.size(); i++) {
+    SessionSiteType & site = this->m_Sites[i];
+    delete site.Analyzer;
+    site.Analyzer = new PQCT_Analyzer();
+    site.Analyzer->SetParameterValues( parameterReader.GetParameterValues() );
+    site.Analyzer->SetPQCTImageFilename( site.ImageFilename );
+    site.Analyzer->SetWorkflowID( site.WorkflowID );
+    site.Analyzer->SetOutputPath( this->m_OutputPath );
+    site.Analyzer->SetOutputWriter( this->m_OutputWriter );
+    site.Analyzer->SetKeepQuantification( true );
+    site.Status = EXIT_FAILURE;
+  }
+
+  //! The filters use the process-wide thread count set by the caller.
+  PQCT_ParallelJobs::Run( this->m_Sites.size(), AnalyzeSite, this,
+			  this->m_Sites.size() );
+
+  int status = EXIT_SUCCESS;
+  for (unsigned int i = 0; i < this->m_Sites.size(); i++)
+    if (this->m_Sites[i].Status != EXIT_SUCCESS) {
+      std::cerr << "Site " << AnatomicalSite[this->m_Sites[i].WorkflowID]
+		<< " of " << this->m_SubjectID << " failed." << std::endl;
+      status = EXIT_FAILURE;
+    }
+
+  try {
+    this->WriteSubjectRecord();
+  }
+  catch(const char * Message) {
+    std::cerr << "Error:" << Message << std::endl;
+    return EXIT_FAILURE;
+  }
+  return status;
+}
+
+
+//! Emit the quantification of the successful sites in the order they
+//! were added.
+void PQCT_SubjectSession::WriteSubjectRecord() {
+  std::vector<PQCT_MetricsRecord> records;
+  std::string text;
+  for (unsigned int i = 0; i < this->m_Sites.size(); i++) {
+    const SessionSiteType & site = this->m_Sites[i];
+    if (site.Status != EXIT_SUCCESS)
+      continue;
+    const std::vector<PQCT_MetricsRecord> & siteRecords =
+      site.Analyzer->GetMetricsRecords();
+    records.insert( records.end(), siteRecords.begin(), siteRecords.end() );
+    text += site.Analyzer->GetQuantificationText();
+  }
+  if ( records.empty() )
+    return;
+
+  if (this->m_MetricsAppender != NULL) {
+    for (unsigned int i = 0; i < records.size(); i++)
+      SetMetricsSubjectID( records[i], this->m_SubjectID );
+    this->m_MetricsAppender->Append( records );
+    return;
+  }
+
+  std::string filename = this->m_OutputPath + this->m_SubjectID +
+    "_Session" + quantificationFileExtension;
+  if (this->m_OutputWriter != NULL)
+    this->m_OutputWriter->WriteTextFile( filename, text );
+  else
+    PQCT_AsyncWriter::WriteTextFileNow( filename, text );
+}
@@ -0,0 +1,92 @@
+/*===========================================================================
+
+Program:   Bone, muscle and fat quantification from PQCT data.
+Module:    $RCSfile: PQCT_SubjectSession.h,v $
+Language:  C++
+Date:      $Date: 2012/08/30 10:00:00 $
+Version:   $Revision: 0.1 $
+Author:    S. K. Makrogiannis
+3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+=============================================================================*/
+
+#ifndef __PQCT_SubjectSession_h__
+#define __PQCT_SubjectSession_h__
+
+#include <string>
+#include <vector>
+
+#include "PQCT_AsyncWriter.h"
+#include "PQCT_Metrics.h"
+
+class PQCT_Analyzer;
+
+
+//! Analysis of all site images of one subject in one process.
+//! The parameter file is parsed once and its values are handed to one
+//! analyzer per site; the sites run concurrently and share the output
+//! writer, the calibration tables and the processors. The quantification
+//! of all sites is emitted as one subject record: a single append to the
+//! cohort results file, or one text file with a block per site.
+class PQCT_SubjectSession {
+
+ public:
+  PQCT_SubjectSession();
+  ~PQCT_SubjectSession();
+
+  //! Subject ID of the combined record; defaults to the first image name.
+  void SetSubjectID(const std::string & subjectID) {
+    this->m_SubjectID = subjectID;
+  };
+  void SetParameterFilename(const std::string & parameterFilename) {
+    this->m_ParameterFilename = parameterFilename;
+  };
+  void SetOutputPath(const std::string & outputPath) {
+    this->m_OutputPath = outputPath;
+  };
+  //! Not owned; flushed by the caller.
+  void SetOutputWriter(PQCT_AsyncWriter * outputWriter) {
+    this->m_OutputWriter = outputWriter;
+  };
+  //! Not owned; the subject record is appended instead of written as text.
+  void SetMetricsAppender(PQCT_MetricsAppender * metricsAppender) {
+    this->m_MetricsAppender = metricsAppender;
+  };
+
+  //! Add the image of one site; throws for workflows other than the
+  //! pQCT and CT analyses.
+  void AddSite(unsigned short workflowID, const std::string & imageFilename);
+
+  //! Returns EXIT_FAILURE if the parameter file could not be read or any
+  //! site failed. Sites that succeeded are still recorded. The sites run
+  //! with the global default number of ITK threads each; the session
+  //! does not change it, so that concurrent sessions do not interfere.
+  //! A single-session process splits the processors beforehand.
+  int Execute();
+
+ private:
+  PQCT_SubjectSession(const PQCT_SubjectSession &);  // Not implemented.
+  void operator=(const PQCT_SubjectSession &);       // Not implemented.
+
+  //! One site of the session and its analyzer.
+  typedef struct t_SessionSiteType
+  {
+    unsigned short WorkflowID;
+    std::string ImageFilename;
+    PQCT_Analyzer * Analyzer;
+    int Status;
+  }
+  SessionSiteType;
+
+  static void AnalyzeSite(unsigned int siteIndex, void * userData);
+  void WriteSubjectRecord();
+
+  std::vector<SessionSiteType> m_Sites;
+  std::string m_SubjectID;
+  std::string m_ParameterFilename;
+  std::string m_OutputPath;
+  PQCT_AsyncWriter * m_OutputWriter;
+  PQCT_MetricsAppender * m_MetricsAppender;
+};
+
+#endif
@@ -0,0 +1,97 @@
+/*===========================================================================
+
+  Program:   Bone, muscle and fat quantification from PQCT data.
+  Module:    $RCSfile: PQCT_Threading.cxx,v $
+  Language:  C++
+  Date:      $Date: 2012/08/22 10:00:00 $
+  Version:   $Revision: 0.1 $
+  Author:    S. K. Makrogiannis
+  3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+  =============================================================================*/
+
+#include <iostream>
+#include <exception>
+
+#include "PQCT_Threading.h"
+
+
+//! Execute one job and contain its failure.
+void PQCT_ParallelJobs::RunJob(JobQueueType * queue, unsigned int jobIndex) {
+  bool failed = false;
+  try {
+    queue->JobFunction( jobIndex, queue->UserData );
+  }
+  catch(const char * Message) {
+    std::cerr << "Error in job " << jobIndex << ": " << Message << std::endl;
+    failed = true;
+  }
+  catch(itk::ExceptionObject & e) {
+    std::cerr << "Exception in job " << jobIndex << std::endl;
+    std::cerr << e << std::endl;
+    failed = true;
+  }
+  catch(std::exception & e) {
+    std::cerr << "Exception in job " << jobIndex << ": " << e.what() << std::endl;
+    failed = true;
+  }
+
+  if (failed) {
+    itk::MutexLockHolder<itk::SimpleFastMutexLock> holder( queue->Lock );
+    queue->NumberOfFailedJobs++;
+  }
+}
+
+
+//! Pool thread: take the next job until the queue is empty.
+ITK_THREAD_RETURN_TYPE PQCT_ParallelJobs::ThreaderCallback(void * arg) {
+  itk::MultiThreader::ThreadInfoStruct * threadInfo = 
+    static_cast<itk::MultiThreader::ThreadInfoStruct *>( arg );
+  JobQueueType * queue = static_cast<JobQueueType *>( threadInfo->UserData );
+
+  while (true) {
+    unsigned int jobIndex;
+    {
+      itk::MutexLockHolder<itk::SimpleFastMutexLock> holder( queue->Lock );
+      if (queue->NextJob >= queue->NumberOfJobs)
+	break;
+      jobIndex = queue->NextJob++;
+    }
+    RunJob( queue, jobIndex );
+  }
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+
+//! Dispatch the jobs.
+unsigned int PQCT_ParallelJobs::Run(unsigned int numberOfJobs,
+				    JobFunctionType jobFunction,
+				    void * userData,
+				    unsigned int numberOfThreads) {
+  JobQueueType queue;
+  queue.JobFunction = jobFunction;
+  queue.UserData = userData;
+  queue.NumberOfJobs = numberOfJobs;
+  queue.NextJob = 0;
+  queue.NumberOfFailedJobs = 0;
+
+  if (numberOfThreads == 0)
+    numberOfThreads = itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+  if (numberOfThreads > numberOfJobs)
+    numberOfThreads = numberOfJobs;
+
+  //! Run serially on the calling thread when there is nothing to share.
+  if (numberOfThreads <= 1) {
+    for (unsigned int i = 0; i < numberOfJobs; i++)
+      RunJob( &queue, i );
+    return queue.NumberOfFailedJobs;
+  }
+
+  itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+  threader->SetNumberOfThreads( numberOfThreads );
+  threader->SetSingleMethod( ThreaderCallback, &queue );
+  threader->SingleMethodExecute();
+
+  return queue.NumberOfFailedJobs;
+}
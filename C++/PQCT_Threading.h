@@ -0,0 +1,113 @@
+/*===========================================================================
+
+Program:   Bone, muscle and fat quantification from PQCT data.
+Module:    $RCSfile: PQCT_Threading.h,v $
+Language:  C++
+Date:      $Date: 2012/08/22 10:00:00 $
+Version:   $Revision: 0.1 $
+Author:    S. K. Makrogiannis
+3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+=============================================================================*/
+
+#ifndef __PQCT_Threading_h__
+#define __PQCT_Threading_h__
+
+#include <itkMultiThreader.h>
+#include <itkSimpleFastMutexLock.h>
+#include <itkMutexLockHolder.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sched.h>
+#endif
+
+
+//! Atomic counter helpers (full barriers).
+//! Returns the value after the addition.
+inline long PQCT_AtomicAdd(volatile long * value, long increment) {
+#if defined(_WIN32)
+  return InterlockedExchangeAdd( value, increment ) + increment;
+#else
+  return __sync_add_and_fetch( value, increment );
+#endif
+}
+
+inline long PQCT_AtomicLoad(volatile long * value) {
+  return PQCT_AtomicAdd( value, 0 );
+}
+
+inline void PQCT_AtomicStore(volatile long * value, long newValue) {
+#if defined(_WIN32)
+  InterlockedExchange( value, newValue );
+#else
+  __sync_lock_test_and_set( value, newValue );
+  __sync_synchronize();
+#endif
+}
+
+//! Give up the processor while spinning.
+inline void PQCT_YieldThread() {
+#if defined(_WIN32)
+  Sleep( 0 );
+#else
+  sched_yield();
+#endif
+}
+
+
+//! Set the ITK global default number of threads for the life of the
+//! guard; the previous value is restored on any exit from the scope.
+class PQCT_GlobalThreadsGuard {
+
+ public:
+  explicit PQCT_GlobalThreadsGuard(unsigned int numberOfThreads) {
+    this->m_PreviousNumberOfThreads =
+      itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+    itk::MultiThreader::SetGlobalDefaultNumberOfThreads( numberOfThreads );
+  };
+  ~PQCT_GlobalThreadsGuard() {
+    itk::MultiThreader::SetGlobalDefaultNumberOfThreads( this->m_PreviousNumberOfThreads );
+  };
+
+ private:
+  PQCT_GlobalThreadsGuard(const PQCT_GlobalThreadsGuard &);  // Not implemented.
+  void operator=(const PQCT_GlobalThreadsGuard &);           // Not implemented.
+
+  unsigned int m_PreviousNumberOfThreads;
+};
+
+
+//! Run independent jobs 0..N-1 on a pool of ITK threads.
+//! Jobs are handed out one at a time, so files or subjects of uneven
+//! cost balance across threads. A job that throws is reported and
+//! counted as failed; the remaining jobs still run.
+class PQCT_ParallelJobs {
+
+ public:
+  typedef void (*JobFunctionType)(unsigned int jobIndex, void * userData);
+
+  //! Returns the number of failed jobs. numberOfThreads = 0 uses the
+  //! ITK global default.
+  static unsigned int Run(unsigned int numberOfJobs,
+			  JobFunctionType jobFunction,
+			  void * userData,
+			  unsigned int numberOfThreads = 0);
+
+ private:
+  //! State shared by the pool threads.
+  struct JobQueueType {
+    JobFunctionType JobFunction;
+    void * UserData;
+    unsigned int NumberOfJobs;
+    unsigned int NextJob;
+    unsigned int NumberOfFailedJobs;
+    itk::SimpleFastMutexLock Lock;
+  };
+
+  static ITK_THREAD_RETURN_TYPE ThreaderCallback(void * arg);
+  static void RunJob(JobQueueType * queue, unsigned int jobIndex);
+};
+
+#endif
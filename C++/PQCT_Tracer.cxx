@@ -0,0 +1,147 @@
+/*===========================================================================
+
+Program:   Bone, muscle and fat quantification from PQCT data.
+Module:    $RCSfile: PQCT_Tracer.cxx,v $
+Language:  C++
+Date:      $Date: 2012/08/31 10:00:00 $
+Version:   $Revision: 0.1 $
+Author:    S. K. Makrogiannis
+3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+=============================================================================*/
+
+#include <sstream>
+
+#include <itkMutexLockHolder.h>
+
+#include "PQCT_Tracer.h"
+
+
+PQCT_Tracer::PQCT_Tracer() {
+  this->m_Clock = itk::RealTimeClock::New();
+  this->m_Origin = this->m_Clock->GetTimeInSeconds();
+}
+
+
+void PQCT_Tracer::Reset() {
+  itk::MutexLockHolder<itk::SimpleFastMutexLock> holder( this->m_Lock );
+  this->m_Events.clear();
+  this->m_Threads.clear();
+  this->m_Origin = this->m_Clock->GetTimeInSeconds();
+  PQCT_MemoryMonitor::ResetPeaks();
+}
+
+
+double PQCT_Tracer::GetElapsedTime() const {
+  return this->m_Clock->GetTimeInSeconds() - this->m_Origin;
+}
+
+
+void PQCT_Tracer::AddEvent(TraceStageType stage, double startTime, double stopTime,
+			   PQCT_MemorySizeType allocatedBytes) {
+  itk::MutexLockHolder<itk::SimpleFastMutexLock> holder( this->m_Lock );
+  TraceEventType event;
+  event.Stage = stage;
+  event.StartTime = startTime;
+  event.StopTime = stopTime;
+  event.ThreadIndex = this->GetThreadIndex();
+  event.AllocatedBytes = allocatedBytes;
+  event.LiveBytes = PQCT_MemoryMonitor::GetLiveBytes();
+  this->m_Events.push_back( event );
+}
+
+
+unsigned int PQCT_Tracer::GetThreadIndex() {
+#if defined(_WIN32)
+  NativeThreadIDType threadID = GetCurrentThreadId();
+#else
+  NativeThreadIDType threadID = pthread_self();
+#endif
+  for (unsigned int i = 0; i < this->m_Threads.size(); i++) {
+#if defined(_WIN32)
+    if (this->m_Threads[i] == threadID)
+#else
+    if ( pthread_equal( this->m_Threads[i], threadID ) )
+#endif
+      return i;
+  }
+  this->m_Threads.push_back( threadID );
+  return this->m_Threads.size() - 1;
+}
+
+
+void PQCT_Tracer::GetStageTimes(double startTime, std::vector<double> & stageTimes) const {
+  itk::MutexLockHolder<itk::SimpleFastMutexLock> holder( this->m_Lock );
+  stageTimes.assign( NUMBER_OF_TRACE_STAGES, 0.0 );
+  for (unsigned int i = 0; i < this->m_Events.size(); i++) {
+    const TraceEventType & event = this->m_Events[i];
+    if (event.StartTime >= startTime)
+      stageTimes[event.Stage] += event.StopTime - event.StartTime;
+  }
+}
+
+
+void PQCT_Tracer::GetStageAllocations(double startTime,
+				      std::vector<PQCT_MemorySizeType> & stageAllocations) const {
+  itk::MutexLockHolder<itk::SimpleFastMutexLock> holder( this->m_Lock );
+  stageAllocations.assign( NUMBER_OF_TRACE_STAGES, 0 );
+  for (unsigned int i = 0; i < this->m_Events.size(); i++) {
+    const TraceEventType & event = this->m_Events[i];
+    if (event.StartTime >= startTime)
+      stageAllocations[event.Stage] += event.AllocatedBytes;
+  }
+}
+
+
+PQCT_MemoryFootprintType PQCT_Tracer::GetMemoryFootprint() const {
+  PQCT_MemoryFootprintType footprint;
+  footprint.PeakHeapBytes = PQCT_MemoryMonitor::GetPeakLiveBytes();
+  footprint.PeakImageBuffers = PQCT_MemoryMonitor::GetPeakLiveImageBuffers();
+  footprint.PeakResidentSetSize = PQCT_MemoryMonitor::GetPeakResidentSetSize();
+  return footprint;
+}
+
+
+bool PQCT_Tracer::IsEmpty() const {
+  itk::MutexLockHolder<itk::SimpleFastMutexLock> holder( this->m_Lock );
+  return this->m_Events.empty();
+}
+
+
+std::string PQCT_Tracer::GetChromeTrace(const std::string & processName) const {
+  itk::MutexLockHolder<itk::SimpleFastMutexLock> holder( this->m_Lock );
+
+  //! Escape the characters that may appear in file names.
+  std::string escapedName;
+  for (unsigned int i = 0; i < processName.size(); i++) {
+    if (processName[i] == '"' || processName[i] == '\\')
+      escapedName += '\\';
+    escapedName += processName[i];
+  }
+
+  //! Complete ("X") events with microsecond timestamps, and a counter
+  //! of live heap bytes at the end of each stage.
+  std::ostringstream trace;
+  trace.setf(std::ios::fixed, std::ios::floatfield);
+  trace.precision(1);
+  trace << "{\"traceEvents\":[" << std::endl;
+  trace << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,"
+	<< "\"args\":{\"name\":\"" << escapedName << "\"}}";
+  for (unsigned int i = 0; i < this->m_Events.size(); i++) {
+    const TraceEventType & event = this->m_Events[i];
+    trace << "," << std::endl
+	  << "{\"name\":\"" << TraceStageString[event.Stage] << "\","
+	  << "\"cat\":\"pqct\",\"ph\":\"X\","
+	  << "\"ts\":" << event.StartTime * 1e6 << ","
+	  << "\"dur\":" << ( event.StopTime - event.StartTime ) * 1e6 << ","
+	  << "\"pid\":1,\"tid\":" << event.ThreadIndex << ","
+	  << "\"args\":{\"allocated_bytes\":" << event.AllocatedBytes << "}}";
+    if ( PQCT_MemoryMonitor::IsHeapAccountingEnabled() )
+      trace << "," << std::endl
+	    << "{\"name\":\"Heap\",\"ph\":\"C\","
+	    << "\"ts\":" << event.StopTime * 1e6 << ","
+	    << "\"pid\":1,\"args\":{\"live_bytes\":" << event.LiveBytes << "}}";
+  }
+  trace << std::endl << "],\"displayTimeUnit\":\"ms\"}" << std::endl;
+  return trace.str();
+}
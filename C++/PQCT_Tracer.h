@@ -0,0 +1,151 @@
+/*===========================================================================
+
+Program:   Bone, muscle and fat quantification from PQCT data.
+Module:    $RCSfile: PQCT_Tracer.h,v $
+Language:  C++
+Date:      $Date: 2012/08/31 10:00:00 $
+Version:   $Revision: 0.1 $
+Author:    S. K. Makrogiannis
+3T MRI Facility National Institute on Aging/National Institutes of Health.
+
+=============================================================================*/
+
+#ifndef __PQCT_Tracer_h__
+#define __PQCT_Tracer_h__
+
+#include <string>
+#include <vector>
+
+#include <itkRealTimeClock.h>
+#include <itkSimpleFastMutexLock.h>
+
+#include "PQCT_Memory.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+
+//! Enumeration of traced stages.
+typedef enum{TRACE_READ=0,
+	     TRACE_CALIBRATE,
+	     TRACE_SMOOTH,
+	     TRACE_KMEANS,
+	     TRACE_CCL,
+	     TRACE_FAST_MARCHING,
+	     TRACE_GAC,
+	     TRACE_LABEL_STATISTICS,
+	     TRACE_WRITE,
+	     NUMBER_OF_TRACE_STAGES} TraceStageType;
+
+//! Names of the traced stages, used for result columns and trace events.
+static const std::string TraceStageString[] = { "Read",
+						"Calibrate",
+						"Smooth",
+						"KMeans",
+						"CCL",
+						"FastMarching",
+						"GAC",
+						"LabelStatistics",
+						"Write" };
+
+
+//! Wall-clock trace of the stages of an analysis.
+//! Stages may run on several threads at once; each event keeps the
+//! index of the thread that ran it, in order of first appearance, and
+//! the heap bytes allocated while it ran (see PQCT_MemoryMonitor).
+class PQCT_Tracer {
+
+ public:
+  PQCT_Tracer();
+
+  //! Drop all events, restart the clock and the memory peaks.
+  void Reset();
+
+  //! Wall-clock seconds since Reset().
+  double GetElapsedTime() const;
+
+  //! Record a stage of the calling thread.
+  void AddEvent(TraceStageType stage, double startTime, double stopTime,
+		PQCT_MemorySizeType allocatedBytes);
+
+  //! Total time per stage (NUMBER_OF_TRACE_STAGES entries) of the events
+  //! that started at or after startTime. Nested stages are counted in
+  //! both stages.
+  void GetStageTimes(double startTime, std::vector<double> & stageTimes) const;
+
+  //! Heap bytes allocated per stage, counted like GetStageTimes().
+  void GetStageAllocations(double startTime,
+			   std::vector<PQCT_MemorySizeType> & stageAllocations) const;
+
+  //! Peak heap, image buffers and resident set since Reset().
+  PQCT_MemoryFootprintType GetMemoryFootprint() const;
+
+  bool IsEmpty() const;
+
+  //! Events in Chrome trace_event JSON format (chrome://tracing).
+  std::string GetChromeTrace(const std::string & processName) const;
+
+ private:
+  PQCT_Tracer(const PQCT_Tracer &);     // Not implemented.
+  void operator=(const PQCT_Tracer &);  // Not implemented.
+
+#if defined(_WIN32)
+  typedef DWORD NativeThreadIDType;
+#else
+  typedef pthread_t NativeThreadIDType;
+#endif
+
+  //! One traced stage.
+  typedef struct t_TraceEventType
+  {
+    TraceStageType Stage;
+    double StartTime;
+    double StopTime;
+    unsigned int ThreadIndex;
+    PQCT_MemorySizeType AllocatedBytes;
+    PQCT_MemorySizeType LiveBytes;
+  }
+  TraceEventType;
+
+  //! Not locked; called with m_Lock held.
+  unsigned int GetThreadIndex();
+
+  itk::RealTimeClock::Pointer m_Clock;
+  double m_Origin;
+  std::vector<TraceEventType> m_Events;
+  std::vector<NativeThreadIDType> m_Threads;
+  mutable itk::SimpleFastMutexLock m_Lock;
+};
+
+
+//! Traces the enclosing scope as one stage, also when it is left by an
+//! exception.
+class PQCT_TraceScope {
+
+ public:
+  PQCT_TraceScope(PQCT_Tracer & tracer, TraceStageType stage) :
+    m_Tracer(tracer), m_Stage(stage) {
+    this->m_StartTime = tracer.GetElapsedTime();
+    this->m_StartAllocatedBytes = PQCT_MemoryMonitor::GetAllocatedBytes();
+  };
+  ~PQCT_TraceScope() {
+    this->m_Tracer.AddEvent( this->m_Stage, this->m_StartTime,
+			     this->m_Tracer.GetElapsedTime(),
+			     PQCT_MemoryMonitor::GetAllocatedBytes() -
+			     this->m_StartAllocatedBytes );
+  };
+
+ private:
+  PQCT_TraceScope(const PQCT_TraceScope &);  // Not implemented.
+  void operator=(const PQCT_TraceScope &);   // Not implemented.
+
+  PQCT_Tracer & m_Tracer;
+  TraceStageType m_Stage;
+  double m_StartTime;
+  PQCT_MemorySizeType m_StartAllocatedBytes;
+};
+
+#endif